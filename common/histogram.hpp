@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace common {
+
+/**
+ * @brief A fixed-size, log-linear histogram in the spirit of HdrHistogram.
+ *
+ * Values are bucketed by their most significant bit and then split linearly
+ * into 2^(kSubBucketBits - 1) sub-buckets, which bounds the relative error of
+ * any reported value to 2^-(kSubBucketBits - 1). Recording is a couple of bit
+ * operations and one increment, and two histograms can be merged by adding
+ * their counts, so each thread can record into its own instance. Each bit of
+ * precision doubles the size, see Histogram for the default.
+ */
+template <unsigned kBits> class BasicHistogram {
+public:
+  static_assert(kBits >= 2 && kBits < 64);
+  static constexpr unsigned kSubBucketBits = kBits;
+  static constexpr uint64_t kSubBucketCount = uint64_t{1} << kSubBucketBits;
+  static constexpr uint64_t kSubBucketHalfCount = kSubBucketCount / 2;
+  static constexpr size_t kNumBuckets =
+      kSubBucketCount + (64 - kSubBucketBits) * kSubBucketHalfCount;
+
+  void Record(uint64_t value) { RecordN(value, 1); }
+
+  void RecordN(uint64_t value, uint64_t count) {
+    counts[IndexOf(value)] += count;
+    total_count += count;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+
+  void Merge(BasicHistogram const &other) {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      counts[i] += other.counts[i];
+    }
+    total_count += other.total_count;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+  }
+
+  void Reset() { *this = BasicHistogram{}; }
+
+  uint64_t Count() const { return total_count; }
+  uint64_t Min() const { return total_count == 0 ? 0 : min_value; }
+  uint64_t Max() const { return max_value; }
+
+  /**
+   * @return the highest value equivalent to the bucket that contains the given
+   * percentile (0-100], clamped to the exact maximum.
+   */
+  uint64_t ValueAtPercentile(double percentile) const {
+    if (total_count == 0) {
+      return 0;
+    }
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    auto const rank =
+        std::ceil(percentile / 100.0 * static_cast<double>(total_count));
+    auto const target = std::max<uint64_t>(1, static_cast<uint64_t>(rank));
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      cumulative += counts[i];
+      if (cumulative >= target) {
+        return std::min(HighestEquivalentValue(i), max_value);
+      }
+    }
+    return max_value;
+  }
+
+  static size_t IndexOf(uint64_t value) {
+    if (value < kSubBucketCount) {
+      return static_cast<size_t>(value);
+    }
+    unsigned const msb = 63 - std::countl_zero(value);
+    unsigned const shift = msb - (kSubBucketBits - 1);
+    return static_cast<size_t>(kSubBucketCount +
+                               (shift - 1) * kSubBucketHalfCount +
+                               ((value >> shift) - kSubBucketHalfCount));
+  }
+
+  static uint64_t LowestEquivalentValue(size_t index) {
+    if (index < kSubBucketCount) {
+      return index;
+    }
+    auto const shift = (index - kSubBucketCount) / kSubBucketHalfCount + 1;
+    auto const sub = (index - kSubBucketCount) % kSubBucketHalfCount;
+    return (kSubBucketHalfCount + sub) << shift;
+  }
+
+  static uint64_t HighestEquivalentValue(size_t index) {
+    if (index + 1 >= kNumBuckets) {
+      return std::numeric_limits<uint64_t>::max();
+    }
+    return LowestEquivalentValue(index + 1) - 1;
+  }
+
+private:
+  std::array<uint64_t, kNumBuckets> counts{};
+  uint64_t total_count = 0;
+  uint64_t min_value = std::numeric_limits<uint64_t>::max();
+  uint64_t max_value = 0;
+};
+
+/// Within ~1.6% of the recorded values, at about 30 KB.
+using Histogram = BasicHistogram<7>;
+
+} // namespace common
@@ -0,0 +1,51 @@
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include <histogram.hpp>
+
+TEST(Histogram, Empty) {
+  auto histogram = common::Histogram{};
+  EXPECT_EQ(histogram.Count(), 0u);
+  EXPECT_EQ(histogram.Min(), 0u);
+  EXPECT_EQ(histogram.Max(), 0u);
+  EXPECT_EQ(histogram.ValueAtPercentile(50), 0u);
+}
+
+TEST(Histogram, IndexRoundTrip) {
+  for (uint64_t value : {0ull, 1ull, 127ull, 128ull, 255ull, 256ull, 1'000ull,
+                         123'456'789ull, ~0ull}) {
+    auto const index = common::Histogram::IndexOf(value);
+    EXPECT_LE(common::Histogram::LowestEquivalentValue(index), value);
+    EXPECT_GE(common::Histogram::HighestEquivalentValue(index), value);
+  }
+}
+
+TEST(Histogram, Percentiles) {
+  auto histogram = common::Histogram{};
+  for (uint64_t value = 1; value <= 10'000; ++value) {
+    histogram.Record(value);
+  }
+  EXPECT_EQ(histogram.Count(), 10'000u);
+  EXPECT_EQ(histogram.Min(), 1u);
+  EXPECT_EQ(histogram.Max(), 10'000u);
+  EXPECT_NEAR(histogram.ValueAtPercentile(50), 5'000, 5'000 / 64);
+  EXPECT_NEAR(histogram.ValueAtPercentile(99), 9'900, 9'900 / 64);
+  EXPECT_NEAR(histogram.ValueAtPercentile(99.9), 9'990, 9'990 / 64);
+  EXPECT_EQ(histogram.ValueAtPercentile(100), 10'000u);
+}
+
+TEST(Histogram, Merge) {
+  auto lower = common::Histogram{};
+  auto upper = common::Histogram{};
+  for (uint64_t value = 1; value <= 100; ++value) {
+    lower.Record(value);
+    upper.Record(value + 1'000'000);
+  }
+  lower.Merge(upper);
+  EXPECT_EQ(lower.Count(), 200u);
+  EXPECT_EQ(lower.Min(), 1u);
+  EXPECT_EQ(lower.Max(), 1'000'100u);
+  EXPECT_LE(lower.ValueAtPercentile(50), 100u);
+  EXPECT_GE(lower.ValueAtPercentile(51), 1'000'000u);
+}
@@ -3,13 +3,17 @@
 #include <cassert>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <random>
 #include <stop_token>
 #include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#include <histogram.hpp>
+
 #include "concurrent_lru_cache_parallel.hpp"
 #include "concurrent_lru_cache_serialized.hpp"
 #include "lru_cache.hpp"
@@ -17,9 +21,19 @@
 using std::string_view_literals::operator""sv;
 using std::chrono_literals::operator""ns;
 using std::chrono_literals::operator""s;
+using std::chrono_literals::operator""ms;
+using std::chrono_literals::operator""us;
 
 enum class OutputFormat { CSV, JSON };
 
+/**
+ * ClosedLoop issues the next operation as soon as the previous one returned and
+ * reports throughput. OpenLoop issues operations at a fixed rate and reports
+ * latency percentiles measured from the intended send time, so queueing delay
+ * is not hidden (coordinated omission).
+ */
+enum class LoadMode { ClosedLoop, OpenLoop };
+
 constexpr OutputFormat kOutputFormat = OutputFormat::CSV;
 constexpr auto kCsvFieldSeparator = ","sv;
 
@@ -198,7 +212,225 @@ void WriteOutputFooter() {
   }
 }
 
-int main() {
+struct OpenLoopConfig {
+  size_t num_readers;
+  size_t num_writers;
+  size_t ops_per_sec_per_thread;
+  std::chrono::nanoseconds duration;
+};
+
+struct ScheduledOperation {
+  std::chrono::nanoseconds offset;
+  int key;
+};
+
+struct OpenLoopResult {
+  common::Histogram latencies_ns;
+  size_t num_sent = 0;
+  std::chrono::nanoseconds duration{};
+};
+
+/**
+ * @brief Precomputes the intended send times (relative to the common start)
+ * and keys of a single thread, so that no work besides the cache operation
+ * itself happens on the measured path.
+ */
+std::vector<ScheduledOperation> BuildSchedule(OpenLoopConfig const &config,
+                                              size_t op_modulo, uint32_t seed) {
+  auto const interval = std::chrono::nanoseconds{
+      1'000'000'000 / std::max<size_t>(config.ops_per_sec_per_thread, 1)};
+  auto const num_ops =
+      static_cast<size_t>(config.duration.count() / interval.count());
+  auto engine = std::mt19937{seed};
+  auto distribution =
+      std::uniform_int_distribution<int>(0, static_cast<int>(op_modulo) - 1);
+
+  auto schedule = std::vector<ScheduledOperation>{};
+  schedule.reserve(num_ops);
+  for (size_t i = 0; i < num_ops; ++i) {
+    schedule.push_back({interval * i, distribution(engine)});
+  }
+  return schedule;
+}
+
+/**
+ * @brief Waits until the given point in time. Sleeps while the deadline is far
+ * away and spins for the last stretch, since sleep_for() alone overshoots by
+ * far more than a cache operation takes.
+ */
+void WaitUntil(std::chrono::steady_clock::time_point deadline) {
+  constexpr auto kSpinThreshold = 100us;
+  auto now = std::chrono::steady_clock::now();
+  if (deadline - now > kSpinThreshold) {
+    std::this_thread::sleep_until(deadline - kSpinThreshold);
+  }
+  while (std::chrono::steady_clock::now() < deadline) {
+  }
+}
+
+template <template <typename Key, typename Value> typename CacheType,
+          typename Key, typename Value>
+OpenLoopResult MeasureOpenLoopLatency(CacheType<Key, Value> *cache,
+                                      size_t read_modulo, size_t write_modulo,
+                                      OpenLoopConfig const &config) {
+  auto const num_threads = config.num_readers + config.num_writers;
+
+  auto schedules = std::vector<std::vector<ScheduledOperation>>{};
+  schedules.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    auto const is_writer = i >= config.num_readers;
+    schedules.push_back(BuildSchedule(config,
+                                      is_writer ? write_modulo : read_modulo,
+                                      static_cast<uint32_t>(i)));
+  }
+
+  auto histograms = std::vector<common::Histogram>(num_threads);
+  auto num_sent = std::vector<size_t>(num_threads);
+  // leave enough headroom for all threads to be started before the first send
+  auto const start = std::chrono::steady_clock::now() + 50ms;
+  // a saturated cache falls further and further behind its schedule, so stop
+  // sending once it is a full run duration late
+  auto const cutoff = start + 2 * config.duration;
+
+  {
+    auto threads = std::vector<std::jthread>{};
+    threads.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads.emplace_back([cache, start, cutoff,
+                            is_writer = i >= config.num_readers,
+                            schedule = &schedules[i],
+                            histogram = &histograms[i], sent = &num_sent[i]] {
+        size_t num_sent_local = 0;
+        for (auto const &op : *schedule) {
+          auto const intended = start + op.offset;
+          if (std::chrono::steady_clock::now() >= cutoff) {
+            // never sent, but it would have waited at least until the cutoff
+            histogram->Record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::max(cutoff - intended, 0ns))
+                    .count()));
+            continue;
+          }
+          WaitUntil(intended);
+          if (is_writer) {
+            cache->Put(op.key, op.key);
+          } else {
+            cache->Get(op.key);
+          }
+          auto const done = std::chrono::steady_clock::now();
+          histogram->Record(static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(done -
+                                                                   intended)
+                  .count()));
+          ++num_sent_local;
+        }
+        *sent = num_sent_local;
+      });
+    }
+  }
+
+  auto result = OpenLoopResult{};
+  result.duration = std::chrono::steady_clock::now() - start;
+  for (size_t i = 0; i < num_threads; ++i) {
+    result.latencies_ns.Merge(histograms[i]);
+    result.num_sent += num_sent[i];
+  }
+  return result;
+}
+
+void PrintOpenLoopRecord(std::string_view cache_name, size_t capacity,
+                         OpenLoopConfig const &config,
+                         OpenLoopResult const &result,
+                         OutputFormat output_format) {
+  auto const &latencies = result.latencies_ns;
+  auto const target_ops_sec = config.ops_per_sec_per_thread *
+                              (config.num_readers + config.num_writers);
+  auto const achieved_ops_sec = static_cast<size_t>(
+      static_cast<double>(result.num_sent) /
+      std::chrono::duration<double>(result.duration).count());
+
+  if (output_format == OutputFormat::CSV) {
+    std::cout << cache_name << kCsvFieldSeparator << capacity
+              << kCsvFieldSeparator << config.num_readers << kCsvFieldSeparator
+              << config.num_writers << kCsvFieldSeparator << target_ops_sec
+              << kCsvFieldSeparator << achieved_ops_sec << kCsvFieldSeparator
+              << latencies.ValueAtPercentile(50) << kCsvFieldSeparator
+              << latencies.ValueAtPercentile(99) << kCsvFieldSeparator
+              << latencies.ValueAtPercentile(99.9) << kCsvFieldSeparator
+              << latencies.Max();
+  } else if (output_format == OutputFormat::JSON) {
+    std::cout << '{' << R"("name": ")" << cache_name << R"(", "capacity": )"
+              << capacity << R"(, "num_readers": )" << config.num_readers
+              << R"(, "num_writers": )" << config.num_writers
+              << R"(, "target_ops_sec": )" << target_ops_sec
+              << R"(, "achieved_ops_sec": )" << achieved_ops_sec
+              << R"(, "p50_ns": )" << latencies.ValueAtPercentile(50)
+              << R"(, "p99_ns": )" << latencies.ValueAtPercentile(99)
+              << R"(, "p999_ns": )" << latencies.ValueAtPercentile(99.9)
+              << R"(, "max_ns": )" << latencies.Max() << '}';
+  }
+}
+
+template <template <typename Key, typename Value> typename CacheType,
+          typename Key = int, typename Value = int>
+void RunOpenLoopBenchmarkCases(std::string_view cache_name,
+                               OutputFormat output_format) {
+  for (auto const cache_capacity : std::array<size_t, 2>{10'000, 100'000}) {
+    const auto read_modulos = static_cast<size_t>(cache_capacity * 1.5);
+    const auto write_modulos = static_cast<size_t>(cache_capacity * 1.1);
+    // sweep the rate to find the knee where the latency percentiles explode
+    for (auto const ops_per_sec_per_thread : std::array<size_t, 6>{
+             10'000, 50'000, 100'000, 250'000, 500'000, 1'000'000}) {
+      auto const config = OpenLoopConfig{4, 1, ops_per_sec_per_thread, 500ms};
+      auto cache = CacheType<Key, Value>{cache_capacity};
+      PreFillCache(&cache);
+
+      auto const result = MeasureOpenLoopLatency(&cache, read_modulos,
+                                                 write_modulos, config);
+
+      PrintOutputPreRecord();
+      PrintOpenLoopRecord(cache_name, cache_capacity, config, result,
+                          output_format);
+      PrintOutputRecordSeparator();
+    }
+  }
+}
+
+void WriteOpenLoopOutputHeader() {
+  if (kOutputFormat == OutputFormat::CSV) {
+    std::cout << "name" << kCsvFieldSeparator << "capacity"
+              << kCsvFieldSeparator << "num_readers" << kCsvFieldSeparator
+              << "num_writers" << kCsvFieldSeparator << "target_ops_sec"
+              << kCsvFieldSeparator << "achieved_ops_sec" << kCsvFieldSeparator
+              << "p50_ns" << kCsvFieldSeparator << "p99_ns"
+              << kCsvFieldSeparator << "p999_ns" << kCsvFieldSeparator
+              << "max_ns\n";
+  } else if (kOutputFormat == OutputFormat::JSON) {
+    std::cout << "[\n";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  auto const mode = (argc > 1 && argv[1] == "open-loop"sv)
+                        ? LoadMode::OpenLoop
+                        : LoadMode::ClosedLoop;
+
+  if (mode == LoadMode::OpenLoop) {
+    WriteOpenLoopOutputHeader();
+
+    RunOpenLoopBenchmarkCases<ConcurrentLRUCacheSerializedMemoryOptimized>(
+        "ConcurrentLRUCacheSerializedMemoryOptimized", kOutputFormat);
+    RunOpenLoopBenchmarkCases<ConcurrentLRUCacheSerializedList>(
+        "ConcurrentLRUCacheSerializedList", kOutputFormat);
+    RunOpenLoopBenchmarkCases<ConcurrentLRUCacheParallelReadMemoryOptimized>(
+        "ConcurrentLRUCacheParallelReadMemoryOptimized", kOutputFormat);
+    RunOpenLoopBenchmarkCases<ConcurrentLRUCacheParallelReadList>(
+        "ConcurrentLRUCacheParallelReadList", kOutputFormat);
+
+    WriteOutputFooter();
+    return 0;
+  }
+
   WriteOutputHeader();
 
   RunCacheBenchmarkCases<ConcurrentLRUCacheSerializedMemoryOptimized>(
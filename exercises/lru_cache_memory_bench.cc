@@ -0,0 +1,232 @@
+// Heap footprint of the LRU cache variants: fills each variant to capacity
+// and reports the exact number of heap bytes and allocations it holds as well
+// as the peak RSS, as JSON. Every case runs in a process of its own, so that
+// the peak RSS is not that of an earlier case, which the allocator may not
+// have given back to the system.
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "concurrent_lru_cache_parallel.hpp"
+#include "concurrent_lru_cache_serialized.hpp"
+#include "lru_cache.hpp"
+
+namespace {
+
+struct AllocationCounters {
+  std::atomic<size_t> live_bytes{0};
+  std::atomic<size_t> peak_bytes{0};
+  std::atomic<size_t> num_allocations{0};
+};
+
+AllocationCounters counters;
+
+// Every allocation is prefixed with its size, so that the unsized operator
+// delete can account for it as well. The prefix is as large as the maximum
+// fundamental alignment to keep the returned pointer suitably aligned.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+
+void *CountingAllocate(size_t size) {
+  auto *raw = static_cast<std::byte *>(std::malloc(size + kHeaderSize));
+  if (raw == nullptr) {
+    throw std::bad_alloc{};
+  }
+  *reinterpret_cast<size_t *>(raw) = size;
+  auto const live =
+      counters.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  auto peak = counters.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !counters.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+  counters.num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return raw + kHeaderSize;
+}
+
+void CountingDeallocate(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  auto *raw = static_cast<std::byte *>(ptr) - kHeaderSize;
+  counters.live_bytes.fetch_sub(*reinterpret_cast<size_t *>(raw),
+                                std::memory_order_relaxed);
+  std::free(raw);
+}
+
+} // namespace
+
+void *operator new(size_t size) { return CountingAllocate(size); }
+void *operator new[](size_t size) { return CountingAllocate(size); }
+void operator delete(void *ptr) noexcept { CountingDeallocate(ptr); }
+void operator delete[](void *ptr) noexcept { CountingDeallocate(ptr); }
+void operator delete(void *ptr, size_t) noexcept { CountingDeallocate(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { CountingDeallocate(ptr); }
+
+namespace {
+
+struct Value256 {
+  std::array<std::byte, 256> data{};
+};
+
+/**
+ * @brief Resets the peak RSS (VmHWM) of this process, see proc(5), which a
+ * forked child inherits.
+ */
+void ResetPeakRss() { std::ofstream{"/proc/self/clear_refs"} << "5"; }
+
+size_t ReadPeakRssBytes() {
+  auto status = std::ifstream{"/proc/self/status"};
+  auto line = std::string{};
+  while (std::getline(status, line)) {
+    if (line.starts_with("VmHWM:")) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+  return 0;
+}
+
+template <typename Value> Value MakeValue();
+
+template <> int MakeValue<int>() { return 42; }
+
+template <> std::string MakeValue<std::string>() {
+  // long enough to not fit into the small string buffer
+  return std::string(32, 'x');
+}
+
+template <> Value256 MakeValue<Value256>() { return Value256{}; }
+
+struct FootprintRecord {
+  size_t heap_bytes;
+  size_t peak_heap_bytes;
+  size_t num_allocations;
+  size_t peak_rss_bytes;
+};
+
+template <template <typename Key, typename Value> typename CacheType,
+          typename Value>
+FootprintRecord MeasureFootprint(size_t capacity) {
+  auto const value = MakeValue<Value>();
+
+  ResetPeakRss();
+  auto const heap_bytes_before = counters.live_bytes.load();
+  auto const num_allocations_before = counters.num_allocations.load();
+  counters.peak_bytes.store(heap_bytes_before);
+
+  auto cache = CacheType<int, Value>{capacity};
+  for (size_t k = 0; k < capacity; ++k) {
+    cache.Put(static_cast<int>(k), value);
+  }
+
+  return FootprintRecord{
+      counters.live_bytes.load() - heap_bytes_before,
+      counters.peak_bytes.load() - heap_bytes_before,
+      counters.num_allocations.load() - num_allocations_before,
+      ReadPeakRssBytes()};
+}
+
+/**
+ * @brief Measures in a forked child, which holds nothing but the cache.
+ */
+template <template <typename Key, typename Value> typename CacheType,
+          typename Value>
+FootprintRecord MeasureFootprintInChild(size_t capacity) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    throw std::system_error{errno, std::system_category(), "pipe"};
+  }
+  auto const pid = fork();
+  if (pid < 0) {
+    throw std::system_error{errno, std::system_category(), "fork"};
+  }
+  if (pid == 0) {
+    ::close(fds[0]);
+    auto const record = MeasureFootprint<CacheType, Value>(capacity);
+    auto const written = write(fds[1], &record, sizeof(record));
+    // without flushing the output the parent buffered
+    _exit(written == sizeof(record) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  ::close(fds[1]);
+  auto record = FootprintRecord{};
+  auto const res = read(fds[0], &record, sizeof(record));
+  ::close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (res != sizeof(record) || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS) {
+    throw std::runtime_error{"measuring the footprint failed"};
+  }
+  return record;
+}
+
+bool first_record = true;
+
+template <template <typename Key, typename Value> typename CacheType,
+          typename Value>
+void RunFootprintCases(std::string_view cache_name,
+                       std::string_view value_name, size_t max_capacity) {
+  for (auto const capacity : std::array<size_t, 5>{
+           1'000, 10'000, 100'000, 1'000'000, 10'000'000}) {
+    if (capacity > max_capacity) {
+      break;
+    }
+    auto const record = MeasureFootprintInChild<CacheType, Value>(capacity);
+    std::cout << (first_record ? "\t" : ",\n\t") << '{' << R"("name": ")"
+              << cache_name << R"(", "value_type": ")" << value_name
+              << R"(", "capacity": )" << capacity << R"(, "heap_bytes": )"
+              << record.heap_bytes << R"(, "peak_heap_bytes": )"
+              << record.peak_heap_bytes << R"(, "bytes_per_entry": )"
+              << static_cast<double>(record.heap_bytes) /
+                     static_cast<double>(capacity)
+              << R"(, "allocations": )" << record.num_allocations
+              << R"(, "peak_rss_bytes": )" << record.peak_rss_bytes << '}';
+    first_record = false;
+  }
+}
+
+template <template <typename Key, typename Value> typename CacheType>
+void RunFootprintCases(std::string_view cache_name, size_t max_capacity) {
+  RunFootprintCases<CacheType, int>(cache_name, "int", max_capacity);
+  RunFootprintCases<CacheType, std::string>(cache_name, "std::string",
+                                            max_capacity);
+  RunFootprintCases<CacheType, Value256>(cache_name, "byte[256]",
+                                         max_capacity);
+}
+
+} // namespace
+
+/**
+ * Usage: lru_cache_memory_bench [max_capacity]
+ */
+int main(int argc, char *argv[]) {
+  size_t const max_capacity =
+      argc > 1 ? std::stoull(argv[1]) : size_t{10'000'000};
+
+  std::cout << "[\n";
+  RunFootprintCases<LRUCacheListBased>("LRUCacheListBased", max_capacity);
+  RunFootprintCases<LRUCacheMemoryOptimized>("LRUCacheMemoryOptimized",
+                                             max_capacity);
+  RunFootprintCases<ConcurrentLRUCacheSerializedList>(
+      "ConcurrentLRUCacheSerializedList", max_capacity);
+  RunFootprintCases<ConcurrentLRUCacheSerializedMemoryOptimized>(
+      "ConcurrentLRUCacheSerializedMemoryOptimized", max_capacity);
+  RunFootprintCases<ConcurrentLRUCacheParallelReadList>(
+      "ConcurrentLRUCacheParallelReadList", max_capacity);
+  RunFootprintCases<ConcurrentLRUCacheParallelReadMemoryOptimized>(
+      "ConcurrentLRUCacheParallelReadMemoryOptimized", max_capacity);
+  std::cout << "\n]\n";
+  return 0;
+}
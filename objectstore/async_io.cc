@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stop_token>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "async_io.hpp"
+
+namespace objectstore {
+
+namespace detail {
+
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+
+  /**
+   * @brief Queues a request, the caller guarantees that no more than
+   * queue_depth requests are in flight.
+   */
+  virtual void prepare(int fd, IoRequest const &request) = 0;
+
+  /**
+   * @brief Hands all prepared requests to the kernel or the workers.
+   */
+  virtual void submit() = 0;
+
+  virtual std::size_t wait(std::span<IoCompletion> completions,
+                           std::size_t min_completions) = 0;
+};
+
+namespace {
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::error_code NotSupported() {
+  return std::make_error_code(std::errc::operation_not_supported);
+}
+
+/**
+ * @brief Minimal io_uring wrapper on top of the raw system calls, so that no
+ * liburing is required.
+ */
+class IoUringBackend : public IoBackend {
+public:
+  static std::unique_ptr<IoUringBackend> Create(unsigned queue_depth) {
+    auto backend = std::unique_ptr<IoUringBackend>{new IoUringBackend{}};
+    if (!backend->setup(queue_depth)) {
+      return nullptr;
+    }
+    return backend;
+  }
+
+  ~IoUringBackend() override {
+    if (m_sqes != nullptr) {
+      munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring) {
+      munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring != nullptr) {
+      munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if (m_ring_fd >= 0) {
+      ::close(m_ring_fd);
+    }
+  }
+
+  void prepare(int fd, IoRequest const &request) override {
+    auto const tail = m_sq_local_tail;
+    auto const index = tail & *m_sq_mask;
+    auto *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request.operation == IoOperation::Read ? IORING_OP_READ
+                                                         : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = request.offset;
+    sqe->addr = reinterpret_cast<std::uint64_t>(request.buffer.data());
+    sqe->len = static_cast<std::uint32_t>(request.buffer.size());
+    sqe->user_data = request.user_data;
+    m_sq_array[index] = index;
+    m_sq_local_tail = tail + 1;
+  }
+
+  void submit() override {
+    auto const to_submit = m_sq_local_tail - *m_sq_tail;
+    if (to_submit == 0) {
+      return;
+    }
+    std::atomic_ref{*m_sq_tail}.store(m_sq_local_tail,
+                                      std::memory_order_release);
+    auto submitted = 0u;
+    while (submitted < to_submit) {
+      auto res = Enter(to_submit - submitted, 0, 0);
+      if (res < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          continue;
+        }
+        throw std::system_error{LastError(), "io_uring_enter"};
+      }
+      submitted += static_cast<unsigned>(res);
+    }
+  }
+
+  std::size_t wait(std::span<IoCompletion> completions,
+                   std::size_t min_completions) override {
+    std::size_t reaped = drain(completions);
+    while (reaped < min_completions) {
+      auto const wanted = static_cast<unsigned>(min_completions - reaped);
+      if (Enter(0, wanted, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        throw std::system_error{LastError(), "io_uring_enter"};
+      }
+      reaped += drain(completions.subspan(reaped));
+    }
+    return reaped;
+  }
+
+private:
+  IoUringBackend() = default;
+
+  bool setup(unsigned queue_depth) {
+    auto params = io_uring_params{};
+    m_ring_fd = static_cast<int>(
+        syscall(__NR_io_uring_setup, std::max(queue_depth, 1u), &params));
+    // IORING_OP_READ/WRITE need 5.6, which is also when RW_CUR_POS came in
+    if (m_ring_fd < 0 || (params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+      return false;
+    }
+
+    m_sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+    m_cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      m_sq_ring_size = m_cq_ring_size =
+          std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    m_sq_ring = MapRing(m_sq_ring_size, IORING_OFF_SQ_RING);
+    if (m_sq_ring == nullptr) {
+      return false;
+    }
+    m_cq_ring = single_mmap ? m_sq_ring
+                            : MapRing(m_cq_ring_size, IORING_OFF_CQ_RING);
+    if (m_cq_ring == nullptr) {
+      return false;
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes =
+        static_cast<io_uring_sqe *>(MapRing(m_sqes_size, IORING_OFF_SQES));
+    if (m_sqes == nullptr) {
+      return false;
+    }
+
+    auto *sq = static_cast<std::byte *>(m_sq_ring);
+    m_sq_tail = reinterpret_cast<std::uint32_t *>(sq + params.sq_off.tail);
+    m_sq_mask =
+        reinterpret_cast<std::uint32_t *>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<std::uint32_t *>(sq + params.sq_off.array);
+    m_sq_local_tail = *m_sq_tail;
+
+    auto *cq = static_cast<std::byte *>(m_cq_ring);
+    m_cq_head = reinterpret_cast<std::uint32_t *>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<std::uint32_t *>(cq + params.cq_off.tail);
+    m_cq_mask =
+        reinterpret_cast<std::uint32_t *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void *MapRing(std::size_t size, off_t offset) const {
+    void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_ring_fd, offset);
+    return ring == MAP_FAILED ? nullptr : ring;
+  }
+
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) const {
+    return static_cast<int>(syscall(__NR_io_uring_enter, m_ring_fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+  }
+
+  std::size_t drain(std::span<IoCompletion> completions) {
+    auto head = *m_cq_head;
+    auto const tail =
+        std::atomic_ref{*m_cq_tail}.load(std::memory_order_acquire);
+    std::size_t count = 0;
+    for (; head != tail && count < completions.size(); ++head, ++count) {
+      auto const &cqe = m_cqes[head & *m_cq_mask];
+      if (cqe.res < 0) {
+        auto ec = std::error_code{-cqe.res, std::system_category()};
+        completions[count] = {cqe.user_data, 0, ec};
+      } else {
+        completions[count] = {cqe.user_data,
+                              static_cast<std::size_t>(cqe.res), {}};
+      }
+    }
+    std::atomic_ref{*m_cq_head}.store(head, std::memory_order_release);
+    return count;
+  }
+
+  int m_ring_fd = -1;
+  void *m_sq_ring = nullptr;
+  void *m_cq_ring = nullptr;
+  std::size_t m_sq_ring_size = 0;
+  std::size_t m_cq_ring_size = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  std::size_t m_sqes_size = 0;
+
+  std::uint32_t *m_sq_tail = nullptr;
+  std::uint32_t *m_sq_mask = nullptr;
+  std::uint32_t *m_sq_array = nullptr;
+  std::uint32_t m_sq_local_tail = 0;
+
+  std::uint32_t *m_cq_head = nullptr;
+  std::uint32_t *m_cq_tail = nullptr;
+  std::uint32_t *m_cq_mask = nullptr;
+  io_uring_cqe *m_cqes = nullptr;
+};
+
+/**
+ * @brief Emulates the submission/completion queues with blocking
+ * pread/pwrite calls executed by a pool of worker threads.
+ */
+class ThreadPoolBackend : public IoBackend {
+  struct Pending {
+    int fd;
+    IoRequest request;
+  };
+
+public:
+  explicit ThreadPoolBackend(unsigned queue_depth) {
+    auto const num_workers = std::clamp(queue_depth, 1u, kMaxWorkers);
+    m_workers.reserve(num_workers);
+    for (unsigned i = 0; i < num_workers; ++i) {
+      m_workers.emplace_back([this](std::stop_token token) { work(token); });
+    }
+  }
+
+  void prepare(int fd, IoRequest const &request) override {
+    m_prepared.push_back({fd, request});
+  }
+
+  void submit() override {
+    if (m_prepared.empty()) {
+      return;
+    }
+    {
+      auto lock = std::lock_guard{m_mutex};
+      m_submitted.insert(m_submitted.end(), m_prepared.begin(),
+                         m_prepared.end());
+    }
+    m_prepared.clear();
+    m_submitted_cv.notify_all();
+  }
+
+  std::size_t wait(std::span<IoCompletion> completions,
+                   std::size_t min_completions) override {
+    auto lock = std::unique_lock{m_mutex};
+    m_completed_cv.wait(
+        lock, [&] { return m_completed.size() >= min_completions; });
+    auto const count = std::min(completions.size(), m_completed.size());
+    std::copy_n(m_completed.begin(), count, completions.begin());
+    m_completed.erase(m_completed.begin(), m_completed.begin() + count);
+    return count;
+  }
+
+private:
+  static constexpr unsigned kMaxWorkers = 32;
+
+  void work(std::stop_token token) {
+    while (true) {
+      auto pending = Pending{};
+      {
+        auto lock = std::unique_lock{m_mutex};
+        if (!m_submitted_cv.wait(lock, token,
+                                 [&] { return !m_submitted.empty(); })) {
+          return;
+        }
+        pending = m_submitted.front();
+        m_submitted.pop_front();
+      }
+
+      auto const &request = pending.request;
+      auto res =
+          request.operation == IoOperation::Read
+              ? pread(pending.fd, request.buffer.data(), request.buffer.size(),
+                      static_cast<off_t>(request.offset))
+              : pwrite(pending.fd, request.buffer.data(),
+                       request.buffer.size(),
+                       static_cast<off_t>(request.offset));
+      auto completion =
+          res < 0 ? IoCompletion{request.user_data, 0, LastError()}
+                  : IoCompletion{request.user_data,
+                                 static_cast<std::size_t>(res),
+                                 {}};
+
+      {
+        auto lock = std::lock_guard{m_mutex};
+        m_completed.push_back(completion);
+      }
+      m_completed_cv.notify_one();
+    }
+  }
+
+  std::vector<Pending> m_prepared;
+  std::mutex m_mutex;
+  std::condition_variable_any m_submitted_cv;
+  std::condition_variable m_completed_cv;
+  std::deque<Pending> m_submitted;
+  std::deque<IoCompletion> m_completed;
+  // declared last, so that the workers are stopped and joined before the
+  // queues go away
+  std::vector<std::jthread> m_workers;
+};
+
+} // namespace
+
+} // namespace detail
+
+AsyncObjectIO::AsyncObjectIO(StoredFolder *folder, unsigned queue_depth,
+                             Backend backend)
+    : m_folder{folder}, m_queue_depth{std::max(queue_depth, 1u)},
+      m_backend{backend}, m_slots{m_queue_depth, folder->m_resource},
+      m_free_slots{folder->m_resource}, m_completed{folder->m_resource} {
+  if (m_backend != Backend::ThreadPool) {
+    m_io = detail::IoUringBackend::Create(m_queue_depth);
+    if (m_io != nullptr) {
+      m_backend = Backend::IoUring;
+    } else if (m_backend == Backend::IoUring) {
+      throw std::system_error{
+          std::make_error_code(std::errc::function_not_supported),
+          "io_uring is not available"};
+    }
+  }
+  if (m_io == nullptr) {
+    m_io = std::make_unique<detail::ThreadPoolBackend>(m_queue_depth);
+    m_backend = Backend::ThreadPool;
+  }
+  m_free_slots.reserve(m_queue_depth);
+  for (auto slot = m_queue_depth; slot > 0; --slot) {
+    m_free_slots.push_back(slot - 1);
+  }
+}
+
+AsyncObjectIO::~AsyncObjectIO() {
+  auto completions =
+      std::pmr::vector<IoCompletion>(m_queue_depth, m_folder->m_resource);
+  while (m_in_flight > 0) {
+    auto const reaped = m_io->wait(completions, 1);
+    finish(std::span{completions}.first(reaped));
+    m_in_flight -= reaped;
+  }
+}
+
+std::size_t AsyncObjectIO::submit(std::span<IoRequest const> requests) {
+  std::size_t taken = 0;
+  for (; taken < requests.size() && m_in_flight < m_queue_depth; ++taken) {
+    auto const &request = requests[taken];
+    if (request.buffer.size() > kMaxRequestSize) {
+      // rather than a truncated length, on every backend alike
+      m_completed.push_back(
+          {request.user_data, 0,
+           std::make_error_code(std::errc::invalid_argument)});
+      continue;
+    }
+    auto ec = std::error_code{};
+    int fd = file_descriptor(request, &ec);
+    if (fd < 0) {
+      m_completed.push_back({request.user_data, 0, ec});
+      continue;
+    }
+    auto const slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    m_slots[slot] = InFlight{request.id, request.user_data};
+    auto borrowed = request;
+    borrowed.user_data = slot;
+    m_io->prepare(fd, borrowed);
+    ++m_in_flight;
+  }
+  m_io->submit();
+  return taken;
+}
+
+std::size_t AsyncObjectIO::reap(std::span<IoCompletion> completions,
+                                std::size_t min_completions) {
+  std::size_t count = std::min(completions.size(), m_completed.size());
+  std::copy_n(m_completed.begin(), count, completions.begin());
+  m_completed.erase(m_completed.begin(), m_completed.begin() + count);
+
+  auto const remaining = completions.subspan(count);
+  auto const wanted = std::min(
+      {min_completions > count ? min_completions - count : 0, m_in_flight,
+       remaining.size()});
+  auto const reaped = m_io->wait(remaining, wanted);
+  finish(remaining.first(reaped));
+  m_in_flight -= reaped;
+  return count + reaped;
+}
+
+int AsyncObjectIO::file_descriptor(IoRequest const &request,
+                                   std::error_code *ec) {
+  auto it = m_folder->m_files.find(request.id);
+  if (it == m_folder->m_files.end()) {
+    *ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    return -1;
+  }
+  // raw reads and writes would bypass the block format
+  if (m_folder->m_compression.codec != nullptr) {
+    *ec = detail::NotSupported();
+    return -1;
+  }
+  // shared with the folder, which closes it when the object is destroyed, so
+  // that a recycled id never gets the descriptor of the old object
+  return m_folder->use_descriptor(request.id, it->second,
+                                  request.operation == IoOperation::Write,
+                                  ec);
+}
+
+void AsyncObjectIO::finish(std::span<IoCompletion> completions) {
+  for (auto &completion : completions) {
+    auto const slot = static_cast<std::uint32_t>(completion.user_data);
+    m_folder->release_descriptor(m_slots[slot].id);
+    completion.user_data = m_slots[slot].user_data;
+    m_free_slots.push_back(slot);
+  }
+}
+
+} // namespace objectstore
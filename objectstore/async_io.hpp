@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+enum class IoOperation { Read, Write };
+
+/**
+ * @brief A single positional read or write of an object. The buffer is the
+ * destination of a read and the source of a write and has to stay valid until
+ * the matching completion has been reaped.
+ */
+struct IoRequest {
+  StoredFolder::object_id_t id;
+  IoOperation operation;
+  std::uint64_t offset;
+  std::span<std::byte> buffer;
+  std::uint64_t user_data;
+};
+
+struct IoCompletion {
+  std::uint64_t user_data;
+  std::size_t bytes_transferred;
+  std::error_code error;
+};
+
+namespace detail {
+class IoBackend;
+} // namespace detail
+
+/**
+ * @brief Batched, asynchronous reads and writes of the objects of a
+ * StoredFolder, keeping up to queue_depth I/Os in flight.
+ *
+ * Uses io_uring where the kernel supports it and a pool of pread/pwrite worker
+ * threads otherwise. The I/O goes through the descriptors of
+ * StoredFolder::read_at() and write_at(), which count against
+ * max_open_files and stay open while I/Os on them are in flight. It
+ * bypasses the streams handed out by StoredFolder::get(), so those must be
+ * flushed before an object is accessed through this interface, and objects
+ * must not be destroyed while I/Os on them are in flight. Reads of an object
+ * that was never written complete right away and find it empty, and
+ * compressed folders are not supported. An instance is meant to be used by a
+ * single submitting thread.
+ */
+class AsyncObjectIO {
+public:
+  enum class Backend { Automatic, IoUring, ThreadPool };
+
+  /// The largest buffer of a request, which io_uring takes as 32 bits.
+  static constexpr std::size_t kMaxRequestSize =
+      std::numeric_limits<std::uint32_t>::max();
+
+  AsyncObjectIO(StoredFolder *folder, unsigned queue_depth = 64,
+                Backend backend = Backend::Automatic);
+
+  AsyncObjectIO(const AsyncObjectIO &) = delete;
+  AsyncObjectIO(AsyncObjectIO &&) = delete;
+  AsyncObjectIO &operator=(const AsyncObjectIO &) = delete;
+  AsyncObjectIO &operator=(AsyncObjectIO &&) = delete;
+
+  ~AsyncObjectIO();
+
+  /**
+   * @brief Submits as many of the requests as fit into the queue.
+   *
+   * Requests for objects that are not part of the folder, or that cannot be
+   * opened, are completed immediately with an error, and so are requests
+   * with a buffer larger than kMaxRequestSize.
+   *
+   * @return the number of requests taken from the front of the batch
+   */
+  std::size_t submit(std::span<IoRequest const> requests);
+
+  /**
+   * @brief Blocks until at least min_completions I/Os have completed (or none
+   * are in flight anymore) and copies up to completions.size() of them.
+   *
+   * @return the number of completions written
+   */
+  std::size_t reap(std::span<IoCompletion> completions,
+                   std::size_t min_completions = 1);
+
+  std::size_t in_flight() const { return m_in_flight; }
+  unsigned queue_depth() const { return m_queue_depth; }
+  Backend backend() const { return m_backend; }
+
+private:
+  /**
+   * @brief A request in flight, whose index the backend gets as user_data.
+   */
+  struct InFlight {
+    StoredFolder::object_id_t id;
+    std::uint64_t user_data;
+  };
+
+  /**
+   * @return the descriptor of the folder for the request, which stays open
+   * until finish() releases it, or -1, with ec set if the request failed
+   */
+  int file_descriptor(IoRequest const &request, std::error_code *ec);
+
+  /**
+   * @brief Releases the descriptors of completed I/Os and gives their
+   * completions the user_data of the requests back.
+   */
+  void finish(std::span<IoCompletion> completions);
+
+  StoredFolder *m_folder;
+  unsigned m_queue_depth;
+  Backend m_backend;
+  std::unique_ptr<detail::IoBackend> m_io;
+  /// By the user_data the backend got, see m_free_slots.
+  std::pmr::vector<InFlight> m_slots;
+  std::pmr::vector<std::uint32_t> m_free_slots;
+  /// Requests completed without an I/O.
+  std::pmr::vector<IoCompletion> m_completed;
+  std::size_t m_in_flight = 0;
+};
+
+} // namespace objectstore
@@ -0,0 +1,227 @@
+#include <cstddef>
+#include <filesystem>
+#include <numeric>
+#include <span>
+#include <sys/mman.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <async_io.hpp>
+#include <objectstore.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+constexpr size_t kNumObjects = 50;
+constexpr size_t kBlockSize = 4096;
+constexpr size_t kBlocksPerObject = 4;
+constexpr unsigned kQueueDepth = 8;
+} // namespace
+
+class AsyncObjectIOTest
+    : public testing::TestWithParam<objectstore::AsyncObjectIO::Backend> {};
+
+TEST_P(AsyncObjectIOTest, WriteThenReadBatch) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_async_io"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_async_io");
+  });
+
+  auto io = objectstore::AsyncObjectIO{&folder, kQueueDepth, GetParam()};
+  if (GetParam() != objectstore::AsyncObjectIO::Backend::Automatic) {
+    EXPECT_EQ(io.backend(), GetParam());
+  }
+
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (size_t i = 0; i < kNumObjects; ++i) {
+    ids.push_back(folder.add());
+  }
+
+  auto const num_requests = kNumObjects * kBlocksPerObject;
+  auto written = std::vector<std::byte>(num_requests * kBlockSize);
+  for (size_t i = 0; i < written.size(); ++i) {
+    written[i] = static_cast<std::byte>(i * 7 + i / kBlockSize);
+  }
+  auto read = std::vector<std::byte>(written.size());
+
+  auto run_batch = [&io](std::vector<objectstore::IoRequest> const &requests) {
+    auto completions = std::vector<objectstore::IoCompletion>(kQueueDepth);
+    auto seen = std::vector<bool>(requests.size());
+    size_t submitted = 0;
+    size_t completed = 0;
+    while (completed < requests.size()) {
+      submitted += io.submit(std::span{requests}.subspan(submitted));
+      EXPECT_LE(io.in_flight(), kQueueDepth);
+      auto const num_reaped = io.reap(completions);
+      for (size_t i = 0; i < num_reaped; ++i) {
+        auto const &completion = completions[i];
+        EXPECT_FALSE(completion.error) << completion.error.message();
+        EXPECT_EQ(completion.bytes_transferred, kBlockSize);
+        EXPECT_FALSE(seen[completion.user_data]);
+        seen[completion.user_data] = true;
+      }
+      completed += num_reaped;
+    }
+    EXPECT_EQ(io.in_flight(), 0u);
+  };
+
+  auto make_requests = [&](objectstore::IoOperation operation,
+                           std::vector<std::byte> *buffer) {
+    auto requests = std::vector<objectstore::IoRequest>{};
+    for (size_t i = 0; i < num_requests; ++i) {
+      // interleave the objects, so that consecutive requests hit other files
+      auto const object = i % kNumObjects;
+      auto const block = i / kNumObjects;
+      requests.push_back(
+          {ids[object], operation, block * kBlockSize,
+           std::span{*buffer}.subspan(i * kBlockSize, kBlockSize), i});
+    }
+    return requests;
+  };
+
+  run_batch(make_requests(objectstore::IoOperation::Write, &written));
+  for (auto id : ids) {
+    EXPECT_EQ(folder.size(id).first, kBlocksPerObject * kBlockSize);
+  }
+
+  run_batch(make_requests(objectstore::IoOperation::Read, &read));
+  EXPECT_EQ(read, written);
+}
+
+TEST_P(AsyncObjectIOTest, UnknownObject) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_async_io_unknown"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_async_io_unknown");
+  });
+
+  auto io = objectstore::AsyncObjectIO{&folder, 4, GetParam()};
+  auto buffer = std::vector<std::byte>(16);
+  auto const request = objectstore::IoRequest{
+      42, objectstore::IoOperation::Read, 0, buffer, 4711};
+  EXPECT_EQ(io.submit({&request, 1}), 1u);
+  EXPECT_EQ(io.in_flight(), 0u);
+
+  auto completion = objectstore::IoCompletion{};
+  ASSERT_EQ(io.reap({&completion, 1}), 1u);
+  EXPECT_EQ(completion.user_data, 4711u);
+  EXPECT_EQ(completion.error, std::errc::no_such_file_or_directory);
+}
+
+TEST_P(AsyncObjectIOTest, RejectsOversizedBuffers) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_async_io_large"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_async_io_large");
+  });
+  auto const id = folder.add();
+
+  // only address space, the request never touches it
+  auto const size = objectstore::AsyncObjectIO::kMaxRequestSize + 1;
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  ASSERT_NE(memory, MAP_FAILED);
+  auto unmap = common::MakeScopeGuard([&] { munmap(memory, size); });
+
+  auto io = objectstore::AsyncObjectIO{&folder, 4, GetParam()};
+  auto const request = objectstore::IoRequest{
+      id, objectstore::IoOperation::Write, 0,
+      std::span{static_cast<std::byte *>(memory), size}, 4711};
+  EXPECT_EQ(io.submit({&request, 1}), 1u);
+  EXPECT_EQ(io.in_flight(), 0u);
+
+  auto completion = objectstore::IoCompletion{};
+  ASSERT_EQ(io.reap({&completion, 1}), 1u);
+  EXPECT_EQ(completion.user_data, 4711u);
+  EXPECT_EQ(completion.bytes_transferred, 0u);
+  EXPECT_EQ(completion.error, std::errc::invalid_argument);
+  // nothing was written
+  EXPECT_FALSE(std::filesystem::exists(folder.path(id)));
+}
+
+TEST_P(AsyncObjectIOTest, SharesDescriptorsWithFolder) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.max_open_files = 4;
+  options.recycle_ids = true;
+  auto folder = objectstore::StoredFolder{
+      resource, "objectstore_test_async_io_shared", options};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_async_io_shared");
+  });
+
+  auto io = objectstore::AsyncObjectIO{&folder, kQueueDepth, GetParam()};
+  auto buffer = std::vector<std::byte>(kBlockSize, std::byte{1});
+  auto run = [&io, &buffer](objectstore::StoredFolder::object_id_t id,
+                            objectstore::IoOperation operation) {
+    auto const request = objectstore::IoRequest{id, operation, 0, buffer, 0};
+    EXPECT_EQ(io.submit({&request, 1}), 1u);
+    auto completion = objectstore::IoCompletion{};
+    EXPECT_EQ(io.reap({&completion, 1}), 1u);
+    return completion;
+  };
+
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (size_t i = 0; i < kNumObjects; ++i) {
+    ids.push_back(folder.add());
+    EXPECT_EQ(run(ids.back(), objectstore::IoOperation::Write)
+                  .bytes_transferred,
+              kBlockSize);
+    EXPECT_LE(folder.num_open_files(), 4u);
+  }
+
+  // the descriptor goes with the object, writes do not end up in its
+  // unlinked file
+  folder.destroy(ids[0]);
+  EXPECT_EQ(run(ids[0], objectstore::IoOperation::Write).error,
+            std::errc::no_such_file_or_directory);
+
+  // the recycled id names a new, empty object, not the destroyed one, which
+  // is read as empty and not created until it is written
+  ASSERT_EQ(folder.add(), ids[0]);
+  auto const completion = run(ids[0], objectstore::IoOperation::Read);
+  EXPECT_FALSE(completion.error);
+  EXPECT_EQ(completion.bytes_transferred, 0u);
+  EXPECT_FALSE(std::filesystem::exists(folder.path(ids[0])));
+  run(ids[0], objectstore::IoOperation::Write);
+  EXPECT_EQ(folder.size(ids[0]).first, kBlockSize);
+}
+
+TEST_P(AsyncObjectIOTest, CompressedFolder) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.compression.codec = &objectstore::DefaultCodec();
+  auto folder = objectstore::StoredFolder{
+      resource, "objectstore_test_async_io_compressed", options};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_async_io_compressed");
+  });
+
+  auto io = objectstore::AsyncObjectIO{&folder, 4, GetParam()};
+  auto buffer = std::vector<std::byte>(16);
+  auto const request = objectstore::IoRequest{
+      folder.add(), objectstore::IoOperation::Write, 0, buffer, 1};
+  EXPECT_EQ(io.submit({&request, 1}), 1u);
+  auto completion = objectstore::IoCompletion{};
+  ASSERT_EQ(io.reap({&completion, 1}), 1u);
+  EXPECT_EQ(completion.error, std::errc::operation_not_supported);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Backends, AsyncObjectIOTest,
+    testing::Values(objectstore::AsyncObjectIO::Backend::Automatic,
+                    objectstore::AsyncObjectIO::Backend::ThreadPool),
+    [](auto const &info) {
+      return info.param == objectstore::AsyncObjectIO::Backend::Automatic
+                 ? "Automatic"
+                 : "ThreadPool";
+    });
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "cache_folder.hpp"
+
+namespace objectstore {
+
+namespace {
+
+/// Not an object name, so the folder does not take it for one.
+constexpr auto kNextIdFileName = ".next_id";
+constexpr auto kNextIdTmpFileName = ".next_id.tmp";
+
+std::system_error SystemError(char const *what) {
+  return std::system_error{errno, std::system_category(), what};
+}
+
+/**
+ * @return the persisted high-water mark, or 0 if there is none
+ */
+CacheFolder::object_id_t LoadNextId(std::filesystem::path const &root_path) {
+  int fd = ::open((root_path / kNextIdFileName).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  auto mark = CacheFolder::object_id_t{};
+  auto const res = ::pread(fd, &mark, sizeof(mark), 0);
+  ::close(fd);
+  return res == sizeof(mark) ? mark : 0;
+}
+
+void StoreNextId(std::filesystem::path const &root_path,
+                 CacheFolder::object_id_t mark) {
+  auto const tmp_path = root_path / kNextIdTmpFileName;
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    throw SystemError("open id mark");
+  }
+  if (::pwrite(fd, &mark, sizeof(mark), 0) != sizeof(mark) ||
+      fdatasync(fd) != 0) {
+    auto error = SystemError("write id mark");
+    ::close(fd);
+    throw error;
+  }
+  ::close(fd);
+  std::filesystem::rename(tmp_path, root_path / kNextIdFileName);
+
+  // the rename itself, or a crash brings the old mark back
+  fd = ::open(root_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    throw SystemError("open directory");
+  }
+  if (fsync(fd) != 0) {
+    auto error = SystemError("fsync directory");
+    ::close(fd);
+    throw error;
+  }
+  ::close(fd);
+}
+
+CacheFolderOptions ForCache(CacheFolderOptions options) {
+  // a recycled id would name another object to a caller that remembers it
+  options.folder_options.recycle_ids = false;
+  // the streams are used without the lock, so the limit could close the
+  // stream of another thread while it is in use
+  options.folder_options.max_open_files = 0;
+  return options;
+}
+
+} // namespace
+
+CacheFolder::CacheFolder(std::pmr::memory_resource *resource,
+                         std::filesystem::path root_path,
+                         CacheFolderOptions options)
+    : m_resource{resource}, m_options{ForCache(std::move(options))},
+      m_folder{resource, std::move(root_path), m_options.folder_options},
+      m_entries{resource}, m_lru{resource} {
+  add_existing_objects();
+  m_thread = std::jthread{[this](std::stop_token token) { run(token); }};
+}
+
+bool CacheFolder::has(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  return m_entries.contains(id);
+}
+
+CacheFolder::object_id_t CacheFolder::add() {
+  auto lock = std::lock_guard{m_mutex};
+  auto const id = m_next_object_id;
+  if (id >= m_reserved_ids) {
+    reserve_ids(id + std::max<std::uint64_t>(1, m_options.ids_per_reservation));
+  }
+  m_folder.add(id);
+  ++m_next_object_id;
+  // in use until it is closed, so that it is not evicted before it is written
+  m_entries.try_emplace(id);
+  return id;
+}
+
+std::iostream *CacheFolder::get(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return nullptr;
+  }
+  use(it->second);
+  return m_folder.get(id);
+}
+
+std::iostream const &CacheFolder::get(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    throw std::out_of_range{"Object ID not found in CacheFolder"};
+  }
+  use(it->second);
+  return m_folder.get(id);
+}
+
+std::pair<std::uintmax_t, std::error_code>
+CacheFolder::size(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  return m_folder.size(id);
+}
+
+void CacheFolder::close(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return;
+  }
+  m_folder.close(id);
+  auto &entry = it->second;
+  if (!entry.in_use) {
+    return;
+  }
+  entry.in_use = false;
+  auto const size = disk_size(id);
+  m_disk_bytes = m_disk_bytes - entry.size + size;
+  entry.size = size;
+  m_lru.push_front(id);
+  entry.lru = m_lru.begin();
+  if (over_budget()) {
+    m_cv.notify_all();
+  }
+}
+
+void CacheFolder::destroy(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return;
+  }
+  auto &entry = it->second;
+  if (!entry.in_use) {
+    m_lru.erase(entry.lru);
+  }
+  m_disk_bytes -= entry.size;
+  m_entries.erase(it);
+  m_folder.destroy(id);
+}
+
+void CacheFolder::clear() {
+  auto lock = std::lock_guard{m_mutex};
+  m_entries.clear();
+  m_lru.clear();
+  m_disk_bytes = 0;
+  m_folder.clear();
+  // which may have taken the mark with it
+  reserve_ids(m_reserved_ids);
+  // whoever waits for eviction is done
+  m_cv.notify_all();
+}
+
+std::uint64_t CacheFolder::disk_bytes() const {
+  auto lock = std::lock_guard{m_mutex};
+  return m_disk_bytes;
+}
+
+void CacheFolder::wait_for_eviction() const {
+  auto lock = std::unique_lock{m_mutex};
+  m_cv.wait(lock, [this] { return !over_budget(); });
+}
+
+void CacheFolder::use(Entry &entry) const {
+  if (!entry.in_use) {
+    m_lru.erase(entry.lru);
+    entry.in_use = true;
+  }
+}
+
+bool CacheFolder::over_budget() const {
+  // objects in use cannot help
+  return m_disk_bytes > m_options.disk_budget && !m_lru.empty();
+}
+
+std::uint64_t CacheFolder::disk_size(object_id_t id) const {
+  // what the file takes, even if the folder compresses it
+  struct stat st {};
+  if (::stat(m_folder.path(id).c_str(), &st) != 0) {
+    // never written
+    return 0;
+  }
+  return static_cast<std::uint64_t>(st.st_size);
+}
+
+void CacheFolder::add_existing_objects() {
+  struct Found {
+    std::int64_t mtime_ns;
+    object_id_t id;
+    std::uint64_t size;
+  };
+  auto found = std::pmr::vector<Found>{m_resource};
+  for (auto id : m_folder) {
+    struct stat st {};
+    if (::stat(m_folder.path(id).c_str(), &st) != 0) {
+      st = {};
+    }
+    found.push_back({st.st_mtim.tv_sec * 1'000'000'000 + st.st_mtim.tv_nsec,
+                     id, static_cast<std::uint64_t>(st.st_size)});
+  }
+  // the most recently modified first, like the LRU list
+  std::sort(found.begin(), found.end(), [](auto const &a, auto const &b) {
+    return std::tie(b.mtime_ns, b.id) < std::tie(a.mtime_ns, a.id);
+  });
+  auto end_id = object_id_t{};
+  for (auto const &object : found) {
+    end_id = std::max(end_id, object.id + 1);
+  }
+  m_entries.reserve(end_id);
+  // the ids of evicted objects may be above the ones found
+  m_next_object_id = std::max(end_id, LoadNextId(m_folder.path()));
+  m_reserved_ids = m_next_object_id;
+  for (auto const &object : found) {
+    auto &entry = m_entries.try_emplace(object.id).first->second;
+    entry.in_use = false;
+    entry.size = object.size;
+    m_disk_bytes += object.size;
+    entry.lru = m_lru.insert(m_lru.end(), object.id);
+  }
+}
+
+void CacheFolder::reserve_ids(object_id_t mark) {
+  StoreNextId(m_folder.path(), mark);
+  m_reserved_ids = mark;
+}
+
+void CacheFolder::evict(object_id_t id) {
+  auto it = m_entries.find(id);
+  m_lru.erase(it->second.lru);
+  m_disk_bytes -= it->second.size;
+  m_entries.erase(it);
+  m_folder.destroy(id);
+  m_num_evicted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CacheFolder::run(std::stop_token token) {
+  auto const target = static_cast<std::uint64_t>(
+      static_cast<double>(m_options.disk_budget) *
+      std::clamp(m_options.eviction_target, 0.0, 1.0));
+  auto const batch = std::max<std::size_t>(1, m_options.eviction_batch);
+  auto lock = std::unique_lock{m_mutex};
+  while (true) {
+    m_cv.wait(lock, token, [this] { return over_budget(); });
+    if (token.stop_requested()) {
+      return;
+    }
+    while (!token.stop_requested() && m_disk_bytes > target &&
+           !m_lru.empty()) {
+      for (std::size_t i = 0;
+           i < batch && m_disk_bytes > target && !m_lru.empty(); ++i) {
+        evict(m_lru.back());
+      }
+      // lets the foreground in between batches
+      lock.unlock();
+      std::this_thread::yield();
+      lock.lock();
+    }
+    m_cv.notify_all();
+  }
+}
+
+} // namespace objectstore
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <memory_resource>
+#include <mutex>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "dense_id_map.hpp"
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+struct CacheFolderOptions {
+  /// Bytes the objects may take on disk before the least recently used ones
+  /// are evicted.
+  std::uint64_t disk_budget = std::uint64_t{1} << 30;
+  /// Once over the budget, objects are evicted until they take at most this
+  /// share of it, so that eviction does not start again with every add.
+  double eviction_target = 0.9;
+  /// Objects evicted at a time, after which the lock is handed to the
+  /// foreground, so that it waits for that many removals at most.
+  std::size_t eviction_batch = 8;
+  /// Options of the StoredFolder that holds the objects. It never recycles
+  /// ids or limits the open files, whatever recycle_ids and max_open_files
+  /// say, see CacheFolder.
+  StoredFolderOptions folder_options;
+  /// Ids the high-water mark is raised by at a time, each time with a synced
+  /// write. Up to that many ids are skipped after a restart.
+  std::uint64_t ids_per_reservation = 1024;
+};
+
+/**
+ * @brief A StoredFolder with a disk budget, for use as a bounded cache, e.g.
+ * of remote blobs.
+ *
+ * The folder accounts every object with its size on disk, learned on
+ * close(), and keeps the closed objects in LRU order. Once they take more
+ * than the budget, a thread evicts the least recently used ones down to the
+ * eviction target, a batch at a time: add() and close() only tell it to.
+ * Evicted objects are destroyed, has() is false for them from then on, and
+ * their ids are never handed out again, so that an id a caller remembers
+ * never names another object. Not after a restart either: the folder hands
+ * out the ids itself and keeps a high-water mark next to the objects, which
+ * is raised a block of ids at a time.
+ *
+ * An object is in use from add() or get() until close(), and objects in use
+ * are never evicted, so the budget may be exceeded while they are. The
+ * objects found in the folder when it is opened are ordered by their
+ * modification time, and evicted right away if they exceed the budget.
+ *
+ * All operations take a lock, as the thread changes the folder too. The
+ * streams are used without it, following the contract of
+ * StoredObjectCollection, so the folder keeps every file open until it is
+ * closed: a limit would let one thread close the stream of another.
+ */
+class CacheFolder : public StoredObjectCollection {
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  CacheFolder(std::pmr::memory_resource *resource,
+              std::filesystem::path root_path,
+              CacheFolderOptions options = {});
+
+  CacheFolder(const CacheFolder &) = delete;
+  CacheFolder(CacheFolder &&) = delete;
+  CacheFolder &operator=(const CacheFolder &) = delete;
+  CacheFolder &operator=(CacheFolder &&) = delete;
+
+  ~CacheFolder() override = default;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  /**
+   * @brief Like get(), the object is in use until close().
+   */
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @return the bytes the objects took on disk when they were last closed
+   */
+  std::uint64_t disk_bytes() const;
+
+  /**
+   * @return the number of objects evicted so far
+   */
+  std::uint64_t num_evicted() const { return m_num_evicted.load(); }
+
+  /**
+   * @brief Blocks until the objects fit into the budget, or all that are
+   * left over it are in use.
+   */
+  void wait_for_eviction() const;
+
+  std::filesystem::path const &path() const { return m_folder.path(); }
+
+private:
+  using LruList = std::pmr::list<object_id_t>;
+
+  struct Entry {
+    /// The size the object was accounted with on its last close().
+    std::uint64_t size = 0;
+    /// Between add() or get() and close(), when it must not be evicted.
+    bool in_use = true;
+    /// Position among the closed objects, unless in_use.
+    LruList::iterator lru;
+  };
+
+  void use(Entry &entry) const;
+  bool over_budget() const;
+  std::uint64_t disk_size(object_id_t id) const;
+  void add_existing_objects();
+  /**
+   * @brief Persists that no id below @p mark is handed out again.
+   */
+  void reserve_ids(object_id_t mark);
+  void evict(object_id_t id);
+  void run(std::stop_token token);
+
+  std::pmr::memory_resource *m_resource;
+  CacheFolderOptions m_options;
+  StoredFolder m_folder;
+  mutable std::mutex m_mutex;
+  // get() const marks the object in use
+  mutable DenseIdMap<Entry> m_entries;
+  /// Most recently used first.
+  mutable LruList m_lru;
+  std::uint64_t m_disk_bytes = 0;
+  object_id_t m_next_object_id{};
+  /// The persisted high-water mark, m_next_object_id stays below it.
+  object_id_t m_reserved_ids{};
+  std::atomic<std::uint64_t> m_num_evicted{0};
+
+  mutable std::condition_variable_any m_cv;
+  // declared last, so that it is stopped before any other member goes away
+  std::jthread m_thread;
+};
+
+} // namespace objectstore
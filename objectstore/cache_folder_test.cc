@@ -0,0 +1,205 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cache_folder.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_cache_folder";
+constexpr std::size_t kObjectSize = 1000;
+
+objectstore::CacheFolderOptions Budget(std::uint64_t bytes) {
+  auto options = objectstore::CacheFolderOptions{};
+  options.disk_budget = bytes;
+  options.eviction_target = 1.0;
+  return options;
+}
+
+objectstore::CacheFolder::object_id_t
+AddObject(objectstore::CacheFolder *folder) {
+  auto const id = folder->add();
+  auto const content = std::string(kObjectSize, 'x');
+  folder->get(id)->write(content.data(),
+                         static_cast<std::streamsize>(content.size()));
+  folder->close(id);
+  return id;
+}
+
+class CacheFolderTest : public objectstore::test::DirectoryTest {
+protected:
+  CacheFolderTest() : DirectoryTest{kTestPath} {}
+};
+
+} // namespace
+
+TEST_F(CacheFolderTest, EvictsLeastRecentlyUsed) {
+  auto folder =
+      objectstore::CacheFolder{resource, kTestPath, Budget(10 * kObjectSize)};
+  auto ids = std::vector<objectstore::CacheFolder::object_id_t>{};
+  for (int i = 0; i < 10; ++i) {
+    ids.push_back(AddObject(&folder));
+  }
+  EXPECT_EQ(folder.disk_bytes(), 10 * kObjectSize);
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 0u);
+
+  // the oldest object is used again, the second oldest is the coldest now
+  folder.get(ids[0]);
+  folder.close(ids[0]);
+  auto const added = AddObject(&folder);
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 1u);
+  EXPECT_EQ(folder.disk_bytes(), 10 * kObjectSize);
+  EXPECT_TRUE(folder.has(ids[0]));
+  EXPECT_FALSE(folder.has(ids[1]));
+  EXPECT_FALSE(std::filesystem::exists(
+      std::filesystem::path{kTestPath} / std::to_string(ids[1])));
+  EXPECT_TRUE(folder.has(added));
+
+  // evicted ids are not handed out again
+  EXPECT_NE(folder.add(), ids[1]);
+}
+
+TEST_F(CacheFolderTest, EvictsDownToTarget) {
+  auto options = Budget(10 * kObjectSize);
+  options.eviction_target = 0.5;
+  auto folder = objectstore::CacheFolder{resource, kTestPath, options};
+  for (int i = 0; i < 11; ++i) {
+    AddObject(&folder);
+  }
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 6u);
+  EXPECT_EQ(folder.disk_bytes(), 5 * kObjectSize);
+}
+
+TEST_F(CacheFolderTest, NeverEvictsObjectsInUse) {
+  auto folder =
+      objectstore::CacheFolder{resource, kTestPath, Budget(kObjectSize)};
+  auto const open = AddObject(&folder);
+  auto *stream = folder.get(open);
+  // added, but neither written nor closed yet
+  auto const pending = folder.add();
+
+  AddObject(&folder);
+  AddObject(&folder);
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 2u);
+  EXPECT_TRUE(folder.has(open));
+  EXPECT_TRUE(folder.has(pending));
+  auto const content =
+      std::string{std::istreambuf_iterator<char>{*stream}, {}};
+  EXPECT_EQ(content, std::string(kObjectSize, 'x'));
+
+  // closed, and the only object over the budget
+  folder.close(open);
+  folder.close(pending);
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 2u);
+  AddObject(&folder);
+  folder.wait_for_eviction();
+  EXPECT_FALSE(folder.has(open));
+  EXPECT_EQ(folder.disk_bytes(), kObjectSize);
+}
+
+TEST_F(CacheFolderTest, NeverClosesStreamsInUse) {
+  auto options = Budget(10 * kObjectSize);
+  // ignored, another thread may still use the stream it would close
+  options.folder_options.max_open_files = 1;
+  auto folder = objectstore::CacheFolder{resource, kTestPath, options};
+  auto first = folder.add();
+  auto second = folder.add();
+  auto *stream = folder.get(first);
+  *stream << "first";
+  *folder.get(second) << "second";
+  *stream << " and more";
+  EXPECT_TRUE(stream->good());
+  folder.close(first);
+  folder.close(second);
+  EXPECT_EQ(folder.size(first).first, 14u);
+}
+
+TEST_F(CacheFolderTest, OrdersExistingObjectsByModificationTime) {
+  auto ids = std::vector<objectstore::CacheFolder::object_id_t>{};
+  {
+    auto folder = objectstore::CacheFolder{resource, kTestPath,
+                                           Budget(10 * kObjectSize)};
+    for (int i = 0; i < 3; ++i) {
+      ids.push_back(AddObject(&folder));
+    }
+  }
+  // the first object was modified last, the second one first
+  auto const now = std::filesystem::file_time_type::clock::now();
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    auto const age = i == 0 ? 0 : static_cast<int>(ids.size() - i);
+    std::filesystem::last_write_time(
+        std::filesystem::path{kTestPath} / std::to_string(ids[i]),
+        now - std::chrono::hours{age});
+  }
+
+  auto folder =
+      objectstore::CacheFolder{resource, kTestPath, Budget(2 * kObjectSize)};
+  folder.wait_for_eviction();
+  EXPECT_EQ(folder.num_evicted(), 1u);
+  EXPECT_TRUE(folder.has(ids[0]));
+  EXPECT_FALSE(folder.has(ids[1]));
+  EXPECT_TRUE(folder.has(ids[2]));
+}
+
+TEST_F(CacheFolderTest, DestroyAndClearRelease) {
+  auto folder =
+      objectstore::CacheFolder{resource, kTestPath, Budget(10 * kObjectSize)};
+  auto const id = AddObject(&folder);
+  AddObject(&folder);
+  folder.destroy(id);
+  EXPECT_FALSE(folder.has(id));
+  EXPECT_EQ(folder.disk_bytes(), kObjectSize);
+  folder.clear();
+  EXPECT_EQ(folder.disk_bytes(), 0u);
+  AddObject(&folder);
+  EXPECT_EQ(folder.disk_bytes(), kObjectSize);
+  EXPECT_EQ(folder.num_evicted(), 0u);
+}
+
+TEST_F(CacheFolderTest, NeverReusesIdsAfterRestart) {
+  auto options = Budget(10 * kObjectSize);
+  options.ids_per_reservation = 2;
+  auto last = objectstore::CacheFolder::object_id_t{};
+  {
+    auto folder = objectstore::CacheFolder{resource, kTestPath, options};
+    for (int i = 0; i < 5; ++i) {
+      last = AddObject(&folder);
+    }
+    // the highest ids are gone from the disk
+    folder.destroy(last);
+    folder.destroy(last - 1);
+  }
+  {
+    auto folder = objectstore::CacheFolder{resource, kTestPath, options};
+    EXPECT_GT(folder.add(), last);
+    last = AddObject(&folder);
+    folder.clear();
+  }
+  {
+    auto folder = objectstore::CacheFolder{resource, kTestPath, options};
+    EXPECT_GT(folder.add(), last);
+  }
+
+  // the mark survives a clear that takes the whole folder with it
+  auto const deferred = std::filesystem::path{kTestPath} / "deferred";
+  options.folder_options.deferred_deletion = true;
+  {
+    auto folder = objectstore::CacheFolder{resource, deferred, options};
+    last = AddObject(&folder);
+    folder.clear();
+  }
+  auto folder = objectstore::CacheFolder{resource, deferred, options};
+  EXPECT_GT(folder.add(), last);
+}
@@ -0,0 +1,748 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <scopeguard.hpp>
+
+#include "compression.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr char kHeaderMagic[8] = {'O', 'S', 'B', 'L', 'O', 'C', 'K', '2'};
+constexpr std::size_t kMaxBlockSize = std::size_t{1} << 30;
+/// Suffix of the file a compaction writes before it replaces the object.
+constexpr char kCompactSuffix[] = ".compact";
+
+/**
+ * The start of a compressed file, pointing to the block index, which like the
+ * blocks it lists may be anywhere behind it.
+ */
+struct Header {
+  char magic[8];
+  std::uint64_t size;
+  std::uint64_t num_blocks;
+  std::uint64_t index_offset;
+  std::uint32_t block_size;
+  std::uint32_t codec_id;
+};
+static_assert(sizeof(Header) == 40);
+
+struct IndexEntry {
+  std::uint64_t offset;
+  std::uint32_t stored_size;
+  /// Non-zero for blocks stored as they are.
+  std::uint32_t raw;
+};
+static_assert(sizeof(IndexEntry) == 16);
+
+constexpr std::size_t kMinMatch = 4;
+// matches never reach into the last bytes, which keeps the encoder's
+// 4-byte loads in bounds
+constexpr std::size_t kLastLiterals = 5;
+constexpr std::size_t kMaxOffset = 65535;
+constexpr unsigned kHashBits = 14;
+constexpr std::size_t kCopySize = 16;
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::error_code Corrupt() {
+  return std::make_error_code(std::errc::illegal_byte_sequence);
+}
+
+std::uint32_t Load32(std::uint8_t const *p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// the encoder finds the first differing byte of two loads by counting zeros
+static_assert(std::endian::native == std::endian::little);
+
+std::uint64_t Load64(std::uint8_t const *p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+std::uint32_t Hash(std::uint32_t v) {
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+/**
+ * Appends the length above the 4 bits of the token as a run of bytes, each
+ * 255 meaning there is more.
+ */
+bool PutLength(std::size_t length, std::uint8_t **op,
+               std::uint8_t const *oend) {
+  if (length < 15) {
+    return true;
+  }
+  length -= 15;
+  while (length >= 255) {
+    if (*op == oend) {
+      return false;
+    }
+    *(*op)++ = 255;
+    length -= 255;
+  }
+  if (*op == oend) {
+    return false;
+  }
+  *(*op)++ = static_cast<std::uint8_t>(length);
+  return true;
+}
+
+bool GetLength(std::size_t *length, std::uint8_t const **ip,
+               std::uint8_t const *iend) {
+  if (*length < 15) {
+    return true;
+  }
+  while (*ip != iend) {
+    auto const byte = *(*ip)++;
+    *length += byte;
+    if (byte != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * A token with the literal length in the high and the match length in the low
+ * nibble, followed by the literals, the offset and the rest of the lengths.
+ * Without a match, the sequence is the last one.
+ */
+bool PutSequence(std::uint8_t const *literals, std::size_t num_literals,
+                 std::size_t offset, std::size_t match_length,
+                 std::uint8_t **op, std::uint8_t const *oend) {
+  if (*op == oend) {
+    return false;
+  }
+  auto const match_code = match_length == 0 ? 0 : match_length - kMinMatch;
+  auto *token = (*op)++;
+  *token = static_cast<std::uint8_t>((std::min<std::size_t>(num_literals, 15)
+                                      << 4) |
+                                     std::min<std::size_t>(match_code, 15));
+  if (!PutLength(num_literals, op, oend) ||
+      static_cast<std::size_t>(oend - *op) < num_literals) {
+    return false;
+  }
+  std::memcpy(*op, literals, num_literals);
+  *op += num_literals;
+  if (match_length == 0) {
+    return true;
+  }
+  if (oend - *op < 2) {
+    return false;
+  }
+  *(*op)++ = static_cast<std::uint8_t>(offset);
+  *(*op)++ = static_cast<std::uint8_t>(offset >> 8);
+  return PutLength(match_code, op, oend);
+}
+
+std::error_code ReadAll(int fd, void *data, std::size_t size, off_t offset) {
+  auto *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    auto const n = pread(fd, bytes, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    if (n == 0) {
+      return Corrupt();
+    }
+    bytes += n;
+    size -= static_cast<std::size_t>(n);
+    offset += n;
+  }
+  return {};
+}
+
+std::error_code WriteAll(int fd, void const *data, std::size_t size,
+                         off_t offset) {
+  auto const *bytes = static_cast<char const *>(data);
+  while (size > 0) {
+    auto const n = pwrite(fd, bytes, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    bytes += n;
+    size -= static_cast<std::size_t>(n);
+    offset += n;
+  }
+  return {};
+}
+
+/**
+ * @return the header of the file of the given size, checked against the codec
+ */
+std::pair<Header, std::error_code> ReadHeader(int fd, std::uintmax_t size,
+                                              Codec const &codec) {
+  auto header = Header{};
+  if (size < sizeof(header)) {
+    return std::make_pair(header, Corrupt());
+  }
+  if (auto ec = ReadAll(fd, &header, sizeof(header), 0)) {
+    return std::make_pair(header, ec);
+  }
+  if (std::memcmp(header.magic, kHeaderMagic, sizeof(kHeaderMagic)) != 0 ||
+      header.codec_id != codec.id() || header.block_size == 0 ||
+      header.block_size > kMaxBlockSize ||
+      header.num_blocks !=
+          (header.size + header.block_size - 1) / header.block_size ||
+      header.index_offset < sizeof(header) || header.index_offset > size ||
+      header.num_blocks > (size - header.index_offset) / sizeof(IndexEntry)) {
+    return std::make_pair(header, Corrupt());
+  }
+  return std::make_pair(header, std::error_code{});
+}
+
+} // namespace
+
+std::uint32_t LzCodec::id() const { return 0x4c5a3031; }
+
+std::size_t LzCodec::compress(std::span<const std::byte> in,
+                              std::span<std::byte> out) const {
+  auto const *src = reinterpret_cast<std::uint8_t const *>(in.data());
+  auto const size = in.size();
+  auto *op = reinterpret_cast<std::uint8_t *>(out.data());
+  auto const *oend = op + out.size();
+  std::size_t anchor = 0;
+
+  if (size >= kMinMatch + kLastLiterals) {
+    // positions + 1, zero for none
+    auto table = std::array<std::uint32_t, std::size_t{1} << kHashBits>{};
+    auto const limit = size - kLastLiterals;
+    std::size_t pos = 0;
+    while (pos + kMinMatch <= limit) {
+      auto const value = Load32(src + pos);
+      auto &entry = table[Hash(value)];
+      auto const candidate = static_cast<std::size_t>(entry);
+      entry = static_cast<std::uint32_t>(pos + 1);
+      if (candidate == 0 || pos - (candidate - 1) > kMaxOffset ||
+          Load32(src + candidate - 1) != value) {
+        // skip ahead faster the longer nothing matched
+        pos += 1 + ((pos - anchor) >> 6);
+        continue;
+      }
+      auto const match = candidate - 1;
+      auto length = kMinMatch;
+      // eight bytes at a time, the first difference ends the match
+      while (pos + length + 8 <= limit) {
+        auto const diff =
+            Load64(src + match + length) ^ Load64(src + pos + length);
+        if (diff != 0) {
+          length += static_cast<std::size_t>(std::countr_zero(diff)) / 8;
+          break;
+        }
+        length += 8;
+      }
+      if (pos + length + 8 > limit) {
+        while (pos + length < limit &&
+               src[match + length] == src[pos + length]) {
+          ++length;
+        }
+      }
+      if (!PutSequence(src + anchor, pos - anchor, pos - match, length, &op,
+                       oend)) {
+        return 0;
+      }
+      pos += length;
+      anchor = pos;
+    }
+  }
+
+  if (!PutSequence(src + anchor, size - anchor, 0, 0, &op, oend)) {
+    return 0;
+  }
+  return static_cast<std::size_t>(
+      op - reinterpret_cast<std::uint8_t *>(out.data()));
+}
+
+bool LzCodec::decompress(std::span<const std::byte> in,
+                         std::span<std::byte> out) const {
+  auto const *ip = reinterpret_cast<std::uint8_t const *>(in.data());
+  auto const *iend = ip + in.size();
+  auto *const ostart = reinterpret_cast<std::uint8_t *>(out.data());
+  auto *op = ostart;
+  auto const *oend = op + out.size();
+
+  while (ip != iend) {
+    auto const token = *ip++;
+    auto num_literals = static_cast<std::size_t>(token >> 4);
+    if (!GetLength(&num_literals, &ip, iend) ||
+        static_cast<std::size_t>(iend - ip) < num_literals ||
+        static_cast<std::size_t>(oend - op) < num_literals) {
+      return false;
+    }
+    if (num_literals <= kCopySize &&
+        static_cast<std::size_t>(iend - ip) >= kCopySize &&
+        static_cast<std::size_t>(oend - op) >= kCopySize) {
+      // a fixed size copy is much faster, the excess is overwritten later
+      std::memcpy(op, ip, kCopySize);
+    } else {
+      std::memcpy(op, ip, num_literals);
+    }
+    ip += num_literals;
+    op += num_literals;
+    if (ip == iend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return false;
+    }
+    auto const offset = static_cast<std::size_t>(ip[0] | (ip[1] << 8));
+    ip += 2;
+    auto length = static_cast<std::size_t>(token & 0xf);
+    if (!GetLength(&length, &ip, iend)) {
+      return false;
+    }
+    length += kMinMatch;
+    if (offset == 0 || offset > static_cast<std::size_t>(op - ostart) ||
+        static_cast<std::size_t>(oend - op) < length) {
+      return false;
+    }
+    auto const *match = op - offset;
+    if (offset >= kCopySize &&
+        static_cast<std::size_t>(oend - op) >= length + kCopySize) {
+      // each chunk only reads bytes in front of it, which are final
+      for (std::size_t i = 0; i < length; i += kCopySize) {
+        std::memcpy(op + i, match + i, kCopySize);
+      }
+      op += length;
+    } else if (offset >= length) {
+      std::memcpy(op, match, length);
+      op += length;
+    } else {
+      // the match overlaps the output, e.g. a run of a single byte
+      for (std::size_t i = 0; i < length; ++i) {
+        *op++ = match[i];
+      }
+    }
+  }
+  return op == oend;
+}
+
+Codec const &DefaultCodec() {
+  static auto const codec = LzCodec{};
+  return codec;
+}
+
+CompressedStreambuf::CompressedStreambuf(
+    std::pmr::memory_resource *resource,
+    std::filesystem::path const &file_path, CompressionOptions const &options)
+    : m_resource{resource},
+      m_codec{options.codec != nullptr ? options.codec : &DefaultCodec()},
+      m_block_size{std::clamp<std::size_t>(options.block_size, 1,
+                                           kMaxBlockSize)},
+      m_path{file_path}, m_blocks{resource}, m_pending{resource},
+      m_block{resource}, m_scratch{resource} {
+  m_fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    m_error = LastError();
+    return;
+  }
+  m_error = read_index();
+}
+
+CompressedStreambuf::~CompressedStreambuf() {
+  if (m_fd >= 0) {
+    sync();
+    ::close(m_fd);
+  }
+}
+
+std::error_code CompressedStreambuf::read_index() {
+  struct stat st {};
+  if (fstat(m_fd, &st) != 0) {
+    return LastError();
+  }
+  m_stored_size = static_cast<std::uintmax_t>(st.st_size);
+  if (m_stored_size == 0) {
+    // a new object, written with the configured block size
+    return {};
+  }
+
+  auto [header, ec] = ReadHeader(m_fd, m_stored_size, *m_codec);
+  if (ec) {
+    return ec;
+  }
+  auto index = std::pmr::vector<IndexEntry>(header.num_blocks, m_resource);
+  if (auto ec = ReadAll(m_fd, index.data(), index.size() * sizeof(IndexEntry),
+                        static_cast<off_t>(header.index_offset))) {
+    return ec;
+  }
+
+  m_blocks.reserve(index.size());
+  for (auto const &entry : index) {
+    if (entry.offset < sizeof(header) || entry.offset > m_stored_size ||
+        entry.stored_size > m_stored_size - entry.offset) {
+      return Corrupt();
+    }
+    m_blocks.push_back({entry.offset, entry.stored_size, entry.raw != 0});
+  }
+  m_block_size = header.block_size;
+  m_size = header.size;
+  return {};
+}
+
+std::uintmax_t CompressedStreambuf::size() const {
+  if (pbase() == nullptr) {
+    return m_size;
+  }
+  return std::max<std::uintmax_t>(m_size, m_block_index * m_block_size +
+                                              (pptr() - pbase()));
+}
+
+std::size_t CompressedStreambuf::position_in_block() const {
+  if (pbase() != nullptr) {
+    return static_cast<std::size_t>(pptr() - pbase());
+  }
+  return static_cast<std::size_t>(gptr() - eback());
+}
+
+void CompressedStreambuf::leave_put_mode() {
+  if (pbase() == nullptr) {
+    return;
+  }
+  auto const offset = position_in_block();
+  m_block_length = std::max(m_block_length, offset);
+  m_size = std::max<std::uintmax_t>(
+      m_size, m_block_index * m_block_size + m_block_length);
+  setp(nullptr, nullptr);
+  set_position(offset);
+}
+
+void CompressedStreambuf::set_position(std::size_t offset) {
+  // the get area ends at the current position rather than at the end of the
+  // block, so that the next read goes through underflow() and sees writes
+  auto *block = m_block.data();
+  setg(block, block + offset, block + offset);
+}
+
+void CompressedStreambuf::store_block() {
+  if (!m_block_dirty) {
+    return;
+  }
+  auto const content = std::as_bytes(std::span{m_block}.first(m_block_length));
+  auto data = std::pmr::vector<std::byte>(m_block_length, m_resource);
+  // only worth it if the compressed block is smaller
+  auto size = m_block_length > 1
+                  ? m_codec->compress(content, std::span{data}.first(
+                                                   m_block_length - 1))
+                  : 0;
+  auto const raw = size == 0;
+  if (raw) {
+    std::memcpy(data.data(), content.data(), content.size());
+    size = content.size();
+  }
+  data.resize(size);
+  m_pending.insert_or_assign(m_block_index,
+                             PendingBlock{std::move(data), raw});
+  m_block_dirty = false;
+}
+
+std::error_code CompressedStreambuf::load_block(std::size_t index) {
+  store_block();
+  m_block.resize(m_block_size);
+  auto const begin = static_cast<std::uintmax_t>(index) * m_block_size;
+  auto const length = static_cast<std::size_t>(
+      begin < m_size ? std::min<std::uintmax_t>(m_size - begin, m_block_size)
+                     : 0);
+  m_block_index = index;
+  m_block_length = 0;
+  if (length == 0) {
+    return {};
+  }
+
+  auto stored = std::span<const std::byte>{};
+  auto raw = false;
+  if (auto it = m_pending.find(index); it != m_pending.end()) {
+    stored = it->second.data;
+    raw = it->second.raw;
+  } else {
+    auto const &block = m_blocks[index];
+    m_scratch.resize(block.stored_size);
+    if (auto ec = ReadAll(m_fd, m_scratch.data(), m_scratch.size(),
+                          static_cast<off_t>(block.offset))) {
+      return ec;
+    }
+    stored = m_scratch;
+    raw = block.raw;
+  }
+
+  auto const target = std::as_writable_bytes(std::span{m_block}.first(length));
+  if (raw) {
+    if (stored.size() != length) {
+      return Corrupt();
+    }
+    std::memcpy(target.data(), stored.data(), length);
+  } else if (!m_codec->decompress(stored, target)) {
+    return Corrupt();
+  }
+  m_block_length = length;
+  return {};
+}
+
+CompressedStreambuf::int_type CompressedStreambuf::underflow() {
+  if (m_error) {
+    return traits_type::eof();
+  }
+  leave_put_mode();
+  auto const position =
+      eback() == nullptr
+          ? std::uintmax_t{0}
+          : m_block_index * m_block_size + position_in_block();
+  if (position >= m_size) {
+    return traits_type::eof();
+  }
+  auto const index = static_cast<std::size_t>(position / m_block_size);
+  auto const offset = static_cast<std::size_t>(position % m_block_size);
+  if (index != m_block_index || eback() == nullptr) {
+    if (auto ec = load_block(index)) {
+      m_error = ec;
+      return traits_type::eof();
+    }
+  }
+  auto *block = m_block.data();
+  setg(block, block + offset, block + m_block_length);
+  return traits_type::to_int_type(*gptr());
+}
+
+CompressedStreambuf::int_type CompressedStreambuf::overflow(int_type ch) {
+  if (traits_type::eq_int_type(ch, traits_type::eof())) {
+    return traits_type::not_eof(ch);
+  }
+  if (m_error) {
+    return traits_type::eof();
+  }
+  auto position = std::uintmax_t{0};
+  if (pbase() != nullptr) {
+    // the block is full
+    position = m_block_index * m_block_size + position_in_block();
+    leave_put_mode();
+  } else if (eback() != nullptr) {
+    position = m_block_index * m_block_size + position_in_block();
+  }
+  auto const index = static_cast<std::size_t>(position / m_block_size);
+  auto const offset = static_cast<std::size_t>(position % m_block_size);
+  if (index != m_block_index || eback() == nullptr) {
+    if (auto ec = load_block(index)) {
+      m_error = ec;
+      return traits_type::eof();
+    }
+  }
+  setg(nullptr, nullptr, nullptr);
+  auto *block = m_block.data();
+  setp(block, block + m_block_size);
+  pbump(static_cast<int>(offset));
+  m_block_dirty = true;
+  *pptr() = traits_type::to_char_type(ch);
+  pbump(1);
+  return ch;
+}
+
+CompressedStreambuf::pos_type
+CompressedStreambuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                             std::ios_base::openmode /*which*/) {
+  leave_put_mode();
+  auto const current =
+      eback() == nullptr
+          ? std::uintmax_t{0}
+          : m_block_index * m_block_size + position_in_block();
+  auto base = std::uintmax_t{0};
+  if (dir == std::ios_base::cur) {
+    base = current;
+  } else if (dir == std::ios_base::end) {
+    base = m_size;
+  }
+  auto const target = static_cast<off_type>(base) + off;
+  if (target < 0 || static_cast<std::uintmax_t>(target) > m_size) {
+    return pos_type(off_type(-1));
+  }
+  auto const position = static_cast<std::uintmax_t>(target);
+  auto const index = static_cast<std::size_t>(position / m_block_size);
+  if (eback() != nullptr && index == m_block_index) {
+    set_position(static_cast<std::size_t>(position % m_block_size));
+  } else if (position == 0) {
+    // nothing loaded yet, the same as the start
+    setg(nullptr, nullptr, nullptr);
+  } else {
+    if (auto ec = load_block(index)) {
+      m_error = ec;
+      return pos_type(off_type(-1));
+    }
+    set_position(static_cast<std::size_t>(position % m_block_size));
+  }
+  return pos_type(target);
+}
+
+CompressedStreambuf::pos_type
+CompressedStreambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+int CompressedStreambuf::sync() {
+  if (m_fd < 0 || m_error) {
+    return -1;
+  }
+  leave_put_mode();
+  store_block();
+  if (auto ec = write_blocks()) {
+    m_error = ec;
+    return -1;
+  }
+  return 0;
+}
+
+std::error_code CompressedStreambuf::write_blocks() {
+  if (m_pending.empty()) {
+    return {};
+  }
+  auto const num_blocks =
+      static_cast<std::size_t>((m_size + m_block_size - 1) / m_block_size);
+  auto blocks = m_blocks;
+  blocks.resize(num_blocks);
+
+  // behind everything the header points to, so that a failed write leaves
+  // it intact
+  auto const start = std::max<std::uint64_t>(m_stored_size, sizeof(Header));
+  auto tail = std::pmr::vector<std::byte>{m_resource};
+  for (auto const &[index, pending] : m_pending) {
+    blocks[index] = {start + tail.size(),
+                     static_cast<std::uint32_t>(pending.data.size()),
+                     pending.raw};
+    tail.insert(tail.end(), pending.data.begin(), pending.data.end());
+  }
+  auto const index_offset = start + tail.size();
+  append_index(blocks, &tail);
+  if (auto ec =
+          WriteAll(m_fd, tail.data(), tail.size(), static_cast<off_t>(start))) {
+    return ec;
+  }
+  if (auto ec = write_header(m_fd, num_blocks, index_offset)) {
+    return ec;
+  }
+  m_blocks = std::move(blocks);
+  m_stored_size = start + tail.size();
+  m_pending.clear();
+
+  // what earlier versions left behind is only dropped once it outweighs the
+  // content, so that rewriting the file costs as much as the syncs before
+  std::uint64_t live_size =
+      sizeof(Header) + m_blocks.size() * sizeof(IndexEntry);
+  for (auto const &block : m_blocks) {
+    live_size += block.stored_size;
+  }
+  if (m_stored_size > 2 * live_size) {
+    return compact();
+  }
+  return {};
+}
+
+void CompressedStreambuf::append_index(std::span<Block const> blocks,
+                                       std::pmr::vector<std::byte> *out) const {
+  auto index = std::pmr::vector<IndexEntry>{m_resource};
+  index.reserve(blocks.size());
+  for (auto const &block : blocks) {
+    index.push_back({block.offset, block.stored_size, block.raw ? 1u : 0u});
+  }
+  auto const index_bytes = std::as_bytes(std::span{index});
+  out->insert(out->end(), index_bytes.begin(), index_bytes.end());
+}
+
+std::error_code CompressedStreambuf::write_header(
+    int fd, std::size_t num_blocks, std::uint64_t index_offset) const {
+  auto header = Header{};
+  std::memcpy(header.magic, kHeaderMagic, sizeof(kHeaderMagic));
+  header.size = m_size;
+  header.num_blocks = num_blocks;
+  header.index_offset = index_offset;
+  header.block_size = static_cast<std::uint32_t>(m_block_size);
+  header.codec_id = m_codec->id();
+  return WriteAll(fd, &header, sizeof(header), 0);
+}
+
+std::error_code CompressedStreambuf::compact() {
+  auto const compact_path = m_path.native() + kCompactSuffix;
+  int fd = ::open(compact_path.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return LastError();
+  }
+  auto fail = common::MakeScopeGuard([fd, &compact_path] {
+    ::close(fd);
+    ::unlink(compact_path.c_str());
+  });
+
+  // the blocks back to back, a block at a time
+  auto blocks = m_blocks;
+  std::uint64_t offset = sizeof(Header);
+  for (auto &block : blocks) {
+    m_scratch.resize(block.stored_size);
+    if (auto ec = ReadAll(m_fd, m_scratch.data(), m_scratch.size(),
+                          static_cast<off_t>(block.offset))) {
+      return ec;
+    }
+    if (auto ec = WriteAll(fd, m_scratch.data(), m_scratch.size(),
+                           static_cast<off_t>(offset))) {
+      return ec;
+    }
+    block.offset = offset;
+    offset += block.stored_size;
+  }
+  auto index = std::pmr::vector<std::byte>{m_resource};
+  append_index(blocks, &index);
+  if (auto ec = WriteAll(fd, index.data(), index.size(),
+                         static_cast<off_t>(offset))) {
+    return ec;
+  }
+  if (auto ec = write_header(fd, blocks.size(), offset)) {
+    return ec;
+  }
+  // the old file stays until the new one is complete
+  if (fdatasync(fd) != 0 || ::rename(compact_path.c_str(), m_path.c_str())) {
+    return LastError();
+  }
+  fail.release();
+  ::close(m_fd);
+  m_fd = fd;
+  m_blocks = std::move(blocks);
+  m_stored_size = offset + index.size();
+  return {};
+}
+
+std::pair<std::uintmax_t, std::error_code>
+CompressedSize(std::filesystem::path const &file_path, Codec const &codec) {
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::make_pair(std::uintmax_t{0}, LastError());
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    return std::make_pair(std::uintmax_t{0}, LastError());
+  }
+  if (st.st_size == 0) {
+    return std::make_pair(std::uintmax_t{0}, std::error_code{});
+  }
+  auto [header, ec] =
+      ReadHeader(fd, static_cast<std::uintmax_t>(st.st_size), codec);
+  return std::make_pair(std::uintmax_t{ec ? 0 : header.size}, ec);
+}
+
+} // namespace objectstore
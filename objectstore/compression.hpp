@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <span>
+#include <streambuf>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace objectstore {
+
+/**
+ * @brief Compresses and decompresses independent blocks of data.
+ */
+class Codec {
+public:
+  virtual ~Codec() = default;
+
+  /**
+   * @return a number identifying the format, which is stored with the data so
+   * that it is never decompressed by another codec
+   */
+  virtual std::uint32_t id() const = 0;
+
+  /**
+   * @return the size of the compressed data, or zero if it does not fit into
+   * out, in which case in is better stored as it is
+   */
+  virtual std::size_t compress(std::span<const std::byte> in,
+                               std::span<std::byte> out) const = 0;
+
+  /**
+   * @return false unless in decompresses to exactly out.size() bytes
+   */
+  virtual bool decompress(std::span<const std::byte> in,
+                          std::span<std::byte> out) const = 0;
+};
+
+/**
+ * @brief A byte-oriented LZ77 codec in the style of LZ4: literal runs and
+ * back references of at least four bytes within the last 64 KB, found with a
+ * single-entry hash table. It favours speed over ratio.
+ */
+class LzCodec final : public Codec {
+public:
+  std::uint32_t id() const override;
+  std::size_t compress(std::span<const std::byte> in,
+                       std::span<std::byte> out) const override;
+  bool decompress(std::span<const std::byte> in,
+                  std::span<std::byte> out) const override;
+};
+
+/**
+ * @return the codec used when none is given
+ */
+Codec const &DefaultCodec();
+
+struct CompressionOptions {
+  /// Objects are stored uncompressed without a codec. The codec must outlive
+  /// every object using it.
+  Codec const *codec = nullptr;
+  /// Size of the blocks that are compressed independently. Reading any byte
+  /// of an object decompresses the whole block it is in.
+  std::size_t block_size = 64 << 10;
+};
+
+/**
+ * @brief A stream buffer over a file that stores its content as compressed
+ * blocks.
+ *
+ * The file starts with a header pointing to an index of the blocks, each
+ * either compressed or raw if the codec could not make it smaller. Only the
+ * block at the current position is kept decompressed. Modified blocks are
+ * compressed when the position leaves them, and on sync() appended to the
+ * file together with a new index, before the header is updated to point to
+ * it. A sync() therefore writes only what changed, and a write that fails
+ * leaves the previous content readable. It does not sync the file to disk,
+ * which is left to the durability of the folder, so a crash may still tear
+ * it. Once the blocks and indexes that are no longer referenced outweigh the
+ * rest, the file is rewritten into a new one that replaces it.
+ *
+ * Like a file buffer, there is a single position for reading and writing.
+ * Seeking past the end is not supported.
+ */
+class CompressedStreambuf : public std::streambuf {
+public:
+  CompressedStreambuf(std::pmr::memory_resource *resource,
+                      std::filesystem::path const &file_path,
+                      CompressionOptions const &options);
+
+  CompressedStreambuf(const CompressedStreambuf &) = delete;
+  CompressedStreambuf &operator=(const CompressedStreambuf &) = delete;
+
+  ~CompressedStreambuf() override;
+
+  /**
+   * @return an error if the file could not be opened or is not a compressed
+   * object of this codec
+   */
+  std::error_code error() const { return m_error; }
+
+  /**
+   * @return the size of the uncompressed content
+   */
+  std::uintmax_t size() const;
+
+  /**
+   * @return the size of the file
+   */
+  std::uintmax_t stored_size() const { return m_stored_size; }
+
+protected:
+  int_type underflow() override;
+  int_type overflow(int_type ch) override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+  int sync() override;
+
+private:
+  struct Block {
+    std::uint64_t offset;
+    std::uint32_t stored_size;
+    bool raw;
+  };
+  struct PendingBlock {
+    std::pmr::vector<std::byte> data;
+    bool raw;
+  };
+
+  std::error_code read_index();
+  std::error_code write_blocks();
+  void append_index(std::span<Block const> blocks,
+                    std::pmr::vector<std::byte> *out) const;
+  std::error_code write_header(int fd, std::size_t num_blocks,
+                               std::uint64_t index_offset) const;
+  /**
+   * @brief Replaces the file by one holding only the current blocks.
+   */
+  std::error_code compact();
+  void store_block();
+  std::error_code load_block(std::size_t index);
+  void leave_put_mode();
+  void set_position(std::size_t offset);
+  std::size_t position_in_block() const;
+
+  std::pmr::memory_resource *m_resource;
+  Codec const *m_codec;
+  std::size_t m_block_size;
+  std::filesystem::path m_path;
+  int m_fd = -1;
+  std::error_code m_error;
+  /// The blocks in the file, as of the last sync().
+  std::pmr::vector<Block> m_blocks;
+  /// Blocks compressed since the last sync(), by index.
+  std::pmr::map<std::size_t, PendingBlock> m_pending;
+  /// The current block, decompressed.
+  std::pmr::vector<char> m_block;
+  std::pmr::vector<std::byte> m_scratch;
+  std::size_t m_block_index = 0;
+  std::size_t m_block_length = 0;
+  bool m_block_dirty = false;
+  std::uintmax_t m_size = 0;
+  std::uintmax_t m_stored_size = 0;
+};
+
+/**
+ * @brief std::iostream over a CompressedStreambuf. It is bad from the start
+ * if the file cannot be used.
+ */
+class CompressedStream : public std::iostream {
+public:
+  CompressedStream(std::pmr::memory_resource *resource,
+                   std::filesystem::path const &file_path,
+                   CompressionOptions const &options)
+      : std::iostream{nullptr}, m_buffer{resource, file_path, options} {
+    rdbuf(&m_buffer);
+    if (m_buffer.error()) {
+      setstate(std::ios::badbit);
+    }
+  }
+
+  CompressedStreambuf &buffer() { return m_buffer; }
+  CompressedStreambuf const &buffer() const { return m_buffer; }
+
+private:
+  CompressedStreambuf m_buffer;
+};
+
+/**
+ * @return the uncompressed size of the object stored in the file, from its
+ * header
+ */
+std::pair<std::uintmax_t, std::error_code>
+CompressedSize(std::filesystem::path const &file_path, Codec const &codec);
+
+} // namespace objectstore
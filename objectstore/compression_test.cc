@@ -0,0 +1,269 @@
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <compression.hpp>
+#include <objectstore.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_compressed.dat";
+constexpr auto kTestFolder = "objectstore_test_compressed_folder";
+
+std::string JsonLike(std::size_t size) {
+  auto engine = std::mt19937_64{42};
+  auto text = std::string{};
+  for (std::size_t i = 0; text.size() < size; ++i) {
+    text += "{\"index\": " + std::to_string(i) + ", \"balance\": \"$" +
+            std::to_string(engine() % 100'000) +
+            "\", \"isActive\": " + (engine() % 2 ? "true" : "false") +
+            ", \"tags\": [\"lorem\", \"ipsum\", \"dolor\"]},\n";
+  }
+  text.resize(size);
+  return text;
+}
+
+std::string Random(std::size_t size) {
+  auto engine = std::mt19937_64{7};
+  auto text = std::string(size, '\0');
+  for (auto &c : text) {
+    c = static_cast<char>(engine());
+  }
+  return text;
+}
+
+std::string RoundTrip(objectstore::Codec const &codec,
+                      std::string const &input, std::size_t *compressed) {
+  auto in = std::as_bytes(std::span{input});
+  auto buffer = std::vector<std::byte>(input.size() + 64);
+  *compressed = codec.compress(in, buffer);
+  auto output = std::string(input.size(), '\0');
+  if (*compressed == 0 ||
+      !codec.decompress(std::span{buffer}.first(*compressed),
+                        std::as_writable_bytes(std::span{output}))) {
+    return {};
+  }
+  return output;
+}
+
+std::string ReadAll(std::iostream &stream) {
+  stream.clear();
+  stream.seekg(0);
+  return std::string{std::istreambuf_iterator<char>{stream}, {}};
+}
+
+} // namespace
+
+TEST(LzCodec, RoundTrip) {
+  auto const codec = objectstore::LzCodec{};
+  std::size_t compressed = 0;
+  for (auto const &input :
+       {std::string{}, std::string{"a"}, std::string{"abcdefgh"},
+        std::string(100'000, 'x'), JsonLike(200'000),
+        std::string{"abcabcabcabcabcabcabcabc, abcabc"}}) {
+    EXPECT_EQ(RoundTrip(codec, input, &compressed), input);
+  }
+
+  auto const json = JsonLike(64 << 10);
+  EXPECT_EQ(RoundTrip(codec, json, &compressed), json);
+  EXPECT_LT(compressed, json.size() / 2);
+
+  // incompressible data does not fit into a buffer of its own size
+  auto const random = Random(64 << 10);
+  auto out = std::vector<std::byte>(random.size());
+  EXPECT_EQ(codec.compress(std::as_bytes(std::span{random}), out), 0u);
+}
+
+TEST(LzCodec, RejectsCorruptInput) {
+  auto const codec = objectstore::LzCodec{};
+  auto const input = JsonLike(4096);
+  auto buffer = std::vector<std::byte>(input.size());
+  auto const size = codec.compress(std::as_bytes(std::span{input}), buffer);
+  ASSERT_GT(size, 0u);
+  buffer.resize(size);
+
+  auto output = std::string(input.size(), '\0');
+  auto out = std::as_writable_bytes(std::span{output});
+  EXPECT_FALSE(codec.decompress(std::span{buffer}.first(size / 2), out));
+  EXPECT_FALSE(codec.decompress(buffer, out.first(out.size() - 1)));
+  for (std::size_t i = 0; i < buffer.size(); i += 7) {
+    auto corrupt = buffer;
+    corrupt[i] ^= std::byte{0x5a};
+    // may or may not be detected, but must stay within the buffers
+    codec.decompress(corrupt, out);
+  }
+}
+
+TEST(CompressedStream, ReadWriteSeek) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::CompressionOptions{};
+  options.block_size = 1024;
+  std::filesystem::remove(kTestPath);
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+
+  auto const content = JsonLike(10'000);
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    ASSERT_TRUE(stream.good());
+    stream.write(content.data(), static_cast<std::streamsize>(1000));
+    stream.write(content.data() + 1000,
+                 static_cast<std::streamsize>(content.size() - 1000));
+    EXPECT_EQ(stream.buffer().size(), content.size());
+    EXPECT_EQ(ReadAll(stream), content);
+  }
+  EXPECT_LT(std::filesystem::file_size(kTestPath), content.size() / 2);
+  EXPECT_EQ(objectstore::CompressedSize(kTestPath, objectstore::LzCodec{}),
+            std::make_pair(std::uintmax_t{content.size()}, std::error_code{}));
+
+  auto expected = content;
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    EXPECT_EQ(stream.buffer().size(), content.size());
+    // reading in the middle only touches a single block
+    auto part = std::string(100, '\0');
+    stream.seekg(5000);
+    stream.read(part.data(), static_cast<std::streamsize>(part.size()));
+    EXPECT_EQ(part, content.substr(5000, 100));
+
+    // overwrite across a block boundary, and append
+    stream.seekp(2000);
+    stream << std::string(100, '#');
+    expected.replace(2000, 100, std::string(100, '#'));
+    EXPECT_EQ(stream.tellp(), 2100);
+    stream.seekp(0, std::ios::end);
+    stream << "appended";
+    expected += "appended";
+    EXPECT_EQ(ReadAll(stream), expected);
+
+    EXPECT_EQ(stream.seekg(expected.size() + 1).fail(), true);
+  }
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    EXPECT_EQ(ReadAll(stream), expected);
+  }
+
+  // the block size of an existing file wins over the options
+  options.block_size = 4096;
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    EXPECT_EQ(ReadAll(stream), expected);
+  }
+}
+
+TEST(CompressedStream, IncompressibleBlocksAreStoredRaw) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::CompressionOptions{};
+  options.block_size = 4096;
+  std::filesystem::remove(kTestPath);
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+
+  auto const content = Random(10'000);
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    stream << content;
+  }
+  // only the header and the index are added
+  EXPECT_LT(std::filesystem::file_size(kTestPath), content.size() + 128);
+  auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+  EXPECT_EQ(ReadAll(stream), content);
+}
+
+TEST(CompressedStream, SyncWritesOnlyWhatChanged) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::CompressionOptions{};
+  options.block_size = 1024;
+  std::filesystem::remove(kTestPath);
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+
+  auto expected = Random(100'000);
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    stream << expected;
+  }
+  auto const initial_size = std::filesystem::file_size(kTestPath);
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    stream << '#';
+    expected[0] = '#';
+  }
+  // the first block and a new index, instead of everything behind it
+  auto const num_blocks = (expected.size() + 1023) / 1024;
+  EXPECT_LE(std::filesystem::file_size(kTestPath),
+            initial_size + 1024 + num_blocks * 16);
+
+  // an append interrupted before the header was updated is ignored
+  {
+    auto file = std::ofstream{kTestPath, std::ios::binary | std::ios::app};
+    file << Random(3000);
+  }
+  {
+    auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+    EXPECT_EQ(ReadAll(stream), expected);
+    for (std::size_t i = 0; i < 200; ++i) {
+      auto const offset = i * 997 % expected.size();
+      stream.seekp(static_cast<std::streamoff>(offset));
+      stream << '*';
+      expected[offset] = '*';
+      stream.flush();
+    }
+    EXPECT_EQ(ReadAll(stream), expected);
+  }
+  // what earlier syncs left behind is dropped now and then
+  EXPECT_LT(std::filesystem::file_size(kTestPath), 3 * initial_size);
+  EXPECT_FALSE(std::filesystem::exists(std::string{kTestPath} + ".compact"));
+  auto stream = objectstore::CompressedStream{resource, kTestPath, options};
+  EXPECT_EQ(ReadAll(stream), expected);
+}
+
+TEST(CompressedStream, RejectsOtherFiles) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove(kTestPath);
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+  {
+    auto file = objectstore::StoredFile{resource, kTestPath};
+    *file.stream() << "not compressed at all, just a plain old file";
+  }
+  auto stream = objectstore::CompressedStream{resource, kTestPath, {}};
+  EXPECT_TRUE(stream.bad());
+  EXPECT_TRUE(stream.buffer().error());
+}
+
+TEST(StoredFolder, Compression) {
+  auto resource = std::pmr::get_default_resource();
+  auto const codec = objectstore::LzCodec{};
+  auto options = objectstore::StoredFolderOptions{};
+  options.compression.codec = &codec;
+  options.compression.block_size = 4096;
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestFolder); });
+
+  auto const content = JsonLike(100'000);
+  auto id = objectstore::StoredFolder::object_id_t{};
+  {
+    auto folder = objectstore::StoredFolder{resource, kTestFolder, options};
+    id = folder.add();
+    *folder.get(id) << content;
+    folder.close(id);
+    EXPECT_EQ(folder.size(id).first, content.size());
+    EXPECT_LT(std::filesystem::file_size(folder.path(id)), content.size() / 2);
+    EXPECT_EQ(folder.map(id).second, std::errc::operation_not_supported);
+    auto [scanner, ec] = folder.scan();
+    EXPECT_EQ(ec, std::errc::operation_not_supported);
+    EXPECT_FALSE(scanner.next());
+  }
+
+  auto folder = objectstore::StoredFolder{resource, kTestFolder, options};
+  ASSERT_TRUE(folder.has(id));
+  EXPECT_EQ(folder.size(id).first, content.size());
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>{*folder.get(id)}, {}),
+            content);
+  folder.close(id);
+}
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+
+#include "concurrent_folder.hpp"
+#include "folder_manifest.hpp"
+
+namespace objectstore {
+
+namespace {
+/// The objects are files in the root, laid out like in a StoredFolder
+/// without fan-out.
+constexpr unsigned kFanoutLevels = 0;
+
+std::error_code NotFound() {
+  return std::make_error_code(std::errc::no_such_file_or_directory);
+}
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+} // namespace
+
+ConcurrentStoredFolder::WriteAccess &
+ConcurrentStoredFolder::WriteAccess::operator=(WriteAccess &&other) noexcept {
+  if (this != &other) {
+    release();
+    m_entry = std::move(other.m_entry);
+    m_lock = std::move(other.m_lock);
+    m_stream = std::exchange(other.m_stream, nullptr);
+  }
+  return *this;
+}
+
+ConcurrentStoredFolder::WriteAccess::~WriteAccess() { release(); }
+
+void ConcurrentStoredFolder::WriteAccess::release() {
+  if (m_lock.owns_lock()) {
+    m_stream->flush();
+    m_lock.unlock();
+  }
+  m_stream = nullptr;
+  m_entry.reset();
+}
+
+ConcurrentStoredFolder::ConcurrentStoredFolder(
+    std::pmr::memory_resource *resource, std::filesystem::path root_path,
+    bool add_all_existing_files, std::size_t num_shards)
+    : m_resource{resource}, m_root_path{std::move(root_path)},
+      m_shards{resource},
+      m_shard_mask{std::bit_ceil(std::max<std::size_t>(num_shards, 1)) - 1} {
+  m_shards.reserve(m_shard_mask + 1);
+  for (std::size_t i = 0; i <= m_shard_mask; ++i) {
+    m_shards.push_back(common::MakeUnique<Shard>(m_resource, m_resource));
+  }
+
+  if (!std::filesystem::exists(m_root_path)) {
+    std::filesystem::create_directories(m_root_path);
+  } else if (add_all_existing_files) {
+    auto [listing, ec] =
+        ScanFolder(m_resource, m_root_path,
+                   std::thread::hardware_concurrency(), kFanoutLevels);
+    if (ec) {
+      throw std::filesystem::filesystem_error{
+          "Cannot scan ConcurrentStoredFolder", m_root_path, ec};
+    }
+    for (auto object_id : listing.ids) {
+      shard(object_id).entries.try_emplace(
+          object_id, std::allocate_shared<Entry>(
+                         std::pmr::polymorphic_allocator<Entry>{m_resource},
+                         m_resource,
+                         ObjectPath(m_root_path, object_id, kFanoutLevels)));
+    }
+    m_next_object_id = listing.next_object_id;
+  }
+}
+
+ConcurrentStoredFolder::EntryPtr
+ConcurrentStoredFolder::find(object_id_t id) const {
+  auto &shard = this->shard(id);
+  auto lock = std::shared_lock{shard.mutex};
+  auto it = shard.entries.find(id);
+  return it == shard.entries.end() ? nullptr : it->second;
+}
+
+bool ConcurrentStoredFolder::has(object_id_t id) const {
+  auto &shard = this->shard(id);
+  auto lock = std::shared_lock{shard.mutex};
+  return shard.entries.contains(id);
+}
+
+ConcurrentStoredFolder::object_id_t ConcurrentStoredFolder::add() {
+  auto id = m_next_object_id++;
+  // build the entry before taking the lock, the shard is only held to insert
+  auto entry = std::allocate_shared<Entry>(
+      std::pmr::polymorphic_allocator<Entry>{m_resource}, m_resource,
+      ObjectPath(m_root_path, id, kFanoutLevels));
+  auto &shard = this->shard(id);
+  auto lock = std::unique_lock{shard.mutex};
+  shard.entries.try_emplace(id, std::move(entry));
+  return id;
+}
+
+std::iostream *ConcurrentStoredFolder::get(object_id_t id) {
+  auto entry = find(id);
+  if (!entry) {
+    return nullptr;
+  }
+  auto lock = std::unique_lock{entry->mutex};
+  if (entry->destroyed) {
+    return nullptr;
+  }
+  return entry->file.stream();
+}
+
+std::iostream const &ConcurrentStoredFolder::get(object_id_t id) const {
+  auto entry = find(id);
+  if (!entry) {
+    throw std::out_of_range{"Object ID not found in ConcurrentStoredFolder"};
+  }
+  auto lock = std::unique_lock{entry->mutex};
+  if (entry->destroyed) {
+    throw std::out_of_range{"Object ID not found in ConcurrentStoredFolder"};
+  }
+  // the entry outlives this call as long as the object is not destroyed,
+  // which the caller must not do while using the stream
+  return *entry->file.stream();
+}
+
+std::pair<std::uintmax_t, std::error_code>
+ConcurrentStoredFolder::size(object_id_t id) const {
+  auto entry = find(id);
+  if (!entry) {
+    return std::make_pair(0, NotFound());
+  }
+  auto lock = std::shared_lock{entry->mutex};
+  if (entry->destroyed) {
+    return std::make_pair(0, NotFound());
+  }
+  return entry->file.size();
+}
+
+void ConcurrentStoredFolder::close(object_id_t id) {
+  if (auto entry = find(id)) {
+    auto lock = std::unique_lock{entry->mutex};
+    entry->file.close();
+  }
+}
+
+void ConcurrentStoredFolder::destroy(object_id_t id) {
+  auto entry = EntryPtr{};
+  {
+    auto &shard = this->shard(id);
+    auto lock = std::unique_lock{shard.mutex};
+    auto it = shard.entries.find(id);
+    if (it == shard.entries.end()) {
+      return;
+    }
+    entry = std::move(it->second);
+    shard.entries.erase(it);
+  }
+  // waits for everyone who found the entry before it was erased
+  auto lock = std::unique_lock{entry->mutex};
+  entry->destroyed = true;
+  entry->file.destroy();
+}
+
+void ConcurrentStoredFolder::clear() {
+  for (auto &shard : m_shards) {
+    auto entries = std::pmr::unordered_map<object_id_t, EntryPtr>{m_resource};
+    {
+      auto lock = std::unique_lock{shard->mutex};
+      entries.swap(shard->entries);
+    }
+    for (auto &[id, entry] : entries) {
+      auto lock = std::unique_lock{entry->mutex};
+      entry->destroyed = true;
+      entry->file.destroy();
+    }
+  }
+}
+
+std::pair<ConcurrentStoredFolder::ReadAccess, std::error_code>
+ConcurrentStoredFolder::read(object_id_t id) const {
+  auto entry = find(id);
+  if (!entry) {
+    return std::make_pair(ReadAccess{}, NotFound());
+  }
+  auto lock = std::shared_lock{entry->mutex};
+  if (entry->destroyed) {
+    return std::make_pair(ReadAccess{}, NotFound());
+  }
+  auto const &path = entry->file.path();
+  auto access = ReadAccess{std::move(entry), std::move(lock)};
+  access.m_stream.open(path, std::ios::in | std::ios::binary);
+  if (!access.m_stream.is_open() && errno != ENOENT) {
+    return std::make_pair(ReadAccess{}, LastError());
+  }
+  // otherwise nothing was written yet, and the stream reads as empty
+  access.m_stream.clear();
+  return std::make_pair(std::move(access), std::error_code{});
+}
+
+std::pair<ConcurrentStoredFolder::WriteAccess, std::error_code>
+ConcurrentStoredFolder::write(object_id_t id) {
+  auto entry = find(id);
+  if (!entry) {
+    return std::make_pair(WriteAccess{}, NotFound());
+  }
+  auto lock = std::unique_lock{entry->mutex};
+  if (entry->destroyed) {
+    return std::make_pair(WriteAccess{}, NotFound());
+  }
+  return std::make_pair(WriteAccess{std::move(entry), std::move(lock)},
+                        std::error_code{});
+}
+
+} // namespace objectstore
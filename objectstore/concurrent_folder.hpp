@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <memory.hpp>
+
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+/**
+ * @brief A StoredFolder that can be used from many threads at once.
+ *
+ * The object ids are spread over shards, each with its own map and lock, so
+ * that operations on different objects never wait for each other, apart from
+ * the short moment it takes to look up or insert an id in the same shard.
+ * Every object has a reader/writer lock of its own: read() hands out shared
+ * access with a private stream, write() exclusive access to the object's
+ * stream, and destroy() waits until neither is held anymore.
+ *
+ * The streams returned by get() follow the contract of StoredObjectCollection,
+ * i.e. the caller must make sure nobody else uses the object until close().
+ */
+class ConcurrentStoredFolder : public StoredObjectCollection {
+  struct Entry {
+    Entry(std::pmr::memory_resource *resource, std::filesystem::path path)
+        : file{resource, std::move(path)} {}
+
+    mutable std::shared_mutex mutex;
+    StoredFile file;
+    bool destroyed = false;
+  };
+
+  using EntryPtr = std::shared_ptr<Entry>;
+
+  struct alignas(64) Shard {
+    explicit Shard(std::pmr::memory_resource *resource) : entries{resource} {}
+
+    mutable std::shared_mutex mutex;
+    std::pmr::unordered_map<object_id_t, EntryPtr> entries;
+  };
+
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  /**
+   * @brief Shared access to an object, several readers may hold it at once.
+   */
+  class ReadAccess {
+  public:
+    ReadAccess() = default;
+
+    std::istream &stream() { return m_stream; }
+
+  private:
+    friend class ConcurrentStoredFolder;
+
+    ReadAccess(EntryPtr entry, std::shared_lock<std::shared_mutex> lock)
+        : m_entry{std::move(entry)}, m_lock{std::move(lock)} {}
+
+    EntryPtr m_entry;
+    std::shared_lock<std::shared_mutex> m_lock;
+    std::ifstream m_stream;
+  };
+
+  /**
+   * @brief Exclusive access to an object. Pending writes are flushed when the
+   * access is released.
+   */
+  class WriteAccess {
+  public:
+    WriteAccess() = default;
+    WriteAccess(WriteAccess &&) = default;
+    WriteAccess &operator=(WriteAccess &&other) noexcept;
+    ~WriteAccess();
+
+    std::iostream &stream() { return *m_stream; }
+
+  private:
+    friend class ConcurrentStoredFolder;
+
+    WriteAccess(EntryPtr entry, std::unique_lock<std::shared_mutex> lock)
+        : m_entry{std::move(entry)}, m_lock{std::move(lock)},
+          m_stream{m_entry->file.stream()} {}
+
+    void release();
+
+    EntryPtr m_entry;
+    std::unique_lock<std::shared_mutex> m_lock;
+    std::iostream *m_stream = nullptr;
+  };
+
+  static constexpr std::size_t kDefaultNumShards = 64;
+
+  ConcurrentStoredFolder(std::pmr::memory_resource *resource,
+                         std::filesystem::path root_path,
+                         bool add_all_existing_files = true,
+                         std::size_t num_shards = kDefaultNumShards);
+
+  ConcurrentStoredFolder(const ConcurrentStoredFolder &) = delete;
+  ConcurrentStoredFolder(ConcurrentStoredFolder &&) = delete;
+  ConcurrentStoredFolder &operator=(const ConcurrentStoredFolder &) = delete;
+  ConcurrentStoredFolder &operator=(ConcurrentStoredFolder &&) = delete;
+
+  ~ConcurrentStoredFolder() override = default;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @brief An object that was added but never written reads as empty.
+   */
+  std::pair<ReadAccess, std::error_code> read(object_id_t id) const;
+  std::pair<WriteAccess, std::error_code> write(object_id_t id);
+
+  std::filesystem::path const &path() const { return m_root_path; }
+
+private:
+  Shard &shard(object_id_t id) const {
+    // ids are handed out sequentially, so the low bits spread them evenly
+    return *m_shards[id & m_shard_mask];
+  }
+
+  EntryPtr find(object_id_t id) const;
+
+  std::pmr::memory_resource *m_resource;
+  std::filesystem::path m_root_path;
+  std::pmr::vector<common::UniquePtr<Shard>> m_shards;
+  std::size_t m_shard_mask;
+  std::atomic<object_id_t> m_next_object_id{};
+};
+
+} // namespace objectstore
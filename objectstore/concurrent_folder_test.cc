@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <concurrent_folder.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_concurrent_folder";
+constexpr size_t kNumThreads = 8;
+constexpr size_t kObjectsPerThread = 200;
+constexpr size_t kSharedObjectSize = 4096;
+
+std::string ReadAll(objectstore::ConcurrentStoredFolder const &folder,
+                    objectstore::ConcurrentStoredFolder::object_id_t id) {
+  auto [access, ec] = folder.read(id);
+  if (ec) {
+    return {};
+  }
+  return std::string{std::istreambuf_iterator<char>{access.stream()}, {}};
+}
+
+} // namespace
+
+TEST(ConcurrentStoredFolder, Basics) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder = objectstore::ConcurrentStoredFolder{resource, kTestPath};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    EXPECT_TRUE(std::filesystem::is_empty(kTestPath));
+    std::filesystem::remove_all(kTestPath);
+  });
+
+  auto id1 = folder.add();
+  auto id2 = folder.add();
+  EXPECT_NE(id1, id2);
+  EXPECT_TRUE(folder.has(id1));
+  // added, but not written yet
+  EXPECT_FALSE(folder.read(id1).second);
+  EXPECT_EQ(ReadAll(folder, id1), "");
+
+  std::string const data = "Data written with exclusive access";
+  {
+    auto [access, ec] = folder.write(id1);
+    ASSERT_FALSE(ec);
+    access.stream().write(data.data(), data.size());
+  }
+  EXPECT_EQ(folder.size(id1).first, data.size());
+  EXPECT_EQ(ReadAll(folder, id1), data);
+  {
+    // readers share the object
+    auto [first, ec1] = folder.read(id1);
+    auto [second, ec2] = folder.read(id1);
+    ASSERT_FALSE(ec1);
+    ASSERT_FALSE(ec2);
+  }
+
+  auto *stream = folder.get(id2);
+  ASSERT_NE(stream, nullptr);
+  stream->write(data.data(), data.size());
+  folder.close(id2);
+  EXPECT_EQ(ReadAll(folder, id2), data);
+
+  folder.destroy(id1);
+  EXPECT_FALSE(folder.has(id1));
+  EXPECT_EQ(folder.get(id1), nullptr);
+  EXPECT_EQ(folder.size(id1).second, std::errc::no_such_file_or_directory);
+  EXPECT_EQ(folder.write(id1).second, std::errc::no_such_file_or_directory);
+}
+
+TEST(ConcurrentStoredFolder, AddExistingFiles) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::create_directories(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  std::ofstream{std::filesystem::path{kTestPath} / "7"} << "seven";
+
+  auto folder = objectstore::ConcurrentStoredFolder{resource, kTestPath};
+  EXPECT_TRUE(folder.has(7));
+  EXPECT_EQ(ReadAll(folder, 7), "seven");
+  EXPECT_EQ(folder.add(), 8u);
+}
+
+TEST(ConcurrentStoredFolder, Stress) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder = objectstore::ConcurrentStoredFolder{resource, kTestPath};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all(kTestPath);
+  });
+
+  // writers fill the shared object with a single character, so a reader sees
+  // a torn write as soon as two characters differ
+  auto const shared_id = folder.add();
+  {
+    auto [access, ec] = folder.write(shared_id);
+    access.stream() << std::string(kSharedObjectSize, 'a');
+  }
+
+  auto num_torn_reads = std::atomic<size_t>{0};
+  auto num_errors = std::atomic<size_t>{0};
+  auto threads = std::vector<std::jthread>{};
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t] {
+      auto const own_data = "object of thread " + std::to_string(t);
+      auto kept =
+          std::vector<objectstore::ConcurrentStoredFolder::object_id_t>{};
+      for (size_t i = 0; i < kObjectsPerThread; ++i) {
+        auto id = folder.add();
+        {
+          auto [access, ec] = folder.write(id);
+          access.stream().write(own_data.data(), own_data.size());
+        }
+        if (folder.size(id).first != own_data.size() ||
+            ReadAll(folder, id) != own_data) {
+          ++num_errors;
+        }
+        if (i % 2 == 0) {
+          folder.destroy(id);
+        } else {
+          kept.push_back(id);
+        }
+
+        if (i % 10 == t % 10) {
+          auto [access, ec] = folder.write(shared_id);
+          access.stream() << std::string(kSharedObjectSize,
+                                         static_cast<char>('a' + t));
+        } else {
+          auto const content = ReadAll(folder, shared_id);
+          if (content.size() != kSharedObjectSize ||
+              std::count(content.begin(), content.end(), content.front()) !=
+                  static_cast<std::ptrdiff_t>(content.size())) {
+            ++num_torn_reads;
+          }
+        }
+      }
+      for (auto id : kept) {
+        if (!folder.has(id)) {
+          ++num_errors;
+        }
+      }
+    });
+  }
+  threads.clear();
+
+  EXPECT_EQ(num_errors, 0u);
+  EXPECT_EQ(num_torn_reads, 0u);
+  size_t num_objects = 0;
+  for (auto const &entry : std::filesystem::directory_iterator(kTestPath)) {
+    num_objects += entry.is_regular_file();
+  }
+  EXPECT_EQ(num_objects, 1 + kNumThreads * kObjectsPerThread / 2);
+}
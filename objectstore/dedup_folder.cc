@@ -0,0 +1,721 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "dedup_folder.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr std::string_view kBlobDirectory = "blobs";
+constexpr std::string_view kPendingDirectory = "pending";
+constexpr std::string_view kIndexFileName = "index";
+constexpr std::string_view kIndexCheckpointFileName = "index.tmp";
+constexpr std::size_t kBufferSize = 64 << 10;
+/// The index log is rewritten once it holds this many records more than
+/// twice the number of objects.
+constexpr std::size_t kMinCheckpointRecords = 1024;
+
+constexpr std::uint64_t kC1 = 0x87c37b91114253d5ull;
+constexpr std::uint64_t kC2 = 0x4cf5ad432745937full;
+
+/**
+ * Add records an object without content, Put the blob of an object,
+ * Tombstone its destruction and NextId the id counter, so that ids are never
+ * handed out twice.
+ */
+enum class RecordKind : std::uint32_t {
+  Add = 1,
+  Put = 2,
+  Tombstone = 3,
+  NextId = 4
+};
+
+/**
+ * @brief Fixed-size record of the persisted index log.
+ */
+struct IndexRecord {
+  std::uint64_t id;
+  RecordKind kind;
+  std::uint32_t reserved;
+  std::uint64_t hash_low;
+  std::uint64_t hash_high;
+};
+static_assert(sizeof(IndexRecord) == 32);
+
+std::system_error SystemError(char const *what) {
+  return std::system_error{errno, std::system_category(), what};
+}
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::error_code WriteAll(int fd, void const *data, std::size_t size,
+                         off_t offset) {
+  auto const *bytes = static_cast<std::byte const *>(data);
+  while (size > 0) {
+    auto res = pwrite(fd, bytes, size, offset);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    bytes += res;
+    size -= static_cast<std::size_t>(res);
+    offset += res;
+  }
+  return {};
+}
+
+void AppendAll(int fd, void const *data, std::size_t size) {
+  auto const *bytes = static_cast<std::byte const *>(data);
+  while (size > 0) {
+    auto res = write(fd, bytes, size);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw SystemError("write");
+    }
+    bytes += res;
+    size -= static_cast<std::size_t>(res);
+  }
+}
+
+std::uint64_t Load64(std::byte const *p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+std::uint64_t FinalMix(std::uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+std::string ToHex(ContentHash const &hash) {
+  constexpr char kDigits[] = "0123456789abcdef";
+  auto text = std::string(32, '0');
+  for (int i = 0; i < 16; ++i) {
+    text[15 - i] = kDigits[(hash.high >> (4 * i)) & 0xf];
+    text[31 - i] = kDigits[(hash.low >> (4 * i)) & 0xf];
+  }
+  return text;
+}
+
+bool ParseHex(std::string_view name, ContentHash *hash) {
+  if (name.size() != 32) {
+    return false;
+  }
+  auto parse = [](std::string_view digits, std::uint64_t *value) {
+    auto const *end = digits.data() + digits.size();
+    auto [ptr, ec] = std::from_chars(digits.data(), end, *value, 16);
+    return ec == std::errc{} && ptr == end;
+  };
+  return parse(name.substr(0, 16), &hash->high) &&
+         parse(name.substr(16), &hash->low);
+}
+
+} // namespace
+
+void ContentHasher::mix(std::uint64_t k1, std::uint64_t k2) {
+  k1 *= kC1;
+  k1 = std::rotl(k1, 31);
+  k1 *= kC2;
+  m_h1 ^= k1;
+  m_h1 = std::rotl(m_h1, 27);
+  m_h1 += m_h2;
+  m_h1 = m_h1 * 5 + 0x52dce729;
+
+  k2 *= kC2;
+  k2 = std::rotl(k2, 33);
+  k2 *= kC1;
+  m_h2 ^= k2;
+  m_h2 = std::rotl(m_h2, 31);
+  m_h2 += m_h1;
+  m_h2 = m_h2 * 5 + 0x38495ab5;
+}
+
+void ContentHasher::update(std::span<const std::byte> data) {
+  m_length += data.size();
+  if (m_tail_size > 0) {
+    auto const n = std::min(data.size(), m_tail.size() - m_tail_size);
+    std::memcpy(m_tail.data() + m_tail_size, data.data(), n);
+    m_tail_size += n;
+    data = data.subspan(n);
+    if (m_tail_size < m_tail.size()) {
+      return;
+    }
+    mix(Load64(m_tail.data()), Load64(m_tail.data() + 8));
+    m_tail_size = 0;
+  }
+  while (data.size() >= 16) {
+    mix(Load64(data.data()), Load64(data.data() + 8));
+    data = data.subspan(16);
+  }
+  std::memcpy(m_tail.data(), data.data(), data.size());
+  m_tail_size = data.size();
+}
+
+ContentHash ContentHasher::digest() const {
+  auto h1 = m_h1;
+  auto h2 = m_h2;
+  std::uint64_t k1 = 0;
+  std::uint64_t k2 = 0;
+  for (auto i = m_tail_size; i > 8; --i) {
+    k2 ^= static_cast<std::uint64_t>(m_tail[i - 1]) << (8 * (i - 9));
+  }
+  for (auto i = std::min<std::size_t>(m_tail_size, 8); i > 0; --i) {
+    k1 ^= static_cast<std::uint64_t>(m_tail[i - 1]) << (8 * (i - 1));
+  }
+  if (m_tail_size > 8) {
+    k2 *= kC2;
+    k2 = std::rotl(k2, 33);
+    k2 *= kC1;
+    h2 ^= k2;
+  }
+  if (m_tail_size > 0) {
+    k1 *= kC1;
+    k1 = std::rotl(k1, 31);
+    k1 *= kC2;
+    h1 ^= k1;
+  }
+
+  h1 ^= m_length;
+  h2 ^= m_length;
+  h1 += h2;
+  h2 += h1;
+  h1 = FinalMix(h1);
+  h2 = FinalMix(h2);
+  h1 += h2;
+  h2 += h1;
+  return {h1, h2};
+}
+
+DedupStreambuf::DedupStreambuf(std::pmr::memory_resource *resource,
+                               std::filesystem::path content_path,
+                               std::uintmax_t content_size,
+                               std::filesystem::path pending_path)
+    : m_content_path{std::move(content_path)},
+      m_pending_path{std::move(pending_path)},
+      m_get_buffer(kBufferSize, resource), m_put_buffer(kBufferSize, resource),
+      m_size{content_size} {
+  if (!m_content_path.empty() && m_size > 0) {
+    m_read_fd = ::open(m_content_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_read_fd < 0) {
+      m_error = LastError();
+    }
+  }
+}
+
+DedupStreambuf::~DedupStreambuf() {
+  if (m_read_fd >= 0 && m_read_fd != m_write_fd) {
+    ::close(m_read_fd);
+  }
+  if (m_write_fd >= 0) {
+    // the pending file is gone already if the folder kept the content
+    ::close(m_write_fd);
+    unlink(m_pending_path.c_str());
+  }
+}
+
+std::uintmax_t DedupStreambuf::size() const {
+  return m_size + static_cast<std::uintmax_t>(pptr() - pbase());
+}
+
+std::uintmax_t DedupStreambuf::get_position() const {
+  return m_get_offset + static_cast<std::uintmax_t>(gptr() - eback());
+}
+
+std::error_code DedupStreambuf::start_writing() {
+  m_write_fd = ::open(m_pending_path.c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (m_write_fd < 0) {
+    return LastError();
+  }
+  // the new content starts with the old one
+  for (std::uintmax_t offset = 0; offset < m_size;) {
+    auto const res = pread(m_read_fd, m_put_buffer.data(),
+                           std::min<std::uintmax_t>(kBufferSize,
+                                                    m_size - offset),
+                           static_cast<off_t>(offset));
+    if (res <= 0) {
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      return res < 0 ? LastError()
+                     : std::make_error_code(std::errc::io_error);
+    }
+    auto const chunk = std::as_bytes(
+        std::span{m_put_buffer}.first(static_cast<std::size_t>(res)));
+    m_hasher.update(chunk);
+    if (auto ec = WriteAll(m_write_fd, chunk.data(), chunk.size(),
+                           static_cast<off_t>(offset))) {
+      return ec;
+    }
+    offset += static_cast<std::uintmax_t>(res);
+  }
+  if (m_read_fd >= 0) {
+    ::close(m_read_fd);
+  }
+  m_read_fd = m_write_fd;
+  setp(m_put_buffer.data(), m_put_buffer.data() + m_put_buffer.size());
+  return {};
+}
+
+std::error_code DedupStreambuf::write_pending() {
+  auto const chunk = std::as_bytes(
+      std::span{pbase(), static_cast<std::size_t>(pptr() - pbase())});
+  if (chunk.empty()) {
+    return {};
+  }
+  m_hasher.update(chunk);
+  if (auto ec = WriteAll(m_write_fd, chunk.data(), chunk.size(),
+                         static_cast<off_t>(m_size))) {
+    return ec;
+  }
+  m_size += chunk.size();
+  setp(m_put_buffer.data(), m_put_buffer.data() + m_put_buffer.size());
+  return {};
+}
+
+DedupStreambuf::int_type DedupStreambuf::underflow() {
+  if (m_error) {
+    return traits_type::eof();
+  }
+  if (modified()) {
+    // reads see everything written so far
+    if (auto ec = write_pending()) {
+      m_error = ec;
+      return traits_type::eof();
+    }
+  }
+  auto const position = get_position();
+  if (position >= m_size || m_read_fd < 0) {
+    return traits_type::eof();
+  }
+  auto res = pread(m_read_fd, m_get_buffer.data(),
+                   std::min<std::uintmax_t>(kBufferSize, m_size - position),
+                   static_cast<off_t>(position));
+  while (res < 0 && errno == EINTR) {
+    res = pread(m_read_fd, m_get_buffer.data(),
+                std::min<std::uintmax_t>(kBufferSize, m_size - position),
+                static_cast<off_t>(position));
+  }
+  if (res <= 0) {
+    m_error = res < 0 ? LastError() : std::make_error_code(std::errc::io_error);
+    return traits_type::eof();
+  }
+  m_get_offset = position;
+  auto *buffer = m_get_buffer.data();
+  setg(buffer, buffer, buffer + res);
+  return traits_type::to_int_type(*gptr());
+}
+
+DedupStreambuf::int_type DedupStreambuf::overflow(int_type ch) {
+  if (m_error) {
+    return traits_type::eof();
+  }
+  auto ec = modified() ? write_pending() : start_writing();
+  if (ec) {
+    m_error = ec;
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+DedupStreambuf::pos_type
+DedupStreambuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                        std::ios_base::openmode which) {
+  auto const size = this->size();
+  auto base = std::uintmax_t{0};
+  if (dir == std::ios_base::cur) {
+    base = (which & std::ios_base::in) ? get_position() : size;
+  } else if (dir == std::ios_base::end) {
+    base = size;
+  }
+  auto const target = static_cast<off_type>(base) + off;
+  if (target < 0 || static_cast<std::uintmax_t>(target) > size) {
+    return pos_type(off_type(-1));
+  }
+  if ((which & std::ios_base::out) &&
+      static_cast<std::uintmax_t>(target) != size) {
+    // writes only ever append
+    return pos_type(off_type(-1));
+  }
+  if ((which & std::ios_base::in) &&
+      static_cast<std::uintmax_t>(target) != get_position()) {
+    m_get_offset = static_cast<std::uintmax_t>(target);
+    setg(nullptr, nullptr, nullptr);
+  }
+  return pos_type(target);
+}
+
+DedupStreambuf::pos_type
+DedupStreambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+int DedupStreambuf::sync() {
+  if (!modified()) {
+    return 0;
+  }
+  if (auto ec = write_pending()) {
+    m_error = ec;
+  }
+  return m_error ? -1 : 0;
+}
+
+std::pair<ContentHash, std::error_code> DedupStreambuf::finish() {
+  if (sync() != 0) {
+    return std::make_pair(ContentHash{}, m_error);
+  }
+  return std::make_pair(m_hasher.digest(), std::error_code{});
+}
+
+DedupFolder::DedupFolder(std::pmr::memory_resource *resource,
+                         std::filesystem::path root_path)
+    : m_resource{resource}, m_root_path{std::move(root_path)},
+      m_objects{resource}, m_blobs{resource}, m_open_objects{resource} {
+  std::filesystem::create_directories(m_root_path / kBlobDirectory);
+  // left over from objects that were not closed
+  std::filesystem::remove_all(m_root_path / kPendingDirectory);
+  std::filesystem::create_directories(m_root_path / kPendingDirectory);
+  recover();
+}
+
+DedupFolder::~DedupFolder() {
+  // like flush(), but an object that cannot be written must not take the
+  // others with it, nor end the program
+  while (!m_open_objects.empty()) {
+    auto const id = m_open_objects.begin()->first;
+    try {
+      close(id);
+    } catch (std::exception const &e) {
+      std::cerr << "DedupFolder: cannot close object " << id << ": "
+                << e.what() << '\n';
+    }
+  }
+  if (m_index_fd >= 0) {
+    ::close(m_index_fd);
+  }
+}
+
+void DedupFolder::recover() {
+  m_index_fd = ::open((m_root_path / kIndexFileName).c_str(),
+                      O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_index_fd < 0) {
+    throw SystemError("open index");
+  }
+
+  auto records = std::vector<IndexRecord>(4096);
+  std::size_t num_records_total = 0;
+  off_t offset = 0;
+  while (true) {
+    auto res = pread(m_index_fd, records.data(),
+                     records.size() * sizeof(IndexRecord), offset);
+    if (res < 0) {
+      throw SystemError("pread index");
+    }
+    auto const num_records =
+        static_cast<std::size_t>(res) / sizeof(IndexRecord);
+    for (std::size_t i = 0; i < num_records; ++i) {
+      auto const &record = records[i];
+      switch (record.kind) {
+      case RecordKind::Add:
+        m_objects.insert_or_assign(record.id, Object{});
+        break;
+      case RecordKind::Put:
+        m_objects.insert_or_assign(
+            record.id,
+            Object{ContentHash{record.hash_low, record.hash_high}, true});
+        break;
+      case RecordKind::Tombstone:
+        m_objects.erase(record.id);
+        break;
+      case RecordKind::NextId:
+        m_next_object_id = std::max(m_next_object_id, record.id);
+        continue;
+      }
+      m_next_object_id = std::max(m_next_object_id, record.id + 1);
+    }
+    num_records_total += num_records;
+    offset += static_cast<off_t>(num_records * sizeof(IndexRecord));
+    if (num_records < records.size()) {
+      break;
+    }
+  }
+  // cut off a record that was torn by a crash while it was appended
+  if (ftruncate(m_index_fd, offset) != 0) {
+    throw SystemError("ftruncate index");
+  }
+
+  for (auto const &entry :
+       std::filesystem::directory_iterator(m_root_path / kBlobDirectory)) {
+    auto hash = ContentHash{};
+    if (entry.is_regular_file() &&
+        ParseHex(entry.path().filename().native(), &hash)) {
+      m_blobs.try_emplace(hash, Blob{0, entry.file_size()});
+    }
+  }
+  for (auto it = m_objects.begin(); it != m_objects.end();) {
+    auto &object = it->second;
+    if (!object.has_content) {
+      ++it;
+      continue;
+    }
+    if (auto blob = m_blobs.find(object.hash); blob != m_blobs.end()) {
+      ++blob->second.references;
+      ++it;
+    } else {
+      // the index record made it to disk, but the blob didn't
+      it = m_objects.erase(it);
+    }
+  }
+  // blobs without references are left over from a crash during close()
+  std::erase_if(m_blobs, [this](auto const &entry) {
+    if (entry.second.references > 0) {
+      return false;
+    }
+    unlink(blob_path(entry.first).c_str());
+    return true;
+  });
+
+  m_num_records = num_records_total;
+  if (m_num_records > 2 * m_objects.size() + kMinCheckpointRecords) {
+    checkpoint();
+  }
+}
+
+bool DedupFolder::has(object_id_t id) const { return m_objects.contains(id); }
+
+DedupFolder::object_id_t DedupFolder::add() {
+  auto id = m_next_object_id++;
+  auto const &object = m_objects.try_emplace(id).first->second;
+  log(id, object);
+  return id;
+}
+
+DedupStream *DedupFolder::open(object_id_t id) const {
+  if (auto it = m_open_objects.find(id); it != m_open_objects.end()) {
+    return it->second.get();
+  }
+  auto const &object = m_objects.at(id);
+  auto content_size = std::uintmax_t{0};
+  if (object.has_content) {
+    content_size = m_blobs.at(object.hash).size;
+  }
+  auto stream = common::MakeUnique<DedupStream>(
+      m_resource, m_resource, path(id), content_size, pending_path(id));
+  auto *result = stream.get();
+  m_open_objects.try_emplace(id, std::move(stream));
+  return result;
+}
+
+std::iostream *DedupFolder::get(object_id_t id) {
+  if (!has(id)) {
+    return nullptr;
+  }
+  auto *stream = open(id);
+  stream->clear();
+  stream->seekg(0);
+  return stream;
+}
+
+std::iostream const &DedupFolder::get(object_id_t id) const {
+  if (!has(id)) {
+    throw std::out_of_range{"Object ID not found in DedupFolder"};
+  }
+  auto *stream = open(id);
+  stream->clear();
+  stream->seekg(0);
+  return *stream;
+}
+
+std::pair<std::uintmax_t, std::error_code>
+DedupFolder::size(object_id_t id) const {
+  if (auto it = m_open_objects.find(id); it != m_open_objects.end()) {
+    return std::make_pair(it->second->buffer().size(), std::error_code{});
+  }
+  auto it = m_objects.find(id);
+  if (it == m_objects.end()) {
+    return std::make_pair(
+        0, std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+  if (!it->second.has_content) {
+    return std::make_pair(0, std::error_code{});
+  }
+  return std::make_pair(m_blobs.at(it->second.hash).size, std::error_code{});
+}
+
+void DedupFolder::close(object_id_t id) {
+  auto it = m_open_objects.find(id);
+  if (it == m_open_objects.end()) {
+    return;
+  }
+  auto stream = std::move(it->second);
+  m_open_objects.erase(it);
+  auto &buffer = stream->buffer();
+  if (!buffer.modified()) {
+    return;
+  }
+
+  auto [hash, ec] = buffer.finish();
+  if (ec) {
+    throw std::system_error{ec, "write pending object"};
+  }
+  auto &object = m_objects.at(id);
+  auto const previous = object;
+  auto const size = buffer.size();
+  if (size == 0) {
+    object = Object{};
+  } else {
+    auto blob = m_blobs.find(hash);
+    if (blob == m_blobs.end()) {
+      // only known once it is in place, a failed rename leaves no trace
+      std::filesystem::rename(buffer.pending_path(), blob_path(hash));
+      blob = m_blobs.try_emplace(hash, Blob{0, size}).first;
+    }
+    // otherwise the new copy goes away with the stream
+    ++blob->second.references;
+    object = Object{hash, true};
+  }
+  // the old blob goes only once the log no longer refers to it
+  log(id, object);
+  if (previous.has_content) {
+    release(previous.hash);
+  }
+}
+
+void DedupFolder::destroy(object_id_t id) {
+  m_open_objects.erase(id);
+  if (auto it = m_objects.find(id); it != m_objects.end()) {
+    auto const object = it->second;
+    m_objects.erase(it);
+    log(id, object, true);
+    if (object.has_content) {
+      release(object.hash);
+    }
+  }
+}
+
+void DedupFolder::clear() {
+  m_open_objects.clear();
+  m_objects.clear();
+  for (auto const &[hash, blob] : m_blobs) {
+    unlink(blob_path(hash).c_str());
+  }
+  m_blobs.clear();
+  checkpoint();
+}
+
+void DedupFolder::flush() {
+  while (!m_open_objects.empty()) {
+    close(m_open_objects.begin()->first);
+  }
+}
+
+DedupStats DedupFolder::stats() const {
+  auto stats = DedupStats{};
+  stats.num_objects = m_objects.size();
+  stats.num_blobs = m_blobs.size();
+  for (auto const &[id, object] : m_objects) {
+    if (object.has_content) {
+      stats.logical_bytes += m_blobs.at(object.hash).size;
+    }
+  }
+  for (auto const &[hash, blob] : m_blobs) {
+    stats.stored_bytes += blob.size;
+  }
+  return stats;
+}
+
+std::filesystem::path DedupFolder::path(object_id_t id) const {
+  auto it = m_objects.find(id);
+  if (it == m_objects.end() || !it->second.has_content) {
+    return {};
+  }
+  return blob_path(it->second.hash);
+}
+
+void DedupFolder::release(ContentHash const &hash) {
+  auto it = m_blobs.find(hash);
+  if (it != m_blobs.end() && --it->second.references == 0) {
+    unlink(blob_path(hash).c_str());
+    m_blobs.erase(it);
+  }
+}
+
+void DedupFolder::log(object_id_t id, Object const &object, bool tombstone) {
+  auto kind = RecordKind::Add;
+  if (tombstone) {
+    kind = RecordKind::Tombstone;
+  } else if (object.has_content) {
+    kind = RecordKind::Put;
+  }
+  auto const record =
+      IndexRecord{id, kind, 0, object.hash.low, object.hash.high};
+  AppendAll(m_index_fd, &record, sizeof(record));
+  // keep the log from growing with records that no longer matter
+  if (++m_num_records > 2 * m_objects.size() + kMinCheckpointRecords) {
+    checkpoint();
+  }
+}
+
+void DedupFolder::checkpoint() {
+  auto const tmp_path = m_root_path / kIndexCheckpointFileName;
+  int fd = ::open(tmp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw SystemError("open index checkpoint");
+  }
+
+  auto records = std::vector<IndexRecord>{};
+  records.reserve(m_objects.size() + 1);
+  for (auto const &[id, object] : m_objects) {
+    records.push_back({id,
+                       object.has_content ? RecordKind::Put : RecordKind::Add,
+                       0, object.hash.low, object.hash.high});
+  }
+  records.push_back({m_next_object_id, RecordKind::NextId, 0, 0, 0});
+  AppendAll(fd, records.data(), records.size() * sizeof(IndexRecord));
+  if (fdatasync(fd) != 0) {
+    ::close(fd);
+    throw SystemError("fdatasync index checkpoint");
+  }
+
+  std::filesystem::rename(tmp_path, m_root_path / kIndexFileName);
+  ::close(m_index_fd);
+  m_index_fd = fd;
+  m_num_records = records.size();
+}
+
+std::filesystem::path DedupFolder::blob_path(ContentHash const &hash) const {
+  return m_root_path / kBlobDirectory / ToHex(hash);
+}
+
+std::filesystem::path DedupFolder::pending_path(object_id_t id) const {
+  return m_root_path / kPendingDirectory / std::to_string(id);
+}
+
+} // namespace objectstore
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory_resource>
+#include <span>
+#include <streambuf>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <memory.hpp>
+
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+/**
+ * @brief 128-bit hash of the content of an object.
+ */
+struct ContentHash {
+  std::uint64_t low = 0;
+  std::uint64_t high = 0;
+
+  bool operator==(ContentHash const &) const = default;
+};
+
+struct ContentHashHasher {
+  std::size_t operator()(ContentHash const &hash) const {
+    return static_cast<std::size_t>(hash.low);
+  }
+};
+
+/**
+ * @brief MurmurHash3 x64 128 with seed 0, fed piece by piece. The result is
+ * the same no matter how the data is split.
+ */
+class ContentHasher {
+public:
+  void update(std::span<const std::byte> data);
+  ContentHash digest() const;
+
+private:
+  void mix(std::uint64_t k1, std::uint64_t k2);
+
+  std::uint64_t m_h1 = 0;
+  std::uint64_t m_h2 = 0;
+  std::uint64_t m_length = 0;
+  std::array<std::byte, 16> m_tail{};
+  std::size_t m_tail_size = 0;
+};
+
+/**
+ * @brief The stream of an object of a DedupFolder.
+ *
+ * Reads come from the content blob of the object. The first write copies the
+ * current content to a pending file of the object and hashes it on the way,
+ * every write after that is hashed as it goes to the file, so the hash is
+ * ready once the stream is done without reading the data again. Writes
+ * always append to the end of the object.
+ */
+class DedupStreambuf : public std::streambuf {
+public:
+  /**
+   * @param content_path the blob with the current content, empty for none
+   */
+  DedupStreambuf(std::pmr::memory_resource *resource,
+                 std::filesystem::path content_path,
+                 std::uintmax_t content_size,
+                 std::filesystem::path pending_path);
+
+  DedupStreambuf(const DedupStreambuf &) = delete;
+  DedupStreambuf &operator=(const DedupStreambuf &) = delete;
+
+  ~DedupStreambuf() override;
+
+  bool modified() const { return m_write_fd >= 0; }
+  std::uintmax_t size() const;
+
+  /**
+   * @brief Writes all pending output to the pending file.
+   *
+   * @return the hash of the new content
+   */
+  std::pair<ContentHash, std::error_code> finish();
+
+  std::filesystem::path const &pending_path() const { return m_pending_path; }
+
+protected:
+  int_type underflow() override;
+  int_type overflow(int_type ch) override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+  int sync() override;
+
+private:
+  std::error_code start_writing();
+  std::error_code write_pending();
+  std::uintmax_t get_position() const;
+
+  std::filesystem::path m_content_path;
+  std::filesystem::path m_pending_path;
+  int m_read_fd = -1;
+  int m_write_fd = -1;
+  std::error_code m_error;
+  ContentHasher m_hasher;
+  std::pmr::vector<char> m_get_buffer;
+  std::pmr::vector<char> m_put_buffer;
+  /// Offset of the get area in the object.
+  std::uintmax_t m_get_offset = 0;
+  /// Bytes of the object in the file that is read from.
+  std::uintmax_t m_size = 0;
+};
+
+class DedupStream : public std::iostream {
+public:
+  DedupStream(std::pmr::memory_resource *resource,
+              std::filesystem::path content_path, std::uintmax_t content_size,
+              std::filesystem::path pending_path)
+      : std::iostream{nullptr}, m_buffer{resource, std::move(content_path),
+                                         content_size,
+                                         std::move(pending_path)} {
+    rdbuf(&m_buffer);
+  }
+
+  DedupStreambuf &buffer() { return m_buffer; }
+  DedupStreambuf const &buffer() const { return m_buffer; }
+
+private:
+  DedupStreambuf m_buffer;
+};
+
+struct DedupStats {
+  std::size_t num_objects = 0;
+  std::size_t num_blobs = 0;
+  /// Sum of the sizes of all objects.
+  std::uintmax_t logical_bytes = 0;
+  /// Sum of the sizes of all blobs, i.e. what is on disk.
+  std::uintmax_t stored_bytes = 0;
+};
+
+/**
+ * @brief Stores byte-identical objects only once.
+ *
+ * Every object refers to a content blob named after the hash of its content,
+ * which is shared by all objects with the same content and removed with the
+ * last of them. The hash is computed while the object is written, see
+ * DedupStreambuf, and the new content is moved into place on close(): if a
+ * blob with the same hash exists, the object refers to it and the new copy
+ * is dropped. Blobs are never changed, so writing to an object that shares
+ * its blob never affects the others. Two different contents with the same
+ * hash are not told apart, which for 128 bits is not a practical concern.
+ *
+ * Which blob each object refers to is kept in an append-only log, replayed
+ * on construction and rewritten once most of its records are outdated.
+ * Objects that were not closed are lost on a restart.
+ */
+class DedupFolder : public StoredObjectCollection {
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  DedupFolder(std::pmr::memory_resource *resource,
+              std::filesystem::path root_path);
+
+  DedupFolder(const DedupFolder &) = delete;
+  DedupFolder(DedupFolder &&) = delete;
+  DedupFolder &operator=(const DedupFolder &) = delete;
+  DedupFolder &operator=(DedupFolder &&) = delete;
+
+  /**
+   * @brief Closes all objects that are still open, logging those that cannot
+   * be written instead of throwing.
+   */
+  ~DedupFolder() override;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @brief Closes all objects that are still open.
+   */
+  void flush();
+
+  DedupStats stats() const;
+
+  std::filesystem::path const &path() const { return m_root_path; }
+
+  /**
+   * @return the path of the blob with the content of the object, or an empty
+   * path if it has no content
+   */
+  std::filesystem::path path(object_id_t id) const;
+
+private:
+  struct Object {
+    ContentHash hash;
+    /// Objects without content have no blob.
+    bool has_content = false;
+  };
+
+  struct Blob {
+    std::size_t references = 0;
+    std::uintmax_t size = 0;
+  };
+
+  using OpenObjectMap =
+      std::pmr::unordered_map<object_id_t, common::UniquePtr<DedupStream>>;
+
+  void recover();
+  DedupStream *open(object_id_t id) const;
+  void release(ContentHash const &hash);
+  void log(object_id_t id, Object const &object, bool tombstone = false);
+  void checkpoint();
+
+  std::filesystem::path blob_path(ContentHash const &hash) const;
+  std::filesystem::path pending_path(object_id_t id) const;
+
+  std::pmr::memory_resource *m_resource;
+  std::filesystem::path m_root_path;
+  std::pmr::unordered_map<object_id_t, Object> m_objects;
+  std::pmr::unordered_map<ContentHash, Blob, ContentHashHasher> m_blobs;
+  mutable OpenObjectMap m_open_objects;
+  int m_index_fd = -1;
+  std::size_t m_num_records = 0;
+  object_id_t m_next_object_id{};
+};
+
+} // namespace objectstore
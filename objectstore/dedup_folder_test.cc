@@ -0,0 +1,226 @@
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+#include <dedup_folder.hpp>
+#include <scopeguard.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_dedup";
+
+objectstore::ContentHash Hash(std::string_view text) {
+  auto hasher = objectstore::ContentHasher{};
+  hasher.update(std::as_bytes(std::span{text}));
+  return hasher.digest();
+}
+
+using objectstore::test::ReadAll;
+using objectstore::test::Write;
+
+} // namespace
+
+TEST(ContentHasher, MatchesMurmurHash3) {
+  EXPECT_EQ(Hash(""), (objectstore::ContentHash{0, 0}));
+  EXPECT_EQ(Hash("hello"),
+            (objectstore::ContentHash{0xcbd8a7b341bd9b02, 0x5b1e906a48ae1d19}));
+  EXPECT_EQ(Hash("The quick brown fox jumps over the lazy dog"),
+            (objectstore::ContentHash{0xe34bbc7bbc071b6c, 0x7a433ca9c49a9347}));
+}
+
+TEST(ContentHasher, IndependentOfSplits) {
+  auto text = std::string{};
+  for (int i = 0; i < 100; ++i) {
+    text += std::to_string(i * i) + ",";
+  }
+  auto const expected = Hash(text);
+  for (std::size_t step : {1, 3, 8, 15, 16, 17, 100}) {
+    auto hasher = objectstore::ContentHasher{};
+    auto bytes = std::as_bytes(std::span{text});
+    for (std::size_t i = 0; i < bytes.size(); i += step) {
+      hasher.update(bytes.subspan(i, std::min(step, bytes.size() - i)));
+    }
+    EXPECT_EQ(hasher.digest(), expected) << step;
+  }
+}
+
+TEST(DedupFolder, SharesIdenticalContent) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto folder = objectstore::DedupFolder{resource, kTestPath};
+  auto const content = std::string(10'000, 'x');
+  auto a = folder.add();
+  auto b = folder.add();
+  auto c = folder.add();
+  Write(&folder, a, content);
+  Write(&folder, b, content);
+  Write(&folder, c, "something else");
+
+  EXPECT_EQ(folder.path(a), folder.path(b));
+  EXPECT_NE(folder.path(a), folder.path(c));
+  auto stats = folder.stats();
+  EXPECT_EQ(stats.num_objects, 3u);
+  EXPECT_EQ(stats.num_blobs, 2u);
+  EXPECT_EQ(stats.logical_bytes, 2 * content.size() + 14);
+  EXPECT_EQ(stats.stored_bytes, content.size() + 14);
+
+  // the blob lives as long as one object refers to it
+  auto const shared = folder.path(a);
+  folder.destroy(a);
+  EXPECT_TRUE(std::filesystem::exists(shared));
+  EXPECT_EQ(ReadAll(&folder, b), content);
+  folder.destroy(b);
+  EXPECT_FALSE(std::filesystem::exists(shared));
+  EXPECT_EQ(folder.stats().num_blobs, 1u);
+
+  EXPECT_EQ(folder.size(a).second, std::errc::no_such_file_or_directory);
+  EXPECT_EQ(folder.get(a), nullptr);
+}
+
+TEST(DedupFolder, WritesDoNotAffectSharedBlobs) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto folder = objectstore::DedupFolder{resource, kTestPath};
+  auto a = folder.add();
+  auto b = folder.add();
+  Write(&folder, a, "Hello");
+  Write(&folder, b, "Hello");
+
+  auto *stream = folder.get(a);
+  EXPECT_TRUE(stream->seekp(0, std::ios::end));
+  *stream << ", World";
+  EXPECT_EQ(folder.size(a).first, 12u);
+  // reads see the pending content
+  EXPECT_EQ(ReadAll(&folder, a), "Hello, World");
+  // writes only append
+  EXPECT_FALSE(stream->seekp(0));
+  stream->clear();
+  folder.close(a);
+
+  EXPECT_EQ(ReadAll(&folder, a), "Hello, World");
+  EXPECT_EQ(ReadAll(&folder, b), "Hello");
+  EXPECT_EQ(folder.stats().num_blobs, 2u);
+
+  // writing the same content again ends up in the same blob
+  auto *other = folder.get(b);
+  other->seekp(0, std::ios::end);
+  *other << ", World";
+  folder.close(b);
+  EXPECT_EQ(folder.path(a), folder.path(b));
+  EXPECT_EQ(folder.stats().num_blobs, 1u);
+  EXPECT_TRUE(std::filesystem::is_empty(std::filesystem::path{kTestPath} /
+                                        "pending"));
+}
+
+TEST(DedupFolder, Reopen) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto a = objectstore::DedupFolder::object_id_t{};
+  auto b = a;
+  auto empty = a;
+  auto unclosed = a;
+  {
+    auto folder = objectstore::DedupFolder{resource, kTestPath};
+    a = folder.add();
+    b = folder.add();
+    empty = folder.add();
+    auto destroyed = folder.add();
+    Write(&folder, a, "shared");
+    Write(&folder, b, "shared");
+    Write(&folder, destroyed, "gone");
+    folder.destroy(destroyed);
+    unclosed = folder.add();
+    *folder.get(unclosed) << "flushed by the destructor";
+  }
+
+  auto folder = objectstore::DedupFolder{resource, kTestPath};
+  EXPECT_EQ(ReadAll(&folder, a), "shared");
+  EXPECT_EQ(ReadAll(&folder, b), "shared");
+  EXPECT_TRUE(folder.has(empty));
+  EXPECT_EQ(folder.size(empty).first, 0u);
+  EXPECT_EQ(ReadAll(&folder, unclosed), "flushed by the destructor");
+  EXPECT_EQ(folder.stats().num_objects, 4u);
+  EXPECT_EQ(folder.stats().num_blobs, 2u);
+  EXPECT_GT(folder.add(), unclosed);
+
+  // refcounts were rebuilt
+  folder.destroy(a);
+  EXPECT_EQ(ReadAll(&folder, b), "shared");
+  folder.destroy(b);
+  EXPECT_EQ(folder.stats().num_blobs, 1u);
+
+  folder.clear();
+  EXPECT_EQ(folder.stats().num_objects, 0u);
+  EXPECT_TRUE(std::filesystem::is_empty(std::filesystem::path{kTestPath} /
+                                        "blobs"));
+}
+
+TEST(DedupFolder, FailedCloseKeepsState) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto const blobs = std::filesystem::path{kTestPath} / "blobs";
+  auto const moved = std::filesystem::path{kTestPath} / "moved";
+  auto kept = objectstore::DedupFolder::object_id_t{};
+  {
+    auto folder = objectstore::DedupFolder{resource, kTestPath};
+    kept = folder.add();
+    Write(&folder, kept, "kept");
+
+    std::filesystem::rename(blobs, moved);
+    auto failed = folder.add();
+    *folder.get(failed) << "lost";
+    EXPECT_THROW(folder.close(failed), std::filesystem::filesystem_error);
+    EXPECT_EQ(folder.stats().num_blobs, 1u);
+    EXPECT_EQ(folder.size(failed).first, 0u);
+
+    // the destructor logs the failure instead of terminating
+    auto unclosed = folder.add();
+    *folder.get(unclosed) << "lost as well";
+  }
+  std::filesystem::rename(moved, blobs);
+
+  auto folder = objectstore::DedupFolder{resource, kTestPath};
+  EXPECT_EQ(ReadAll(&folder, kept), "kept");
+  EXPECT_EQ(folder.stats().num_blobs, 1u);
+}
+
+TEST(DedupFolder, IndexStaysSmall) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto const index = std::filesystem::path{kTestPath} / "index";
+  auto last = objectstore::DedupFolder::object_id_t{};
+  {
+    auto folder = objectstore::DedupFolder{resource, kTestPath};
+    auto kept = folder.add();
+    Write(&folder, kept, "kept");
+    for (int i = 0; i < 10'000; ++i) {
+      last = folder.add();
+      Write(&folder, last, std::to_string(i % 10));
+      folder.destroy(last);
+    }
+    EXPECT_LT(std::filesystem::file_size(index), 32u * 4096);
+  }
+
+  auto folder = objectstore::DedupFolder{resource, kTestPath};
+  EXPECT_EQ(folder.stats().num_objects, 1u);
+  EXPECT_GT(folder.add(), last);
+}
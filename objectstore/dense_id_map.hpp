@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace objectstore {
+
+/**
+ * @brief A map from integer ids to values for ids that are handed out
+ * densely from zero, such as object ids.
+ *
+ * The values live in chunks of kChunkSize slots, found by indexing a vector
+ * with the id, and a bitmap in each chunk tells which slots hold a value. A
+ * chunk is only allocated once one of its ids is used, and given back once
+ * its last value is erased. Ids from kMaxDenseId on, which a folder only
+ * gets from files named by hand, go to a tree map instead, so that a single
+ * large id does not make the chunk vector huge.
+ *
+ * Iteration is in id order, dense ids first. The elements are pairs of the
+ * id and a reference to the value, so that they read like the elements of a
+ * std::unordered_map. Erasing an element only invalidates iterators to it.
+ */
+template <typename T> class DenseIdMap {
+public:
+  using key_type = std::uint64_t;
+  using mapped_type = T;
+
+  static constexpr key_type kChunkSize = 4096;
+  static constexpr key_type kMaxDenseId = key_type{1} << 32;
+
+private:
+  static constexpr std::size_t kWordBits = 64;
+  static constexpr std::size_t kChunkWords = kChunkSize / kWordBits;
+
+  struct Chunk {
+    std::uint64_t live[kChunkWords] = {};
+    std::size_t count = 0;
+    alignas(T) std::byte slots[kChunkSize * sizeof(T)];
+
+    T *slot(key_type id) {
+      return std::launder(reinterpret_cast<T *>(slots) + id % kChunkSize);
+    }
+    bool contains(key_type id) const {
+      auto const bit = id % kChunkSize;
+      return (live[bit / kWordBits] >> (bit % kWordBits)) & 1;
+    }
+    void set(key_type id, bool value) {
+      auto const bit = id % kChunkSize;
+      auto const mask = std::uint64_t{1} << (bit % kWordBits);
+      if (value) {
+        live[bit / kWordBits] |= mask;
+      } else {
+        live[bit / kWordBits] &= ~mask;
+      }
+    }
+  };
+
+  /// Ordered, so that iteration stays in id order past the dense ids.
+  using SparseMap = std::pmr::map<key_type, T>;
+
+  template <bool kConst> class Iterator {
+    using Map = std::conditional_t<kConst, DenseIdMap const, DenseIdMap>;
+    using Value = std::conditional_t<kConst, T const, T>;
+    using SparseIterator =
+        std::conditional_t<kConst, typename SparseMap::const_iterator,
+                           typename SparseMap::iterator>;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::pair<key_type, Value &>;
+    using reference = value_type;
+
+    /// What operator-> points to, as there is no pair to point to in the map.
+    class pointer {
+    public:
+      value_type *operator->() { return &m_value; }
+
+    private:
+      friend class Iterator;
+      explicit pointer(value_type value) : m_value{value} {}
+      value_type m_value;
+    };
+
+    Iterator() = default;
+    // a const_iterator from an iterator
+    template <bool kOther, typename = std::enable_if_t<kConst && !kOther>>
+    Iterator(Iterator<kOther> const &other)
+        : m_map{other.m_map}, m_id{other.m_id}, m_sparse{other.m_sparse} {}
+
+    reference operator*() const {
+      if (m_id != kMaxDenseId) {
+        return {m_id, *m_map->m_chunks[m_id / kChunkSize]->slot(m_id)};
+      }
+      return {m_sparse->first, m_sparse->second};
+    }
+    pointer operator->() const { return pointer{**this}; }
+
+    Iterator &operator++() {
+      if (m_id != kMaxDenseId) {
+        m_id = m_map->next_live(m_id + 1);
+        if (m_id == kMaxDenseId) {
+          // e.g. from find(), which leaves m_sparse unset for a dense id
+          m_sparse = m_map->m_sparse.begin();
+        }
+      } else {
+        ++m_sparse;
+      }
+      return *this;
+    }
+    Iterator operator++(int) {
+      auto copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    friend bool operator==(Iterator const &a, Iterator const &b) {
+      return a.m_id == b.m_id &&
+             (a.m_id != kMaxDenseId || a.m_sparse == b.m_sparse);
+    }
+
+  private:
+    friend class DenseIdMap;
+    friend class Iterator<!kConst>;
+
+    Iterator(Map *map, key_type id, SparseIterator sparse)
+        : m_map{map}, m_id{id}, m_sparse{sparse} {}
+
+    Map *m_map = nullptr;
+    /// kMaxDenseId once in the sparse part.
+    key_type m_id = kMaxDenseId;
+    SparseIterator m_sparse{};
+  };
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  explicit DenseIdMap(std::pmr::memory_resource *resource)
+      : m_resource{resource}, m_chunks{resource}, m_sparse{resource} {}
+
+  DenseIdMap(const DenseIdMap &) = delete;
+  DenseIdMap &operator=(const DenseIdMap &) = delete;
+
+  ~DenseIdMap() { clear(); }
+
+  bool contains(key_type id) const {
+    if (id >= kMaxDenseId) {
+      return m_sparse.contains(id);
+    }
+    auto const *chunk = chunk_of(id);
+    return chunk != nullptr && chunk->contains(id);
+  }
+
+  iterator find(key_type id) {
+    if (id >= kMaxDenseId) {
+      return {this, kMaxDenseId, m_sparse.find(id)};
+    }
+    return contains(id) ? iterator{this, id, {}} : end();
+  }
+  const_iterator find(key_type id) const {
+    if (id >= kMaxDenseId) {
+      return {this, kMaxDenseId, m_sparse.find(id)};
+    }
+    return contains(id) ? const_iterator{this, id, {}} : end();
+  }
+
+  /**
+   * @throw std::out_of_range if there is no value for the id
+   */
+  T &at(key_type id) {
+    return const_cast<T &>(std::as_const(*this).at(id));
+  }
+  T const &at(key_type id) const {
+    if (id >= kMaxDenseId) {
+      return m_sparse.at(id);
+    }
+    if (!contains(id)) {
+      throw std::out_of_range{"DenseIdMap::at"};
+    }
+    return *m_chunks[id / kChunkSize]->slot(id);
+  }
+
+  /**
+   * @brief Constructs the value from args unless the id has one already.
+   *
+   * @return the element of the id, and whether it was added
+   */
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type id, Args &&...args) {
+    if (id >= kMaxDenseId) {
+      auto [it, added] =
+          m_sparse.try_emplace(id, std::forward<Args>(args)...);
+      return {iterator{this, kMaxDenseId, it}, added};
+    }
+    auto const index = id / kChunkSize;
+    if (index >= m_chunks.size()) {
+      m_chunks.resize(index + 1, nullptr);
+    }
+    auto *&chunk = m_chunks[index];
+    if (chunk == nullptr) {
+      chunk = new (m_resource->allocate(sizeof(Chunk), alignof(Chunk))) Chunk;
+    } else if (chunk->contains(id)) {
+      return {iterator{this, id, {}}, false};
+    }
+    new (chunk->slot(id)) T(std::forward<Args>(args)...);
+    chunk->set(id, true);
+    ++chunk->count;
+    ++m_size;
+    return {iterator{this, id, {}}, true};
+  }
+
+  /**
+   * @return whether the id had a value
+   */
+  bool erase(key_type id) {
+    if (id >= kMaxDenseId) {
+      return m_sparse.erase(id) != 0;
+    }
+    auto *chunk = chunk_of(id);
+    if (chunk == nullptr || !chunk->contains(id)) {
+      return false;
+    }
+    std::destroy_at(chunk->slot(id));
+    chunk->set(id, false);
+    --m_size;
+    if (--chunk->count == 0) {
+      release(m_chunks[id / kChunkSize]);
+    }
+    return true;
+  }
+  void erase(const_iterator it) { erase((*it).first); }
+
+  /**
+   * @brief Reserves the chunk vector for the ids below num_ids.
+   */
+  void reserve(key_type num_ids) {
+    m_chunks.reserve((std::min(num_ids, kMaxDenseId) + kChunkSize - 1) /
+                     kChunkSize);
+  }
+
+  void clear() {
+    for (auto *&chunk : m_chunks) {
+      if (chunk != nullptr) {
+        destroy_values(chunk);
+        release(chunk);
+      }
+    }
+    m_chunks.clear();
+    m_sparse.clear();
+    m_size = 0;
+  }
+
+  std::size_t size() const { return m_size + m_sparse.size(); }
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @return the lowest id from `from` on without a value, which is
+   * kMaxDenseId at most, i.e. holes among the sparse ids are not found
+   */
+  key_type first_free(key_type from) const {
+    for (auto index = from / kChunkSize;
+         from < kMaxDenseId && index < m_chunks.size();
+         ++index, from = index * kChunkSize) {
+      auto const *chunk = m_chunks[index];
+      if (chunk == nullptr) {
+        return from;
+      }
+      if (chunk->count == kChunkSize) {
+        continue;
+      }
+      for (auto word = from % kChunkSize / kWordBits; word < kChunkWords;
+           ++word) {
+        // the bits below `from` count as taken
+        auto const taken =
+            chunk->live[word] |
+            (word == from % kChunkSize / kWordBits
+                 ? (std::uint64_t{1} << (from % kWordBits)) - 1
+                 : 0);
+        if (taken != ~std::uint64_t{0}) {
+          return index * kChunkSize + word * kWordBits +
+                 static_cast<key_type>(std::countr_one(taken));
+        }
+      }
+    }
+    return std::min(from, kMaxDenseId);
+  }
+
+  iterator begin() { return {this, next_live(0), m_sparse.begin()}; }
+  iterator end() { return {this, kMaxDenseId, m_sparse.end()}; }
+  const_iterator begin() const {
+    return {this, next_live(0), m_sparse.begin()};
+  }
+  const_iterator end() const { return {this, kMaxDenseId, m_sparse.end()}; }
+
+private:
+  Chunk *chunk_of(key_type id) const {
+    auto const index = id / kChunkSize;
+    return index < m_chunks.size() ? m_chunks[index] : nullptr;
+  }
+
+  /**
+   * @return the lowest dense id from `from` on with a value, kMaxDenseId if
+   * there is none
+   */
+  key_type next_live(key_type from) const {
+    for (auto index = from / kChunkSize; index < m_chunks.size();
+         ++index, from = index * kChunkSize) {
+      auto const *chunk = m_chunks[index];
+      if (chunk == nullptr) {
+        continue;
+      }
+      for (auto word = from % kChunkSize / kWordBits; word < kChunkWords;
+           ++word) {
+        // the bits below `from` do not count
+        auto const live =
+            chunk->live[word] &
+            (word == from % kChunkSize / kWordBits
+                 ? ~std::uint64_t{0} << (from % kWordBits)
+                 : ~std::uint64_t{0});
+        if (live != 0) {
+          return index * kChunkSize + word * kWordBits +
+                 static_cast<key_type>(std::countr_zero(live));
+        }
+      }
+    }
+    return kMaxDenseId;
+  }
+
+  static void destroy_values(Chunk *chunk) {
+    for (std::size_t word = 0; word < kChunkWords; ++word) {
+      for (auto live = chunk->live[word]; live != 0; live &= live - 1) {
+        std::destroy_at(chunk->slot(word * kWordBits +
+                                    static_cast<key_type>(
+                                        std::countr_zero(live))));
+      }
+    }
+  }
+
+  void release(Chunk *&chunk) {
+    std::destroy_at(chunk);
+    m_resource->deallocate(chunk, sizeof(Chunk), alignof(Chunk));
+    chunk = nullptr;
+  }
+
+  std::pmr::memory_resource *m_resource;
+  std::pmr::vector<Chunk *> m_chunks;
+  /// Values in the chunks.
+  std::size_t m_size = 0;
+  SparseMap m_sparse;
+};
+
+} // namespace objectstore
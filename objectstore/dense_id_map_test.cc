@@ -0,0 +1,135 @@
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <dense_id_map.hpp>
+
+namespace {
+
+using Map = objectstore::DenseIdMap<std::unique_ptr<int>>;
+
+std::vector<std::uint64_t> Ids(Map const &map) {
+  auto ids = std::vector<std::uint64_t>{};
+  for (auto const &[id, value] : map) {
+    EXPECT_EQ(*value, static_cast<int>(id % 1000));
+    ids.push_back(id);
+  }
+  return ids;
+}
+
+void Add(Map *map, std::uint64_t id) {
+  map->try_emplace(id, std::make_unique<int>(static_cast<int>(id % 1000)));
+}
+
+} // namespace
+
+TEST(DenseIdMap, FindsAndIteratesInIdOrder) {
+  auto map = Map{std::pmr::get_default_resource()};
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.begin(), map.end());
+
+  auto const large = Map::kMaxDenseId + 5;
+  for (auto id : {large, std::uint64_t{9000}, std::uint64_t{0},
+                  std::uint64_t{63}, std::uint64_t{64}, std::uint64_t{4095}}) {
+    Add(&map, id);
+  }
+  EXPECT_EQ(map.size(), 6u);
+  EXPECT_EQ(Ids(map),
+            (std::vector<std::uint64_t>{0, 63, 64, 4095, 9000, large}));
+  EXPECT_EQ(std::distance(map.begin(), map.end()), 6);
+
+  EXPECT_TRUE(map.contains(63));
+  EXPECT_TRUE(map.contains(large));
+  EXPECT_FALSE(map.contains(62));
+  EXPECT_FALSE(map.contains(1'000'000));
+  EXPECT_FALSE(map.contains(large + 1));
+  EXPECT_EQ(*map.find(4095)->second, 95);
+  EXPECT_EQ(map.find(large)->first, large);
+  EXPECT_EQ(map.find(65), map.end());
+  EXPECT_EQ(std::as_const(map).find(large + 1), map.end());
+  EXPECT_EQ(*map.at(9000), 0);
+  EXPECT_THROW(map.at(1), std::out_of_range);
+
+  // an id that is taken keeps its value
+  auto [it, added] = map.try_emplace(64, std::make_unique<int>(-1));
+  EXPECT_FALSE(added);
+  EXPECT_EQ(*it->second, 64);
+}
+
+TEST(DenseIdMap, IteratesFromDenseIntoSparseIds) {
+  auto map = Map{std::pmr::get_default_resource()};
+  auto const large = Map::kMaxDenseId + 5;
+  for (auto id : {std::uint64_t{7}, std::uint64_t{70}, large, large + 1}) {
+    Add(&map, id);
+  }
+
+  auto ids = std::vector<std::uint64_t>{};
+  for (auto it = map.find(7); it != map.end(); ++it) {
+    ids.push_back(it->first);
+  }
+  EXPECT_EQ(ids, (std::vector<std::uint64_t>{7, 70, large, large + 1}));
+
+  auto it = std::as_const(map).find(70);
+  EXPECT_EQ((++it)->first, large);
+  auto emplaced = map.try_emplace(71, std::make_unique<int>(71)).first;
+  EXPECT_EQ(std::next(emplaced)->first, large);
+}
+
+TEST(DenseIdMap, EraseReleasesChunks) {
+  auto resource = std::pmr::unsynchronized_pool_resource{};
+  auto map = Map{&resource};
+  for (std::uint64_t id = 0; id < 3 * Map::kChunkSize; ++id) {
+    Add(&map, id);
+  }
+  // the whole middle chunk
+  for (auto id = Map::kChunkSize; id < 2 * Map::kChunkSize; ++id) {
+    EXPECT_TRUE(map.erase(id));
+  }
+  EXPECT_FALSE(map.erase(Map::kChunkSize));
+  map.erase(map.find(0));
+  EXPECT_EQ(map.size(), 2 * Map::kChunkSize - 1);
+  auto const ids = Ids(map);
+  EXPECT_EQ(ids.front(), 1u);
+  EXPECT_EQ(ids[Map::kChunkSize - 2], Map::kChunkSize - 1);
+  EXPECT_EQ(ids[Map::kChunkSize - 1], 2 * Map::kChunkSize);
+  EXPECT_EQ(ids.back(), 3 * Map::kChunkSize - 1);
+
+  map.clear();
+  EXPECT_EQ(map.size(), 0u);
+  EXPECT_EQ(map.begin(), map.end());
+}
+
+TEST(DenseIdMap, FirstFree) {
+  auto map = Map{std::pmr::get_default_resource()};
+  EXPECT_EQ(map.first_free(0), 0u);
+  EXPECT_EQ(map.first_free(12345), 12345u);
+  for (std::uint64_t id = 0; id < 2 * Map::kChunkSize + 10; ++id) {
+    Add(&map, id);
+  }
+  EXPECT_EQ(map.first_free(0), 2 * Map::kChunkSize + 10);
+  EXPECT_EQ(map.first_free(3 * Map::kChunkSize), 3 * Map::kChunkSize);
+
+  auto const holes = std::set<std::uint64_t>{3, 64, 70, 4096, 8200};
+  for (auto id : holes) {
+    map.erase(id);
+  }
+  auto found = std::set<std::uint64_t>{};
+  for (auto id = map.first_free(0); id < 2 * Map::kChunkSize + 10;
+       id = map.first_free(id + 1)) {
+    found.insert(id);
+  }
+  EXPECT_EQ(found, holes);
+  EXPECT_EQ(map.first_free(65), 70u);
+  EXPECT_EQ(map.first_free(71), 4096u);
+
+  // holes among the sparse ids are not handed out
+  Add(&map, Map::kMaxDenseId);
+  EXPECT_EQ(map.first_free(Map::kMaxDenseId), Map::kMaxDenseId);
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+#include "durability.hpp"
+
+namespace objectstore {
+
+namespace {
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::error_code SyncPath(std::filesystem::path const &path, int flags,
+                         int (*sync)(int)) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | flags);
+  if (fd < 0) {
+    return LastError();
+  }
+  auto ec = sync(fd) == 0 ? std::error_code{} : LastError();
+  ::close(fd);
+  return ec;
+}
+
+std::shared_future<std::error_code> Ready(std::error_code ec) {
+  auto promise = std::promise<std::error_code>{};
+  promise.set_value(ec);
+  return promise.get_future().share();
+}
+
+} // namespace
+
+std::error_code SyncFile(std::filesystem::path const &file_path,
+                         bool sync_directory) {
+  if (auto ec = SyncPath(file_path, 0, fdatasync)) {
+    return ec;
+  }
+  if (sync_directory) {
+    return SyncPath(file_path.parent_path(), O_DIRECTORY, fsync);
+  }
+  return {};
+}
+
+GroupCommitter::GroupCommitter(std::pmr::memory_resource *resource,
+                               GroupCommitOptions options)
+    : m_resource{resource}, m_options{options}, m_batches{resource} {
+  m_options.max_batch = std::max<std::size_t>(m_options.max_batch, 1);
+  m_options.max_pending_batches =
+      std::max<std::size_t>(m_options.max_pending_batches, 1);
+  m_thread = std::jthread{[this](std::stop_token token) { run(token); }};
+}
+
+GroupCommitter::~GroupCommitter() {
+  m_thread.request_stop();
+  m_thread.join();
+}
+
+std::shared_future<std::error_code>
+GroupCommitter::commit(std::filesystem::path file_path, bool sync_directory) {
+  // waits before opening anything, the descriptors of the pending batches are
+  // what the limit is for
+  auto lock = std::unique_lock{m_mutex};
+  m_synced_cv.wait(lock, [this] { return !full(); });
+
+  auto commit = Commit{-1, -1, {}};
+  commit.fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (commit.fd < 0) {
+    return Ready(LastError());
+  }
+  if (sync_directory) {
+    commit.directory_path = file_path.parent_path();
+    commit.directory_fd = ::open(commit.directory_path.c_str(),
+                                 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (commit.directory_fd < 0) {
+      auto ec = LastError();
+      ::close(commit.fd);
+      return Ready(ec);
+    }
+  }
+
+  if (m_batches.empty() ||
+      m_batches.back().commits.size() >= m_options.max_batch) {
+    m_batches.emplace_back(m_resource);
+    m_cv.notify_one();
+  }
+  auto &batch = m_batches.back();
+  batch.commits.push_back(std::move(commit));
+  if (batch.commits.size() == m_options.max_batch) {
+    m_cv.notify_one();
+  }
+  return batch.future;
+}
+
+bool GroupCommitter::full() const {
+  auto const pending = m_batches.size() + (m_syncing ? 1 : 0);
+  return pending >= m_options.max_pending_batches &&
+         (m_batches.empty() ||
+          m_batches.back().commits.size() >= m_options.max_batch);
+}
+
+std::size_t GroupCommitter::num_batches() const {
+  auto lock = std::lock_guard{m_mutex};
+  return m_num_batches;
+}
+
+void GroupCommitter::run(std::stop_token token) {
+  auto lock = std::unique_lock{m_mutex};
+  while (true) {
+    m_cv.wait(lock, token, [this] { return !m_batches.empty(); });
+    if (m_batches.empty()) {
+      // stopped
+      return;
+    }
+    // once stopped, the batch is synced right away
+    auto &oldest = m_batches.front();
+    m_cv.wait_until(lock, token, oldest.start + m_options.interval, [&] {
+      return oldest.commits.size() >= m_options.max_batch ||
+             m_batches.size() > 1;
+    });
+
+    auto batch = std::move(oldest);
+    m_batches.pop_front();
+    m_syncing = true;
+    lock.unlock();
+    // the next batch fills in the meantime
+    auto ec = sync(batch);
+    lock.lock();
+    m_syncing = false;
+    ++m_num_batches;
+    batch.promise.set_value(ec);
+    m_synced_cv.notify_all();
+  }
+}
+
+std::error_code GroupCommitter::sync(Batch const &batch) const {
+  auto first_error = std::error_code{};
+  auto check = [&first_error](int result) {
+    if (result != 0 && !first_error) {
+      first_error = LastError();
+    }
+  };
+  if (m_options.use_syncfs) {
+    // a batch is never empty
+    check(syncfs(batch.commits.front().fd));
+  } else {
+    auto directories = std::pmr::vector<Commit const *>{m_resource};
+    for (auto const &commit : batch.commits) {
+      check(fdatasync(commit.fd));
+      if (commit.directory_fd >= 0) {
+        directories.push_back(&commit);
+      }
+    }
+    // each directory is synced once, no matter how many new files it got
+    auto by_path = [](Commit const *lhs, Commit const *rhs) {
+      return lhs->directory_path < rhs->directory_path;
+    };
+    std::sort(directories.begin(), directories.end(), by_path);
+    auto same_path = [](Commit const *lhs, Commit const *rhs) {
+      return lhs->directory_path == rhs->directory_path;
+    };
+    directories.erase(
+        std::unique(directories.begin(), directories.end(), same_path),
+        directories.end());
+    for (auto const *commit : directories) {
+      check(fsync(commit->directory_fd));
+    }
+  }
+  for (auto const &commit : batch.commits) {
+    ::close(commit.fd);
+    if (commit.directory_fd >= 0) {
+      ::close(commit.directory_fd);
+    }
+  }
+  return first_error;
+}
+
+} // namespace objectstore
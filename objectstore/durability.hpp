@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory_resource>
+#include <mutex>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace objectstore {
+
+/**
+ * @brief When the content of a closed object is guaranteed to be on disk.
+ */
+enum class Durability {
+  /// Whenever the kernel writes it back, nothing is ever synced.
+  None,
+  /// Before close() returns, each object with a sync of its own.
+  Sync,
+  /// Shortly after close(), together with the other objects closed in the
+  /// meantime, see GroupCommitter.
+  GroupCommit
+};
+
+struct GroupCommitOptions {
+  /// Longest time a commit waits for others to join its batch.
+  std::chrono::microseconds interval{1'000};
+  /// A batch is synced right away once it holds this many commits.
+  std::size_t max_batch = 128;
+  /// Batches that may wait for their sync, the one being synced included.
+  /// Once they are all full, commit() blocks until the oldest is synced, so
+  /// that no more than max_pending_batches * max_batch commits hold open
+  /// descriptors.
+  std::size_t max_pending_batches = 2;
+  /// Syncs the whole file system with a single syncfs() per batch instead of
+  /// each file and directory on its own. Cheaper for large batches of small
+  /// files, but also waits for unrelated writes to the same file system.
+  bool use_syncfs = false;
+};
+
+/**
+ * @brief Makes a file durable: its data with fdatasync(), and with
+ * sync_directory its directory entry as well, which a new file needs.
+ */
+std::error_code SyncFile(std::filesystem::path const &file_path,
+                         bool sync_directory);
+
+/**
+ * @brief Batches commits from any number of threads into as few syncs as
+ * possible.
+ *
+ * A background thread collects the commits arriving within the interval
+ * after the first one of a batch, or until the batch is full, and syncs them
+ * all before it completes their futures. A batch is synced while the next
+ * one fills, so callers that do not wait for their future right away keep
+ * the disk busy without ever waiting for it.
+ *
+ * Files are opened when they are committed and synced through these
+ * descriptors, so a file that is removed or replaced in the meantime does
+ * not fail the batch, nor is another file at the same path synced instead.
+ * Callers that outpace the disk are held back in commit(), see
+ * GroupCommitOptions::max_pending_batches.
+ */
+class GroupCommitter {
+public:
+  GroupCommitter(std::pmr::memory_resource *resource,
+                 GroupCommitOptions options);
+
+  GroupCommitter(const GroupCommitter &) = delete;
+  GroupCommitter &operator=(const GroupCommitter &) = delete;
+
+  /**
+   * @brief Syncs the pending batch before the thread stops.
+   */
+  ~GroupCommitter();
+
+  /**
+   * @brief Adds the file to the current batch, first waiting for the oldest
+   * batch to be synced if there are too many already.
+   *
+   * @return ready once the file is on disk, see SyncFile(), with the first
+   * error of its batch, or right away if the file cannot be opened
+   */
+  std::shared_future<std::error_code> commit(std::filesystem::path file_path,
+                                             bool sync_directory);
+
+  /**
+   * @return the number of batches synced so far
+   */
+  std::size_t num_batches() const;
+
+private:
+  struct Commit {
+    int fd;
+    /// Only set with sync_directory.
+    int directory_fd;
+    std::filesystem::path directory_path;
+  };
+
+  struct Batch {
+    explicit Batch(std::pmr::memory_resource *resource)
+        : commits{resource}, future{promise.get_future().share()},
+          start{std::chrono::steady_clock::now()} {}
+
+    std::pmr::vector<Commit> commits;
+    std::promise<std::error_code> promise;
+    std::shared_future<std::error_code> future;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  /**
+   * @return whether a commit has to wait before it can join a batch
+   */
+  bool full() const;
+  void run(std::stop_token token);
+  /**
+   * @brief Syncs the commits of the batch and closes their descriptors.
+   */
+  std::error_code sync(Batch const &batch) const;
+
+  std::pmr::memory_resource *m_resource;
+  GroupCommitOptions m_options;
+
+  mutable std::mutex m_mutex;
+  /// Oldest first, only the last one takes new commits.
+  std::pmr::list<Batch> m_batches;
+  /// Whether the thread syncs a batch that is no longer in m_batches.
+  bool m_syncing = false;
+  std::size_t m_num_batches = 0;
+
+  std::condition_variable_any m_cv;
+  /// Signalled whenever a batch has been synced.
+  std::condition_variable m_synced_cv;
+  // declared last, so that it is stopped before any other member goes away
+  std::jthread m_thread;
+};
+
+} // namespace objectstore
@@ -0,0 +1,292 @@
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <system_error>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <durability.hpp>
+#include <objectstore.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_durability";
+constexpr std::size_t kNumFiles = 100;
+
+std::vector<std::filesystem::path> CreateFiles() {
+  std::filesystem::create_directories(kTestPath);
+  auto paths = std::vector<std::filesystem::path>{};
+  for (std::size_t i = 0; i < kNumFiles; ++i) {
+    paths.push_back(std::filesystem::path{kTestPath} / std::to_string(i));
+    std::ofstream{paths.back()} << i;
+  }
+  return paths;
+}
+
+std::size_t NumOpenFiles() {
+  auto const entries = std::filesystem::directory_iterator{"/proc/self/fd"};
+  return static_cast<std::size_t>(
+      std::distance(std::filesystem::begin(entries),
+                    std::filesystem::end(entries)));
+}
+
+bool IsReady(std::shared_future<std::error_code> const &future) {
+  return future.wait_for(std::chrono::seconds{0}) ==
+         std::future_status::ready;
+}
+
+} // namespace
+
+TEST(SyncFile, ReportsErrors) {
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto const paths = CreateFiles();
+  EXPECT_FALSE(objectstore::SyncFile(paths[0], false));
+  EXPECT_FALSE(objectstore::SyncFile(paths[0], true));
+  EXPECT_EQ(objectstore::SyncFile(std::filesystem::path{kTestPath} / "none",
+                                  false),
+            std::errc::no_such_file_or_directory);
+}
+
+TEST(GroupCommitter, BatchesWithinInterval) {
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto const paths = CreateFiles();
+  auto options = objectstore::GroupCommitOptions{};
+  options.interval = std::chrono::milliseconds{200};
+  options.max_batch = 1000;
+  auto committer =
+      objectstore::GroupCommitter{std::pmr::get_default_resource(), options};
+
+  auto futures = std::vector<std::shared_future<std::error_code>>{};
+  for (auto const &path : paths) {
+    futures.push_back(committer.commit(path, true));
+  }
+  EXPECT_FALSE(IsReady(futures.back()));
+  for (auto const &future : futures) {
+    EXPECT_FALSE(future.get());
+  }
+  EXPECT_EQ(committer.num_batches(), 1u);
+
+  // a missing file fails right away, without the others
+  auto failed = committer.commit(std::filesystem::path{kTestPath} / "none",
+                                 false);
+  EXPECT_TRUE(IsReady(failed));
+  auto ok = committer.commit(paths[0], false);
+  EXPECT_EQ(failed.get(), std::errc::no_such_file_or_directory);
+  EXPECT_FALSE(ok.get());
+
+  // files removed after their commit are still synced
+  auto removed = committer.commit(paths[1], true);
+  std::filesystem::remove(paths[1]);
+  std::filesystem::rename(kTestPath, std::string{kTestPath} + ".moved");
+  auto _moved = common::MakeScopeGuard([] {
+    std::filesystem::remove_all(std::string{kTestPath} + ".moved");
+  });
+  EXPECT_FALSE(removed.get());
+}
+
+TEST(GroupCommitter, FullBatchesDoNotWait) {
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto const paths = CreateFiles();
+  auto options = objectstore::GroupCommitOptions{};
+  options.interval = std::chrono::hours{1};
+  options.max_batch = 10;
+  options.use_syncfs = true;
+  auto committer = std::optional<objectstore::GroupCommitter>{};
+  committer.emplace(std::pmr::get_default_resource(), options);
+
+  auto futures = std::vector<std::shared_future<std::error_code>>{};
+  for (auto const &path : paths) {
+    futures.push_back(committer->commit(path, false));
+  }
+  for (auto const &future : futures) {
+    EXPECT_FALSE(future.get());
+  }
+  EXPECT_EQ(committer->num_batches(), kNumFiles / options.max_batch);
+
+  // a partial batch is synced when the committer goes away
+  auto pending = committer->commit(paths[0], false);
+  committer.reset();
+  EXPECT_TRUE(IsReady(pending));
+}
+
+TEST(GroupCommitter, LimitsPendingCommits) {
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto const paths = CreateFiles();
+  auto options = objectstore::GroupCommitOptions{};
+  options.max_batch = 4;
+  options.max_pending_batches = 2;
+
+  // a commit holds two descriptors, the file and its directory
+  auto limit = rlimit{};
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+  auto const previous = limit;
+  limit.rlim_cur =
+      NumOpenFiles() + 2 * options.max_batch * options.max_pending_batches + 8;
+  ASSERT_LT(limit.rlim_cur, 2 * kNumFiles);
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+  auto restore = common::MakeScopeGuard(
+      [&previous] { setrlimit(RLIMIT_NOFILE, &previous); });
+
+  auto committer =
+      objectstore::GroupCommitter{std::pmr::get_default_resource(), options};
+  auto futures = std::vector<std::shared_future<std::error_code>>{};
+  for (auto const &path : paths) {
+    futures.push_back(committer.commit(path, true));
+  }
+  for (auto const &future : futures) {
+    EXPECT_FALSE(future.get());
+  }
+}
+
+class StoredFolderDurabilityTest
+    : public testing::TestWithParam<objectstore::Durability> {};
+
+TEST_P(StoredFolderDurabilityTest, Commit) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = 1;
+  options.durability = GetParam();
+  options.group_commit.interval = std::chrono::milliseconds{5};
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  {
+    auto folder = objectstore::StoredFolder{resource, kTestPath, options};
+    auto futures = std::vector<std::shared_future<std::error_code>>{};
+    for (std::size_t i = 0; i < kNumFiles; ++i) {
+      ids.push_back(folder.add());
+      *folder.get(ids.back()) << "object " << i;
+      futures.push_back(folder.commit(ids.back()));
+    }
+    for (auto const &future : futures) {
+      EXPECT_FALSE(future.get());
+    }
+
+    // never written, but still part of the folder
+    auto empty = folder.add();
+    EXPECT_FALSE(folder.commit(empty).get());
+    EXPECT_EQ(folder.commit(empty + 1).get(),
+              std::errc::no_such_file_or_directory);
+
+    auto *stream = folder.get(ids[0]);
+    stream->seekp(0, std::ios::end);
+    *stream << " again";
+    folder.close(ids[0]);
+  }
+
+  auto folder = objectstore::StoredFolder{resource, kTestPath, options};
+  for (std::size_t i = 0; i < kNumFiles; ++i) {
+    auto *stream = folder.get(ids[i]);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>{*stream}, {}),
+              "object " + std::to_string(i) + (i == 0 ? " again" : ""));
+    folder.close(ids[i]);
+  }
+
+  // objects destroyed before their batch is synced do not fail it
+  auto destroyed = folder.add();
+  *folder.get(destroyed) << "gone";
+  auto commit = folder.commit(destroyed);
+  auto kept = folder.add();
+  *folder.get(kept) << "kept";
+  auto kept_commit = folder.commit(kept);
+  folder.destroy(destroyed);
+  folder.clear();
+  EXPECT_FALSE(commit.get());
+  EXPECT_FALSE(kept_commit.get());
+}
+
+TEST_P(StoredFolderDurabilityTest, CloseReportsErrors) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.durability = GetParam();
+  options.group_commit.interval = std::chrono::milliseconds{1};
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto folder = objectstore::StoredFolder{resource, kTestPath, options};
+
+  auto id = folder.add();
+  *folder.get(id) << "synced";
+  folder.close(id);
+  EXPECT_FALSE(folder.wait_for_commits());
+
+  // the file is gone by the time the object is synced again
+  *folder.get(id) << " twice";
+  std::filesystem::remove(folder.path(id));
+  switch (GetParam()) {
+  case objectstore::Durability::None:
+    folder.close(id);
+    EXPECT_FALSE(folder.wait_for_commits());
+    break;
+  case objectstore::Durability::Sync:
+    EXPECT_THROW(folder.close(id), std::system_error);
+    EXPECT_FALSE(folder.wait_for_commits());
+    break;
+  case objectstore::Durability::GroupCommit:
+    folder.close(id);
+    EXPECT_EQ(folder.wait_for_commits(), std::errc::no_such_file_or_directory);
+    // reported once
+    EXPECT_FALSE(folder.wait_for_commits());
+    break;
+  }
+}
+
+TEST(StoredFolderDurability, ClearWithReaperForgetsCommits) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.durability = objectstore::Durability::GroupCommit;
+  options.group_commit.interval = std::chrono::milliseconds{1};
+  options.deferred_deletion = true;
+  auto _ = common::MakeScopeGuard([] {
+    std::filesystem::remove_all(kTestPath);
+    std::filesystem::remove_all(std::string{kTestPath} + ".trash");
+  });
+  auto folder = objectstore::StoredFolder{resource, kTestPath, options};
+
+  auto id = folder.add();
+  *folder.get(id) << "synced";
+  folder.close(id);
+  EXPECT_FALSE(folder.wait_for_commits());
+
+  // a commit that fails, of an object that is cleared before it is reaped
+  *folder.get(id) << " twice";
+  std::filesystem::remove(folder.path(id));
+  folder.close(id);
+  folder.clear();
+  EXPECT_FALSE(folder.wait_for_commits());
+
+  auto kept = folder.add();
+  *folder.get(kept) << "kept";
+  folder.close(kept);
+  EXPECT_FALSE(folder.wait_for_commits());
+  folder.wait_for_deletion();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Modes, StoredFolderDurabilityTest,
+    testing::Values(objectstore::Durability::None,
+                    objectstore::Durability::Sync,
+                    objectstore::Durability::GroupCommit),
+    [](auto const &info) {
+      switch (info.param) {
+      case objectstore::Durability::None:
+        return "None";
+      case objectstore::Durability::Sync:
+        return "Sync";
+      case objectstore::Durability::GroupCommit:
+        return "GroupCommit";
+      }
+      return "Unknown";
+    });
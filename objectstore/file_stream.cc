@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "file_stream.hpp"
+
+namespace objectstore {
+
+namespace {
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::error_code WriteFully(int fd, std::uint64_t offset, char const *data,
+                           std::size_t size, FileStreamStats *stats) {
+  while (size > 0) {
+    auto res = pwrite(fd, data, size, static_cast<off_t>(offset));
+    ++stats->writes;
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    data += res;
+    size -= static_cast<std::size_t>(res);
+    offset += static_cast<std::uint64_t>(res);
+    stats->bytes_written += static_cast<std::uint64_t>(res);
+  }
+  return {};
+}
+
+/**
+ * @return what a single pread() returns, which is less than size not only at
+ * the end of the file
+ */
+std::pair<std::size_t, std::error_code> ReadSome(int fd, std::uint64_t offset,
+                                                 char *data, std::size_t size,
+                                                 FileStreamStats *stats) {
+  while (true) {
+    auto res = pread(fd, data, size, static_cast<off_t>(offset));
+    ++stats->reads;
+    if (res >= 0) {
+      stats->bytes_read += static_cast<std::uint64_t>(res);
+      return std::make_pair(static_cast<std::size_t>(res), std::error_code{});
+    }
+    if (errno != EINTR) {
+      return std::make_pair(0, LastError());
+    }
+  }
+}
+
+/**
+ * @return the number of bytes read, less than size only at the end of the
+ * file or on an error
+ */
+std::pair<std::size_t, std::error_code>
+ReadFully(int fd, std::uint64_t offset, char *data, std::size_t size,
+          FileStreamStats *stats) {
+  std::size_t done = 0;
+  while (done < size) {
+    auto [read, ec] = ReadSome(fd, offset + done, data + done, size - done,
+                                 stats);
+    if (ec || read == 0) {
+      return std::make_pair(done, ec);
+    }
+    done += read;
+  }
+  return std::make_pair(done, std::error_code{});
+}
+
+std::size_t BufferSize(FileStreamOptions const &options) {
+  if (!options.direct_io) {
+    return std::max<std::size_t>(options.buffer_size, 1);
+  }
+  auto const blocks = (options.buffer_size + kDirectIoAlignment - 1) /
+                      kDirectIoAlignment;
+  return std::max<std::size_t>(blocks, 1) * kDirectIoAlignment;
+}
+
+} // namespace
+
+FileStreambuf::FileStreambuf(std::pmr::memory_resource *resource,
+                             FileStreamOptions const &options)
+    : m_resource{resource}, m_buffer_size{BufferSize(options)},
+      m_alignment{options.direct_io ? kDirectIoAlignment : 1},
+      m_direct_io{options.direct_io} {}
+
+FileStreambuf::~FileStreambuf() { close(); }
+
+std::error_code FileStreambuf::open(std::filesystem::path const &file_path) {
+  close();
+  m_fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  ++m_stats.opens;
+  if (m_fd < 0) {
+    return LastError();
+  }
+  if (m_direct_io) {
+    // file systems without O_DIRECT refuse to open the file with it
+    m_direct_fd = ::open(file_path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    ++m_stats.opens;
+  }
+  return {};
+}
+
+std::error_code FileStreambuf::close() {
+  if (!is_open()) {
+    return {};
+  }
+  auto ec = write_output();
+  release_buffer();
+  m_offset = 0;
+  if (m_direct_fd >= 0) {
+    ::close(std::exchange(m_direct_fd, -1));
+    ++m_stats.closes;
+  }
+  ::close(std::exchange(m_fd, -1));
+  ++m_stats.closes;
+  return ec;
+}
+
+int FileStreambuf::release_buffer() {
+  auto const position = this->position();
+  auto const result = sync();
+  setg(nullptr, nullptr, nullptr);
+  m_offset = position;
+  if (m_buffer != nullptr) {
+    m_resource->deallocate(m_buffer, m_buffer_size,
+                           std::max(m_alignment, alignof(std::max_align_t)));
+    m_buffer = nullptr;
+  }
+  return result;
+}
+
+FileStreambuf::int_type FileStreambuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  if (!is_open()) {
+    return traits_type::eof();
+  }
+  auto const position = this->position();
+  if (write_output()) {
+    return traits_type::eof();
+  }
+  allocate();
+  m_offset = position;
+  auto [read, ec] = ReadSome(m_fd, m_offset, m_buffer, m_buffer_size, &m_stats);
+  if (ec || read == 0) {
+    setg(nullptr, nullptr, nullptr);
+    return traits_type::eof();
+  }
+  setg(m_buffer, m_buffer, m_buffer + read);
+  return traits_type::to_int_type(*gptr());
+}
+
+FileStreambuf::int_type FileStreambuf::overflow(int_type ch) {
+  if (!is_open()) {
+    return traits_type::eof();
+  }
+  if (pbase() == nullptr || pptr() == epptr()) {
+    auto const position = this->position();
+    if (write_output()) {
+      return traits_type::eof();
+    }
+    allocate();
+    m_offset = position;
+    start_output();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize FileStreambuf::xsgetn(char_type *s, std::streamsize count) {
+  if (static_cast<std::size_t>(count) < m_buffer_size || !is_open()) {
+    return std::streambuf::xsgetn(s, count);
+  }
+  // large reads take what is buffered and go to the file for the rest
+  auto const buffered = std::min<std::streamsize>(count, egptr() - gptr());
+  if (buffered > 0) {
+    std::memcpy(s, gptr(), static_cast<std::size_t>(buffered));
+    setg(eback(), gptr() + buffered, egptr());
+  }
+  auto const position = this->position();
+  if (write_output()) {
+    return buffered;
+  }
+  setg(nullptr, nullptr, nullptr);
+  m_offset = position;
+  auto [read, ec] =
+      ReadFully(m_fd, m_offset, s + buffered,
+                static_cast<std::size_t>(count - buffered), &m_stats);
+  m_offset += read;
+  return buffered + static_cast<std::streamsize>(read);
+}
+
+std::streamsize FileStreambuf::xsputn(char_type const *s,
+                                      std::streamsize count) {
+  // with O_DIRECT, only the buffer is aligned
+  if (static_cast<std::size_t>(count) < m_buffer_size || direct() ||
+      !is_open()) {
+    return std::streambuf::xsputn(s, count);
+  }
+  auto const position = this->position();
+  if (write_output()) {
+    return 0;
+  }
+  setg(nullptr, nullptr, nullptr);
+  m_offset = position;
+  if (WriteFully(m_fd, m_offset, s, static_cast<std::size_t>(count),
+                 &m_stats)) {
+    return 0;
+  }
+  m_offset += static_cast<std::uint64_t>(count);
+  return count;
+}
+
+FileStreambuf::pos_type FileStreambuf::seekoff(off_type off,
+                                               std::ios_base::seekdir dir,
+                                               std::ios_base::openmode) {
+  if (!is_open()) {
+    return pos_type(off_type(-1));
+  }
+  auto const position = this->position();
+  if (dir == std::ios_base::cur && off == 0) {
+    // tellg() and tellp() leave the buffer alone
+    return pos_type(static_cast<off_type>(position));
+  }
+  if (write_output()) {
+    return pos_type(off_type(-1));
+  }
+  auto base = off_type{0};
+  if (dir == std::ios_base::cur) {
+    base = static_cast<off_type>(position);
+  } else if (dir == std::ios_base::end) {
+    struct stat st {};
+    if (fstat(m_fd, &st) != 0) {
+      return pos_type(off_type(-1));
+    }
+    base = static_cast<off_type>(st.st_size);
+  }
+  if (base + off < 0) {
+    return pos_type(off_type(-1));
+  }
+  setg(nullptr, nullptr, nullptr);
+  m_offset = static_cast<std::uint64_t>(base + off);
+  return pos_type(base + off);
+}
+
+FileStreambuf::pos_type FileStreambuf::seekpos(pos_type pos,
+                                               std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+int FileStreambuf::sync() { return write_output() ? -1 : 0; }
+
+std::uint64_t FileStreambuf::position() const {
+  if (pbase() != nullptr) {
+    return m_offset + static_cast<std::uint64_t>(pptr() - pbase());
+  }
+  if (eback() != nullptr) {
+    return m_offset + static_cast<std::uint64_t>(gptr() - eback());
+  }
+  return m_offset;
+}
+
+void FileStreambuf::allocate() {
+  if (m_buffer == nullptr) {
+    m_buffer = static_cast<char *>(m_resource->allocate(
+        m_buffer_size, std::max(m_alignment, alignof(std::max_align_t))));
+  }
+}
+
+void FileStreambuf::start_output() {
+  setg(nullptr, nullptr, nullptr);
+  // the output starts as far into the buffer as m_offset is into its block,
+  // so that the blocks in the file and in memory line up for O_DIRECT
+  setp(m_buffer + m_offset % m_alignment, m_buffer + m_buffer_size);
+}
+
+std::error_code FileStreambuf::write_output() {
+  if (pbase() == nullptr) {
+    return {};
+  }
+  auto const *data = pbase();
+  auto const size = static_cast<std::size_t>(pptr() - pbase());
+  setp(nullptr, nullptr);
+  auto ec = direct() ? write_direct(m_offset, data, size)
+                     : WriteFully(m_fd, m_offset, data, size, &m_stats);
+  // like with any file buffer, output that could not be written is lost
+  m_offset += size;
+  return ec;
+}
+
+std::error_code FileStreambuf::write_direct(std::uint64_t offset,
+                                            char const *data,
+                                            std::size_t size) {
+  auto const head =
+      std::min(size, (m_alignment - offset % m_alignment) % m_alignment);
+  auto const body = (size - head) / m_alignment * m_alignment;
+  if (auto ec = WriteFully(m_fd, offset, data, head, &m_stats)) {
+    return ec;
+  }
+  if (body > 0) {
+    auto ec =
+        WriteFully(m_direct_fd, offset + head, data + head, body, &m_stats);
+    if (ec == std::errc::invalid_argument) {
+      // the device needs a larger alignment, continue without O_DIRECT
+      ::close(std::exchange(m_direct_fd, -1));
+      ++m_stats.closes;
+      ec = WriteFully(m_fd, offset + head, data + head, body, &m_stats);
+    }
+    if (ec) {
+      return ec;
+    }
+  }
+  return WriteFully(m_fd, offset + head + body, data + head + body,
+                    size - head - body, &m_stats);
+}
+
+} // namespace objectstore
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory_resource>
+#include <streambuf>
+#include <system_error>
+#include <utility>
+
+namespace objectstore {
+
+struct FileStreamOptions {
+  /// Size of the buffer of an open stream, allocated from the memory resource
+  /// with the first read or write. Reads and writes of at least this size
+  /// bypass it.
+  std::size_t buffer_size = 64 << 10;
+  /// Writes whole blocks of kDirectIoAlignment with O_DIRECT, past the page
+  /// cache, for bulk sequential writes of data that is not read back soon.
+  /// The bytes around them and all reads still go through the page cache.
+  /// Without support by the file system, everything does.
+  bool direct_io = false;
+};
+
+/**
+ * @brief What a stream did with its file, see FileStreambuf::take_stats().
+ */
+struct FileStreamStats {
+  /// Calls of open() and close() on the file, two each with O_DIRECT.
+  std::uint64_t opens = 0;
+  std::uint64_t closes = 0;
+  /// Calls of pread() and pwrite().
+  std::uint64_t reads = 0;
+  std::uint64_t writes = 0;
+  std::uint64_t bytes_read = 0;
+  std::uint64_t bytes_written = 0;
+};
+
+/**
+ * The alignment of file offsets, lengths and buffers for O_DIRECT, which is
+ * enough for the logical block size of all common devices.
+ */
+constexpr std::size_t kDirectIoAlignment = 4096;
+
+/**
+ * @brief A stream buffer over a file that reads and writes through a large
+ * buffer with plain pread() and pwrite() calls.
+ *
+ * Like a file buffer, there is a single position for reading and writing,
+ * and the buffer holds either input or output: pending output is written
+ * before the next read or seek. Unlike std::filebuf, it does no locale
+ * conversion and takes its buffer from the memory resource, which
+ * release_buffer() and close() give back.
+ */
+class FileStreambuf : public std::streambuf {
+public:
+  FileStreambuf(std::pmr::memory_resource *resource,
+                FileStreamOptions const &options);
+
+  FileStreambuf(const FileStreambuf &) = delete;
+  FileStreambuf &operator=(const FileStreambuf &) = delete;
+
+  /**
+   * @brief Closes the file, errors are lost.
+   */
+  ~FileStreambuf() override;
+
+  /**
+   * @brief Opens the file for reading and writing at position zero, creating
+   * it if it does not exist. An open file is closed first.
+   */
+  std::error_code open(std::filesystem::path const &file_path);
+
+  /**
+   * @brief Writes pending output and closes the file. Until the next open(),
+   * every read and write fails.
+   *
+   * @return the error if the output could not be written
+   */
+  std::error_code close();
+
+  bool is_open() const { return m_fd >= 0; }
+
+  /**
+   * @return whether whole blocks are written with O_DIRECT
+   */
+  bool direct() const { return m_direct_fd >= 0; }
+
+  /**
+   * @brief Writes pending output and frees the buffer until the next read or
+   * write, keeping the position.
+   *
+   * @return zero, or -1 if the output could not be written
+   */
+  int release_buffer();
+
+  /**
+   * @return what the stream did since the last call
+   */
+  FileStreamStats take_stats() { return std::exchange(m_stats, {}); }
+
+protected:
+  int_type underflow() override;
+  int_type overflow(int_type ch) override;
+  std::streamsize xsgetn(char_type *s, std::streamsize count) override;
+  std::streamsize xsputn(char_type const *s, std::streamsize count) override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+  int sync() override;
+
+private:
+  std::uint64_t position() const;
+  void allocate();
+  void start_output();
+  std::error_code write_output();
+  std::error_code write_direct(std::uint64_t offset, char const *data,
+                               std::size_t size);
+
+  std::pmr::memory_resource *m_resource;
+  std::size_t m_buffer_size;
+  /// kDirectIoAlignment with O_DIRECT, one otherwise.
+  std::size_t m_alignment;
+  bool m_direct_io;
+  int m_fd = -1;
+  /// Only for the aligned blocks of the output, -1 without O_DIRECT.
+  int m_direct_fd = -1;
+  char *m_buffer = nullptr;
+  /// The file offset of the start of the input or output in the buffer, or
+  /// the position if the buffer holds neither.
+  std::uint64_t m_offset = 0;
+  FileStreamStats m_stats;
+};
+
+/**
+ * @brief std::iostream over a FileStreambuf, opened and closed like a
+ * std::fstream. It is bad while the file cannot be opened.
+ */
+class FileStream : public std::iostream {
+public:
+  FileStream(std::pmr::memory_resource *resource,
+             FileStreamOptions const &options)
+      : std::iostream{nullptr}, m_buffer{resource, options} {
+    rdbuf(&m_buffer);
+  }
+
+  FileStream(std::pmr::memory_resource *resource,
+             std::filesystem::path const &file_path,
+             FileStreamOptions const &options)
+      : FileStream{resource, options} {
+    open(file_path);
+  }
+
+  void open(std::filesystem::path const &file_path) {
+    clear();
+    if (m_buffer.open(file_path)) {
+      setstate(std::ios::badbit);
+    }
+  }
+
+  void close() {
+    if (m_buffer.close()) {
+      setstate(std::ios::failbit);
+    }
+  }
+
+  bool is_open() const { return m_buffer.is_open(); }
+
+  FileStreambuf &buffer() { return m_buffer; }
+  FileStreambuf const &buffer() const { return m_buffer; }
+
+private:
+  FileStreambuf m_buffer;
+};
+
+} // namespace objectstore
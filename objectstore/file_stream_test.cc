@@ -0,0 +1,183 @@
+#include <cstddef>
+#include <filesystem>
+#include <iterator>
+#include <memory_resource>
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <file_stream.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_file_stream.dat";
+
+/**
+ * Counts the bytes currently allocated through it.
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t allocated() const { return m_allocated; }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    m_allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    m_allocated -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+
+  std::size_t m_allocated = 0;
+};
+
+std::string Random(std::size_t size) {
+  auto engine = std::mt19937_64{7};
+  auto text = std::string(size, '\0');
+  for (auto &c : text) {
+    c = static_cast<char>(engine());
+  }
+  return text;
+}
+
+std::string ReadAll(std::iostream *stream) {
+  stream->seekg(0);
+  return std::string{std::istreambuf_iterator<char>{*stream}, {}};
+}
+
+objectstore::FileStreamOptions Options(std::size_t buffer_size,
+                                       bool direct_io) {
+  auto options = objectstore::FileStreamOptions{};
+  options.buffer_size = buffer_size;
+  options.direct_io = direct_io;
+  return options;
+}
+
+class FileStreamTest : public ::testing::TestWithParam<bool> {
+protected:
+  void SetUp() override { std::filesystem::remove(kTestPath); }
+  void TearDown() override { std::filesystem::remove(kTestPath); }
+};
+
+} // namespace
+
+TEST_P(FileStreamTest, WritesAndReadsAcrossBuffers) {
+  auto const content = Random(3 * objectstore::kDirectIoAlignment + 123);
+  auto resource = std::pmr::get_default_resource();
+  {
+    auto stream =
+        objectstore::FileStream{resource, kTestPath, Options(100, GetParam())};
+    ASSERT_TRUE(stream.good());
+    // small writes through the buffer and large ones past it
+    std::size_t written = 0;
+    for (std::size_t chunk : {7, 300, 1, 5000, 64}) {
+      stream.write(content.data() + written,
+                   static_cast<std::streamsize>(chunk));
+      written += chunk;
+    }
+    stream.write(content.data() + written,
+                 static_cast<std::streamsize>(content.size() - written));
+    EXPECT_EQ(stream.tellp(), static_cast<std::streamoff>(content.size()));
+    EXPECT_EQ(ReadAll(&stream), content);
+
+    stream.clear();
+    stream.seekg(50);
+    auto piece = std::string(5000, '\0');
+    stream.read(piece.data(), static_cast<std::streamsize>(piece.size()));
+    EXPECT_EQ(piece, content.substr(50, 5000));
+    char c = 0;
+    stream.get(c);
+    EXPECT_EQ(c, content[5050]);
+  }
+  EXPECT_EQ(std::filesystem::file_size(kTestPath), content.size());
+}
+
+TEST_P(FileStreamTest, WritesAtUnalignedPositions) {
+  auto const content = Random(5 * objectstore::kDirectIoAlignment);
+  auto resource = std::pmr::get_default_resource();
+  auto stream = objectstore::FileStream{resource, kTestPath,
+                                        Options(8 << 10, GetParam())};
+  stream << std::string(content.size(), 'x');
+  stream.seekp(100);
+  stream.write(content.data(),
+               static_cast<std::streamsize>(content.size() - 200));
+  stream.flush();
+
+  auto expected = std::string(content.size(), 'x');
+  expected.replace(100, content.size() - 200, content, 0,
+                   content.size() - 200);
+  EXPECT_EQ(ReadAll(&stream), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(Buffering, FileStreamTest, ::testing::Bool(),
+                         [](auto const &info) {
+                           return info.param ? "Direct" : "Buffered";
+                         });
+
+TEST(FileStream, SinglePosition) {
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+  auto resource = std::pmr::get_default_resource();
+  auto stream =
+      objectstore::FileStream{resource, kTestPath, Options(4, false)};
+  stream << "hello world";
+  stream.seekg(6);
+  auto word = std::string{};
+  stream >> word;
+  EXPECT_EQ(word, "world");
+
+  // writing overwrites in place, the file is never truncated
+  stream.clear();
+  stream.seekp(0);
+  stream << "J";
+  EXPECT_EQ(stream.tellg(), 1);
+  EXPECT_EQ(ReadAll(&stream), "Jello world");
+
+  stream.clear();
+  stream.seekp(0, std::ios::end);
+  EXPECT_EQ(stream.tellp(), 11);
+  stream << "!";
+  EXPECT_EQ(ReadAll(&stream), "Jello world!");
+}
+
+TEST(FileStream, ReleaseAndCloseGiveMemoryBack) {
+  auto _ = common::MakeScopeGuard([] { std::filesystem::remove(kTestPath); });
+  auto resource = CountingResource{};
+  {
+    auto stream =
+        objectstore::FileStream{&resource, kTestPath, Options(1 << 20, false)};
+    EXPECT_EQ(resource.allocated(), 0u);
+    stream << "first";
+    EXPECT_EQ(resource.allocated(), std::size_t{1} << 20);
+
+    EXPECT_EQ(stream.buffer().release_buffer(), 0);
+    EXPECT_EQ(resource.allocated(), 0u);
+    EXPECT_EQ(std::filesystem::file_size(kTestPath), 5u);
+
+    // the position is kept
+    stream << " second";
+    EXPECT_EQ(ReadAll(&stream), "first second");
+
+    stream.close();
+    EXPECT_EQ(resource.allocated(), 0u);
+    stream << "lost";
+    EXPECT_FALSE(stream.good());
+    stream.open(kTestPath);
+    EXPECT_TRUE(stream.good());
+    EXPECT_EQ(ReadAll(&stream), "first second");
+  }
+}
+
+TEST(FileStream, MissingDirectoryMakesStreamBad) {
+  auto resource = std::pmr::get_default_resource();
+  auto stream = objectstore::FileStream{
+      resource, "objectstore_test_missing_dir/file.dat", Options(64, false)};
+  EXPECT_TRUE(stream.bad());
+  EXPECT_FALSE(stream.is_open());
+}
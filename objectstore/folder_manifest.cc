@@ -0,0 +1,736 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <scopeguard.hpp>
+
+#include "folder_manifest.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr auto kManifestName = ".manifest";
+constexpr auto kManifestTmpName = ".manifest.tmp";
+constexpr char kManifestMagic[8] = {'O', 'S', 'M', 'N', 'F', 'S', 'T', '2'};
+constexpr std::size_t kDirentBufferSize = 256 << 10;
+
+/**
+ * The manifest is this header followed by count object ids and a stamp of the
+ * root and of each of the num_directories fan-out directories. The stamps are
+ * filled in once the manifest is in place, because renaming a new one into
+ * place changes the modification time of the root, and the manifest is only
+ * marked as sealed after that. An existing manifest is rewritten in place,
+ * which leaves the root alone.
+ *
+ * File system timestamps are coarse, so a change in the same clock tick as
+ * the recorded modification time would go unnoticed. The stamps are therefore
+ * only written once the clock has moved on, and the manifest is only trusted
+ * if its own modification time is newer than all recorded ones.
+ */
+struct ManifestHeader {
+  char magic[8];
+  std::uint64_t count;
+  std::uint64_t next_object_id;
+  std::uint64_t checksum;
+  std::uint64_t num_directories;
+  std::uint32_t fanout_levels;
+  std::uint32_t sealed;
+  std::uint64_t reserved[2];
+};
+static_assert(sizeof(ManifestHeader) == 64);
+
+struct DirectoryStamp {
+  std::uint64_t key;
+  std::uint64_t inode;
+  std::int64_t mtime_sec;
+  std::int64_t mtime_nsec;
+};
+static_assert(sizeof(DirectoryStamp) == 32);
+
+/**
+ * Layout of the records returned by getdents64(), which glibc only declares
+ * for _GNU_SOURCE builds of recent versions.
+ */
+struct LinuxDirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::uint64_t Checksum(std::span<const std::uint64_t> ids,
+                       std::uint64_t next_object_id,
+                       std::span<const DirectoryStamp> stamps) {
+  auto hash = 0x9e3779b97f4a7c15ull ^ next_object_id;
+  for (auto id : ids) {
+    hash = (std::rotl(hash, 5) ^ id) * 0x100000001b3ull;
+  }
+  for (auto const &stamp : stamps) {
+    hash = (std::rotl(hash, 5) ^ stamp.key) * 0x100000001b3ull;
+  }
+  return hash ^ ids.size();
+}
+
+bool IsNewer(struct timespec const &lhs, std::int64_t rhs_sec,
+             std::int64_t rhs_nsec) {
+  return lhs.tv_sec > rhs_sec ||
+         (lhs.tv_sec == rhs_sec && lhs.tv_nsec > rhs_nsec);
+}
+
+/**
+ * @return whether file system timestamps taken from now on are newer than the
+ * given one.
+ */
+bool ClockIsPast(struct timespec const &timestamp) {
+  struct timespec now {};
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  return IsNewer(now, timestamp.tv_sec, timestamp.tv_nsec);
+}
+
+/**
+ * Waits until ClockIsPast(timestamp), which takes at most a clock tick.
+ */
+void WaitForNewerTimestamp(struct timespec const &timestamp) {
+  for (int i = 0; i < 100 && !ClockIsPast(timestamp); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+}
+
+std::error_code WriteAll(int fd, void const *data, std::size_t size) {
+  auto const *bytes = static_cast<char const *>(data);
+  while (size > 0) {
+    auto const written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    bytes += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return {};
+}
+
+/**
+ * Accepts the names StoredFolder creates: decimal ids without leading zeros.
+ */
+bool ParseObjectId(std::string_view name, std::uint64_t *id) {
+  if (name.empty() || (name.size() > 1 && name.front() == '0')) {
+    return false;
+  }
+  auto const *end = name.data() + name.size();
+  auto const [ptr, ec] = std::from_chars(name.data(), end, *id);
+  return ec == std::errc{} && ptr == end;
+}
+
+/**
+ * Accepts the names of fan-out directories: an underscore and a byte as two
+ * lowercase hex digits.
+ */
+bool ParseFanoutName(std::string_view name, std::uint32_t *byte) {
+  auto is_hex_digit = [](char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+  };
+  if (name.size() != 3 || name.front() != '_' ||
+      !std::all_of(name.begin() + 1, name.end(), is_hex_digit)) {
+    return false;
+  }
+  std::from_chars(name.data() + 1, name.data() + name.size(), *byte, 16);
+  return true;
+}
+
+unsigned char EntryType(int dir_fd, LinuxDirent64 const *entry) {
+  if (entry->d_type != DT_UNKNOWN) {
+    return entry->d_type;
+  }
+  // not every file system reports the type, so ask for it
+  struct stat st {};
+  if (fstatat(dir_fd, entry->d_name, &st, 0) != 0) {
+    return DT_UNKNOWN;
+  }
+  if (S_ISREG(st.st_mode)) {
+    return DT_REG;
+  }
+  return S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+}
+
+/**
+ * Sorts the entries of a directory into the listing, and collects the fan-out
+ * directories below it.
+ */
+void ParseEntries(int dir_fd, FanoutDir dir, unsigned fanout_levels,
+                  std::span<const char> entries, FolderListing *listing,
+                  std::vector<FanoutDir> *subdirs) {
+  std::size_t offset = 0;
+  while (offset < entries.size()) {
+    auto const *entry =
+        reinterpret_cast<LinuxDirent64 const *>(entries.data() + offset);
+    offset += entry->d_reclen;
+    auto id = std::uint64_t{};
+    auto byte = std::uint32_t{};
+    if (ParseObjectId(entry->d_name, &id)) {
+      if (EntryType(dir_fd, entry) != DT_REG) {
+        continue;
+      }
+      if (FanoutDirOf(id, fanout_levels) == dir) {
+        listing->ids.push_back(id);
+      } else {
+        listing->misplaced.push_back({id, dir});
+      }
+      listing->next_object_id = std::max(listing->next_object_id, id + 1);
+    } else if (dir.depth < kMaxFanoutLevels &&
+               ParseFanoutName(entry->d_name, &byte) &&
+               EntryType(dir_fd, entry) == DT_DIR) {
+      subdirs->push_back(
+          {dir.path | (byte << (8 * dir.depth)), dir.depth + 1});
+    }
+  }
+}
+
+/**
+ * @return the number of bytes read, zero at the end of the directory
+ */
+std::pair<std::size_t, std::error_code> ReadEntries(int dir_fd,
+                                                    std::vector<char> *buffer) {
+  buffer->resize(kDirentBufferSize);
+  while (true) {
+    auto const res =
+        syscall(SYS_getdents64, dir_fd, buffer->data(), buffer->size());
+    if (res >= 0) {
+      buffer->resize(static_cast<std::size_t>(res));
+      return std::make_pair(static_cast<std::size_t>(res), std::error_code{});
+    }
+    if (errno != EINTR) {
+      buffer->clear();
+      return std::make_pair(std::size_t{0}, LastError());
+    }
+  }
+}
+
+/**
+ * Hands the buffers filled by the reading thread to the parsing workers, and
+ * the parsed buffers back for reuse.
+ */
+class EntryQueue {
+public:
+  void push(std::vector<char> buffer) {
+    {
+      auto lock = std::lock_guard{m_mutex};
+      m_filled.push_back(std::move(buffer));
+    }
+    m_filled_cv.notify_one();
+  }
+
+  void finish() {
+    {
+      auto lock = std::lock_guard{m_mutex};
+      m_finished = true;
+    }
+    m_filled_cv.notify_all();
+  }
+
+  /**
+   * @return false once the queue is finished and drained
+   */
+  bool pop(std::vector<char> *buffer) {
+    auto lock = std::unique_lock{m_mutex};
+    m_filled_cv.wait(lock, [this] { return m_finished || !m_filled.empty(); });
+    if (m_filled.empty()) {
+      return false;
+    }
+    *buffer = std::move(m_filled.front());
+    m_filled.pop_front();
+    return true;
+  }
+
+  void recycle(std::vector<char> buffer) {
+    {
+      auto lock = std::lock_guard{m_mutex};
+      m_free.push_back(std::move(buffer));
+    }
+    m_free_cv.notify_one();
+  }
+
+  /**
+   * @brief Waits for a parsed buffer once max_buffers are in use.
+   */
+  std::vector<char> acquire(std::size_t max_buffers) {
+    auto lock = std::unique_lock{m_mutex};
+    if (m_free.empty() && m_num_buffers < max_buffers) {
+      ++m_num_buffers;
+      return {};
+    }
+    m_free_cv.wait(lock, [this] { return !m_free.empty(); });
+    auto buffer = std::move(m_free.back());
+    m_free.pop_back();
+    return buffer;
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_filled_cv;
+  std::condition_variable m_free_cv;
+  std::deque<std::vector<char>> m_filled;
+  std::vector<std::vector<char>> m_free;
+  std::size_t m_num_buffers = 0;
+  bool m_finished = false;
+};
+
+/**
+ * Fan-out directories still to be read. Workers take one directory at a time
+ * and add the directories found in it, until all of them are done.
+ */
+class DirectoryQueue {
+public:
+  explicit DirectoryQueue(std::vector<FanoutDir> const &dirs)
+      : m_dirs{dirs.begin(), dirs.end()} {}
+
+  /**
+   * @return false once all directories are done
+   */
+  bool pop(FanoutDir *dir) {
+    auto lock = std::unique_lock{m_mutex};
+    m_cv.wait(lock, [this] { return !m_dirs.empty() || m_num_busy == 0; });
+    if (m_dirs.empty()) {
+      return false;
+    }
+    *dir = m_dirs.front();
+    m_dirs.pop_front();
+    ++m_num_busy;
+    return true;
+  }
+
+  void done(std::vector<FanoutDir> const &subdirs, std::error_code ec) {
+    {
+      auto lock = std::lock_guard{m_mutex};
+      m_dirs.insert(m_dirs.end(), subdirs.begin(), subdirs.end());
+      --m_num_busy;
+      if (ec && !m_error) {
+        m_error = ec;
+      }
+    }
+    m_cv.notify_all();
+  }
+
+  std::error_code error() const { return m_error; }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<FanoutDir> m_dirs;
+  std::size_t m_num_busy = 0;
+  std::error_code m_error;
+};
+
+std::string RelativePath(FanoutDir dir) {
+  constexpr char kHexDigits[] = "0123456789abcdef";
+  auto path = std::string{};
+  for (unsigned level = 0; level < dir.depth; ++level) {
+    auto const byte = (dir.path >> (8 * level)) & 0xff;
+    if (level > 0) {
+      path += '/';
+    }
+    path += '_';
+    path += kHexDigits[byte >> 4];
+    path += kHexDigits[byte & 0xf];
+  }
+  return path;
+}
+
+void ScanDirectories(int root_fd, unsigned fanout_levels,
+                     DirectoryQueue *queue, FolderListing *listing) {
+  auto buffer = std::vector<char>{};
+  auto subdirs = std::vector<FanoutDir>{};
+  auto dir = FanoutDir{};
+  while (queue->pop(&dir)) {
+    subdirs.clear();
+    listing->directories.push_back(dir.key());
+    int dir_fd = openat(root_fd, RelativePath(dir).c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    auto ec = dir_fd < 0 ? LastError() : std::error_code{};
+    while (!ec) {
+      auto [num_bytes, read_ec] = ReadEntries(dir_fd, &buffer);
+      ec = read_ec;
+      if (ec || num_bytes == 0) {
+        break;
+      }
+      ParseEntries(dir_fd, dir, fanout_levels, buffer, listing, &subdirs);
+    }
+    if (dir_fd >= 0) {
+      ::close(dir_fd);
+    }
+    queue->done(subdirs, ec);
+  }
+}
+
+void Merge(FolderListing const &partial, FolderListing *listing) {
+  listing->ids.insert(listing->ids.end(), partial.ids.begin(),
+                      partial.ids.end());
+  listing->misplaced.insert(listing->misplaced.end(),
+                            partial.misplaced.begin(), partial.misplaced.end());
+  listing->directories.insert(listing->directories.end(),
+                              partial.directories.begin(),
+                              partial.directories.end());
+  listing->next_object_id =
+      std::max(listing->next_object_id, partial.next_object_id);
+}
+
+/**
+ * Reads the root, which holds all objects of a flat folder, and collects the
+ * fan-out directories in it.
+ */
+std::error_code ScanRoot(int root_fd, unsigned fanout_levels,
+                         unsigned parallelism, FolderListing *listing,
+                         std::vector<FanoutDir> *subdirs) {
+  auto const root = FanoutDir{};
+  if (parallelism <= 1) {
+    auto buffer = std::vector<char>{};
+    while (true) {
+      auto [num_bytes, ec] = ReadEntries(root_fd, &buffer);
+      if (ec || num_bytes == 0) {
+        return ec;
+      }
+      ParseEntries(root_fd, root, fanout_levels, buffer, listing, subdirs);
+    }
+  }
+
+  struct Partial {
+    FolderListing listing;
+    std::vector<FanoutDir> subdirs;
+  };
+  auto const num_workers = parallelism - 1;
+  auto *resource = listing->ids.get_allocator().resource();
+  auto partials =
+      std::vector<Partial>(num_workers, Partial{FolderListing{resource}, {}});
+  auto queue = EntryQueue{};
+  auto error = std::error_code{};
+  {
+    auto workers = std::vector<std::jthread>{};
+    workers.reserve(num_workers);
+    for (unsigned i = 0; i < num_workers; ++i) {
+      workers.emplace_back([&, partial = &partials[i]] {
+        auto buffer = std::vector<char>{};
+        while (queue.pop(&buffer)) {
+          ParseEntries(root_fd, root, fanout_levels, buffer, &partial->listing,
+                       &partial->subdirs);
+          queue.recycle(std::move(buffer));
+        }
+      });
+    }
+
+    while (true) {
+      auto buffer = queue.acquire(2 * num_workers);
+      auto [num_bytes, ec] = ReadEntries(root_fd, &buffer);
+      if (ec || num_bytes == 0) {
+        error = ec;
+        break;
+      }
+      queue.push(std::move(buffer));
+    }
+    queue.finish();
+  }
+
+  std::size_t num_ids = listing->ids.size();
+  for (auto const &partial : partials) {
+    num_ids += partial.listing.ids.size();
+  }
+  listing->ids.reserve(num_ids);
+  for (auto const &partial : partials) {
+    Merge(partial.listing, listing);
+    subdirs->insert(subdirs->end(), partial.subdirs.begin(),
+                    partial.subdirs.end());
+  }
+  return error;
+}
+
+} // namespace
+
+FanoutDir FanoutDirOf(std::uint64_t id, unsigned fanout_levels) {
+  if (fanout_levels == 0) {
+    return {};
+  }
+  // the finalizer of splitmix64
+  auto hash = id + 0x9e3779b97f4a7c15ull;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  hash ^= hash >> 31;
+  auto const mask = (std::uint64_t{1} << (8 * fanout_levels)) - 1;
+  return {static_cast<std::uint32_t>(hash & mask), fanout_levels};
+}
+
+std::filesystem::path FanoutPath(std::filesystem::path const &root_path,
+                                 FanoutDir dir) {
+  if (dir.depth == 0) {
+    return root_path;
+  }
+  return root_path / RelativePath(dir);
+}
+
+std::filesystem::path ObjectPath(std::filesystem::path const &root_path,
+                                 std::uint64_t id, unsigned fanout_levels) {
+  std::filesystem::path filepath =
+      FanoutPath(root_path, FanoutDirOf(id, fanout_levels));
+  filepath += std::filesystem::path::preferred_separator;
+  filepath += std::to_string(id);
+  return filepath;
+}
+
+std::filesystem::path ManifestPath(std::filesystem::path const &root_path) {
+  return root_path / kManifestName;
+}
+
+std::pair<FolderListing, std::error_code>
+LoadManifest(std::pmr::memory_resource *resource,
+             std::filesystem::path const &root_path, unsigned fanout_levels) {
+  auto listing = FolderListing{resource};
+  auto const invalid = std::make_error_code(std::errc::invalid_argument);
+
+  int fd = ::open(ManifestPath(root_path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::make_pair(std::move(listing), LastError());
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    return std::make_pair(std::move(listing), LastError());
+  }
+  auto const size = static_cast<std::size_t>(st.st_size);
+  if (size < sizeof(ManifestHeader)) {
+    return std::make_pair(std::move(listing), invalid);
+  }
+
+  void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (address == MAP_FAILED) {
+    return std::make_pair(std::move(listing), LastError());
+  }
+  auto unmap =
+      common::MakeScopeGuard([address, size] { munmap(address, size); });
+  madvise(address, size, MADV_SEQUENTIAL);
+
+  auto header = ManifestHeader{};
+  std::memcpy(&header, address, sizeof(header));
+  auto const payload_size = size - sizeof(header);
+  if (std::memcmp(header.magic, kManifestMagic, sizeof(kManifestMagic)) != 0 ||
+      header.sealed != 1 || header.fanout_levels != fanout_levels ||
+      header.count > payload_size / sizeof(std::uint64_t) ||
+      header.num_directories >= payload_size / sizeof(DirectoryStamp) ||
+      payload_size != header.count * sizeof(std::uint64_t) +
+                          (header.num_directories + 1) *
+                              sizeof(DirectoryStamp)) {
+    return std::make_pair(std::move(listing), invalid);
+  }
+
+  auto const *ids = reinterpret_cast<std::uint64_t const *>(
+      static_cast<char const *>(address) + sizeof(header));
+  auto const stamps =
+      std::span{reinterpret_cast<DirectoryStamp const *>(ids + header.count),
+                header.num_directories + 1};
+  if (Checksum({ids, header.count}, header.next_object_id, stamps) !=
+      header.checksum) {
+    return std::make_pair(std::move(listing), invalid);
+  }
+
+  for (auto const &stamp : stamps) {
+    auto const dir = FanoutDir::FromKey(stamp.key);
+    struct stat dir_st {};
+    if (dir.depth > kMaxFanoutLevels ||
+        stat(FanoutPath(root_path, dir).c_str(), &dir_st) != 0 ||
+        stamp.inode != dir_st.st_ino ||
+        stamp.mtime_sec != dir_st.st_mtim.tv_sec ||
+        stamp.mtime_nsec != dir_st.st_mtim.tv_nsec ||
+        !IsNewer(st.st_mtim, stamp.mtime_sec, stamp.mtime_nsec)) {
+      return std::make_pair(std::move(listing), invalid);
+    }
+  }
+
+  listing.ids.assign(ids, ids + header.count);
+  listing.directories.reserve(header.num_directories);
+  for (auto const &stamp : stamps.subspan(1)) {
+    listing.directories.push_back(stamp.key);
+  }
+  listing.next_object_id = header.next_object_id;
+  return std::make_pair(std::move(listing), std::error_code{});
+}
+
+std::error_code WriteManifest(std::filesystem::path const &root_path,
+                              std::span<const std::uint64_t> ids,
+                              std::uint64_t next_object_id,
+                              unsigned fanout_levels,
+                              std::span<const std::uint64_t> directories,
+                              bool wait) {
+  auto const manifest_path = ManifestPath(root_path);
+  auto const tmp_path = root_path / kManifestTmpName;
+  int fd = ::open(manifest_path.c_str(), O_WRONLY | O_CLOEXEC);
+  bool const in_place = fd >= 0;
+  if (!in_place) {
+    if (errno != ENOENT) {
+      return LastError();
+    }
+    fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+    if (fd < 0) {
+      return LastError();
+    }
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+
+  // the root comes first, then the fan-out directories
+  auto stamps = std::vector<DirectoryStamp>(directories.size() + 1);
+  for (std::size_t i = 0; i < directories.size(); ++i) {
+    stamps[i + 1].key = directories[i];
+  }
+  auto const stamps_size = stamps.size() * sizeof(DirectoryStamp);
+
+  auto header = ManifestHeader{};
+  std::memcpy(header.magic, kManifestMagic, sizeof(kManifestMagic));
+  header.count = ids.size();
+  header.next_object_id = next_object_id;
+  header.checksum = Checksum(ids, next_object_id, stamps);
+  header.num_directories = directories.size();
+  header.fanout_levels = fanout_levels;
+  if (auto ec = WriteAll(fd, &header, sizeof(header))) {
+    return ec;
+  }
+  if (auto ec = WriteAll(fd, ids.data(), ids.size_bytes())) {
+    return ec;
+  }
+  if (auto ec = WriteAll(fd, stamps.data(), stamps_size)) {
+    return ec;
+  }
+  auto const stamps_offset =
+      static_cast<off_t>(sizeof(header) + ids.size_bytes());
+  if (in_place &&
+      ftruncate(fd, stamps_offset + static_cast<off_t>(stamps_size)) != 0) {
+    return LastError();
+  }
+  if (fdatasync(fd) != 0) {
+    return LastError();
+  }
+  if (!in_place && rename(tmp_path.c_str(), manifest_path.c_str()) != 0) {
+    auto ec = LastError();
+    unlink(tmp_path.c_str());
+    return ec;
+  }
+
+  // seal the manifest with the state of the directories once it is in place
+  auto latest = timespec{};
+  for (auto &stamp : stamps) {
+    auto const dir = FanoutDir::FromKey(stamp.key);
+    struct stat dir_st {};
+    if (stat(FanoutPath(root_path, dir).c_str(), &dir_st) != 0) {
+      return LastError();
+    }
+    stamp.inode = dir_st.st_ino;
+    stamp.mtime_sec = dir_st.st_mtim.tv_sec;
+    stamp.mtime_nsec = dir_st.st_mtim.tv_nsec;
+    if (IsNewer(dir_st.st_mtim, latest.tv_sec, latest.tv_nsec)) {
+      latest = dir_st.st_mtim;
+    }
+  }
+  if (!wait && !ClockIsPast(latest)) {
+    // left unsealed, which the next write replaces in place
+    return std::make_error_code(std::errc::resource_unavailable_try_again);
+  }
+  WaitForNewerTimestamp(latest);
+  if (pwrite(fd, stamps.data(), stamps_size, stamps_offset) !=
+      static_cast<ssize_t>(stamps_size)) {
+    return LastError();
+  }
+  header.sealed = 1;
+  if (pwrite(fd, &header, sizeof(header), 0) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    return LastError();
+  }
+  if (fdatasync(fd) != 0) {
+    return LastError();
+  }
+  return {};
+}
+
+std::error_code UnsealManifest(std::filesystem::path const &root_path) {
+  int fd = ::open(ManifestPath(root_path).c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT ? std::error_code{} : LastError();
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+  std::uint32_t const sealed = 0;
+  if (pwrite(fd, &sealed, sizeof(sealed), offsetof(ManifestHeader, sealed)) !=
+      static_cast<ssize_t>(sizeof(sealed))) {
+    return LastError();
+  }
+  return {};
+}
+
+std::error_code RemoveManifest(std::filesystem::path const &root_path) {
+  if (unlink(ManifestPath(root_path).c_str()) != 0 && errno != ENOENT) {
+    return LastError();
+  }
+  return {};
+}
+
+std::pair<FolderListing, std::error_code>
+ScanFolder(std::pmr::memory_resource *resource,
+           std::filesystem::path const &root_path, unsigned parallelism,
+           unsigned fanout_levels) {
+  auto listing = FolderListing{resource};
+  int root_fd = ::open(root_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0) {
+    return std::make_pair(std::move(listing), LastError());
+  }
+  auto close_fd = common::MakeScopeGuard([root_fd] { ::close(root_fd); });
+
+  auto subdirs = std::vector<FanoutDir>{};
+  if (auto ec =
+          ScanRoot(root_fd, fanout_levels, parallelism, &listing, &subdirs)) {
+    return std::make_pair(std::move(listing), ec);
+  }
+  if (subdirs.empty()) {
+    return std::make_pair(std::move(listing), std::error_code{});
+  }
+
+  // unlike the root, the fan-out directories are read in parallel
+  auto queue = DirectoryQueue{subdirs};
+  auto const num_workers = std::max(parallelism, 1u);
+  auto partials =
+      std::vector<FolderListing>(num_workers, FolderListing{resource});
+  {
+    auto workers = std::vector<std::jthread>{};
+    workers.reserve(num_workers - 1);
+    for (unsigned i = 1; i < num_workers; ++i) {
+      workers.emplace_back([&, partial = &partials[i]] {
+        ScanDirectories(root_fd, fanout_levels, &queue, partial);
+      });
+    }
+    ScanDirectories(root_fd, fanout_levels, &queue, &partials[0]);
+  }
+  for (auto const &partial : partials) {
+    Merge(partial, &listing);
+  }
+  return std::make_pair(std::move(listing), queue.error());
+}
+
+} // namespace objectstore
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory_resource>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace objectstore {
+
+/// Number of fan-out levels a folder supports at most.
+constexpr unsigned kMaxFanoutLevels = 3;
+
+/**
+ * @brief A directory of a fan-out tree, depth levels below the root. The name
+ * of the directory on level i is an underscore followed by the hex value of
+ * byte i of path, so that it never collides with the name of an object.
+ */
+struct FanoutDir {
+  std::uint32_t path = 0;
+  unsigned depth = 0;
+
+  /**
+   * @return a unique number for the directory, e.g. for a hash set
+   */
+  std::uint64_t key() const {
+    return (static_cast<std::uint64_t>(depth) << 32) | path;
+  }
+  static FanoutDir FromKey(std::uint64_t key) {
+    return {static_cast<std::uint32_t>(key), static_cast<unsigned>(key >> 32)};
+  }
+
+  /**
+   * @return the directory one level up, the root for depth 1
+   */
+  FanoutDir parent() const {
+    return {path & ((1u << (8 * (depth - 1))) - 1), depth - 1};
+  }
+
+  bool operator==(FanoutDir const &) const = default;
+};
+
+/**
+ * @return the directory an object belongs to. The levels are taken from a
+ * hash of the id, so that consecutive ids spread over all directories.
+ */
+FanoutDir FanoutDirOf(std::uint64_t id, unsigned fanout_levels);
+
+std::filesystem::path FanoutPath(std::filesystem::path const &root_path,
+                                 FanoutDir dir);
+
+/**
+ * @return the path of the file of an object, e.g. root/_3f/_a2/42
+ */
+std::filesystem::path ObjectPath(std::filesystem::path const &root_path,
+                                 std::uint64_t id, unsigned fanout_levels);
+
+/**
+ * @brief An object found in another directory than the one the layout
+ * expects, e.g. in the root of a formerly flat folder.
+ */
+struct MisplacedObject {
+  std::uint64_t id;
+  FanoutDir dir;
+};
+
+/**
+ * @brief The object ids found in a StoredFolder directory.
+ */
+struct FolderListing {
+  explicit FolderListing(std::pmr::memory_resource *resource)
+      : ids{resource}, misplaced{resource}, directories{resource} {}
+
+  std::pmr::vector<std::uint64_t> ids;
+  std::pmr::vector<MisplacedObject> misplaced;
+  /// All fan-out directories below the root, see FanoutDir::key().
+  std::pmr::vector<std::uint64_t> directories;
+  /// One past the largest id that was ever handed out, at least.
+  std::uint64_t next_object_id = 0;
+};
+
+/**
+ * @return the path of the manifest of the folder at root_path.
+ */
+std::filesystem::path ManifestPath(std::filesystem::path const &root_path);
+
+/**
+ * @brief Loads the manifest of the folder at root_path.
+ *
+ * The manifest is only accepted if it is intact, was written for the same
+ * number of fan-out levels, and no directory of the folder has changed since,
+ * which is checked by comparing their inodes and modification times. Adding,
+ * removing or renaming an entry updates the modification time of its
+ * directory, so a stale manifest is rejected without looking at a single
+ * entry.
+ *
+ * @return the listing, or an error if there is no valid manifest
+ */
+std::pair<FolderListing, std::error_code>
+LoadManifest(std::pmr::memory_resource *resource,
+             std::filesystem::path const &root_path, unsigned fanout_levels);
+
+/**
+ * @brief Replaces the manifest of the folder at root_path.
+ *
+ * A new manifest is renamed into place, an existing one is rewritten in place.
+ * Either way, it is only sealed, and valid, once the clock has moved past the
+ * modification times of the directories, see LoadManifest().
+ *
+ * @param directories all fan-out directories below the root, which must not
+ * change while the manifest is written
+ * @param wait whether to wait for the clock, which takes at most a clock tick.
+ * Without, a manifest that would have to wait is left unsealed and
+ * resource_unavailable_try_again is returned.
+ */
+std::error_code WriteManifest(std::filesystem::path const &root_path,
+                              std::span<const std::uint64_t> ids,
+                              std::uint64_t next_object_id,
+                              unsigned fanout_levels,
+                              std::span<const std::uint64_t> directories,
+                              bool wait = true);
+
+/**
+ * @brief Marks the manifest, if any, as no longer valid. Unlike
+ * RemoveManifest(), it keeps the file, so that the next WriteManifest()
+ * rewrites it in place and need not wait for the clock after changing the
+ * root. Must be called before the content of a folder is changed, unless the
+ * directory modification time is guaranteed to change as well.
+ */
+std::error_code UnsealManifest(std::filesystem::path const &root_path);
+
+/**
+ * @brief Removes the manifest, if any. Must be called before the content of a
+ * folder is changed, unless the directory modification time is guaranteed to
+ * change as well.
+ */
+std::error_code RemoveManifest(std::filesystem::path const &root_path);
+
+/**
+ * @brief Lists all objects of the folder at root_path by reading the
+ * directories with getdents64().
+ *
+ * Only regular files whose name is an id in canonical decimal form are
+ * reported, and fan-out directories are visited no matter how many levels the
+ * folder is supposed to have. Objects outside of the directory fanout_levels
+ * expects are reported as misplaced. With parallelism > 1, the root is read
+ * by the calling thread while parallelism - 1 workers parse the entries, and
+ * the fan-out directories are read by parallelism workers.
+ */
+std::pair<FolderListing, std::error_code>
+ScanFolder(std::pmr::memory_resource *resource,
+           std::filesystem::path const &root_path, unsigned parallelism,
+           unsigned fanout_levels = 0);
+
+} // namespace objectstore
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <folder_manifest.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_manifest";
+
+std::vector<std::uint64_t> Sorted(std::pmr::vector<std::uint64_t> const &ids) {
+  auto sorted = std::vector<std::uint64_t>(ids.begin(), ids.end());
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+} // namespace
+
+TEST(FolderManifest, WriteLoad) {
+  auto resource = std::pmr::get_default_resource();
+  std::filesystem::create_directories(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  {
+    auto [listing, ec] = objectstore::LoadManifest(resource, kTestPath, 0);
+    EXPECT_EQ(ec, std::errc::no_such_file_or_directory);
+  }
+
+  auto const ids = std::vector<std::uint64_t>{3, 1, 4, 15, 9, 2, 6};
+  ASSERT_FALSE(objectstore::WriteManifest(kTestPath, ids, 42, 0, {}));
+  {
+    auto [listing, ec] = objectstore::LoadManifest(resource, kTestPath, 0);
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_EQ(std::vector<std::uint64_t>(listing.ids.begin(),
+                                         listing.ids.end()),
+              ids);
+    EXPECT_EQ(listing.next_object_id, 42u);
+  }
+
+  // any change of the directory invalidates the manifest
+  std::ofstream{std::filesystem::path{kTestPath} / "16"};
+  {
+    auto [listing, ec] = objectstore::LoadManifest(resource, kTestPath, 0);
+    EXPECT_TRUE(ec);
+    EXPECT_TRUE(listing.ids.empty());
+  }
+
+  ASSERT_FALSE(objectstore::WriteManifest(kTestPath, ids, 42, 0, {}));
+  {
+    // a truncated manifest is rejected
+    std::filesystem::resize_file(objectstore::ManifestPath(kTestPath), 70);
+    auto [listing, ec] = objectstore::LoadManifest(resource, kTestPath, 0);
+    EXPECT_TRUE(ec);
+  }
+
+  EXPECT_FALSE(objectstore::RemoveManifest(kTestPath));
+  EXPECT_FALSE(std::filesystem::exists(objectstore::ManifestPath(kTestPath)));
+  EXPECT_FALSE(objectstore::RemoveManifest(kTestPath));
+}
+
+TEST(FolderManifest, Scan) {
+  auto resource = std::pmr::get_default_resource();
+  auto const root = std::filesystem::path{kTestPath};
+  std::filesystem::create_directories(root / "124");
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto expected = std::vector<std::uint64_t>{};
+  for (std::uint64_t id = 0; id < 5000; id += 3) {
+    std::ofstream{root / std::to_string(id)};
+    expected.push_back(id);
+  }
+  std::ofstream{root / "1000000000000"};
+  expected.push_back(1'000'000'000'000);
+  // none of these is an object
+  for (auto name : {"01", "12a", "-1", "18446744073709551616", ".manifest"}) {
+    std::ofstream{root / name};
+  }
+
+  for (unsigned parallelism : {1u, 2u, 5u}) {
+    auto [listing, ec] = objectstore::ScanFolder(resource, root, parallelism);
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_EQ(Sorted(listing.ids), expected) << parallelism;
+    EXPECT_EQ(listing.next_object_id, 1'000'000'000'001u);
+  }
+
+  auto [listing, ec] =
+      objectstore::ScanFolder(resource, root / "missing", 1);
+  EXPECT_EQ(ec, std::errc::no_such_file_or_directory);
+}
+
+TEST(FolderManifest, Fanout) {
+  constexpr unsigned kFanoutLevels = 2;
+  auto resource = std::pmr::get_default_resource();
+  auto const root = std::filesystem::path{kTestPath};
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto expected = std::vector<std::uint64_t>{};
+  auto directories = std::vector<std::uint64_t>{};
+  for (std::uint64_t id = 0; id < 100; ++id) {
+    auto const dir = objectstore::FanoutDirOf(id, kFanoutLevels);
+    EXPECT_EQ(dir.depth, kFanoutLevels);
+    EXPECT_EQ(objectstore::FanoutDir::FromKey(dir.key()), dir);
+    if (std::filesystem::create_directories(
+            objectstore::FanoutPath(root, dir))) {
+      directories.push_back(dir.parent().key());
+      directories.push_back(dir.key());
+    }
+    std::ofstream{objectstore::ObjectPath(root, id, kFanoutLevels)};
+    expected.push_back(id);
+  }
+  std::sort(directories.begin(), directories.end());
+  directories.erase(std::unique(directories.begin(), directories.end()),
+                    directories.end());
+  // left over from a flat layout
+  std::ofstream{root / "100"};
+
+  for (unsigned parallelism : {1u, 3u}) {
+    auto [listing, ec] =
+        objectstore::ScanFolder(resource, root, parallelism, kFanoutLevels);
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_EQ(Sorted(listing.ids), expected);
+    EXPECT_EQ(Sorted(listing.directories), directories);
+    ASSERT_EQ(listing.misplaced.size(), 1u);
+    EXPECT_EQ(listing.misplaced[0].id, 100u);
+    EXPECT_EQ(listing.misplaced[0].dir, objectstore::FanoutDir{});
+    EXPECT_EQ(listing.next_object_id, 101u);
+  }
+  {
+    // with a flat layout, every object in a fan-out directory is misplaced
+    auto [listing, ec] = objectstore::ScanFolder(resource, root, 1);
+    EXPECT_EQ(listing.ids, std::pmr::vector<std::uint64_t>{100});
+    EXPECT_EQ(listing.misplaced.size(), expected.size());
+  }
+
+  ASSERT_FALSE(objectstore::WriteManifest(root, expected, 101, kFanoutLevels,
+                                          directories));
+  {
+    auto [listing, ec] =
+        objectstore::LoadManifest(resource, root, kFanoutLevels);
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_EQ(Sorted(listing.directories), directories);
+    // a manifest is only valid for the layout it was written for
+    EXPECT_TRUE(objectstore::LoadManifest(resource, root, 1).second);
+  }
+
+  // a change deep down in the tree invalidates the manifest as well
+  std::filesystem::remove(objectstore::ObjectPath(root, 42, kFanoutLevels));
+  EXPECT_TRUE(objectstore::LoadManifest(resource, root, kFanoutLevels).second);
+}
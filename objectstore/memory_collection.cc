@@ -0,0 +1,214 @@
+#include <cstdlib>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "memory_collection.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr std::string_view kSpillDirectoryPattern = "spill-XXXXXX";
+constexpr std::string_view kFolderDirectory = "objects";
+
+} // namespace
+
+MemoryCollection::MemoryCollection(std::pmr::memory_resource *resource,
+                                   std::filesystem::path spill_path,
+                                   MemoryCollectionOptions options)
+    : m_resource{resource}, m_spill_path{std::move(spill_path)},
+      m_options{std::move(options)}, m_entries{resource}, m_lru{resource},
+      m_sizes{resource} {
+  m_options.folder_options.add_all_existing_files = false;
+}
+
+MemoryCollection::~MemoryCollection() {
+  if (m_folder) {
+    m_folder.reset();
+    auto ec = std::error_code{};
+    std::filesystem::remove_all(m_path, ec);
+  }
+}
+
+bool MemoryCollection::has(object_id_t id) const {
+  return m_entries.contains(id);
+}
+
+MemoryCollection::object_id_t MemoryCollection::add() {
+  auto id = m_next_object_id++;
+  auto &entry = m_entries.try_emplace(id).first->second;
+  entry.stream = common::MakeUnique<MemoryStream>(m_resource, m_resource);
+  track(id, entry);
+  return id;
+}
+
+std::iostream *MemoryCollection::get(object_id_t id) {
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return nullptr;
+  }
+  auto &entry = it->second;
+  if (!entry.stream) {
+    return m_folder->get(entry.folder_id);
+  }
+  if (!entry.in_use) {
+    untrack(id, entry);
+    entry.in_use = true;
+  }
+  entry.stream->rewind();
+  return entry.stream.get();
+}
+
+std::iostream const &MemoryCollection::get(object_id_t id) const {
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    throw std::out_of_range{"Object ID not found in MemoryCollection"};
+  }
+  auto const &entry = it->second;
+  if (!entry.stream) {
+    return std::as_const(*m_folder).get(entry.folder_id);
+  }
+  if (!entry.in_use) {
+    untrack(id, entry);
+    entry.in_use = true;
+  }
+  entry.stream->rewind();
+  return *entry.stream;
+}
+
+std::pair<std::uintmax_t, std::error_code>
+MemoryCollection::size(object_id_t id) const {
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return std::make_pair(
+        0, std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+  auto const &entry = it->second;
+  if (!entry.stream) {
+    return m_folder->size(entry.folder_id);
+  }
+  return std::make_pair(entry.stream->buffer().size(), std::error_code{});
+}
+
+void MemoryCollection::close(object_id_t id) {
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return;
+  }
+  auto &entry = it->second;
+  if (!entry.stream) {
+    m_folder->close(entry.folder_id);
+    return;
+  }
+  if (!entry.in_use) {
+    return;
+  }
+  entry.in_use = false;
+  auto const size = entry.stream->buffer().size();
+  m_memory_bytes = m_memory_bytes - entry.size + size;
+  entry.size = size;
+  track(id, entry);
+  enforce_budget();
+}
+
+void MemoryCollection::destroy(object_id_t id) {
+  auto it = m_entries.find(id);
+  if (it == m_entries.end()) {
+    return;
+  }
+  auto &entry = it->second;
+  if (!entry.stream) {
+    m_folder->destroy(entry.folder_id);
+  } else {
+    if (!entry.in_use) {
+      untrack(id, entry);
+    }
+    m_memory_bytes -= entry.size;
+  }
+  m_entries.erase(it);
+}
+
+void MemoryCollection::clear() {
+  m_entries.clear();
+  m_lru.clear();
+  m_sizes.clear();
+  m_memory_bytes = 0;
+  if (m_folder) {
+    m_folder->clear();
+  }
+}
+
+std::size_t MemoryCollection::num_spilled() const {
+  return m_folder ? static_cast<std::size_t>(
+                        std::distance(m_folder->begin(), m_folder->end()))
+                  : 0;
+}
+
+bool MemoryCollection::is_spilled(object_id_t id) const {
+  auto it = m_entries.find(id);
+  return it != m_entries.end() && !it->second.stream;
+}
+
+void MemoryCollection::track(object_id_t id, Entry &entry) {
+  m_lru.push_front(id);
+  entry.lru = m_lru.begin();
+  m_sizes.emplace(entry.size, id);
+}
+
+void MemoryCollection::untrack(object_id_t id, Entry const &entry) const {
+  m_lru.erase(entry.lru);
+  m_sizes.erase({entry.size, id});
+}
+
+bool MemoryCollection::spill(object_id_t id, Entry &entry) {
+  if (!m_folder && !create_folder()) {
+    return false;
+  }
+  auto const folder_id = m_folder->add();
+  auto const data = entry.stream->buffer().data();
+  auto *stream = m_folder->get(folder_id);
+  stream->write(reinterpret_cast<char const *>(data.data()),
+                static_cast<std::streamsize>(data.size()));
+  auto const ec = m_folder->commit(folder_id).get();
+  if (ec || !stream->good()) {
+    m_folder->destroy(folder_id);
+    return false;
+  }
+
+  untrack(id, entry);
+  m_memory_bytes -= entry.size;
+  entry.stream.reset();
+  entry.folder_id = folder_id;
+  return true;
+}
+
+bool MemoryCollection::create_folder() {
+  auto ec = std::error_code{};
+  std::filesystem::create_directories(m_spill_path, ec);
+  auto path = (m_spill_path / kSpillDirectoryPattern).string();
+  if (ec || ::mkdtemp(path.data()) == nullptr) {
+    return false;
+  }
+  m_path = std::move(path);
+  // one level down, so that the trash next to the folder is ours as well
+  m_folder = common::MakeUnique<StoredFolder>(m_resource, m_resource,
+                                              m_path / kFolderDirectory,
+                                              m_options.folder_options);
+  return true;
+}
+
+void MemoryCollection::enforce_budget() {
+  while (m_memory_bytes > m_options.memory_budget && !m_lru.empty()) {
+    auto const id = m_options.spill_policy == SpillPolicy::Coldest
+                        ? m_lru.back()
+                        : std::prev(m_sizes.end())->second;
+    if (!spill(id, m_entries.at(id))) {
+      // the disk is not going to take the others either
+      return;
+    }
+  }
+}
+
+} // namespace objectstore
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <memory_resource>
+#include <set>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include <memory.hpp>
+
+#include "memory_stream.hpp"
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+/**
+ * @brief Which objects a MemoryCollection moves to disk first.
+ */
+enum class SpillPolicy {
+  /// The least recently used ones.
+  Coldest,
+  /// The largest ones, which frees the budget with the fewest files.
+  Largest
+};
+
+struct MemoryCollectionOptions {
+  /// Bytes the objects may take in memory before some are spilled to disk.
+  std::size_t memory_budget = 64 << 20;
+  SpillPolicy spill_policy = SpillPolicy::Coldest;
+  /// Options of the StoredFolder the objects are spilled to. It never adds
+  /// existing files, whatever add_all_existing_files says.
+  StoredFolderOptions folder_options;
+};
+
+/**
+ * @brief Keeps temporary objects in memory, in buffers allocated from the
+ * given memory resource, and spills them to a StoredFolder once they take
+ * more than the memory budget.
+ *
+ * The budget is enforced on close(), when the size of the object is known:
+ * closed objects are spilled by the spill policy until the objects in memory
+ * fit into the budget again. Objects still in use are never spilled, so the
+ * budget may be exceeded while they are, and neither are objects whose
+ * spill failed until the next close(). A spilled object stays in the
+ * folder for the rest of its life, and get() hands out the folder's stream.
+ *
+ * The folder is only created with the first spill, in a new directory of
+ * its own below the spill path, and removed together with all objects when
+ * the collection is destroyed: nothing survives a restart. Whatever else is
+ * in the spill path is left alone, so several collections may share it.
+ */
+class MemoryCollection : public StoredObjectCollection {
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  MemoryCollection(std::pmr::memory_resource *resource,
+                   std::filesystem::path spill_path,
+                   MemoryCollectionOptions options = {});
+
+  MemoryCollection(const MemoryCollection &) = delete;
+  MemoryCollection(MemoryCollection &&) = delete;
+  MemoryCollection &operator=(const MemoryCollection &) = delete;
+  MemoryCollection &operator=(MemoryCollection &&) = delete;
+
+  ~MemoryCollection() override;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @return the bytes of the objects in memory
+   */
+  std::size_t memory_bytes() const { return m_memory_bytes; }
+
+  /**
+   * @return the number of objects that were spilled to disk
+   */
+  std::size_t num_spilled() const;
+
+  bool is_spilled(object_id_t id) const;
+
+  /**
+   * @return the directory the objects are spilled to, or an empty path before
+   * the first spill
+   */
+  std::filesystem::path const &path() const { return m_path; }
+
+private:
+  using LruList = std::pmr::list<object_id_t>;
+  using SizeIndex = std::pmr::set<std::pair<std::size_t, object_id_t>>;
+
+  struct Entry {
+    /// Null once the object was spilled.
+    common::UniquePtr<MemoryStream> stream;
+    /// The id of the spilled object in the folder.
+    object_id_t folder_id{};
+    /// The size the object was accounted with on its last close().
+    std::size_t size = 0;
+    /// Between get() and close(), when it must not be spilled.
+    mutable bool in_use = false;
+    /// Position among the closed objects in memory, unless in_use.
+    LruList::iterator lru;
+  };
+
+  void track(object_id_t id, Entry &entry);
+  void untrack(object_id_t id, Entry const &entry) const;
+  /**
+   * @return false if the object could not be written to the folder, in which
+   * case it stays in memory
+   */
+  bool spill(object_id_t id, Entry &entry);
+  bool create_folder();
+  void enforce_budget();
+
+  std::pmr::memory_resource *m_resource;
+  std::filesystem::path m_spill_path;
+  /// Created below m_spill_path with the folder, and owned by it.
+  std::filesystem::path m_path;
+  MemoryCollectionOptions m_options;
+  std::pmr::unordered_map<object_id_t, Entry> m_entries;
+  /// Most recently used first. Both leave out the objects in use, which the
+  /// const get() marks as well.
+  mutable LruList m_lru;
+  mutable SizeIndex m_sizes;
+  std::size_t m_memory_bytes = 0;
+  object_id_t m_next_object_id{};
+  common::UniquePtr<StoredFolder> m_folder;
+};
+
+} // namespace objectstore
@@ -0,0 +1,204 @@
+#include <csignal>
+#include <cstddef>
+#include <filesystem>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <sys/resource.h>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include <memory_collection.hpp>
+#include <scopeguard.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_memory_collection";
+
+/**
+ * Counts the bytes currently allocated through it.
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t allocated() const { return m_allocated; }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    m_allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    m_allocated -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+
+  std::size_t m_allocated = 0;
+};
+
+using objectstore::test::ReadAndClose;
+using objectstore::test::Write;
+
+} // namespace
+
+TEST(MemoryCollection, StaysInMemoryWithinBudget) {
+  auto resource = CountingResource{};
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  {
+    auto collection = objectstore::MemoryCollection{&resource, kTestPath};
+    auto id = collection.add();
+    Write(&collection, id, std::string(10'000, 'x'));
+    EXPECT_EQ(collection.memory_bytes(), 10'000u);
+    // the buffers come from the given resource
+    EXPECT_GE(resource.allocated(), 10'000u);
+    EXPECT_EQ(collection.num_spilled(), 0u);
+    EXPECT_FALSE(std::filesystem::exists(kTestPath));
+
+    collection.destroy(id);
+    EXPECT_EQ(collection.memory_bytes(), 0u);
+  }
+  EXPECT_EQ(resource.allocated(), 0u);
+}
+
+TEST(MemoryCollection, SpillsColdestObjects) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::MemoryCollectionOptions{};
+  options.memory_budget = 250;
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto collection = objectstore::MemoryCollection{resource, kTestPath, options};
+  auto a = collection.add();
+  auto b = collection.add();
+  auto c = collection.add();
+  Write(&collection, a, std::string(100, 'a'));
+  Write(&collection, b, std::string(100, 'b'));
+  // a was used more recently than b
+  EXPECT_EQ(ReadAndClose(&collection, a), std::string(100, 'a'));
+  Write(&collection, c, std::string(100, 'c'));
+
+  EXPECT_TRUE(collection.is_spilled(b));
+  EXPECT_FALSE(collection.is_spilled(a));
+  EXPECT_FALSE(collection.is_spilled(c));
+  EXPECT_EQ(collection.memory_bytes(), 200u);
+  EXPECT_EQ(collection.path().parent_path(), kTestPath);
+  EXPECT_TRUE(std::filesystem::exists(collection.path()));
+
+  // spilled objects work as before
+  EXPECT_EQ(ReadAndClose(&collection, b), std::string(100, 'b'));
+  EXPECT_EQ(collection.size(b).first, 100u);
+  Write(&collection, b, "B");
+  EXPECT_EQ(ReadAndClose(&collection, b).substr(0, 2), "Bb");
+  collection.destroy(b);
+  EXPECT_EQ(collection.num_spilled(), 0u);
+
+  // objects only read are in use as well
+  auto const &reading = std::as_const(collection).get(a);
+  auto d = collection.add();
+  Write(&collection, d, std::string(100, 'd'));
+  EXPECT_FALSE(collection.is_spilled(a));
+  EXPECT_TRUE(collection.is_spilled(c));
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>{reading.rdbuf()}, {}),
+            std::string(100, 'a'));
+  collection.close(a);
+}
+
+TEST(MemoryCollection, SpillsLargestObjects) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::MemoryCollectionOptions{};
+  options.memory_budget = 1000;
+  options.spill_policy = objectstore::SpillPolicy::Largest;
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  {
+    auto collection =
+        objectstore::MemoryCollection{resource, kTestPath, options};
+    auto small = collection.add();
+    auto large = collection.add();
+    Write(&collection, large, std::string(900, 'l'));
+    Write(&collection, small, std::string(200, 's'));
+
+    EXPECT_TRUE(collection.is_spilled(large));
+    EXPECT_FALSE(collection.is_spilled(small));
+    EXPECT_EQ(collection.memory_bytes(), 200u);
+
+    // objects in use are never spilled
+    auto medium = collection.add();
+    auto *stream = collection.get(medium);
+    *stream << std::string(2000, 'm');
+    auto other = collection.add();
+    Write(&collection, other, "o");
+    EXPECT_FALSE(collection.is_spilled(medium));
+    collection.close(medium);
+    EXPECT_TRUE(collection.is_spilled(medium));
+    EXPECT_EQ(ReadAndClose(&collection, medium), std::string(2000, 'm'));
+  }
+  // the spilled objects go away with the collection
+  EXPECT_TRUE(std::filesystem::is_empty(kTestPath));
+}
+
+TEST(MemoryCollection, LeavesSpillPathAlone) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::MemoryCollectionOptions{};
+  options.memory_budget = 0;
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto const kept = std::filesystem::path{kTestPath} / "kept";
+  std::filesystem::create_directories(kept);
+  {
+    auto first = objectstore::MemoryCollection{resource, kTestPath, options};
+    auto second = objectstore::MemoryCollection{resource, kTestPath, options};
+    auto a = first.add();
+    auto b = second.add();
+    Write(&first, a, "first");
+    Write(&second, b, "second");
+    EXPECT_TRUE(first.is_spilled(a));
+    EXPECT_TRUE(second.is_spilled(b));
+    EXPECT_NE(first.path(), second.path());
+  }
+  EXPECT_TRUE(std::filesystem::exists(kept));
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator{kTestPath},
+                          std::filesystem::directory_iterator{}),
+            1);
+}
+
+TEST(MemoryCollection, KeepsObjectsThatFailToSpill) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::MemoryCollectionOptions{};
+  options.memory_budget = 1000;
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+
+  auto collection = objectstore::MemoryCollection{resource, kTestPath, options};
+  auto id = collection.add();
+  {
+    // files cannot grow beyond the limit, like on a full disk
+    auto limit = rlimit{};
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+    auto const previous = limit;
+    limit.rlim_cur = 100;
+    std::signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+    auto restore = common::MakeScopeGuard([&previous] {
+      setrlimit(RLIMIT_FSIZE, &previous);
+      std::signal(SIGXFSZ, SIG_DFL);
+    });
+    Write(&collection, id, std::string(2000, 'x'));
+  }
+  EXPECT_FALSE(collection.is_spilled(id));
+  EXPECT_EQ(collection.num_spilled(), 0u);
+  EXPECT_EQ(collection.memory_bytes(), 2000u);
+
+  // spilled on the next close
+  EXPECT_EQ(ReadAndClose(&collection, id), std::string(2000, 'x'));
+  EXPECT_TRUE(collection.is_spilled(id));
+  EXPECT_EQ(ReadAndClose(&collection, id), std::string(2000, 'x'));
+}
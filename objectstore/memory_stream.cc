@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstring>
+
+#include "memory_stream.hpp"
+
+namespace objectstore {
+
+MemoryStreambuf::MemoryStreambuf(std::pmr::memory_resource *resource)
+    : m_data{resource} {
+  reset_get_area(0);
+}
+
+MemoryStreambuf::MemoryStreambuf(std::pmr::memory_resource *resource,
+                                 std::span<const std::byte> content)
+    : m_data{resource} {
+  assign(content);
+}
+
+void MemoryStreambuf::assign(std::span<const std::byte> content) {
+  auto const *begin = reinterpret_cast<const char *>(content.data());
+  m_data.assign(begin, begin + content.size());
+  m_put_pos = 0;
+  m_dirty = false;
+  reset_get_area(0);
+}
+
+std::span<std::byte> MemoryStreambuf::reset(std::size_t size) {
+  m_data.resize(size);
+  m_put_pos = 0;
+  m_dirty = false;
+  reset_get_area(0);
+  return std::as_writable_bytes(std::span{m_data});
+}
+
+void MemoryStreambuf::rewind() {
+  m_put_pos = 0;
+  reset_get_area(0);
+}
+
+MemoryStreambuf::int_type MemoryStreambuf::underflow() {
+  // the get area always spans the whole buffer, so there is nothing to refill
+  return gptr() < egptr() ? traits_type::to_int_type(*gptr())
+                          : traits_type::eof();
+}
+
+MemoryStreambuf::int_type MemoryStreambuf::overflow(int_type ch) {
+  if (traits_type::eq_int_type(ch, traits_type::eof())) {
+    return traits_type::not_eof(ch);
+  }
+  auto const c = traits_type::to_char_type(ch);
+  return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+std::streamsize MemoryStreambuf::xsputn(const char_type *s,
+                                        std::streamsize count) {
+  if (count <= 0) {
+    return 0;
+  }
+  auto const saved_get_pos = get_pos();
+  auto const n = static_cast<std::size_t>(count);
+  if (m_put_pos + n > m_data.size()) {
+    m_data.resize(m_put_pos + n);
+  }
+  std::memcpy(m_data.data() + m_put_pos, s, n);
+  m_put_pos += n;
+  m_dirty = true;
+  reset_get_area(saved_get_pos);
+  return count;
+}
+
+MemoryStreambuf::pos_type MemoryStreambuf::seekoff(
+    off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+  auto const base = [&]() -> off_type {
+    switch (dir) {
+    case std::ios_base::beg:
+      return 0;
+    case std::ios_base::end:
+      return static_cast<off_type>(m_data.size());
+    default:
+      // a relative seek is only well-defined for a single position
+      if ((which & std::ios_base::in) && (which & std::ios_base::out)) {
+        return -1;
+      }
+      return static_cast<off_type>((which & std::ios_base::in) ? get_pos()
+                                                               : m_put_pos);
+    }
+  }();
+  if (base < 0) {
+    return pos_type(off_type(-1));
+  }
+  return seekpos(pos_type(base + off), which);
+}
+
+MemoryStreambuf::pos_type
+MemoryStreambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+  auto const target = static_cast<off_type>(pos);
+  if (target < 0 || static_cast<std::size_t>(target) > m_data.size()) {
+    return pos_type(off_type(-1));
+  }
+  if (which & std::ios_base::in) {
+    reset_get_area(static_cast<std::size_t>(target));
+  }
+  if (which & std::ios_base::out) {
+    m_put_pos = static_cast<std::size_t>(target);
+  }
+  return pos;
+}
+
+void MemoryStreambuf::reset_get_area(std::size_t get_pos) {
+  auto *begin = m_data.data();
+  get_pos = std::min(get_pos, m_data.size());
+  setg(begin, begin + get_pos, begin + m_data.size());
+}
+
+} // namespace objectstore
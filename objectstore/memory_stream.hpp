@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <ios>
+#include <iostream>
+#include <memory_resource>
+#include <span>
+#include <streambuf>
+#include <vector>
+
+namespace objectstore {
+
+/**
+ * @brief A growable in-memory stream buffer with independent get and put
+ * positions, allocating from a std::pmr::memory_resource.
+ *
+ * There is deliberately no put area, so every write goes through xsputn() or
+ * overflow(). That keeps bulk writes a single memcpy and lets the buffer know
+ * whether it was modified since it was last marked clean.
+ */
+class MemoryStreambuf : public std::streambuf {
+public:
+  explicit MemoryStreambuf(std::pmr::memory_resource *resource);
+  MemoryStreambuf(std::pmr::memory_resource *resource,
+                  std::span<const std::byte> content);
+
+  MemoryStreambuf(const MemoryStreambuf &) = delete;
+  MemoryStreambuf &operator=(const MemoryStreambuf &) = delete;
+
+  std::span<const std::byte> data() const {
+    return std::as_bytes(std::span{m_data});
+  }
+  std::size_t size() const { return m_data.size(); }
+
+  bool dirty() const { return m_dirty; }
+  void mark_clean() { m_dirty = false; }
+
+  /**
+   * @brief Replaces the content and rewinds both positions.
+   */
+  void assign(std::span<const std::byte> content);
+
+  /**
+   * @brief Discards the content and resizes the buffer to the given size,
+   * returning it to be filled in by the caller, e.g. straight from a file.
+   * Rewinds both positions and marks the buffer clean.
+   */
+  std::span<std::byte> reset(std::size_t size);
+
+  /**
+   * @brief Moves both the get and the put position to the beginning.
+   */
+  void rewind();
+
+protected:
+  int_type underflow() override;
+  int_type overflow(int_type ch) override;
+  std::streamsize xsputn(const char_type *s, std::streamsize count) override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+  void reset_get_area(std::size_t get_pos);
+  std::size_t get_pos() const {
+    return static_cast<std::size_t>(gptr() - eback());
+  }
+
+  std::pmr::vector<char> m_data;
+  std::size_t m_put_pos = 0;
+  bool m_dirty = false;
+};
+
+/**
+ * @brief std::iostream over a MemoryStreambuf.
+ */
+class MemoryStream : public std::iostream {
+public:
+  explicit MemoryStream(std::pmr::memory_resource *resource)
+      : std::iostream{nullptr}, m_buffer{resource} {
+    rdbuf(&m_buffer);
+  }
+
+  MemoryStream(std::pmr::memory_resource *resource,
+               std::span<const std::byte> content)
+      : std::iostream{nullptr}, m_buffer{resource, content} {
+    rdbuf(&m_buffer);
+  }
+
+  MemoryStreambuf &buffer() { return m_buffer; }
+  MemoryStreambuf const &buffer() const { return m_buffer; }
+
+  /**
+   * @brief Clears the stream state and rewinds both positions.
+   */
+  void rewind() {
+    clear();
+    m_buffer.rewind();
+  }
+
+private:
+  MemoryStreambuf m_buffer;
+};
+
+} // namespace objectstore
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <new>
+
+#include "metrics.hpp"
+
+namespace objectstore {
+
+namespace {
+
+/**
+ * @return the shard of the calling thread, the same for all Metrics
+ */
+std::size_t ShardIndex(std::size_t num_shards) {
+  static std::atomic<std::size_t> next_thread{0};
+  thread_local std::size_t const thread = next_thread.fetch_add(1);
+  return thread % num_shards;
+}
+
+void AppendField(std::string *json, char const *name, std::uint64_t value) {
+  if (json->back() != '{') {
+    *json += ',';
+  }
+  *json += '"';
+  *json += name;
+  *json += "\":";
+  *json += std::to_string(value);
+}
+
+} // namespace
+
+char const *ToString(MetricOperation operation) {
+  switch (operation) {
+  case MetricOperation::Add:
+    return "add";
+  case MetricOperation::Get:
+    return "get";
+  case MetricOperation::Size:
+    return "size";
+  case MetricOperation::Close:
+    return "close";
+  case MetricOperation::Destroy:
+    return "destroy";
+  case MetricOperation::Clear:
+    return "clear";
+  }
+  return "unknown";
+}
+
+char const *ToString(MetricSyscall syscall) {
+  switch (syscall) {
+  case MetricSyscall::Open:
+    return "open";
+  case MetricSyscall::Close:
+    return "close";
+  case MetricSyscall::Read:
+    return "read";
+  case MetricSyscall::Write:
+    return "write";
+  case MetricSyscall::Stat:
+    return "stat";
+  case MetricSyscall::Sync:
+    return "sync";
+  case MetricSyscall::Unlink:
+    return "unlink";
+  case MetricSyscall::Rename:
+    return "rename";
+  case MetricSyscall::Mkdir:
+    return "mkdir";
+  }
+  return "unknown";
+}
+
+std::string MetricsSnapshot::to_json() const {
+  auto json = std::string{"{\"operations\":{"};
+  for (std::size_t i = 0; i < kNumMetricOperations; ++i) {
+    auto const &histogram = latencies[i];
+    if (i > 0) {
+      json += ',';
+    }
+    json += '"';
+    json += ToString(static_cast<MetricOperation>(i));
+    json += "\":{";
+    AppendField(&json, "count", histogram.Count());
+    AppendField(&json, "p50_ns", histogram.ValueAtPercentile(50));
+    AppendField(&json, "p99_ns", histogram.ValueAtPercentile(99));
+    AppendField(&json, "p999_ns", histogram.ValueAtPercentile(99.9));
+    AppendField(&json, "max_ns", histogram.Max());
+    json += '}';
+  }
+  json += "},\"syscalls\":{";
+  for (std::size_t i = 0; i < kNumMetricSyscalls; ++i) {
+    AppendField(&json, ToString(static_cast<MetricSyscall>(i)), syscalls[i]);
+  }
+  json += '}';
+  AppendField(&json, "bytes_read", bytes_read);
+  AppendField(&json, "bytes_written", bytes_written);
+  AppendField(&json, "open_files", open_files);
+  json += '}';
+  return json;
+}
+
+Metrics::~Metrics() {
+  for (auto &slot : m_shards) {
+    if (auto *shard = slot.load()) {
+      shard->~Shard();
+      m_resource->deallocate(shard, sizeof(Shard), alignof(Shard));
+    }
+  }
+}
+
+MetricsSnapshot Metrics::snapshot() const {
+  auto snapshot = MetricsSnapshot{};
+  for (auto const &slot : m_shards) {
+    auto *shard = slot.load(std::memory_order_acquire);
+    if (shard == nullptr) {
+      continue;
+    }
+    {
+      auto lock = std::lock_guard{shard->mutex};
+      for (std::size_t i = 0; i < kNumMetricOperations; ++i) {
+        snapshot.latencies[i].Merge(shard->latencies[i]);
+      }
+    }
+    for (std::size_t i = 0; i < kNumMetricSyscalls; ++i) {
+      snapshot.syscalls[i] +=
+          shard->syscalls[i].load(std::memory_order_relaxed);
+    }
+    snapshot.bytes_read += shard->bytes_read.load(std::memory_order_relaxed);
+    snapshot.bytes_written +=
+        shard->bytes_written.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+void Metrics::record_latency(MetricOperation operation,
+                             std::chrono::nanoseconds latency) {
+  auto &shard = this->shard();
+  auto lock = std::lock_guard{shard.mutex};
+  shard.latencies[static_cast<std::size_t>(operation)].Record(
+      static_cast<std::uint64_t>(std::max<std::int64_t>(latency.count(), 0)));
+}
+
+Metrics::Shard &Metrics::shard() {
+  auto &slot = m_shards[ShardIndex(kNumShards)];
+  if (auto *shard = slot.load(std::memory_order_acquire)) {
+    return *shard;
+  }
+  auto *shard =
+      new (m_resource->allocate(sizeof(Shard), alignof(Shard))) Shard{};
+  Shard *expected = nullptr;
+  if (!slot.compare_exchange_strong(expected, shard,
+                                    std::memory_order_acq_rel)) {
+    // another thread of the same shard was first
+    shard->~Shard();
+    m_resource->deallocate(shard, sizeof(Shard), alignof(Shard));
+    return *expected;
+  }
+  return *shard;
+}
+
+} // namespace objectstore
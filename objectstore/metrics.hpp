@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+
+#include <histogram.hpp>
+
+namespace objectstore {
+
+/**
+ * Whether the collections can record metrics at all. Building with
+ * OBJECTSTORE_DISABLE_METRICS removes every clock read and counter, and
+ * snapshots stay empty. Otherwise, each collection decides at runtime.
+ */
+#ifdef OBJECTSTORE_DISABLE_METRICS
+inline constexpr bool kMetricsEnabled = false;
+#else
+inline constexpr bool kMetricsEnabled = true;
+#endif
+
+/**
+ * @brief The operations of a collection whose latency is recorded.
+ */
+enum class MetricOperation { Add, Get, Size, Close, Destroy, Clear };
+inline constexpr std::size_t kNumMetricOperations = 6;
+
+/**
+ * @brief The system calls that are counted, as far as the collection makes
+ * them on its own.
+ */
+enum class MetricSyscall {
+  Open,
+  Close,
+  Read,
+  Write,
+  Stat,
+  Sync,
+  Unlink,
+  Rename,
+  Mkdir
+};
+inline constexpr std::size_t kNumMetricSyscalls = 9;
+
+char const *ToString(MetricOperation operation);
+char const *ToString(MetricSyscall syscall);
+
+/// Within ~6% of the recorded latencies, at under 8 KB, as a collection keeps
+/// one per operation and shard.
+using LatencyHistogram = common::BasicHistogram<5>;
+
+/**
+ * @brief Everything recorded up to a point in time, with the latencies in
+ * nanoseconds.
+ */
+struct MetricsSnapshot {
+  std::array<LatencyHistogram, kNumMetricOperations> latencies;
+  std::array<std::uint64_t, kNumMetricSyscalls> syscalls{};
+  std::uint64_t bytes_read = 0;
+  std::uint64_t bytes_written = 0;
+  /// Files open at the time of the snapshot.
+  std::uint64_t open_files = 0;
+
+  LatencyHistogram const &latency(MetricOperation operation) const {
+    return latencies[static_cast<std::size_t>(operation)];
+  }
+  std::uint64_t count(MetricOperation operation) const {
+    return latency(operation).Count();
+  }
+  std::uint64_t count(MetricSyscall syscall) const {
+    return syscalls[static_cast<std::size_t>(syscall)];
+  }
+
+  /**
+   * @return a single JSON object, with the count, p50, p99, p999 and max of
+   * each operation
+   */
+  std::string to_json() const;
+};
+
+/**
+ * @brief Records the metrics of a collection from any number of threads.
+ *
+ * Each thread records into one of a fixed number of shards, so that threads
+ * rarely share a lock or a cache line, and snapshot() adds them up. A shard
+ * is only allocated once a thread records into it, so metrics that are not
+ * enabled cost neither memory nor clock reads.
+ */
+class Metrics {
+public:
+  /**
+   * @brief Records the latency of an operation when it goes out of scope.
+   */
+  class Timer {
+  public:
+    Timer(Metrics *metrics, MetricOperation operation)
+        : m_metrics{metrics}, m_operation{operation} {
+      if (m_metrics->enabled()) {
+        m_start = std::chrono::steady_clock::now();
+      }
+    }
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    ~Timer() {
+      if (m_metrics->enabled()) {
+        m_metrics->record(m_operation,
+                          std::chrono::steady_clock::now() - m_start);
+      }
+    }
+
+  private:
+    Metrics *m_metrics;
+    MetricOperation m_operation;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  explicit Metrics(std::pmr::memory_resource *resource, bool enabled = true)
+      : m_resource{resource}, m_enabled{kMetricsEnabled && enabled} {}
+
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+
+  ~Metrics();
+
+  /**
+   * @return false if built without metrics or created disabled, in which
+   * case nothing is recorded
+   */
+  bool enabled() const {
+    if constexpr (kMetricsEnabled) {
+      return m_enabled;
+    }
+    return false;
+  }
+
+  Timer time(MetricOperation operation) { return Timer{this, operation}; }
+
+  void record(MetricOperation operation, std::chrono::nanoseconds latency) {
+    if (enabled()) {
+      record_latency(operation, latency);
+    }
+  }
+
+  void count(MetricSyscall syscall, std::uint64_t num_calls = 1) {
+    if (enabled() && num_calls > 0) {
+      shard().syscalls[static_cast<std::size_t>(syscall)].fetch_add(
+          num_calls, std::memory_order_relaxed);
+    }
+  }
+
+  void transferred(std::uint64_t bytes_read, std::uint64_t bytes_written) {
+    if (enabled()) {
+      auto &shard = this->shard();
+      shard.bytes_read.fetch_add(bytes_read, std::memory_order_relaxed);
+      shard.bytes_written.fetch_add(bytes_written, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @return the sum of all shards, with open_files left at zero
+   */
+  MetricsSnapshot snapshot() const;
+
+private:
+  static constexpr std::size_t kNumShards = 16;
+
+  struct alignas(64) Shard {
+    /// Only for the histograms, the counters are atomic.
+    std::mutex mutex;
+    std::array<LatencyHistogram, kNumMetricOperations> latencies;
+    std::array<std::atomic<std::uint64_t>, kNumMetricSyscalls> syscalls{};
+    std::atomic<std::uint64_t> bytes_read{0};
+    std::atomic<std::uint64_t> bytes_written{0};
+  };
+
+  void record_latency(MetricOperation operation,
+                      std::chrono::nanoseconds latency);
+  Shard &shard();
+
+  std::pmr::memory_resource *m_resource;
+  bool m_enabled;
+  std::array<std::atomic<Shard *>, kNumShards> m_shards{};
+};
+
+} // namespace objectstore
@@ -0,0 +1,126 @@
+#include <chrono>
+#include <filesystem>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <metrics.hpp>
+#include <objectstore.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_metrics";
+
+} // namespace
+
+TEST(Metrics, AddsUpThreads) {
+  if (!objectstore::kMetricsEnabled) {
+    GTEST_SKIP() << "built without metrics";
+  }
+  auto metrics = objectstore::Metrics{std::pmr::get_default_resource()};
+  auto threads = std::vector<std::thread>{};
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&metrics, i] {
+      for (int j = 0; j < 1000; ++j) {
+        metrics.record(objectstore::MetricOperation::Get,
+                       std::chrono::microseconds{i + 1});
+        metrics.count(objectstore::MetricSyscall::Read);
+        metrics.transferred(10, 1);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  {
+    auto timer = metrics.time(objectstore::MetricOperation::Clear);
+  }
+
+  auto const snapshot = metrics.snapshot();
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Get), 4000u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Clear), 1u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Add), 0u);
+  EXPECT_EQ(snapshot.latency(objectstore::MetricOperation::Get).Max(), 4000u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Read), 4000u);
+  EXPECT_EQ(snapshot.bytes_read, 40'000u);
+  EXPECT_EQ(snapshot.bytes_written, 4'000u);
+}
+
+TEST(Metrics, ExportsJson) {
+  auto snapshot = objectstore::MetricsSnapshot{};
+  snapshot.latencies[0].Record(100);
+  snapshot.syscalls[1] = 7;
+  snapshot.bytes_written = 42;
+  auto const json = snapshot.to_json();
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_EQ(json.back(), '}');
+  EXPECT_NE(json.find("\"add\":{\"count\":1,\"p50_ns\":100,"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"syscalls\":{\"open\":0,\"close\":7,"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"bytes_written\":42"), std::string::npos);
+}
+
+TEST(StoredFolder, RecordsMetrics) {
+  if (!objectstore::kMetricsEnabled) {
+    GTEST_SKIP() << "built without metrics";
+  }
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto options = objectstore::StoredFolderOptions{};
+  options.record_metrics = true;
+  auto folder = objectstore::StoredFolder{std::pmr::get_default_resource(),
+                                          kTestPath, options};
+  auto const content = std::string(1000, 'x');
+  for (int i = 0; i < 3; ++i) {
+    auto id = folder.add();
+    *folder.get(id) << content;
+    folder.close(id);
+  }
+  std::string word;
+  *folder.get(0) >> word;
+  folder.size(1);
+  folder.destroy(2);
+
+  auto snapshot = folder.metrics();
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Add), 3u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Get), 4u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Close), 3u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Size), 1u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Destroy), 1u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Open), 3u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Write), 3u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Unlink), 1u);
+  EXPECT_EQ(snapshot.bytes_written, 3 * content.size());
+  // still open, but collected by metrics()
+  EXPECT_EQ(snapshot.bytes_read, content.size());
+  EXPECT_EQ(snapshot.open_files, 2u);
+
+  folder.clear();
+  snapshot = folder.metrics();
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Clear), 1u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Close), 3u);
+  EXPECT_EQ(snapshot.open_files, 0u);
+}
+
+TEST(StoredFolder, MetricsAreOffByDefault) {
+  std::filesystem::remove_all(kTestPath);
+  auto _ = common::MakeScopeGuard(
+      [] { std::filesystem::remove_all(kTestPath); });
+  auto folder = objectstore::StoredFolder{std::pmr::get_default_resource(),
+                                          kTestPath};
+  auto id = folder.add();
+  *folder.get(id) << "content";
+  folder.close(id);
+
+  auto const snapshot = folder.metrics();
+  EXPECT_EQ(snapshot.count(objectstore::MetricOperation::Add), 0u);
+  EXPECT_EQ(snapshot.count(objectstore::MetricSyscall::Write), 0u);
+  EXPECT_EQ(snapshot.bytes_written, 0u);
+  EXPECT_EQ(snapshot.open_files, 1u);
+}
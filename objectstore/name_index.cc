@@ -0,0 +1,749 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <scopeguard.hpp>
+
+#include "name_index.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr char kCheckpointMagic[8] = {'O', 'S', 'N', 'M', 'I', 'D', 'X', '1'};
+constexpr auto kCheckpointPrefix = std::string_view{"index."};
+constexpr auto kLogPrefix = std::string_view{"log."};
+constexpr auto kTmpSuffix = std::string_view{".tmp"};
+
+constexpr std::uint64_t kEmpty = 0;
+constexpr std::uint64_t kErased = ~std::uint64_t{0};
+constexpr unsigned kOffsetBits = 48;
+constexpr std::uint64_t kOffsetMask = (std::uint64_t{1} << kOffsetBits) - 1;
+
+constexpr std::uint64_t kMinCapacity = 16;
+/// Slots moved from the old table with every change while growing. The new
+/// table has room for twice the keys, so the old one is done long before the
+/// new one fills up.
+constexpr std::size_t kMigrateSlots = 16;
+/// Moved slots are given back to the system a megabyte of 16-byte slots at
+/// a time.
+constexpr std::uint64_t kReleaseSlots = (1 << 20) / 16;
+constexpr std::size_t kChunkSize = 1 << 20;
+constexpr std::size_t kLogBufferSize = 64 << 10;
+
+/**
+ * The checkpoint is this header, the capacity slots of the table, and the
+ * records of the keys they point to, keys_size bytes in total.
+ */
+struct CheckpointHeader {
+  char magic[8];
+  std::uint64_t capacity;
+  std::uint64_t count;
+  std::uint64_t keys_size;
+  std::uint64_t reserved[4];
+};
+static_assert(sizeof(CheckpointHeader) == 64);
+
+/// A key is stored as its size, followed by its bytes.
+using KeySize = std::uint32_t;
+
+/**
+ * A change in the log, followed by the key. The checksum covers the rest of
+ * the record and the key, so that a record that was cut off by a crash is
+ * recognized.
+ */
+struct LogRecord {
+  std::uint64_t checksum;
+  std::uint64_t id;
+  KeySize key_size;
+  std::uint8_t op;
+  std::uint8_t reserved[3];
+};
+static_assert(sizeof(LogRecord) == 24);
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::uint64_t Mix(std::uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+/**
+ * Unlike std::hash, the same in every build, as the checkpoint places the
+ * keys by it.
+ */
+std::uint64_t HashKey(std::string_view key, std::uint64_t seed = 0) {
+  auto hash = seed ^ (key.size() * 0x9e3779b97f4a7c15ull);
+  auto const *bytes = key.data();
+  auto remaining = key.size();
+  for (; remaining >= 8; bytes += 8, remaining -= 8) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    hash = std::rotl((hash ^ word) * 0x9ddfea08eb382d69ull, 29);
+  }
+  if (remaining > 0) {
+    std::uint64_t word = 0;
+    std::memcpy(&word, bytes, remaining);
+    hash = std::rotl((hash ^ word) * 0x9ddfea08eb382d69ull, 29);
+  }
+  return Mix(hash);
+}
+
+/**
+ * @return the upper bits of the hash, which never make a tag kEmpty or
+ * kErased
+ */
+std::uint64_t Fingerprint(std::uint64_t hash) {
+  auto const fingerprint = hash >> kOffsetBits;
+  return std::clamp<std::uint64_t>(fingerprint, 1,
+                                   (kErased >> kOffsetBits) - 1);
+}
+
+std::uint64_t Tag(std::uint64_t fingerprint, std::uint64_t offset) {
+  return (fingerprint << kOffsetBits) | offset;
+}
+
+bool IsLive(std::uint64_t tag) { return tag != kEmpty && tag != kErased; }
+
+std::uint64_t LogChecksum(LogRecord const &record, std::string_view key) {
+  return HashKey(key, Mix(record.id) ^ (std::uint64_t{record.op} << 32) ^
+                          record.key_size);
+}
+
+std::filesystem::path FilePath(std::filesystem::path const &path,
+                               std::string_view prefix,
+                               std::uint64_t generation) {
+  auto name = std::string{prefix};
+  name += std::to_string(generation);
+  return path / name;
+}
+
+/**
+ * @return the generation of a checkpoint or log named prefix and a number,
+ * none for any other name
+ */
+std::optional<std::uint64_t> ParseGeneration(std::string_view name,
+                                             std::string_view prefix) {
+  if (!name.starts_with(prefix) || name.size() == prefix.size()) {
+    return std::nullopt;
+  }
+  auto generation = std::uint64_t{};
+  auto const *end = name.data() + name.size();
+  auto [ptr, ec] =
+      std::from_chars(name.data() + prefix.size(), end, generation);
+  if (ec != std::errc{} || ptr != end) {
+    return std::nullopt;
+  }
+  return generation;
+}
+
+std::error_code WriteAll(int fd, void const *data, std::size_t size) {
+  auto const *bytes = static_cast<char const *>(data);
+  while (size > 0) {
+    auto const written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LastError();
+    }
+    bytes += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return {};
+}
+
+std::error_code SyncDirectory(std::filesystem::path const &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return LastError();
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+  if (::fsync(fd) != 0) {
+    return LastError();
+  }
+  return {};
+}
+
+} // namespace
+
+NameIndex::Mapping &NameIndex::Mapping::operator=(Mapping &&other) noexcept {
+  if (this != &other) {
+    if (m_address != nullptr) {
+      ::munmap(m_address, m_size);
+    }
+    m_address = std::exchange(other.m_address, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+  }
+  return *this;
+}
+
+NameIndex::Mapping::~Mapping() {
+  if (m_address != nullptr) {
+    ::munmap(m_address, m_size);
+  }
+}
+
+NameIndex::NameIndex(std::pmr::memory_resource *resource,
+                     std::filesystem::path path, NameIndexOptions options)
+    : m_resource{resource}, m_path{std::move(path)}, m_options{options},
+      m_chunks{resource}, m_log_buffer{resource} {
+  std::filesystem::create_directories(m_path);
+  // the latest checkpoint that was renamed into place
+  auto latest = std::optional<std::uint64_t>{};
+  for (auto const &entry : std::filesystem::directory_iterator{m_path}) {
+    auto const name = entry.path().filename().native();
+    if (auto generation = ParseGeneration(name, kCheckpointPrefix)) {
+      latest = std::max(latest.value_or(0), *generation);
+    }
+  }
+  m_generation = latest.value_or(0);
+  // what is left of older generations and of interrupted checkpoints
+  for (auto const &entry : std::filesystem::directory_iterator{m_path}) {
+    auto const filename = entry.path().filename();
+    auto const name = std::string_view{filename.native()};
+    auto generation = ParseGeneration(name, kCheckpointPrefix);
+    if (!generation) {
+      generation = ParseGeneration(name, kLogPrefix);
+    }
+    if ((generation && *generation != m_generation) ||
+        name.ends_with(kTmpSuffix)) {
+      ::unlink(entry.path().c_str());
+    }
+  }
+
+  if (auto ec = load(latest.has_value())) {
+    throw std::filesystem::filesystem_error{
+        "Cannot load NameIndex checkpoint",
+        FilePath(m_path, kCheckpointPrefix, m_generation), ec};
+  }
+  if (auto ec = replay()) {
+    throw std::filesystem::filesystem_error{
+        "Cannot replay NameIndex log",
+        FilePath(m_path, kLogPrefix, m_generation), ec};
+  }
+}
+
+NameIndex::~NameIndex() {
+  // errors cannot be reported, the log holds whatever made it
+  auto const changed = m_log_size + m_log_buffer.size() > 0;
+  if (!m_options.checkpoint_on_close || !changed || checkpoint()) {
+    flush_log();
+  }
+  if (m_log_fd >= 0) {
+    ::close(m_log_fd);
+  }
+  free_chunks();
+}
+
+std::optional<NameIndex::object_id_t>
+NameIndex::find(std::string_view key) const {
+  if (auto const *slot = lookup(key, HashKey(key))) {
+    return slot->id;
+  }
+  return std::nullopt;
+}
+
+std::pair<bool, std::error_code> NameIndex::insert(std::string_view key,
+                                                   object_id_t id) {
+  if (key.size() > kMaxKeySize) {
+    return std::make_pair(false,
+                          std::make_error_code(std::errc::value_too_large));
+  }
+  auto const hash = HashKey(key);
+  if (lookup(key, hash) != nullptr) {
+    return std::make_pair(false, std::error_code{});
+  }
+  if (auto ec = log(LogOp::Insert, key, id)) {
+    return std::make_pair(false, ec);
+  }
+  apply_insert(key, hash, id);
+  return std::make_pair(true, std::error_code{});
+}
+
+std::pair<bool, std::error_code> NameIndex::erase(std::string_view key) {
+  auto const hash = HashKey(key);
+  if (lookup(key, hash) == nullptr) {
+    return std::make_pair(false, std::error_code{});
+  }
+  if (auto ec = log(LogOp::Erase, key, 0)) {
+    return std::make_pair(false, ec);
+  }
+  apply_erase(key, hash);
+  return std::make_pair(true, std::error_code{});
+}
+
+std::error_code NameIndex::sync() {
+  if (auto ec = flush_log()) {
+    return ec;
+  }
+  if (::fdatasync(m_log_fd) != 0) {
+    return LastError();
+  }
+  return {};
+}
+
+std::error_code NameIndex::checkpoint() {
+  if (auto ec = flush_log()) {
+    return ec;
+  }
+  auto const next = m_generation + 1;
+  auto const final_path = FilePath(m_path, kCheckpointPrefix, next);
+  auto tmp_path = final_path;
+  tmp_path += kTmpSuffix;
+  auto const log_path = FilePath(m_path, kLogPrefix, next);
+
+  int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return LastError();
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+  auto const fail = [&](std::error_code ec) {
+    ::unlink(tmp_path.c_str());
+    ::unlink(log_path.c_str());
+    return ec;
+  };
+
+  // the keys all fit into the current table, at most three quarters full
+  auto const capacity = m_table.capacity;
+  auto const keys_offset = sizeof(CheckpointHeader) + capacity * sizeof(Slot);
+  auto const file_size = keys_offset + m_live_key_bytes;
+  if (::ftruncate(fd, static_cast<off_t>(file_size)) != 0) {
+    return fail(LastError());
+  }
+  void *address =
+      ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    return fail(LastError());
+  }
+  auto const file = Mapping{address, file_size};
+
+  // rehashed, which leaves out the erased slots and the keys they held
+  auto table = Table{};
+  table.slots =
+      reinterpret_cast<Slot *>(file.data() + sizeof(CheckpointHeader));
+  table.capacity = capacity;
+  auto *keys = file.data() + keys_offset;
+  std::uint64_t keys_size = 0;
+  auto const copy = [&](Table const &from, std::uint64_t moved_below) {
+    for (auto i = moved_below; i < from.capacity; ++i) {
+      auto const &slot = from.slots[i];
+      if (!IsLive(slot.tag)) {
+        continue;
+      }
+      auto const key = key_at(slot.tag & kOffsetMask);
+      auto const size = static_cast<KeySize>(key.size());
+      std::memcpy(keys + keys_size, &size, sizeof(size));
+      std::memcpy(keys + keys_size + sizeof(size), key.data(), key.size());
+      place(table, HashKey(key), Tag(slot.tag >> kOffsetBits, keys_size),
+            slot.id);
+      keys_size += sizeof(size) + key.size();
+    }
+  };
+  copy(m_table, 0);
+  if (growing()) {
+    copy(m_old, m_migrated);
+  }
+  auto header = CheckpointHeader{};
+  std::memcpy(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+  header.capacity = capacity;
+  header.count = table.used;
+  header.keys_size = keys_size;
+  std::memcpy(file.data(), &header, sizeof(header));
+  // writes the pages of the mapping too
+  if (::fdatasync(fd) != 0) {
+    return fail(LastError());
+  }
+
+  int log_fd =
+      ::open(log_path.c_str(),
+             O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (log_fd < 0) {
+    return fail(LastError());
+  }
+  if (::rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+    auto ec = LastError();
+    ::close(log_fd);
+    return fail(ec);
+  }
+  // the new generation is the index from here on, even if the directory
+  // cannot be synced, in which case a crash may bring back the old one
+  auto ec = SyncDirectory(m_path);
+  ::unlink(FilePath(m_path, kCheckpointPrefix, m_generation).c_str());
+  ::unlink(FilePath(m_path, kLogPrefix, m_generation).c_str());
+  ::close(m_log_fd);
+  m_log_fd = log_fd;
+  m_log_size = 0;
+  m_generation = next;
+
+  // maps what was just written, with the keys packed
+  m_table = Table{};
+  m_old = Table{};
+  m_migrated = 0;
+  m_released = 0;
+  m_size = 0;
+  free_chunks();
+  m_file = Mapping{};
+  if (auto load_ec = load(true)) {
+    return load_ec;
+  }
+  return ec;
+}
+
+NameIndex::Table NameIndex::make_table(std::uint64_t capacity) {
+  auto const size = capacity * sizeof(Slot);
+  void *address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (address == MAP_FAILED) {
+    throw std::bad_alloc{};
+  }
+  auto table = Table{};
+  table.slots = static_cast<Slot *>(address);
+  table.capacity = capacity;
+  table.memory = Mapping{address, size};
+  return table;
+}
+
+std::error_code NameIndex::load(bool has_checkpoint) {
+  if (!has_checkpoint) {
+    m_table = make_table(
+        std::bit_ceil(std::max(m_options.initial_capacity, kMinCapacity)));
+    return {};
+  }
+  auto const file_path = FilePath(m_path, kCheckpointPrefix, m_generation);
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return LastError();
+  }
+  auto close_fd = common::MakeScopeGuard([fd] { ::close(fd); });
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    return LastError();
+  }
+  auto const invalid = std::make_error_code(std::errc::invalid_argument);
+  auto const size = static_cast<std::uint64_t>(st.st_size);
+  if (size < sizeof(CheckpointHeader)) {
+    return invalid;
+  }
+  // writable, but changes stay in memory
+  void *address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+  if (address == MAP_FAILED) {
+    return LastError();
+  }
+  m_file = Mapping{address, size};
+
+  auto header = CheckpointHeader{};
+  std::memcpy(&header, m_file.data(), sizeof(header));
+  auto const slots_size = size - sizeof(header);
+  if (std::memcmp(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) !=
+          0 ||
+      header.capacity < kMinCapacity || !std::has_single_bit(header.capacity) ||
+      header.capacity > slots_size / sizeof(Slot) ||
+      header.count >= header.capacity ||
+      slots_size != header.capacity * sizeof(Slot) + header.keys_size) {
+    m_file = Mapping{};
+    return invalid;
+  }
+  m_table.slots =
+      reinterpret_cast<Slot *>(m_file.data() + sizeof(CheckpointHeader));
+  m_table.capacity = header.capacity;
+  // a checkpoint has no erased slots
+  m_table.used = header.count;
+  m_size = header.count;
+  m_file_keys = m_file.data() + sizeof(header) + header.capacity * sizeof(Slot);
+  m_file_keys_size = header.keys_size;
+  m_live_key_bytes = header.keys_size;
+  return {};
+}
+
+std::error_code NameIndex::replay() {
+  auto const log_path = FilePath(m_path, kLogPrefix, m_generation);
+  m_log_fd = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+  if (m_log_fd < 0) {
+    return LastError();
+  }
+  struct stat st {};
+  if (::fstat(m_log_fd, &st) != 0) {
+    return LastError();
+  }
+  auto const size = static_cast<std::uint64_t>(st.st_size);
+  if (size == 0) {
+    // possibly just created
+    return SyncDirectory(m_path);
+  }
+  void *address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_log_fd, 0);
+  if (address == MAP_FAILED) {
+    return LastError();
+  }
+  auto const records = Mapping{address, size};
+  ::madvise(address, size, MADV_SEQUENTIAL);
+
+  std::uint64_t valid = 0;
+  while (size - valid >= sizeof(LogRecord)) {
+    auto record = LogRecord{};
+    std::memcpy(&record, records.data() + valid, sizeof(record));
+    if (record.key_size > kMaxKeySize ||
+        size - valid - sizeof(record) < record.key_size) {
+      break;
+    }
+    auto const key =
+        std::string_view{records.data() + valid + sizeof(record),
+                         record.key_size};
+    if (LogChecksum(record, key) != record.checksum) {
+      break;
+    }
+    auto const hash = HashKey(key);
+    if (record.op == static_cast<std::uint8_t>(LogOp::Insert)) {
+      if (lookup(key, hash) == nullptr) {
+        apply_insert(key, hash, record.id);
+      }
+    } else if (record.op == static_cast<std::uint8_t>(LogOp::Erase)) {
+      apply_erase(key, hash);
+    } else {
+      break;
+    }
+    valid += sizeof(record) + record.key_size;
+  }
+  // the rest was cut off by a crash, and new records must not follow it
+  if (valid < size && ::ftruncate(m_log_fd, static_cast<off_t>(valid)) != 0) {
+    return LastError();
+  }
+  m_log_size = valid;
+  return {};
+}
+
+std::error_code NameIndex::log(LogOp op, std::string_view key,
+                               object_id_t id) {
+  auto record = LogRecord{};
+  record.id = id;
+  record.key_size = static_cast<KeySize>(key.size());
+  record.op = static_cast<std::uint8_t>(op);
+  record.checksum = LogChecksum(record, key);
+  auto const buffered = m_log_buffer.size();
+  auto const *bytes = reinterpret_cast<char const *>(&record);
+  m_log_buffer.insert(m_log_buffer.end(), bytes, bytes + sizeof(record));
+  m_log_buffer.insert(m_log_buffer.end(), key.begin(), key.end());
+  if (!m_options.sync_log && m_log_buffer.size() < kLogBufferSize) {
+    return {};
+  }
+  if (auto ec = m_options.sync_log ? sync() : flush_log()) {
+    // the change is not made, the ones before are written with the next
+    m_log_buffer.resize(buffered);
+    return ec;
+  }
+  return {};
+}
+
+std::error_code NameIndex::flush_log() {
+  if (m_log_buffer.empty()) {
+    return {};
+  }
+  if (auto ec = WriteAll(m_log_fd, m_log_buffer.data(), m_log_buffer.size())) {
+    // a partial record would hide the ones written after it
+    if (::ftruncate(m_log_fd, static_cast<off_t>(m_log_size)) != 0) {
+      return LastError();
+    }
+    return ec;
+  }
+  m_log_size += m_log_buffer.size();
+  m_log_buffer.clear();
+  return {};
+}
+
+NameIndex::Slot *NameIndex::lookup(std::string_view key,
+                                   std::uint64_t hash) const {
+  if (auto *slot = find_slot(m_table, key, hash, 0)) {
+    return slot;
+  }
+  if (growing()) {
+    return find_slot(m_old, key, hash, m_migrated);
+  }
+  return nullptr;
+}
+
+NameIndex::Slot *NameIndex::find_slot(Table const &table,
+                                      std::string_view key,
+                                      std::uint64_t hash,
+                                      std::uint64_t moved_below) const {
+  auto const fingerprint = Fingerprint(hash);
+  auto const mask = table.capacity - 1;
+  for (std::uint64_t i = hash & mask, probes = 0; probes < table.capacity;
+       i = (i + 1) & mask, ++probes) {
+    if (i < moved_below) {
+      // the moved slots may be given back already, and read as empty, but
+      // every slot from the start of the probe to the key was taken
+      probes += moved_below - i;
+      i = moved_below;
+      if (probes >= table.capacity || i == table.capacity) {
+        return nullptr;
+      }
+    }
+    auto const tag = table.slots[i].tag;
+    if (tag == kEmpty) {
+      return nullptr;
+    }
+    if (tag != kErased && tag >> kOffsetBits == fingerprint &&
+        key_at(tag & kOffsetMask) == key) {
+      return &table.slots[i];
+    }
+  }
+  return nullptr;
+}
+
+void NameIndex::apply_insert(std::string_view key, std::uint64_t hash,
+                             object_id_t id) {
+  migrate(kMigrateSlots);
+  if ((m_table.used + 1) * 4 > m_table.capacity * 3) {
+    grow();
+  }
+  auto const offset = append_key(key);
+  place(m_table, hash, Tag(Fingerprint(hash), offset), id);
+  ++m_size;
+  m_live_key_bytes += sizeof(KeySize) + key.size();
+}
+
+bool NameIndex::apply_erase(std::string_view key, std::uint64_t hash) {
+  migrate(kMigrateSlots);
+  auto *slot = lookup(key, hash);
+  if (slot == nullptr) {
+    return false;
+  }
+  // probes for other keys go on past it
+  slot->tag = kErased;
+  --m_size;
+  m_live_key_bytes -= sizeof(KeySize) + key.size();
+  return true;
+}
+
+void NameIndex::place(Table &table, std::uint64_t hash, std::uint64_t tag,
+                      object_id_t id) {
+  auto const mask = table.capacity - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    auto &slot = table.slots[i];
+    if (!IsLive(slot.tag)) {
+      if (slot.tag == kEmpty) {
+        ++table.used;
+      }
+      slot = {tag, id};
+      return;
+    }
+  }
+}
+
+void NameIndex::grow() {
+  // only if the table filled up before the last growth was done, which the
+  // size of the new table rules out but for a burst of erased slots
+  migrate(m_old.capacity);
+  // the same size if it is mostly erased slots
+  auto const capacity =
+      std::max(m_table.capacity,
+               std::bit_ceil(std::max<std::uint64_t>(kMinCapacity,
+                                                     (m_size + 1) * 2)));
+  m_old = std::move(m_table);
+  m_table = make_table(capacity);
+  m_migrated = 0;
+  m_released = 0;
+}
+
+void NameIndex::migrate(std::size_t num_slots) {
+  if (!growing()) {
+    return;
+  }
+  // the moved slots are left as they are, lookups skip them, so that the
+  // pages of a mapped table are not copied just to mark them
+  auto const end = std::min(m_old.capacity, m_migrated + num_slots);
+  for (; m_migrated < end; ++m_migrated) {
+    auto const &slot = m_old.slots[m_migrated];
+    if (IsLive(slot.tag)) {
+      place(m_table, HashKey(key_at(slot.tag & kOffsetMask)), slot.tag,
+            slot.id);
+    }
+  }
+  if (m_migrated == m_old.capacity) {
+    release_old();
+  } else if (m_migrated - m_released >= kReleaseSlots) {
+    // a little at a time, or freeing the whole table at the end would take
+    // as long as a rehash
+    m_released = release_slots(m_old, m_released, m_migrated);
+  }
+}
+
+void NameIndex::release_old() {
+  release_slots(m_old, m_released, m_old.capacity);
+  m_old = Table{};
+  m_migrated = 0;
+  m_released = 0;
+}
+
+std::uint64_t NameIndex::release_slots(Table const &table, std::uint64_t from,
+                                       std::uint64_t to) {
+  // whole pages only, the table of the checkpoint shares its first and last
+  // page with the header and the keys
+  auto const page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+  auto const begin = reinterpret_cast<std::uintptr_t>(table.slots);
+  auto const first = (begin + from * sizeof(Slot) + page - 1) / page * page;
+  auto const last = (begin + to * sizeof(Slot)) / page * page;
+  if (first >= last) {
+    return from;
+  }
+  // anonymous pages are freed, the ones of the file are read again if needed
+  ::madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+  return (last - begin) / sizeof(Slot);
+}
+
+std::uint64_t NameIndex::append_key(std::string_view key) {
+  auto const record_size = sizeof(KeySize) + key.size();
+  if (m_chunks.empty() || m_chunk_used + record_size > kChunkSize) {
+    m_chunks.push_back(static_cast<char *>(m_resource->allocate(kChunkSize)));
+    m_chunk_used = 0;
+  }
+  auto const offset =
+      m_file_keys_size + (m_chunks.size() - 1) * kChunkSize + m_chunk_used;
+  auto *record = m_chunks.back() + m_chunk_used;
+  auto const size = static_cast<KeySize>(key.size());
+  std::memcpy(record, &size, sizeof(size));
+  std::memcpy(record + sizeof(size), key.data(), key.size());
+  m_chunk_used += record_size;
+  return offset;
+}
+
+std::string_view NameIndex::key_at(std::uint64_t offset) const {
+  char const *record = nullptr;
+  if (offset < m_file_keys_size) {
+    record = m_file_keys + offset;
+  } else {
+    offset -= m_file_keys_size;
+    record = m_chunks[offset / kChunkSize] + offset % kChunkSize;
+  }
+  auto size = KeySize{};
+  std::memcpy(&size, record, sizeof(size));
+  return {record + sizeof(size), size};
+}
+
+void NameIndex::free_chunks() {
+  for (auto *chunk : m_chunks) {
+    m_resource->deallocate(chunk, kChunkSize);
+  }
+  m_chunks.clear();
+  m_chunk_used = 0;
+  m_file_keys = nullptr;
+  m_file_keys_size = 0;
+  m_live_key_bytes = 0;
+}
+
+} // namespace objectstore
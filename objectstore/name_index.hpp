@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace objectstore {
+
+struct NameIndexOptions {
+  /// Slots of a new index, rounded up to a power of two.
+  std::uint64_t initial_capacity = 1024;
+  /// Syncs the log with every change. Without, changes reach the log in
+  /// batches and are only durable after sync().
+  bool sync_log = false;
+  /// Writes a checkpoint when the index is destroyed, so that the next open
+  /// finds everything in it and has no log to replay.
+  bool checkpoint_on_close = true;
+};
+
+/**
+ * @brief A persistent map from byte-string keys to object ids, e.g. to give
+ * the objects of a StoredFolder names.
+ *
+ * The keys live in an open-addressing hash table with linear probing. Every
+ * slot holds a 16-bit fingerprint of the hash of its key next to where the
+ * key is stored, so that a probe only compares the keys of slots whose
+ * fingerprint matches. When the table gets too full, a table twice the size
+ * takes the new keys, and every later change moves a few slots of the old
+ * table over, so that no single operation rehashes the whole table. Until
+ * then, lookups check both tables.
+ *
+ * The directory holds a checkpoint and a log. The checkpoint is the table
+ * and the keys as they are laid out in memory, and opening the index maps it
+ * copy-on-write instead of reading it: only the pages that lookups touch are
+ * read, and changes never reach the file. Every change is appended to the
+ * log before it is applied, and the log is replayed on open, up to the first
+ * record that was not completely written. checkpoint() writes a fresh
+ * checkpoint, without the erased keys, next to the old one, renames it into
+ * place, and starts a new log, so the index survives a crash at any point.
+ *
+ * Not thread-safe.
+ */
+class NameIndex {
+public:
+  using object_id_t = std::uint64_t;
+
+  /// Longest key the index takes.
+  static constexpr std::size_t kMaxKeySize = 64 << 10;
+
+  /**
+   * @brief Opens the index in the directory at path, creating it if
+   * necessary, and replays the log.
+   *
+   * @throw std::filesystem::filesystem_error if the index cannot be opened
+   */
+  NameIndex(std::pmr::memory_resource *resource, std::filesystem::path path,
+            NameIndexOptions options = {});
+
+  NameIndex(const NameIndex &) = delete;
+  NameIndex &operator=(const NameIndex &) = delete;
+
+  /**
+   * @brief Writes the buffered log, and a checkpoint with
+   * checkpoint_on_close.
+   */
+  ~NameIndex();
+
+  std::optional<object_id_t> find(std::string_view key) const;
+  bool contains(std::string_view key) const { return find(key).has_value(); }
+
+  /**
+   * @return whether the key was added, false if it has an id already, and
+   * an error if it could not be logged, or is longer than kMaxKeySize
+   */
+  std::pair<bool, std::error_code> insert(std::string_view key,
+                                          object_id_t id);
+
+  /**
+   * @return whether the key was there, and an error if it could not be
+   * logged
+   */
+  std::pair<bool, std::error_code> erase(std::string_view key);
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  /**
+   * @return the number of slots of the table that takes new keys
+   */
+  std::uint64_t capacity() const { return m_table.capacity; }
+
+  /**
+   * @return whether slots are still moved from a smaller table
+   */
+  bool growing() const { return m_old.capacity != 0; }
+
+  /**
+   * @brief Writes the buffered log and syncs it, making all changes so far
+   * durable.
+   */
+  std::error_code sync();
+
+  /**
+   * @brief Writes all keys into a new checkpoint and starts an empty log.
+   * Takes as long as writing the whole index.
+   */
+  std::error_code checkpoint();
+
+  std::filesystem::path const &path() const { return m_path; }
+
+private:
+  struct Slot {
+    /// The fingerprint in the upper 16 bits, where the key is stored in the
+    /// others. See kEmpty and kErased.
+    std::uint64_t tag;
+    object_id_t id;
+  };
+
+  /**
+   * @brief Memory mapped with mmap(), unmapped when it goes away.
+   */
+  class Mapping {
+  public:
+    Mapping() = default;
+    Mapping(void *address, std::size_t size)
+        : m_address{address}, m_size{size} {}
+    Mapping(Mapping &&other) noexcept { *this = std::move(other); }
+    Mapping &operator=(Mapping &&other) noexcept;
+    ~Mapping();
+
+    char *data() const { return static_cast<char *>(m_address); }
+    std::size_t size() const { return m_size; }
+
+  private:
+    void *m_address = nullptr;
+    std::size_t m_size = 0;
+  };
+
+  struct Table {
+    Slot *slots = nullptr;
+    std::uint64_t capacity = 0;
+    /// Slots that are not empty, erased ones included, as both make probes
+    /// longer.
+    std::uint64_t used = 0;
+    /// Empty for the table of the checkpoint, which is part of m_file.
+    Mapping memory;
+  };
+
+  enum class LogOp : std::uint8_t { Insert = 1, Erase = 2 };
+
+  /**
+   * @brief Allocates a table with all slots empty, from anonymous memory
+   * rather than the resource, as it is large and zeroed a page at a time.
+   */
+  static Table make_table(std::uint64_t capacity);
+
+  /**
+   * @brief Maps the checkpoint of the current generation, if there is one.
+   */
+  std::error_code load(bool has_checkpoint);
+  std::error_code replay();
+  std::error_code log(LogOp op, std::string_view key, object_id_t id);
+  std::error_code flush_log();
+
+  Slot *lookup(std::string_view key, std::uint64_t hash) const;
+  /**
+   * @param moved_below slots below are skipped, as they were moved to the
+   * current table
+   */
+  Slot *find_slot(Table const &table, std::string_view key,
+                  std::uint64_t hash, std::uint64_t moved_below) const;
+  void apply_insert(std::string_view key, std::uint64_t hash, object_id_t id);
+  bool apply_erase(std::string_view key, std::uint64_t hash);
+  static void place(Table &table, std::uint64_t hash, std::uint64_t tag,
+                    object_id_t id);
+  void grow();
+  void migrate(std::size_t num_slots);
+  void release_old();
+  /**
+   * @brief Gives the pages of the slots in [from, to) back to the system.
+   *
+   * @return the slot up to which pages were given back
+   */
+  static std::uint64_t release_slots(Table const &table, std::uint64_t from,
+                                     std::uint64_t to);
+
+  std::uint64_t append_key(std::string_view key);
+  std::string_view key_at(std::uint64_t offset) const;
+  void free_chunks();
+
+  std::pmr::memory_resource *m_resource;
+  std::filesystem::path m_path;
+  NameIndexOptions m_options;
+  std::uint64_t m_generation = 0;
+
+  /// The checkpoint, mapped privately.
+  Mapping m_file;
+  Table m_table;
+  /// The table slots are moved from while growing.
+  Table m_old;
+  /// Slots of m_old below are moved.
+  std::uint64_t m_migrated = 0;
+  /// Slots of m_old below were given back to the system.
+  std::uint64_t m_released = 0;
+  std::size_t m_size = 0;
+
+  /// The keys are records in an arena, the ones of the checkpoint first, in
+  /// the file, and the ones added since in chunks.
+  char const *m_file_keys = nullptr;
+  std::uint64_t m_file_keys_size = 0;
+  std::pmr::vector<char *> m_chunks;
+  std::size_t m_chunk_used = 0;
+  /// Bytes of the records of the keys in the index, what a checkpoint takes.
+  std::uint64_t m_live_key_bytes = 0;
+
+  int m_log_fd = -1;
+  /// Bytes written to the log, a failed write is cut off there.
+  std::uint64_t m_log_size = 0;
+  std::pmr::vector<char> m_log_buffer;
+};
+
+} // namespace objectstore
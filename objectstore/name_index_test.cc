@@ -0,0 +1,197 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <system_error>
+
+#include <gtest/gtest.h>
+
+#include <name_index.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_name_index";
+
+std::string Key(std::size_t i) { return "blob/" + std::to_string(i); }
+
+objectstore::NameIndexOptions WithoutCheckpoint() {
+  auto options = objectstore::NameIndexOptions{};
+  options.checkpoint_on_close = false;
+  return options;
+}
+
+std::set<std::string> Files() {
+  auto names = std::set<std::string>{};
+  for (auto const &entry : std::filesystem::directory_iterator{kTestPath}) {
+    names.insert(entry.path().filename().string());
+  }
+  return names;
+}
+
+class NameIndexTest : public objectstore::test::DirectoryTest {
+protected:
+  NameIndexTest() : DirectoryTest{kTestPath} {}
+};
+
+} // namespace
+
+TEST_F(NameIndexTest, InsertFindErase) {
+  auto index = objectstore::NameIndex{resource, kTestPath};
+  EXPECT_TRUE(index.empty());
+  EXPECT_EQ(index.insert("a", 1), std::make_pair(true, std::error_code{}));
+  EXPECT_EQ(index.insert("a", 2), std::make_pair(false, std::error_code{}));
+  // any bytes make a key
+  auto const binary = std::string{"b\0c", 3};
+  EXPECT_TRUE(index.insert(binary, 3).first);
+  EXPECT_TRUE(index.insert("", 4).first);
+  EXPECT_EQ(index.size(), 3u);
+  EXPECT_EQ(index.find("a"), 1u);
+  EXPECT_EQ(index.find(binary), 3u);
+  EXPECT_EQ(index.find(""), 4u);
+  EXPECT_FALSE(index.find("b").has_value());
+
+  EXPECT_EQ(index.erase("a"), std::make_pair(true, std::error_code{}));
+  EXPECT_EQ(index.erase("a"), std::make_pair(false, std::error_code{}));
+  EXPECT_FALSE(index.contains("a"));
+  EXPECT_TRUE(index.insert("a", 5).first);
+  EXPECT_EQ(index.find("a"), 5u);
+
+  auto const [added, ec] = index.insert(
+      std::string(objectstore::NameIndex::kMaxKeySize + 1, 'x'), 6);
+  EXPECT_FALSE(added);
+  EXPECT_EQ(ec, std::errc::value_too_large);
+}
+
+TEST_F(NameIndexTest, GrowsIncrementally) {
+  auto options = objectstore::NameIndexOptions{};
+  options.initial_capacity = 16;
+  auto index = objectstore::NameIndex{resource, kTestPath, options};
+  constexpr std::size_t kNumKeys = 100'000;
+  auto erased = std::set<std::size_t>{};
+  auto was_growing = false;
+  for (std::size_t i = 0; i < kNumKeys; ++i) {
+    ASSERT_TRUE(index.insert(Key(i), i).first);
+    // erased while their slots may still be in the old table
+    if (i % 3 == 0 && erased.insert(i / 2).second) {
+      ASSERT_TRUE(index.erase(Key(i / 2)).first);
+    }
+    if (index.growing()) {
+      was_growing = true;
+      // both tables are searched
+      ASSERT_EQ(index.find(Key(i)), i);
+    }
+  }
+  EXPECT_TRUE(was_growing);
+  EXPECT_EQ(index.size(), kNumKeys - erased.size());
+  EXPECT_GE(index.capacity(), index.size() * 4 / 3);
+  for (std::size_t i = 0; i < kNumKeys; ++i) {
+    ASSERT_EQ(index.contains(Key(i)), !erased.contains(i)) << i;
+  }
+}
+
+TEST_F(NameIndexTest, ReplaysLogAndCheckpoints) {
+  {
+    auto index =
+        objectstore::NameIndex{resource, kTestPath, WithoutCheckpoint()};
+    for (std::size_t i = 0; i < 1000; ++i) {
+      index.insert(Key(i), i);
+    }
+    EXPECT_FALSE(index.checkpoint());
+    for (std::size_t i = 1000; i < 2000; ++i) {
+      index.insert(Key(i), i);
+    }
+    index.erase(Key(0));
+    index.erase(Key(1500));
+  }
+  EXPECT_EQ(Files(), (std::set<std::string>{"index.1", "log.1"}));
+  {
+    // from the checkpoint and the log
+    auto index = objectstore::NameIndex{resource, kTestPath};
+    EXPECT_EQ(index.size(), 1998u);
+    EXPECT_FALSE(index.contains(Key(0)));
+    EXPECT_FALSE(index.contains(Key(1500)));
+    EXPECT_EQ(index.find(Key(999)), 999u);
+    EXPECT_EQ(index.find(Key(1999)), 1999u);
+  }
+  // checkpointed on close
+  EXPECT_EQ(Files(), (std::set<std::string>{"index.2", "log.2"}));
+  EXPECT_EQ(std::filesystem::file_size(std::filesystem::path{kTestPath} /
+                                       "log.2"),
+            0u);
+  auto index = objectstore::NameIndex{resource, kTestPath};
+  EXPECT_EQ(index.size(), 1998u);
+  EXPECT_EQ(index.find(Key(1)), 1u);
+  // the mapped checkpoint takes changes
+  EXPECT_TRUE(index.erase(Key(1)).first);
+  EXPECT_TRUE(index.insert(Key(0), 42).first);
+  EXPECT_EQ(index.find(Key(0)), 42u);
+  EXPECT_FALSE(index.contains(Key(1)));
+}
+
+TEST_F(NameIndexTest, RecoversFromTornLog) {
+  auto const log_path = std::filesystem::path{kTestPath} / "log.0";
+  {
+    auto index =
+        objectstore::NameIndex{resource, kTestPath, WithoutCheckpoint()};
+    for (std::size_t i = 0; i < 100; ++i) {
+      index.insert(Key(i), i);
+    }
+    EXPECT_FALSE(index.sync());
+  }
+  // the last record was cut off in the middle of its key
+  std::filesystem::resize_file(log_path,
+                               std::filesystem::file_size(log_path) - 2);
+  {
+    auto index =
+        objectstore::NameIndex{resource, kTestPath, WithoutCheckpoint()};
+    EXPECT_EQ(index.size(), 99u);
+    EXPECT_FALSE(index.contains(Key(99)));
+    index.insert(Key(100), 100);
+  }
+  // what follows the cut is not lost behind it
+  auto index =
+      objectstore::NameIndex{resource, kTestPath, WithoutCheckpoint()};
+  EXPECT_EQ(index.size(), 100u);
+  EXPECT_EQ(index.find(Key(100)), 100u);
+}
+
+TEST_F(NameIndexTest, IgnoresInterruptedCheckpoint) {
+  {
+    auto index = objectstore::NameIndex{resource, kTestPath};
+    index.insert("a", 1);
+  }
+  // written, but not renamed into place
+  std::filesystem::copy_file(std::filesystem::path{kTestPath} / "index.1",
+                             std::filesystem::path{kTestPath} /
+                                 "index.2.tmp");
+  auto index = objectstore::NameIndex{resource, kTestPath};
+  EXPECT_EQ(index.find("a"), 1u);
+  EXPECT_EQ(Files(), (std::set<std::string>{"index.1", "log.1"}));
+}
+
+TEST_F(NameIndexTest, CheckpointsWhileGrowing) {
+  auto options = objectstore::NameIndexOptions{};
+  options.initial_capacity = 16;
+  std::size_t num_keys = 0;
+  {
+    auto index = objectstore::NameIndex{resource, kTestPath, options};
+    while (num_keys < 100'000 || !index.growing()) {
+      index.insert(Key(num_keys), num_keys);
+      ++num_keys;
+    }
+    EXPECT_FALSE(index.checkpoint());
+    EXPECT_FALSE(index.growing());
+  }
+  // grows out of the table of the checkpoint
+  auto index = objectstore::NameIndex{resource, kTestPath, options};
+  auto const capacity = index.capacity();
+  for (; index.capacity() == capacity || index.growing(); ++num_keys) {
+    index.insert(Key(num_keys), num_keys);
+  }
+  EXPECT_EQ(index.size(), num_keys);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    ASSERT_EQ(index.find(Key(i)), i);
+  }
+}
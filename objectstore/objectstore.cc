@@ -1,57 +1,442 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <dirent.h>
+#include <fcntl.h>
 #include <filesystem>
-#include <fstream>
+#include <future>
 #include <iostream>
+#include <linux/fs.h>
+#include <span>
+#include <string_view>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <system_error>
+#include <thread>
+#include <tuple>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
+#include "folder_manifest.hpp"
 #include "objectstore.hpp"
 
 namespace objectstore {
 
 namespace {
-std::filesystem::path
-BuildPathForObjectStore(StoredFolder::object_id_t object_id,
-                        std::filesystem::path const &root) {
-  std::filesystem::path filepath = root;
-  filepath += std::filesystem::path::preferred_separator;
-  filepath += std::to_string(object_id);
-  return filepath;
+
+int ToMadviseAdvice(AccessAdvice advice) {
+  switch (advice) {
+  case AccessAdvice::Normal:
+    return MADV_NORMAL;
+  case AccessAdvice::Sequential:
+    return MADV_SEQUENTIAL;
+  case AccessAdvice::Random:
+    return MADV_RANDOM;
+  case AccessAdvice::WillNeed:
+    return MADV_WILLNEED;
+  case AccessAdvice::DontNeed:
+    return MADV_DONTNEED;
+  }
+  return MADV_NORMAL;
+}
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+std::pair<std::size_t, std::error_code>
+ReadFully(int fd, std::uint64_t offset, std::span<std::byte> buffer) {
+  std::size_t done = 0;
+  while (done < buffer.size()) {
+    auto res = pread(fd, buffer.data() + done, buffer.size() - done,
+                     static_cast<off_t>(offset + done));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::make_pair(done, LastError());
+    }
+    if (res == 0) {
+      break;
+    }
+    done += static_cast<std::size_t>(res);
+  }
+  return std::make_pair(done, std::error_code{});
+}
+
+std::pair<std::size_t, std::error_code>
+WriteFully(int fd, std::uint64_t offset, std::span<const std::byte> data) {
+  std::size_t done = 0;
+  while (done < data.size()) {
+    auto res = pwrite(fd, data.data() + done, data.size() - done,
+                      static_cast<off_t>(offset + done));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::make_pair(done, LastError());
+    }
+    done += static_cast<std::size_t>(res);
+  }
+  return std::make_pair(done, std::error_code{});
+}
+
+/// Of the buffer that copies and exports fall back to.
+constexpr std::size_t kCopyBufferSize = 1 << 20;
+
+/**
+ * @return whether the error of a kernel copy means that it cannot copy
+ * between these files at all, rather than that it failed
+ */
+bool IsUnsupportedCopy(int error) {
+  return error == EINVAL || error == ENOSYS || error == EXDEV ||
+         error == EOPNOTSUPP;
+}
+
+/**
+ * @brief Copies size bytes from the start of one file to the start of the
+ * other, see StoredFolder::clone().
+ */
+std::error_code CopyContent(int from, int to, std::uint64_t size,
+                            std::pmr::memory_resource *resource) {
+  if (::ioctl(to, FICLONE, from) == 0) {
+    return {};
+  }
+  std::uint64_t done = 0;
+  auto supported = true;
+  while (done < size && supported) {
+    auto in_offset = static_cast<loff_t>(done);
+    auto out_offset = static_cast<loff_t>(done);
+    auto res = copy_file_range(from, &in_offset, to, &out_offset,
+                               static_cast<std::size_t>(size - done), 0);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (done > 0 || !IsUnsupportedCopy(errno)) {
+        return LastError();
+      }
+      supported = false;
+    } else if (res == 0) {
+      // the source got shorter meanwhile
+      return {};
+    } else {
+      done += static_cast<std::uint64_t>(res);
+    }
+  }
+  if (supported) {
+    return {};
+  }
+  auto buffer = std::pmr::vector<std::byte>(kCopyBufferSize, resource);
+  while (done < size) {
+    auto [read, ec] = ReadFully(
+        from, done,
+        std::span{buffer}.first(std::min<std::uint64_t>(size - done,
+                                                        buffer.size())));
+    if (ec || read == 0) {
+      return ec;
+    }
+    if (auto [written, write_ec] =
+            WriteFully(to, done, std::span{buffer}.first(read));
+        write_ec) {
+      return write_ec;
+    }
+    done += read;
+  }
+  return {};
 }
 
-void EnsureFileStreamOpened(std::fstream *stream,
-                            std::filesystem::path const &file_path) {
-  if (!stream->is_open()) {
-    stream->clear();
-    stream->open(file_path, std::fstream::in | std::fstream::out);
-    if (!stream->is_open()) {
-      {
-        std::ofstream{file_path};
+/**
+ * @brief Writes count bytes of the file from offset on to out at its
+ * position, see StoredFolder::export_to().
+ *
+ * @return the number of bytes written, less than count at the end of the
+ * file or on an error
+ */
+std::pair<std::uint64_t, std::error_code>
+SendContent(int from, std::uint64_t offset, std::uint64_t count, int out,
+            std::pmr::memory_resource *resource) {
+  struct stat st {};
+  if (fstat(out, &st) != 0) {
+    return std::make_pair(0, LastError());
+  }
+  // sendfile() into a pipe works as well, but splice() moves page references
+  auto const to_pipe = S_ISFIFO(st.st_mode);
+  std::uint64_t done = 0;
+  auto supported = true;
+  while (done < count && supported) {
+    auto const remaining = static_cast<std::size_t>(count - done);
+    auto res = ssize_t{};
+    if (to_pipe) {
+      auto in_offset = static_cast<loff_t>(offset + done);
+      res = splice(from, &in_offset, out, nullptr, remaining, SPLICE_F_MOVE);
+    } else {
+      auto in_offset = static_cast<off_t>(offset + done);
+      res = sendfile(out, from, &in_offset, remaining);
+    }
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
       }
-      stream->open(file_path, std::fstream::in | std::fstream::out);
+      if (done > 0 || !IsUnsupportedCopy(errno)) {
+        return std::make_pair(done, LastError());
+      }
+      // e.g. out was opened with O_APPEND
+      supported = false;
+    } else if (res == 0) {
+      return std::make_pair(done, std::error_code{});
+    } else {
+      done += static_cast<std::uint64_t>(res);
     }
-    assert(stream->is_open());
   }
+  if (supported) {
+    return std::make_pair(done, std::error_code{});
+  }
+  auto buffer = std::pmr::vector<std::byte>(kCopyBufferSize, resource);
+  while (done < count) {
+    auto [read, ec] = ReadFully(
+        from, offset + done,
+        std::span{buffer}.first(std::min<std::uint64_t>(count - done,
+                                                        buffer.size())));
+    if (ec || read == 0) {
+      return std::make_pair(done, ec);
+    }
+    for (std::size_t written = 0; written < read;) {
+      auto res = ::write(out, buffer.data() + written, read - written);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::make_pair(done + written, LastError());
+      }
+      written += static_cast<std::size_t>(res);
+    }
+    done += read;
+  }
+  return std::make_pair(done, std::error_code{});
+}
+
+std::error_code NotFound() {
+  return std::make_error_code(std::errc::no_such_file_or_directory);
+}
+
+std::error_code NotSupported() {
+  return std::make_error_code(std::errc::operation_not_supported);
+}
+
+std::shared_future<std::error_code> Ready(std::error_code ec) {
+  auto promise = std::promise<std::error_code>{};
+  promise.set_value(ec);
+  return promise.get_future().share();
+}
+
+unsigned ScanParallelism() {
+  // reading the directory is serial, more than a few parsers do not help
+  return std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
 }
 
 } // namespace
 
+MappedObject::MappedObject(MappedObject &&other) noexcept
+    : m_address{std::exchange(other.m_address, nullptr)},
+      m_size{std::exchange(other.m_size, 0)} {}
+
+MappedObject &MappedObject::operator=(MappedObject &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    m_address = std::exchange(other.m_address, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+  }
+  return *this;
+}
+
+MappedObject::~MappedObject() { unmap(); }
+
+std::error_code MappedObject::advise(AccessAdvice advice) const {
+  if (m_address == nullptr) {
+    return {};
+  }
+  if (madvise(m_address, m_size, ToMadviseAdvice(advice)) != 0) {
+    return LastError();
+  }
+  return {};
+}
+
+void MappedObject::unmap() {
+  if (m_address != nullptr) {
+    int res [[maybe_unused]] = munmap(m_address, m_size);
+    assert(res == 0);
+    m_address = nullptr;
+    m_size = 0;
+  }
+}
+
+ObjectReader::ObjectReader(ObjectReader &&other) noexcept
+    : m_fd{std::exchange(other.m_fd, -1)},
+      m_position{std::exchange(other.m_position, 0)},
+      m_end{std::exchange(other.m_end, 0)} {}
+
+ObjectReader &ObjectReader::operator=(ObjectReader &&other) noexcept {
+  if (this != &other) {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+    m_fd = std::exchange(other.m_fd, -1);
+    m_position = std::exchange(other.m_position, 0);
+    m_end = std::exchange(other.m_end, 0);
+  }
+  return *this;
+}
+
+ObjectReader::~ObjectReader() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+std::pair<std::span<const std::byte>, std::error_code>
+ObjectReader::next(std::span<std::byte> buffer) {
+  auto const size = std::min<std::uint64_t>(buffer.size(), remaining());
+  if (size == 0) {
+    return std::make_pair(std::span<const std::byte>{}, std::error_code{});
+  }
+  auto [read, ec] = ReadFully(m_fd, m_position, buffer.first(size));
+  m_position += read;
+  if (read < size && !ec) {
+    // the object was cut short since the reader was created
+    m_end = m_position;
+  }
+  return std::make_pair(std::span<const std::byte>{buffer.first(read)}, ec);
+}
+
+ObjectWriter::ObjectWriter(ObjectWriter &&other) noexcept
+    : m_fd{std::exchange(other.m_fd, -1)},
+      m_position{std::exchange(other.m_position, 0)} {}
+
+ObjectWriter &ObjectWriter::operator=(ObjectWriter &&other) noexcept {
+  if (this != &other) {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+    m_fd = std::exchange(other.m_fd, -1);
+    m_position = std::exchange(other.m_position, 0);
+  }
+  return *this;
+}
+
+ObjectWriter::~ObjectWriter() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+std::error_code ObjectWriter::write(std::span<const std::byte> chunk) {
+  auto [written, ec] = WriteFully(m_fd, m_position, chunk);
+  m_position += written;
+  return ec;
+}
+
+std::error_code ObjectWriter::sync() {
+  return fdatasync(m_fd) == 0 ? std::error_code{} : LastError();
+}
+
+ObjectScanner::ObjectScanner(std::pmr::memory_resource *resource,
+                             std::filesystem::path root_path,
+                             unsigned fanout_levels,
+                             std::pmr::vector<object_id_t> ids,
+                             ScanOptions options)
+    : m_root_path{std::move(root_path)}, m_fanout_levels{fanout_levels},
+      m_ids{std::move(ids)}, m_fds(options.prefetch + 1, -1, resource) {}
+
+ObjectScanner::~ObjectScanner() {
+  for (int fd : m_fds) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+bool ObjectScanner::next() {
+  if (m_next > 0) {
+    if (int &fd = slot(m_next - 1); fd >= 0) {
+      ::close(std::exchange(fd, -1));
+    }
+  }
+  if (m_next == m_ids.size()) {
+    return false;
+  }
+  auto const end = std::min(m_ids.size(), m_next + m_fds.size());
+  for (; m_num_opened < end; ++m_num_opened) {
+    open(m_num_opened);
+  }
+  ++m_next;
+  m_position = 0;
+  return true;
+}
+
+std::pair<std::span<const std::byte>, std::error_code>
+ObjectScanner::read(std::span<std::byte> buffer) {
+  int fd = slot(m_next - 1);
+  if (fd < 0) {
+    // an object that was never written is empty
+    return std::make_pair(std::span<const std::byte>{},
+                          fd == -ENOENT
+                              ? std::error_code{}
+                              : std::error_code{-fd, std::system_category()});
+  }
+  auto [read, ec] = ReadFully(fd, m_position, buffer);
+  m_position += read;
+  return std::make_pair(std::span<const std::byte>{buffer.first(read)}, ec);
+}
+
+void ObjectScanner::open(std::size_t index) {
+  auto const file_path = ObjectPath(m_root_path, m_ids[index], m_fanout_levels);
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    slot(index) = -errno;
+    return;
+  }
+  // starts reading the whole file in the background
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  slot(index) = fd;
+}
+
 void StoredFile::open() {
-  EnsureFileStreamOpened(&m_stream, m_file_path);
-  m_stream.seekg(0, std::ios::beg);
-  assert(m_stream.tellg() == 0);
-  m_stream.seekp(0, std::ios::beg);
-  assert(m_stream.tellp() == 0);
-  m_stream.flush();
-  assert(m_stream.is_open());
+  if (m_compression.codec != nullptr) {
+    if (m_compressed) {
+      m_compressed->clear();
+      m_compressed->seekg(0, std::ios::beg);
+    } else {
+      m_compressed = common::MakeUnique<CompressedStream>(
+          m_resource, m_resource, m_file_path, m_compression);
+    }
+    return;
+  }
+  if (m_stream && m_stream->is_open()) {
+    // a file buffer has a single position, rewinding it flushes pending writes
+    m_stream->clear();
+    m_stream->seekg(0, std::ios::beg);
+    return;
+  }
+  // the stream outlives the file, a closed one fails on every operation
+  if (!m_stream) {
+    m_stream = common::MakeUnique<FileStream>(m_resource, m_resource,
+                                              m_stream_options);
+  }
+  m_stream->open(m_file_path);
 }
 
 void StoredFile::close() {
-  m_stream.close();
-  assert(!m_stream.is_open());
-  m_stream.clear();
-  assert(m_stream.good());
+  // writes the pending blocks
+  m_compressed.reset();
+  if (m_stream) {
+    m_stream->close();
+    m_stream->clear();
+  }
 }
 
 void StoredFile::destroy() {
@@ -62,105 +447,891 @@ void StoredFile::destroy() {
   }
 }
 
+FileStreamStats StoredFile::take_stream_stats() {
+  return m_stream ? m_stream->buffer().take_stats() : FileStreamStats{};
+}
+
+void StoredFile::flush() {
+  if (m_compressed) {
+    m_compressed->flush();
+  }
+  if (m_stream) {
+    m_stream->flush();
+    m_stream->buffer().release_buffer();
+  }
+}
+
 bool StoredFile::exists() const { return std::filesystem::exists(m_file_path); }
 
 std::iostream *StoredFile::stream() {
   open();
-  return &m_stream;
+  if (m_compressed) {
+    return m_compressed.get();
+  }
+  return m_stream.get();
 }
 
 std::pair<std::uintmax_t, std::error_code> StoredFile::size() const {
+  if (m_compressed) {
+    return std::make_pair(m_compressed->buffer().size(), std::error_code{});
+  }
+  if (m_compression.codec != nullptr) {
+    return CompressedSize(m_file_path, *m_compression.codec);
+  }
   auto ec = std::error_code{};
   auto size = std::filesystem::file_size(m_file_path);
   return std::make_pair(size, ec);
 }
 
+std::pair<MappedObject, std::error_code> StoredFile::map() const {
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(
+        MappedObject{},
+        std::make_error_code(std::errc::operation_not_supported));
+  }
+  if (m_stream) {
+    m_stream->flush();
+  }
+
+  int fd = ::open(m_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::make_pair(MappedObject{}, LastError());
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    auto ec = LastError();
+    ::close(fd);
+    return std::make_pair(MappedObject{}, ec);
+  }
+  if (st.st_size == 0) {
+    ::close(fd);
+    return std::make_pair(MappedObject{}, std::error_code{});
+  }
+
+  auto const size = static_cast<std::size_t>(st.st_size);
+  void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  auto ec = address == MAP_FAILED ? LastError() : std::error_code{};
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (ec) {
+    return std::make_pair(MappedObject{}, ec);
+  }
+  return std::make_pair(MappedObject{address, size}, ec);
+}
+
 const std::filesystem::path &StoredFile::path() const { return m_file_path; }
 
-bool StoredFile::is_open() const { return m_stream.is_open(); }
+bool StoredFile::is_open() const {
+  return m_compressed != nullptr || (m_stream && m_stream->is_open());
+}
+
+void StoredFolder::OpenFileCache::use(object_id_t id,
+                                      StoredFolder const &folder) {
+  if (auto it = m_positions.find(id); it != m_positions.end()) {
+    auto &position = it->second;
+    m_in_use.splice(m_in_use.begin(), position.idle ? m_idle : m_in_use,
+                    position.it);
+    position.idle = false;
+    return;
+  }
+  make_room(folder);
+  m_in_use.push_front(id);
+  m_positions.try_emplace(id, Position{m_in_use.begin(), false});
+}
+
+void StoredFolder::OpenFileCache::touch(object_id_t id,
+                                        StoredFolder const &folder) {
+  if (auto it = m_positions.find(id); it != m_positions.end()) {
+    auto &list = it->second.idle ? m_idle : m_in_use;
+    list.splice(list.begin(), list, it->second.it);
+    return;
+  }
+  make_room(folder);
+  m_idle.push_front(id);
+  m_positions.try_emplace(id, Position{m_idle.begin(), true});
+}
+
+void StoredFolder::OpenFileCache::make_room(StoredFolder const &folder) {
+  if (m_max_open_files == 0 || m_positions.size() < m_max_open_files) {
+    return;
+  }
+  for (auto *victims : {&m_idle, &m_in_use}) {
+    for (auto it = victims->end(); it != victims->begin();) {
+      --it;
+      auto const victim = *it;
+      auto entry = folder.m_files.find(victim);
+      if (entry != folder.m_files.end() &&
+          entry->second.fd_users.load(std::memory_order_acquire) != 0) {
+        // another thread reads from its descriptor right now
+        continue;
+      }
+      victims->erase(it);
+      m_positions.erase(victim);
+      if (entry != folder.m_files.end()) {
+        // the stream of a file in use stays valid, and fails until reopened
+        folder.close_file(entry->second, victims == &m_in_use);
+      }
+      return;
+    }
+  }
+}
+
+void StoredFolder::OpenFileCache::release(object_id_t id) {
+  if (auto it = m_positions.find(id); it != m_positions.end()) {
+    auto &position = it->second;
+    m_idle.splice(m_idle.begin(), position.idle ? m_idle : m_in_use,
+                  position.it);
+    position.idle = true;
+  }
+}
+
+void StoredFolder::OpenFileCache::erase(object_id_t id) {
+  if (auto it = m_positions.find(id); it != m_positions.end()) {
+    (it->second.idle ? m_idle : m_in_use).erase(it->second.it);
+    m_positions.erase(it);
+  }
+}
+
+void StoredFolder::OpenFileCache::clear() {
+  m_in_use.clear();
+  m_idle.clear();
+  m_positions.clear();
+}
 
 StoredFolder::StoredFolder(std::pmr::memory_resource *resource,
                            std::filesystem::path root_path,
-                           bool add_all_existing_files)
+                           StoredFolderOptions options)
     : m_resource{resource}, m_root_path{std::move(root_path)},
-      m_files{resource} {
+      m_files{resource}, m_recycle_ids{options.recycle_ids},
+      m_manifest_on_close{options.add_all_existing_files &&
+                          options.manifest_on_close},
+      m_open_files{resource, options.max_open_files},
+      m_fanout_levels{std::min(options.fanout_levels, kMaxFanoutLevels)},
+      m_compression{options.compression},
+      m_stream_options{options.file_stream}, m_directories{resource},
+      m_durability{options.durability}, m_new_files{resource},
+      m_pending_commits{resource},
+      m_deferred_deletion{options.deferred_deletion},
+      m_metrics{resource, options.record_metrics} {
+  if (m_durability == Durability::GroupCommit) {
+    m_committer = common::MakeUnique<GroupCommitter>(
+        m_resource, m_resource, options.group_commit);
+  }
+  auto trash_path = TrashPath(m_root_path);
+  if (m_deferred_deletion || std::filesystem::exists(trash_path)) {
+    // also finishes what a crashed folder left in the trash
+    m_reaper = common::MakeUnique<Reaper>(m_resource, m_resource,
+                                          std::move(trash_path),
+                                          options.reaper);
+  }
   if (!std::filesystem::exists(m_root_path)) {
     std::filesystem::create_directories(m_root_path);
-  } else if (add_all_existing_files) {
-    for (const auto &entry : std::filesystem::directory_iterator(m_root_path)) {
-      if (entry.is_regular_file()) {
-        auto filename = entry.path().filename().string();
-        try {
-          auto object_id =
-              static_cast<StoredFolder::object_id_t>(std::stoull(filename));
-          m_files.try_emplace(
-              object_id, common::MakeUnique<StoredFile>(m_resource, m_resource,
-                                                        entry.path()));
-          if (object_id >= m_next_object_id) {
-            m_next_object_id = object_id + 1;
-          }
-        } catch (const std::invalid_argument &) {
-        } catch (const std::out_of_range &) {
-        }
+  } else if (options.add_all_existing_files) {
+    add_existing_files();
+  }
+  if (m_manifest_on_close && !m_manifest_current &&
+      !std::filesystem::exists(ManifestPath(m_root_path))) {
+    // creating it changes the root, rewriting it in the destructor does not
+    write_manifest(false);
+  }
+}
+
+void StoredFolder::add_existing_files() {
+  auto [listing, ec] = LoadManifest(m_resource, m_root_path, m_fanout_levels);
+  m_manifest_current = !ec;
+  if (ec) {
+    if (ec != std::errc::no_such_file_or_directory) {
+      UnsealManifest(m_root_path);
+    }
+    std::tie(listing, ec) = ScanFolder(m_resource, m_root_path,
+                                       ScanParallelism(), m_fanout_levels);
+    if (ec) {
+      throw std::filesystem::filesystem_error{"Cannot scan StoredFolder",
+                                              m_root_path, ec};
+    }
+  }
+
+  m_directories.insert(listing.directories.begin(), listing.directories.end());
+  m_files.reserve(listing.next_object_id);
+  for (auto object_id : listing.ids) {
+    m_files.try_emplace(object_id);
+  }
+  m_next_object_id = listing.next_object_id;
+
+  // e.g. the files of a formerly flat folder, which are moved into the
+  // fan-out directories
+  for (auto const &[object_id, dir] : listing.misplaced) {
+    if (m_files.contains(object_id)) {
+      // never replace an object that already is in the right place
+      continue;
+    }
+    auto from = FanoutPath(m_root_path, dir) / std::to_string(object_id);
+    auto to = ObjectPath(m_root_path, object_id, m_fanout_levels);
+    create_directory(FanoutDirOf(object_id, m_fanout_levels).key());
+    if (::rename(from.c_str(), to.c_str()) != 0) {
+      auto const ec = LastError();
+      if (ec == std::errc::no_such_file_or_directory &&
+          !std::filesystem::exists(from)) {
+        // removed since the scan
+        continue;
       }
+      // rather than losing the object, which is only found where it belongs
+      throw std::filesystem::filesystem_error{
+          "Cannot move object of StoredFolder", from, to, ec};
     }
+    m_files.try_emplace(object_id);
+  }
+}
+
+void StoredFolder::create_directory(std::uint64_t key) {
+  auto const dir = FanoutDir::FromKey(key);
+  if (dir.depth == 0 || m_directories.contains(key)) {
+    return;
+  }
+  create_directory(dir.parent().key());
+  // the directory may exist already if the folder did not add existing files
+  auto const path = FanoutPath(m_root_path, dir);
+  auto ec = std::error_code{};
+  std::filesystem::create_directory(path, ec);
+  m_metrics.count(MetricSyscall::Mkdir);
+  if (ec) {
+    throw std::filesystem::filesystem_error{
+        "Cannot create directory of StoredFolder", path, ec};
+  }
+  m_directories.insert(key);
+  if (m_durability != Durability::None) {
+    // rare enough to be synced right away, files in it rely on it
+    m_metrics.count(MetricSyscall::Sync);
+    SyncFile(path, true);
+  }
+}
+
+StoredFolder::~StoredFolder() {
+  if (m_manifest_on_close && !m_manifest_current) {
+    // best effort without waiting for the clock, the next start falls back
+    // to scanning the directory
+    write_manifest(false);
   }
 }
 
 bool StoredFolder::has(object_id_t id) const { return m_files.contains(id); }
 
 StoredFolder::object_id_t StoredFolder::add() {
-  auto id = m_next_object_id++;
-  auto file_path = BuildPathForObjectStore(id, m_root_path);
-  m_files.try_emplace(
-      id, common::MakeUnique<StoredFile>(m_resource, m_resource, file_path));
+  auto timer = m_metrics.time(MetricOperation::Add);
+  invalidate_manifest();
+  auto id = m_recycle_ids ? m_files.first_free(m_first_free_id)
+                          : m_next_object_id.load();
+  if (id >= m_next_object_id) {
+    id = m_next_object_id++;
+  }
+  insert(id);
+  m_first_free_id = id + 1;
   return id;
 }
 
+bool StoredFolder::add(object_id_t id) {
+  auto timer = m_metrics.time(MetricOperation::Add);
+  if (m_files.contains(id)) {
+    return false;
+  }
+  invalidate_manifest();
+  if (id >= m_next_object_id) {
+    m_next_object_id = id + 1;
+  }
+  insert(id);
+  return true;
+}
+
+void StoredFolder::insert(object_id_t id) {
+  create_directory(FanoutDirOf(id, m_fanout_levels).key());
+  m_files.try_emplace(id);
+  if (m_durability != Durability::None) {
+    m_new_files.insert(id);
+  }
+}
+
 std::iostream *StoredFolder::get(object_id_t id) {
+  auto timer = m_metrics.time(MetricOperation::Get);
   auto it = m_files.find(id);
   if (it == m_files.end()) {
     return nullptr;
   }
-  auto &file = it->second;
-  file->open();
-  return file->stream();
+  auto lock = std::lock_guard{m_positional_mutex};
+  m_open_files.use(id, *this);
+  return file(id, it->second).stream();
 }
 
 std::iostream const &StoredFolder::get(object_id_t id) const {
+  auto timer = m_metrics.time(MetricOperation::Get);
   auto it = m_files.find(id);
   if (it == m_files.end()) {
     throw std::out_of_range{"Object ID not found in StoredFolder"};
   }
-  auto &file = it->second;
-  file->open();
-  return *(file->stream());
+  auto lock = std::lock_guard{m_positional_mutex};
+  m_open_files.use(id, *this);
+  return *file(id, it->second).stream();
 }
 
 std::pair<std::uintmax_t, std::error_code>
 StoredFolder::size(object_id_t id) const {
+  auto timer = m_metrics.time(MetricOperation::Size);
   auto it = m_files.find(id);
   if (it == m_files.end()) {
     return std::make_pair(
         0, std::make_error_code(std::errc::no_such_file_or_directory));
   }
-  auto &file = it->second;
-  return file->size();
+  m_metrics.count(MetricSyscall::Stat);
+  if (auto const &open_file = it->second.file) {
+    // a compressed stream knows the size of what it holds
+    return open_file->size();
+  }
+  return StoredFile{m_resource, ObjectPath(m_root_path, id, m_fanout_levels),
+                    m_compression, m_stream_options}
+      .size();
+}
+
+void StoredFolder::close(object_id_t id) {
+  commit_object(id, true);
+  if (auto ec = std::exchange(m_close_error, {})) {
+    throw std::system_error{ec, "sync closed object"};
+  }
+}
+
+std::shared_future<std::error_code> StoredFolder::commit(object_id_t id) {
+  return commit_object(id, false);
+}
+
+std::error_code StoredFolder::wait_for_commits() {
+  reap_commits(true);
+  return std::exchange(m_close_error, {});
+}
+
+std::shared_future<std::error_code>
+StoredFolder::commit_object(object_id_t id, bool from_close) {
+  auto timer = m_metrics.time(MetricOperation::Close);
+  reap_commits(false);
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return Ready(NotFound());
+  }
+  // keep the file open for the next get(), but make the content visible
+  {
+    auto lock = std::lock_guard{m_positional_mutex};
+    if (auto const &open_file = it->second.file) {
+      open_file->flush();
+      record_stream_stats(*open_file);
+      if (!m_open_files.contains(id)) {
+        // closed while in use to make room for others
+        close_file(it->second);
+      }
+    }
+    m_open_files.release(id);
+  }
+  if (m_durability == Durability::None) {
+    return Ready({});
+  }
+
+  auto const is_new = m_new_files.contains(id);
+  auto const file_path = ObjectPath(m_root_path, id, m_fanout_levels);
+  if (is_new && !std::filesystem::exists(file_path)) {
+    // never written, there is nothing to sync yet
+    return Ready({});
+  }
+  if (m_durability == Durability::Sync) {
+    m_metrics.count(MetricSyscall::Sync, is_new ? 2 : 1);
+    auto ec = SyncFile(file_path, is_new);
+    if (!ec) {
+      m_new_files.erase(id);
+    } else if (from_close && !m_close_error) {
+      m_close_error = ec;
+    }
+    return Ready(ec);
+  }
+  // the object stays new until its batch is synced, see reap_commits()
+  auto future = m_committer->commit(file_path, is_new);
+  m_pending_commits.push_back({id, is_new, from_close, future});
+  return future;
+}
+
+void StoredFolder::reap_commits(bool wait) {
+  while (!m_pending_commits.empty()) {
+    auto const &commit = m_pending_commits.front();
+    if (!wait && commit.future.wait_for(std::chrono::seconds{0}) !=
+                     std::future_status::ready) {
+      return;
+    }
+    if (auto ec = commit.future.get()) {
+      if (commit.from_close && !m_close_error) {
+        m_close_error = ec;
+      }
+    } else if (commit.is_new) {
+      m_new_files.erase(commit.id);
+    }
+    m_pending_commits.pop_front();
+  }
+}
+
+std::pair<MappedObject, std::error_code>
+StoredFolder::map(object_id_t id, AccessAdvice advice) const {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(
+        MappedObject{},
+        std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+  // pending writes on the stream have to be flushed first
+  auto result = it->second.file
+                    ? it->second.file->map()
+                    : StoredFile{m_resource,
+                                 ObjectPath(m_root_path, id, m_fanout_levels),
+                                 m_compression, m_stream_options}
+                          .map();
+  if (!result.second) {
+    // the advice is only a hint, so failing to apply it is not an error
+    result.first.advise(advice);
+  }
+  return result;
+}
+
+std::pair<std::size_t, std::error_code>
+StoredFolder::read_at(object_id_t id, std::uint64_t offset,
+                      std::span<std::byte> buffer) const {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(0, NotFound());
+  }
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(0, NotSupported());
+  }
+  auto ec = std::error_code{};
+  int fd = use_descriptor(id, it->second, false, &ec);
+  if (fd < 0) {
+    return std::make_pair(0, ec);
+  }
+  auto result = ReadFully(fd, offset, buffer);
+  it->second.fd_users.fetch_sub(1, std::memory_order_release);
+  m_metrics.count(MetricSyscall::Read);
+  m_metrics.transferred(result.first, 0);
+  return result;
+}
+
+std::pair<std::size_t, std::error_code>
+StoredFolder::write_at(object_id_t id, std::uint64_t offset,
+                       std::span<const std::byte> data) {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(0, NotFound());
+  }
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(0, NotSupported());
+  }
+  auto ec = std::error_code{};
+  int fd = use_descriptor(id, it->second, true, &ec);
+  if (fd < 0) {
+    return std::make_pair(0, ec);
+  }
+  auto result = WriteFully(fd, offset, data);
+  it->second.fd_users.fetch_sub(1, std::memory_order_release);
+  m_metrics.count(MetricSyscall::Write);
+  m_metrics.transferred(0, result.first);
+  return result;
+}
+
+std::pair<ObjectReader, std::error_code>
+StoredFolder::reader(object_id_t id, std::uint64_t offset,
+                     std::uint64_t length) const {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(ObjectReader{}, NotFound());
+  }
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(ObjectReader{}, NotSupported());
+  }
+  int fd = ::open(ObjectPath(m_root_path, id, m_fanout_levels).c_str(),
+                  O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // an object that was never written is empty
+    auto ec = LastError();
+    return std::make_pair(ObjectReader{},
+                          ec == std::errc::no_such_file_or_directory
+                              ? std::error_code{}
+                              : ec);
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    auto ec = LastError();
+    ::close(fd);
+    return std::make_pair(ObjectReader{}, ec);
+  }
+  auto const size = static_cast<std::uint64_t>(st.st_size);
+  auto const begin = std::min(offset, size);
+  auto const end = begin + std::min(length, size - begin);
+  return std::make_pair(ObjectReader{fd, begin, end}, std::error_code{});
+}
+
+std::pair<ObjectWriter, std::error_code>
+StoredFolder::writer(object_id_t id, std::uint64_t offset) {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(ObjectWriter{}, NotFound());
+  }
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(ObjectWriter{}, NotSupported());
+  }
+  int fd = ::open(ObjectPath(m_root_path, id, m_fanout_levels).c_str(),
+                  O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return std::make_pair(ObjectWriter{}, LastError());
+  }
+  if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+    auto ec = LastError();
+    ::close(fd);
+    return std::make_pair(ObjectWriter{}, ec);
+  }
+  return std::make_pair(ObjectWriter{fd, offset}, std::error_code{});
+}
+
+std::filesystem::path StoredFolder::path(object_id_t id) const {
+  if (!m_files.contains(id)) {
+    return {};
+  }
+  return ObjectPath(m_root_path, id, m_fanout_levels);
 }
 
 void StoredFolder::destroy(object_id_t id) {
+  auto timer = m_metrics.time(MetricOperation::Destroy);
   if (auto it = m_files.find(id); it != m_files.end()) {
-    auto &file = it->second;
-    file->destroy();
+    invalidate_manifest();
+    m_new_files.erase(id);
+    // a recycled id must not be taken for synced by the old object's commit
+    std::erase_if(m_pending_commits,
+                  [id](auto const &commit) { return commit.id == id; });
+    {
+      auto lock = std::lock_guard{m_positional_mutex};
+      m_open_files.erase(id);
+      close_file(it->second);
+    }
+    auto const file_path = ObjectPath(m_root_path, id, m_fanout_levels);
+    if (m_deferred_deletion && !m_reaper->trash(file_path)) {
+      m_metrics.count(MetricSyscall::Rename);
+    } else {
+      // fails if the file was never written
+      m_metrics.count(MetricSyscall::Unlink);
+      ::unlink(file_path.c_str());
+    }
     m_files.erase(it);
+    m_first_free_id = std::min(m_first_free_id, id);
   }
 }
 
 void StoredFolder::clear() {
+  auto timer = m_metrics.time(MetricOperation::Clear);
+  invalidate_manifest();
+  {
+    auto lock = std::lock_guard{m_positional_mutex};
+    for (auto const &pair : m_files) {
+      close_file(pair.second);
+    }
+  }
+  if (m_deferred_deletion) {
+    // the whole folder at once, however many objects it holds
+    if (!m_reaper->trash(m_root_path)) {
+      m_metrics.count(MetricSyscall::Rename);
+      m_metrics.count(MetricSyscall::Mkdir);
+      std::filesystem::create_directories(m_root_path);
+      m_directories.clear();
+      forget_all_files();
+      return;
+    }
+  }
+  m_metrics.count(MetricSyscall::Unlink, m_files.size());
   for (auto const &pair : m_files) {
-    pair.second->destroy();
+    ::unlink(ObjectPath(m_root_path, pair.first, m_fanout_levels).c_str());
+  }
+  forget_all_files();
+}
+
+void StoredFolder::forget_all_files() {
+  {
+    auto lock = std::lock_guard{m_positional_mutex};
+    m_files.clear();
+    m_open_files.clear();
+  }
+  m_new_files.clear();
+  m_pending_commits.clear();
+  m_first_free_id = 0;
+  if (m_recycle_ids) {
+    m_next_object_id = 0;
+  }
+}
+
+std::pair<StoredFolder::object_id_t, std::error_code>
+StoredFolder::clone(object_id_t id) {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(object_id_t{}, NotFound());
+  }
+  if (it->second.file) {
+    it->second.file->flush();
+  }
+  auto const source_path = ObjectPath(m_root_path, id, m_fanout_levels);
+  int from = ::open(source_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (from < 0 && errno != ENOENT) {
+    return std::make_pair(object_id_t{}, LastError());
+  }
+  auto const clone_id = add();
+  if (from < 0) {
+    // never written, and neither is the copy
+    return std::make_pair(clone_id, std::error_code{});
+  }
+  auto ec = std::error_code{};
+  struct stat st {};
+  int to = -1;
+  if (fstat(from, &st) != 0) {
+    ec = LastError();
+  } else if (to = ::open(
+                 ObjectPath(m_root_path, clone_id, m_fanout_levels).c_str(),
+                 O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+             to < 0) {
+    ec = LastError();
+  } else {
+    ec = CopyContent(from, to, static_cast<std::uint64_t>(st.st_size),
+                     m_resource);
+    ::close(to);
+  }
+  ::close(from);
+  if (ec) {
+    destroy(clone_id);
+    return std::make_pair(object_id_t{}, ec);
+  }
+  return std::make_pair(clone_id, std::error_code{});
+}
+
+std::pair<std::uint64_t, std::error_code>
+StoredFolder::export_to(object_id_t id, int fd, std::uint64_t offset,
+                        std::uint64_t length) const {
+  auto it = m_files.find(id);
+  if (it == m_files.end()) {
+    return std::make_pair(0, NotFound());
+  }
+  if (m_compression.codec != nullptr) {
+    return std::make_pair(0, NotSupported());
+  }
+  int from = ::open(ObjectPath(m_root_path, id, m_fanout_levels).c_str(),
+                    O_RDONLY | O_CLOEXEC);
+  if (from < 0) {
+    // an object that was never written is empty
+    auto ec = LastError();
+    return std::make_pair(0, ec == std::errc::no_such_file_or_directory
+                                 ? std::error_code{}
+                                 : ec);
+  }
+  struct stat st {};
+  if (fstat(from, &st) != 0) {
+    auto ec = LastError();
+    ::close(from);
+    return std::make_pair(0, ec);
+  }
+  auto const size = static_cast<std::uint64_t>(st.st_size);
+  auto const begin = std::min(offset, size);
+  auto result = SendContent(from, begin, std::min(length, size - begin), fd,
+                            m_resource);
+  ::close(from);
+  return result;
+}
+
+std::pair<ObjectScanner, std::error_code>
+StoredFolder::scan(ScanOptions options) const {
+  if (m_compression.codec != nullptr) {
+    // the scanner reads the files as they are
+    return std::make_pair(
+        ObjectScanner{m_resource, m_root_path, m_fanout_levels,
+                      std::pmr::vector<object_id_t>{m_resource}, options},
+        NotSupported());
+  }
+  // the inode numbers come with the directory entries, without a stat()
+  auto inodes = std::pmr::vector<std::pair<ino_t, object_id_t>>{m_resource};
+  inodes.reserve(m_files.size());
+  auto read_directory = [this, &inodes](std::filesystem::path const &dir) {
+    DIR *stream = ::opendir(dir.c_str());
+    if (stream == nullptr) {
+      return LastError();
+    }
+    while (auto const *entry = ::readdir(stream)) {
+      auto const name = std::string_view{entry->d_name};
+      object_id_t id = 0;
+      auto [end, ec] =
+          std::from_chars(name.data(), name.data() + name.size(), id);
+      if (ec == std::errc{} && end == name.data() + name.size() &&
+          m_files.contains(id)) {
+        inodes.emplace_back(entry->d_ino, id);
+      }
+    }
+    ::closedir(stream);
+    return std::error_code{};
+  };
+  if (m_fanout_levels == 0) {
+    if (auto ec = read_directory(m_root_path)) {
+      return std::make_pair(
+          ObjectScanner{m_resource, m_root_path, 0,
+                        std::pmr::vector<object_id_t>{m_resource}, options},
+          ec);
+    }
+  } else {
+    for (auto key : m_directories) {
+      auto const dir = FanoutDir::FromKey(key);
+      if (dir.depth == m_fanout_levels) {
+        // a directory that is gone has no objects either
+        read_directory(FanoutPath(m_root_path, dir));
+      }
+    }
+  }
+  std::sort(inodes.begin(), inodes.end());
+
+  auto ids = std::pmr::vector<object_id_t>{m_resource};
+  ids.reserve(m_files.size());
+  for (auto const &[inode, id] : inodes) {
+    ids.push_back(id);
+  }
+  if (ids.size() < m_files.size()) {
+    // objects that were never written, or in directories the folder did not
+    // create itself
+    auto found = std::pmr::unordered_set<object_id_t>{ids.begin(), ids.end(),
+                                                       ids.size(), m_resource};
+    for (auto const &pair : m_files) {
+      if (!found.contains(pair.first)) {
+        ids.push_back(pair.first);
+      }
+    }
+  }
+  return std::make_pair(ObjectScanner{m_resource, m_root_path,
+                                      m_fanout_levels, std::move(ids),
+                                      options},
+                        std::error_code{});
+}
+
+void StoredFolder::wait_for_deletion() {
+  if (m_reaper) {
+    m_reaper->wait_until_empty();
+  }
+}
+
+std::error_code StoredFolder::checkpoint() { return write_manifest(true); }
+
+std::error_code StoredFolder::write_manifest(bool wait) {
+  auto ids = std::pmr::vector<object_id_t>{m_resource};
+  ids.reserve(m_files.size());
+  for (auto const &pair : m_files) {
+    ids.push_back(pair.first);
+  }
+  auto directories = std::pmr::vector<std::uint64_t>{
+      m_directories.begin(), m_directories.end(), m_resource};
+  auto ec = WriteManifest(m_root_path, ids, m_next_object_id, m_fanout_levels,
+                          directories, wait);
+  m_manifest_current = !ec;
+  return ec;
+}
+
+MetricsSnapshot StoredFolder::metrics() const {
+  if (m_metrics.enabled()) {
+    for (auto const &pair : m_files) {
+      if (pair.second.file) {
+        record_stream_stats(*pair.second.file);
+      }
+    }
+  }
+  auto snapshot = m_metrics.snapshot();
+  snapshot.open_files = num_open_files();
+  return snapshot;
+}
+
+void StoredFolder::ObjectEntry::FileDeleter::operator()(
+    StoredFile *file) const {
+  auto *resource = file->m_resource;
+  std::destroy_at(file);
+  resource->deallocate(file, sizeof(StoredFile), alignof(StoredFile));
+}
+
+StoredFolder::ObjectEntry::~ObjectEntry() {
+  if (int open_fd = fd.exchange(-1); open_fd >= 0) {
+    ::close(open_fd);
+  }
+}
+
+StoredFile &StoredFolder::file(object_id_t id,
+                               ObjectEntry const &entry) const {
+  if (!entry.file) {
+    auto *memory =
+        m_resource->allocate(sizeof(StoredFile), alignof(StoredFile));
+    entry.file.reset(new (memory) StoredFile{
+        m_resource, ObjectPath(m_root_path, id, m_fanout_levels),
+        m_compression, m_stream_options});
+  }
+  return *entry.file;
+}
+
+void StoredFolder::close_file(ObjectEntry const &entry, bool keep_file) const {
+  if (int fd = entry.fd.exchange(-1); fd >= 0) {
+    m_metrics.count(MetricSyscall::Close);
+    ::close(fd);
+  }
+  if (entry.file) {
+    entry.file->close();
+    record_stream_stats(*entry.file);
+    if (!keep_file) {
+      entry.file.reset();
+    }
+  }
+}
+
+int StoredFolder::use_descriptor(object_id_t id, ObjectEntry const &entry,
+                                 bool writable, std::error_code *ec) const {
+  auto lock = std::lock_guard{m_positional_mutex};
+  int fd = entry.fd.load(std::memory_order_relaxed);
+  if (fd < 0) {
+    // opened for writing by reads as well, so that a write never has to
+    // replace a descriptor that reads are using, but only created by writes
+    int const flags = writable ? O_RDWR | O_CREAT : O_RDWR;
+    fd = ::open(ObjectPath(m_root_path, id, m_fanout_levels).c_str(),
+                flags | O_CLOEXEC, 0644);
+    m_metrics.count(MetricSyscall::Open);
+    if (fd < 0) {
+      // an object that was never written is empty
+      if (writable || errno != ENOENT) {
+        *ec = LastError();
+      }
+      return -1;
+    }
+    entry.fd.store(fd, std::memory_order_relaxed);
+  }
+  m_open_files.touch(id, *this);
+  entry.fd_users.fetch_add(1, std::memory_order_relaxed);
+  return fd;
+}
+
+void StoredFolder::release_descriptor(object_id_t id) const {
+  if (auto it = m_files.find(id); it != m_files.end()) {
+    it->second.fd_users.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void StoredFolder::record_stream_stats(StoredFile &file) const {
+  if (m_metrics.enabled()) {
+    auto const stats = file.take_stream_stats();
+    m_metrics.count(MetricSyscall::Open, stats.opens);
+    m_metrics.count(MetricSyscall::Close, stats.closes);
+    m_metrics.count(MetricSyscall::Read, stats.reads);
+    m_metrics.count(MetricSyscall::Write, stats.writes);
+    m_metrics.transferred(stats.bytes_read, stats.bytes_written);
+  }
+}
+
+void StoredFolder::invalidate_manifest() {
+  if (m_manifest_current) {
+    UnsealManifest(m_root_path);
+    m_manifest_current = false;
   }
-  m_files.clear();
 }
 
 } // namespace objectstore
@@ -1,17 +1,33 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
-#include <fstream>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
 #include <memory_resource>
+#include <mutex>
+#include <span>
 #include <system_error>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include <memory.hpp>
 
+#include "compression.hpp"
+#include "dense_id_map.hpp"
+#include "durability.hpp"
+#include "file_stream.hpp"
+#include "metrics.hpp"
+#include "reaper.hpp"
+
 namespace objectstore {
 
 using common::UniquePtr;
@@ -32,15 +48,203 @@ public:
   virtual bool exists() const = 0;
 };
 
+/**
+ * @brief Expected access pattern for a mapped object, forwarded to madvise().
+ */
+enum class AccessAdvice { Normal, Sequential, Random, WillNeed, DontNeed };
+
+/**
+ * @brief Read-only, memory-mapped view of a stored object. The mapping is
+ * released when the view is destroyed. Empty objects map to an empty view.
+ */
+class MappedObject {
+  void *m_address = nullptr;
+  std::size_t m_size = 0;
+
+public:
+  MappedObject() = default;
+  MappedObject(void *address, std::size_t size)
+      : m_address{address}, m_size{size} {}
+
+  MappedObject(const MappedObject &) = delete;
+  MappedObject(MappedObject &&other) noexcept;
+
+  MappedObject &operator=(const MappedObject &) = delete;
+  MappedObject &operator=(MappedObject &&other) noexcept;
+
+  ~MappedObject();
+
+  std::span<const std::byte> data() const {
+    return {static_cast<const std::byte *>(m_address), m_size};
+  }
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  std::error_code advise(AccessAdvice advice) const;
+
+private:
+  void unmap();
+};
+
+/**
+ * @brief Reads a range of an object chunk by chunk into a buffer of the
+ * caller, so that objects of any size are streamed with a fixed amount of
+ * memory. Every reader has a file descriptor of its own and reads with
+ * pread(), so readers of the same object never affect each other or the
+ * object's stream.
+ */
+class ObjectReader {
+  int m_fd = -1;
+  std::uint64_t m_position = 0;
+  std::uint64_t m_end = 0;
+
+public:
+  ObjectReader() = default;
+  ObjectReader(int fd, std::uint64_t begin, std::uint64_t end)
+      : m_fd{fd}, m_position{begin}, m_end{end} {}
+
+  ObjectReader(const ObjectReader &) = delete;
+  ObjectReader(ObjectReader &&other) noexcept;
+
+  ObjectReader &operator=(const ObjectReader &) = delete;
+  ObjectReader &operator=(ObjectReader &&other) noexcept;
+
+  ~ObjectReader();
+
+  /**
+   * @return the next chunk, the filled front of buffer, which is empty at the
+   * end of the range
+   */
+  std::pair<std::span<const std::byte>, std::error_code>
+  next(std::span<std::byte> buffer);
+
+  std::uint64_t position() const { return m_position; }
+  std::uint64_t remaining() const { return m_end - m_position; }
+};
+
+/**
+ * @brief Writes an object chunk by chunk with a file descriptor of its own,
+ * see ObjectReader.
+ */
+class ObjectWriter {
+  int m_fd = -1;
+  std::uint64_t m_position = 0;
+
+public:
+  ObjectWriter() = default;
+  ObjectWriter(int fd, std::uint64_t position)
+      : m_fd{fd}, m_position{position} {}
+
+  ObjectWriter(const ObjectWriter &) = delete;
+  ObjectWriter(ObjectWriter &&other) noexcept;
+
+  ObjectWriter &operator=(const ObjectWriter &) = delete;
+  ObjectWriter &operator=(ObjectWriter &&other) noexcept;
+
+  ~ObjectWriter();
+
+  std::error_code write(std::span<const std::byte> chunk);
+
+  /**
+   * @brief Makes the data written so far durable.
+   */
+  std::error_code sync();
+
+  std::uint64_t position() const { return m_position; }
+};
+
+struct ScanOptions {
+  /// Number of objects after the current one that are opened and read ahead
+  /// with POSIX_FADV_WILLNEED, so that the disk works on them while the
+  /// caller processes the current one.
+  std::size_t prefetch = 32;
+};
+
+/**
+ * @brief Reads every object of a folder once, in the order of the inodes of
+ * their files, which on most file systems follows the order of their data on
+ * disk, with the next objects read ahead. Like ObjectReader, it reads with
+ * file descriptors of its own, so pending writes on the streams are not
+ * visible. The folder must not change during the scan.
+ */
+class ObjectScanner {
+public:
+  using object_id_t = std::uint64_t;
+
+  ObjectScanner(std::pmr::memory_resource *resource,
+                std::filesystem::path root_path, unsigned fanout_levels,
+                std::pmr::vector<object_id_t> ids, ScanOptions options);
+
+  ObjectScanner(const ObjectScanner &) = delete;
+  ObjectScanner(ObjectScanner &&other) noexcept = default;
+
+  ObjectScanner &operator=(const ObjectScanner &) = delete;
+  ObjectScanner &operator=(ObjectScanner &&other) = delete;
+
+  ~ObjectScanner();
+
+  /**
+   * @brief Moves on to the next object, or to the first one on the first
+   * call.
+   *
+   * @return false after the last object
+   */
+  bool next();
+
+  object_id_t id() const { return m_ids[m_next - 1]; }
+
+  /**
+   * @return the next chunk of the current object, the filled front of
+   * buffer, which is empty at the end of the object
+   */
+  std::pair<std::span<const std::byte>, std::error_code>
+  read(std::span<std::byte> buffer);
+
+  /**
+   * @return the number of objects the scan visits
+   */
+  std::size_t size() const { return m_ids.size(); }
+
+private:
+  int &slot(std::size_t index) { return m_fds[index % m_fds.size()]; }
+  void open(std::size_t index);
+
+  std::filesystem::path m_root_path;
+  unsigned m_fanout_levels;
+  std::pmr::vector<object_id_t> m_ids;
+  /// The descriptors of the current object and of the ones read ahead, by
+  /// index modulo the size, or -errno if the file could not be opened.
+  std::pmr::vector<int> m_fds;
+  std::size_t m_next = 0;
+  std::size_t m_num_opened = 0;
+  std::uint64_t m_position = 0;
+};
+
+/**
+ * @brief An object stored in a file of its own, read and written through a
+ * FileStream. With a codec in the compression options, the file holds the
+ * content as compressed blocks, see CompressedStreambuf, which stream() and
+ * size() hide from the caller.
+ */
 class StoredFile : public StoredObject {
   std::pmr::memory_resource *m_resource;
   std::filesystem::path m_file_path;
-  mutable std::fstream m_stream;
+  CompressionOptions m_compression;
+  FileStreamOptions m_stream_options;
+  /// Created when the file is opened for the first time.
+  UniquePtr<FileStream> m_stream;
+  /// Takes the place of m_stream with a codec, only while the file is open.
+  UniquePtr<CompressedStream> m_compressed;
+
+  friend class StoredFolder;
 
 public:
   StoredFile(std::pmr::memory_resource *resource,
-             std::filesystem::path file_path)
-      : m_resource{resource}, m_file_path{std::move(file_path)} {}
+             std::filesystem::path file_path,
+             CompressionOptions compression = {},
+             FileStreamOptions stream_options = {})
+      : m_resource{resource}, m_file_path{std::move(file_path)},
+        m_compression{compression}, m_stream_options{stream_options} {}
 
   StoredFile(const StoredFile &) = delete;
   StoredFile(StoredFile &&) = default;
@@ -57,8 +261,27 @@ public:
 
   std::iostream *stream() override;
 
+  /**
+   * @brief Writes pending output to the file, keeping it open, and gives the
+   * buffer of the stream back to the memory resource until it is used again.
+   */
+  void flush();
+
+  /**
+   * @return what the stream did with the file since the last call, nothing
+   * for compressed files
+   */
+  FileStreamStats take_stream_stats();
+
   std::pair<std::uintmax_t, std::error_code> size() const override;
 
+  /**
+   * @brief Maps the current content of the file read-only. Pending writes on
+   * the stream are flushed first, so they are visible through the mapping.
+   * Compressed files cannot be mapped.
+   */
+  std::pair<MappedObject, std::error_code> map() const;
+
   const std::filesystem::path &path() const;
   bool is_open() const;
 };
@@ -81,53 +304,464 @@ public:
   virtual std::iostream const &get(object_id_t id) const = 0;
   virtual std::pair<std::uintmax_t, std::error_code>
   size(object_id_t id) const = 0;
+  /**
+   * @brief Releases the stream handed out by get(). Collections that buffer
+   * objects persist the content here.
+   */
+  virtual void close(object_id_t id) = 0;
   virtual void destroy(object_id_t id) = 0;
   virtual void clear() = 0;
 };
 
+struct StoredFolderOptions {
+  /// Adds the objects already in the folder, see StoredFolder::StoredFolder().
+  bool add_all_existing_files = true;
+  /// With add_all_existing_files, writes a manifest when the folder is
+  /// destroyed if its content changed, so that the next StoredFolder starts
+  /// without scanning the directory. The destructor never waits for the
+  /// clock, so the manifest is skipped if the last change is too recent, see
+  /// StoredFolder::checkpoint().
+  bool manifest_on_close = false;
+  /// Number of files the folder keeps open at most, zero for no limit. Past
+  /// the limit, even a stream that was never released with close() may be
+  /// closed, which its next operation reports as a failure, so only set it if
+  /// no caller holds on to more streams than that.
+  std::size_t max_open_files = 0;
+  /// Number of directory levels between the root and the object files, each
+  /// with up to 256 subdirectories picked by a hash of the id, at most 3.
+  /// Zero keeps all files in the root. Objects found in other places when
+  /// the folder is opened are moved to where this layout expects them.
+  unsigned fanout_levels = 0;
+  /// Stores the objects compressed if a codec is set. A folder must always be
+  /// opened with the same codec.
+  CompressionOptions compression;
+  /// The buffering of the object streams, ignored with compression.
+  FileStreamOptions file_stream;
+  /// When close() and commit() make an object durable.
+  Durability durability = Durability::None;
+  /// Used with Durability::GroupCommit.
+  GroupCommitOptions group_commit;
+  /// destroy() and clear() move what they delete into the trash next to the
+  /// root, see TrashPath(), and a Reaper removes it in the background. Either
+  /// way, a trash left behind by an earlier folder is emptied.
+  bool deferred_deletion = false;
+  /// Used with deferred_deletion.
+  ReaperOptions reaper;
+  /// add() hands out the lowest id that is not in use, also one of an object
+  /// destroyed earlier, instead of always a new one. That keeps the ids dense
+  /// under churn, but an id kept after destroy() may name another object.
+  bool recycle_ids = false;
+  /// Records the latencies and system calls of the folder, see
+  /// StoredFolder::metrics(). Ignored when built without metrics, see
+  /// kMetricsEnabled.
+  bool record_metrics = false;
+};
+
 class StoredFolder : public StoredObjectCollection {
 public:
   using object_id_t = StoredObjectCollection::object_id_t;
 
 private:
+  /**
+   * @brief The files currently open, in LRU order. Files released with
+   * close() stay open as idle, so that the next get() is free, and are the
+   * first to go once the limit is reached. Files still in use are only
+   * closed if there are no idle ones left.
+   */
+  class OpenFileCache {
+  public:
+    OpenFileCache(std::pmr::memory_resource *resource,
+                  std::size_t max_open_files)
+        : m_max_open_files{max_open_files}, m_in_use{resource},
+          m_idle{resource}, m_positions{resource} {}
+
+    /**
+     * @brief Marks the file as in use, closing another file if it was not
+     * open yet and the limit is reached.
+     */
+    void use(object_id_t id, StoredFolder const &folder);
+    /**
+     * @brief Moves the file to the front of its list without changing
+     * whether it is in use, adding it as idle if it was not open, e.g. for
+     * the descriptor of read_at() and write_at().
+     */
+    void touch(object_id_t id, StoredFolder const &folder);
+    /**
+     * @brief Marks the file as idle, it is kept open.
+     */
+    void release(object_id_t id);
+    /**
+     * @brief Forgets the file, which the caller closes.
+     */
+    void erase(object_id_t id);
+    void clear();
+
+    bool contains(object_id_t id) const { return m_positions.contains(id); }
+    std::size_t size() const { return m_positions.size(); }
+
+  private:
+    using LruList = std::pmr::list<object_id_t>;
+    struct Position {
+      LruList::iterator it;
+      bool idle;
+    };
+
+    /**
+     * @brief Closes the least recently used file if the limit is reached,
+     * idle ones first, but never one that read_at() or write_at() is using.
+     */
+    void make_room(StoredFolder const &folder);
+
+    std::size_t m_max_open_files;
+    LruList m_in_use;
+    LruList m_idle;
+    std::pmr::unordered_map<object_id_t, Position> m_positions;
+  };
+
+  /**
+   * @brief What the folder keeps for every object. Most objects of a large
+   * folder are not in use, so the StoredFile, with the path and the stream,
+   * is only made by file() once an object is opened, and dropped again when
+   * it is closed for good, see close_file().
+   */
+  struct ObjectEntry {
+    /// Frees the file through the resource it was made with, so that the
+    /// pointer does not have to keep it.
+    struct FileDeleter {
+      void operator()(StoredFile *file) const;
+    };
+
+    mutable std::unique_ptr<StoredFile, FileDeleter> file;
+    /// For read_at() and write_at(), opened on first use and closed together
+    /// with the file. It counts as the file in m_open_files.
+    mutable std::atomic<int> fd{-1};
+    /// Calls of read_at() and write_at() using fd, which keep it open.
+    mutable std::atomic<std::uint32_t> fd_users{0};
+
+    ObjectEntry() = default;
+    ~ObjectEntry();
+  };
+
   std::pmr::memory_resource *m_resource;
   std::filesystem::path m_root_path;
-  std::pmr::unordered_map<object_id_t, UniquePtr<StoredFile>> m_files;
+  DenseIdMap<ObjectEntry> m_files;
   std::atomic<object_id_t> m_next_object_id{};
+  bool m_recycle_ids;
+  /// With recycle_ids, all ids below are in use.
+  object_id_t m_first_free_id = 0;
+  bool m_manifest_on_close;
+  bool m_manifest_current = false;
+  mutable OpenFileCache m_open_files;
+  /// Guards m_open_files and the descriptors of the entries on every path,
+  /// as read_at() and write_at() may be called from several threads at once.
+  mutable std::mutex m_positional_mutex;
+  unsigned m_fanout_levels;
+  CompressionOptions m_compression;
+  FileStreamOptions m_stream_options;
+  /// The fan-out directories that exist, see FanoutDir::key().
+  std::pmr::unordered_set<std::uint64_t> m_directories;
+  Durability m_durability;
+  /// Objects whose directory entry was not synced yet.
+  std::pmr::unordered_set<object_id_t> m_new_files;
+  /// Only with Durability::GroupCommit.
+  UniquePtr<GroupCommitter> m_committer;
+  /// A group commit that may not be synced yet.
+  struct PendingCommit {
+    object_id_t id;
+    bool is_new;
+    /// Made by close(), whose caller learns about errors from the folder.
+    bool from_close;
+    std::shared_future<std::error_code> future;
+  };
+  /// Oldest first, which is also the order in which they are synced.
+  std::pmr::deque<PendingCommit> m_pending_commits;
+  /// The first error of a close() that was not reported yet.
+  std::error_code m_close_error;
+  bool m_deferred_deletion;
+  /// With deferred deletion, or while there is a trash to empty.
+  UniquePtr<Reaper> m_reaper;
+  mutable Metrics m_metrics;
+
+  void invalidate_manifest();
+  std::error_code write_manifest(bool wait);
+  void record_stream_stats(StoredFile &file) const;
+  StoredFile &file(object_id_t id, ObjectEntry const &entry) const;
+  /**
+   * @brief Closes the file and the descriptor of the object, and drops the
+   * file unless keep_file, e.g. while the caller still has its stream.
+   */
+  void close_file(ObjectEntry const &entry, bool keep_file = false) const;
+  /**
+   * @brief Opens the descriptor of the object for read_at() or write_at()
+   * and keeps it open until the caller is done, see fd_users.
+   *
+   * @return the descriptor, -1 with ec set if it cannot be opened, or -1
+   * without for an object that was never written and is only read
+   */
+  int use_descriptor(object_id_t id, ObjectEntry const &entry, bool writable,
+                     std::error_code *ec) const;
+  /**
+   * @brief Ends a use_descriptor() of an object that is still in the folder.
+   */
+  void release_descriptor(object_id_t id) const;
+  void create_directory(std::uint64_t key);
+  void add_existing_files();
+  void insert(object_id_t id);
+  void forget_all_files();
+  std::shared_future<std::error_code> commit_object(object_id_t id,
+                                                    bool from_close);
+  /**
+   * @brief Forgets the commits that are synced, all of them with wait. An
+   * object stays new until the sync of its directory entry succeeded, and
+   * the first failed commit of close() is kept in m_close_error.
+   */
+  void reap_commits(bool wait);
+
+  /// Borrows the descriptors of read_at() and write_at().
+  friend class AsyncObjectIO;
 
 public:
-  using iterator_t =
-      std::pmr::unordered_map<object_id_t, UniquePtr<StoredFile>>::iterator;
-  using const_iterator_t =
-      std::pmr::unordered_map<object_id_t,
-                              UniquePtr<StoredFile>>::const_iterator;
+  /**
+   * @brief Iterates over the ids of the objects in id order. Files are only
+   * opened by get(), so there is no StoredFile to hand out along with them.
+   */
+  class IdIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = object_id_t;
+    using reference = object_id_t;
+    using pointer = void;
+
+    IdIterator() = default;
+
+    object_id_t operator*() const { return m_it->first; }
+    IdIterator &operator++() {
+      ++m_it;
+      return *this;
+    }
+    IdIterator operator++(int) {
+      auto copy = *this;
+      ++m_it;
+      return copy;
+    }
+
+    friend bool operator==(IdIterator const &a, IdIterator const &b) {
+      return a.m_it == b.m_it;
+    }
+
+  private:
+    friend class StoredFolder;
+    explicit IdIterator(DenseIdMap<ObjectEntry>::const_iterator it)
+        : m_it{it} {}
+
+    DenseIdMap<ObjectEntry>::const_iterator m_it;
+  };
+  using iterator_t = IdIterator;
+  using const_iterator_t = IdIterator;
+
+  /**
+   * @brief Opens the folder at root_path, creating it if necessary.
+   *
+   * With add_all_existing_files, the objects already in the folder are taken
+   * from its manifest if it is still valid, or found by scanning the
+   * directory otherwise. Such a folder invalidates the manifest before its
+   * content changes, and writes a fresh one on checkpoint(), or when it is
+   * destroyed with manifest_on_close. Objects that are not in the fan-out
+   * directory they belong to are moved there.
+   *
+   * @throws std::filesystem::filesystem_error if the folder cannot be
+   * scanned, or an object cannot be moved to where it belongs
+   */
+  StoredFolder(std::pmr::memory_resource *resource,
+               std::filesystem::path root_path, StoredFolderOptions options);
 
   StoredFolder(std::pmr::memory_resource *resource,
                std::filesystem::path root_path,
-               bool add_all_existing_files = true);
+               bool add_all_existing_files = true)
+      : StoredFolder{resource, std::move(root_path), [=] {
+          auto options = StoredFolderOptions{};
+          options.add_all_existing_files = add_all_existing_files;
+          return options;
+        }()} {}
 
   StoredFolder(const StoredFolder &) = delete;
   StoredFolder(StoredFolder &&) = delete;
   StoredFolder &operator=(const StoredFolder &) = delete;
   StoredFolder &operator=(StoredFolder &&) = delete;
 
-  ~StoredFolder() override = default;
+  ~StoredFolder() override;
 
   bool has(object_id_t id) const override;
+  /**
+   * @throw std::filesystem::filesystem_error if the fan-out directory of the
+   * object cannot be created
+   */
   object_id_t add() override;
+  /**
+   * @brief Adds an empty object with the given id, for collections that
+   * hand out the ids themselves. add() never hands it out afterwards.
+   *
+   * @return false if the id is taken
+   * @throw std::filesystem::filesystem_error like add()
+   */
+  bool add(object_id_t id);
   std::iostream *get(object_id_t id) override;
   std::iostream const &get(object_id_t id) const override;
   std::pair<std::uintmax_t, std::error_code>
   size(object_id_t id) const override;
+  /**
+   * @brief Same as commit(), without waiting for the object to be durable.
+   *
+   * @throws std::system_error if syncing failed: with Sync right away, and
+   * with GroupCommit from the next close() after the batch was synced, see
+   * also wait_for_commits()
+   */
+  void close(object_id_t id) override;
   void destroy(object_id_t id) override;
   void clear() override;
 
+  /**
+   * @brief Blocks until the files that destroy() and clear() deleted so far
+   * are gone from disk, which with deferred deletion happens in the
+   * background.
+   */
+  void wait_for_deletion();
+
+  /**
+   * @brief Releases the stream handed out by get() like close(), and makes the
+   * content durable as the durability option says: not at all with None,
+   * before returning with Sync, or with the next batch with GroupCommit.
+   *
+   * @return ready once the object is durable, with the error if syncing it
+   * failed
+   */
+  std::shared_future<std::error_code> commit(object_id_t id);
+
+  /**
+   * @brief Blocks until the objects closed so far are durable.
+   *
+   * @return the first error of syncing them that close() did not report yet
+   */
+  std::error_code wait_for_commits();
+
+  /**
+   * @brief Zero-copy read access to an object, see StoredFile::map().
+   */
+  std::pair<MappedObject, std::error_code>
+  map(object_id_t id, AccessAdvice advice = AccessAdvice::Sequential) const;
+
+  /**
+   * @brief Reads at offset with pread(), without touching the stream of the
+   * object. Pending writes on the stream are not visible. The descriptor
+   * stays open for the next call and counts against max_open_files like a
+   * stream. Any number of threads may read at once, as long as no other
+   * operation changes the folder at the same time. Not supported for
+   * compressed objects.
+   *
+   * @return the number of bytes read, less than buffer.size() only at the
+   * end of the object, and none for an object that was never written
+   */
+  std::pair<std::size_t, std::error_code>
+  read_at(object_id_t id, std::uint64_t offset,
+          std::span<std::byte> buffer) const;
+
+  /**
+   * @brief Writes at offset with pwrite(), see read_at(). The stream may
+   * still hold what it read before.
+   */
+  std::pair<std::size_t, std::error_code>
+  write_at(object_id_t id, std::uint64_t offset,
+           std::span<const std::byte> data);
+
+  /**
+   * @brief Reads length bytes of the object from offset on, or up to its
+   * end, in chunks. Like map(), the reader bypasses the stream and stays
+   * valid after the object is closed.
+   */
+  std::pair<ObjectReader, std::error_code>
+  reader(object_id_t id, std::uint64_t offset = 0,
+         std::uint64_t length = UINT64_MAX) const;
+
+  /**
+   * @brief Replaces the content of the object from offset on with what is
+   * written in chunks, so writing at the size of the object appends to it.
+   */
+  std::pair<ObjectWriter, std::error_code> writer(object_id_t id,
+                                                  std::uint64_t offset = 0);
+
+  /**
+   * @brief Adds a copy of the object with the content it has now, including
+   * pending writes on its stream. The copy shares the data on disk with the
+   * original where the file system supports reflinks (FICLONE), is copied
+   * within the kernel with copy_file_range() otherwise, and only read and
+   * written through a buffer where neither works. Like any written object,
+   * commit() makes the copy durable.
+   *
+   * @return the id of the copy
+   */
+  std::pair<object_id_t, std::error_code> clone(object_id_t id);
+
+  /**
+   * @brief Writes length bytes of the object from offset on, or up to its
+   * end, to the file descriptor at its current position, with sendfile(), or
+   * splice() for a pipe, so that the content never passes through user
+   * space. Like reader(), pending writes on the stream are not visible, and
+   * compressed objects are not supported.
+   *
+   * @return the number of bytes written to fd
+   */
+  std::pair<std::uint64_t, std::error_code>
+  export_to(object_id_t id, int fd, std::uint64_t offset = 0,
+            std::uint64_t length = UINT64_MAX) const;
+
+  /**
+   * @brief Starts reading all objects for bulk processing, faster than
+   * get() for each of them in the order of the iterators. Objects that were
+   * never written are visited as empty. Compressed objects are not
+   * supported.
+   */
+  std::pair<ObjectScanner, std::error_code>
+  scan(ScanOptions options = {}) const;
+
   std::filesystem::path const &path() const { return m_root_path; }
 
-  iterator_t begin() { return m_files.begin(); }
-  iterator_t end() { return m_files.end(); }
-  const_iterator_t begin() const { return m_files.begin(); }
-  const_iterator_t end() const { return m_files.end(); }
+  /**
+   * @return the path of the file backing the object, or an empty path if the
+   * object is not part of the folder.
+   */
+  std::filesystem::path path(object_id_t id) const;
+
+  /**
+   * @brief Writes the manifest, so that the next StoredFolder on this
+   * directory starts without scanning it. Objects that were added but never
+   * written are part of the manifest as well.
+   *
+   * Directory timestamps are coarse, so this waits for up to a clock tick if
+   * the folder has just been changed.
+   */
+  std::error_code checkpoint();
+
+  /**
+   * @return the number of files the folder currently keeps open
+   */
+  std::size_t num_open_files() const {
+    auto lock = std::lock_guard{m_positional_mutex};
+    return m_open_files.size();
+  }
+
+  /**
+   * @brief The latencies of the operations, the bytes read and written and
+   * the system calls made since the folder was opened, see Metrics. The
+   * streams report what they did when they are closed, except for the open
+   * ones, which this collects from all objects. Reads and writes through
+   * readers, writers, mappings and compressed streams are not counted.
+   * Empty but for open_files unless StoredFolderOptions::record_metrics.
+   */
+  MetricsSnapshot metrics() const;
+
+  const_iterator_t begin() const { return IdIterator{m_files.begin()}; }
+  const_iterator_t end() const { return IdIterator{m_files.end()}; }
 };
 
 } // namespace objectstore
@@ -0,0 +1,2141 @@
+// Google Benchmark-based micro-benchmarks for the object store
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <async_io.hpp>
+#include <cache_folder.hpp>
+#include <compression.hpp>
+#include <concurrent_folder.hpp>
+#include <dedup_folder.hpp>
+#include <dense_id_map.hpp>
+#include <file_stream.hpp>
+#include <folder_manifest.hpp>
+#include <histogram.hpp>
+#include <memory_collection.hpp>
+#include <metrics.hpp>
+#include <name_index.hpp>
+#include <objectstore.hpp>
+#include <segment_store.hpp>
+#include <striped_folder.hpp>
+
+namespace {
+
+constexpr auto kBenchFolder = "objectstore_bench_folder";
+
+/**
+ * @brief A collection whose directory exists for the duration of a single
+ * benchmark.
+ */
+template <typename Collection> class BenchCollection {
+public:
+  template <typename... Args>
+  explicit BenchCollection(std::string const &name, Args &&...args)
+      : m_name{name} {
+    std::filesystem::remove_all(m_name);
+    m_collection.emplace(std::pmr::get_default_resource(), m_name,
+                         std::forward<Args>(args)...);
+  }
+
+  ~BenchCollection() {
+    m_collection.reset();
+    std::filesystem::remove_all(m_name);
+  }
+
+  Collection &operator*() { return *m_collection; }
+  Collection *operator->() { return &*m_collection; }
+
+private:
+  std::string m_name;
+  std::optional<Collection> m_collection;
+};
+
+class BenchFolder : public BenchCollection<objectstore::StoredFolder> {
+public:
+  explicit BenchFolder(std::string const &name = kBenchFolder)
+      : BenchCollection{name, false} {}
+};
+
+objectstore::StoredFolder::object_id_t
+AddObjectOfSize(objectstore::StoredFolder *folder, size_t size) {
+  auto id = folder->add();
+  auto *stream = folder->get(id);
+  auto chunk = std::vector<char>(std::min<size_t>(size, 1 << 20));
+  std::iota(chunk.begin(), chunk.end(), 0);
+  for (size_t written = 0; written < size; written += chunk.size()) {
+    stream->write(chunk.data(),
+                  static_cast<std::streamsize>(
+                      std::min(chunk.size(), size - written)));
+  }
+  stream->flush();
+  return id;
+}
+
+uint64_t Checksum(std::byte const *data, size_t size) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += static_cast<uint64_t>(data[i]);
+  }
+  return sum;
+}
+
+/**
+ * Writes the file back and drops it from the page cache, so that the next
+ * read has to go to the disk.
+ */
+void DropFromPageCache(std::filesystem::path const &file_path) {
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+/**
+ * Drops all files below root from the page cache, and the dentries and inodes
+ * of the whole system as well where the process may write to drop_caches.
+ */
+void DropFromCaches(std::filesystem::path const &root) {
+  for (auto const &entry :
+       std::filesystem::recursive_directory_iterator{root}) {
+    if (entry.is_regular_file()) {
+      DropFromPageCache(entry.path());
+    }
+  }
+  ::sync();
+  if (auto drop_caches = std::ofstream{"/proc/sys/vm/drop_caches"}) {
+    drop_caches << "2\n";
+  }
+}
+
+/**
+ * @return the fraction of the file's pages in the page cache
+ */
+double CachedFraction(std::filesystem::path const &file_path) {
+  auto const size = std::filesystem::file_size(file_path);
+  if (size == 0) {
+    return 0;
+  }
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  auto const page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto pages = std::vector<unsigned char>((size + page_size - 1) / page_size);
+  mincore(address, size, pages.data());
+  munmap(address, size);
+  auto const cached =
+      std::count_if(pages.begin(), pages.end(),
+                    [](unsigned char page) { return page & 1; });
+  return static_cast<double>(cached) / static_cast<double>(pages.size());
+}
+
+/**
+ * @brief Counts the system calls the calling thread makes between start() and
+ * stop(), with a perf counter on the raw_syscalls:sys_enter tracepoint.
+ *
+ * That takes a mounted tracefs and the privileges to use tracepoints. Without
+ * them available() is false, and benchmarks leave their syscall counts out.
+ */
+class SyscallCounter {
+public:
+  SyscallCounter() {
+    for (auto const *tracefs :
+         {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"}) {
+      auto id_file = std::ifstream{std::string{tracefs} +
+                                   "/events/raw_syscalls/sys_enter/id"};
+      uint64_t id = 0;
+      if (id_file >> id) {
+        auto attributes = perf_event_attr{};
+        attributes.type = PERF_TYPE_TRACEPOINT;
+        attributes.size = sizeof(attributes);
+        attributes.config = id;
+        m_fd = static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0,
+                                          -1, -1, PERF_FLAG_FD_CLOEXEC));
+        return;
+      }
+    }
+  }
+
+  SyscallCounter(SyscallCounter const &) = delete;
+  SyscallCounter &operator=(SyscallCounter const &) = delete;
+
+  ~SyscallCounter() {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+  }
+
+  bool available() const { return m_fd >= 0; }
+
+  void start() { m_start = value(); }
+
+  void stop() {
+    // the read() of the counter in stop() counts itself
+    m_count += value() - m_start - 1;
+  }
+
+  uint64_t count() const { return m_count; }
+
+  /**
+   * @brief Adds the system calls per operation as the syscalls_per_op counter,
+   * averaged over the threads.
+   */
+  void report(benchmark::State &state, size_t num_operations) const {
+    if (available() && num_operations > 0) {
+      state.counters["syscalls_per_op"] = benchmark::Counter(
+          static_cast<double>(m_count) / static_cast<double>(num_operations),
+          benchmark::Counter::kAvgThreads);
+    }
+  }
+
+private:
+  uint64_t value() const {
+    uint64_t value = 0;
+    if (m_fd < 0 || ::read(m_fd, &value, sizeof(value)) != sizeof(value)) {
+      return 0;
+    }
+    return value;
+  }
+
+  int m_fd = -1;
+  uint64_t m_start = 0;
+  uint64_t m_count = 0;
+};
+
+} // namespace
+
+static void BM_StoredFolderReadStream(benchmark::State &state) {
+  size_t const size = state.range(0);
+  auto folder = BenchFolder{};
+  auto id = AddObjectOfSize(&*folder, size);
+  auto buffer = std::vector<std::byte>(size);
+
+  for (auto _ : state) {
+    auto *stream = folder->get(id);
+    stream->read(reinterpret_cast<char *>(buffer.data()),
+                 static_cast<std::streamsize>(size));
+    benchmark::DoNotOptimize(Checksum(buffer.data(), size));
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_StoredFolderReadStream)
+    ->RangeMultiplier(16)
+    ->Range(4 << 10, 1 << 30)
+    ->Unit(benchmark::kMicrosecond);
+
+static void BM_StoredFolderReadMapped(benchmark::State &state) {
+  size_t const size = state.range(0);
+  auto folder = BenchFolder{};
+  auto id = AddObjectOfSize(&*folder, size);
+
+  for (auto _ : state) {
+    auto [mapped, ec] = folder->map(id);
+    auto data = mapped.data();
+    benchmark::DoNotOptimize(Checksum(data.data(), data.size()));
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_StoredFolderReadMapped)
+    ->RangeMultiplier(16)
+    ->Range(4 << 10, 1 << 30)
+    ->Unit(benchmark::kMicrosecond);
+
+/**
+ * Random 4 KB reads or writes across 64 objects of 1 MB each, keeping
+ * queue_depth I/Os in flight at all times.
+ */
+template <objectstore::AsyncObjectIO::Backend kBackend,
+          objectstore::IoOperation kOperation>
+static void BM_AsyncObjectIO(benchmark::State &state) {
+  constexpr size_t kNumObjects = 64;
+  constexpr size_t kObjectSize = 1 << 20;
+  constexpr size_t kBlockSize = 4 << 10;
+  constexpr size_t kOpsPerIteration = 1024;
+  auto const queue_depth = static_cast<unsigned>(state.range(0));
+
+  auto folder = BenchFolder{};
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (size_t i = 0; i < kNumObjects; ++i) {
+    ids.push_back(AddObjectOfSize(&*folder, kObjectSize));
+  }
+
+  auto io = objectstore::AsyncObjectIO{&*folder, queue_depth, kBackend};
+  if (io.backend() != kBackend) {
+    state.SkipWithError("backend not available");
+    return;
+  }
+
+  auto buffers = std::vector<std::byte>(queue_depth * kBlockSize);
+  auto completions = std::vector<objectstore::IoCompletion>(queue_depth);
+  auto free_slots = std::vector<uint64_t>(queue_depth);
+  std::iota(free_slots.begin(), free_slots.end(), 0);
+  auto engine = std::mt19937_64{42};
+  auto object_distribution =
+      std::uniform_int_distribution<size_t>(0, kNumObjects - 1);
+  auto block_distribution =
+      std::uniform_int_distribution<size_t>(0, kObjectSize / kBlockSize - 1);
+
+  size_t num_ops = 0;
+  for (auto _ : state) {
+    size_t submitted = 0;
+    size_t completed = 0;
+    while (completed < kOpsPerIteration) {
+      while (!free_slots.empty() && submitted < kOpsPerIteration) {
+        auto const slot = free_slots.back();
+        auto const request = objectstore::IoRequest{
+            ids[object_distribution(engine)], kOperation,
+            block_distribution(engine) * kBlockSize,
+            std::span{buffers}.subspan(slot * kBlockSize, kBlockSize), slot};
+        if (io.submit({&request, 1}) == 0) {
+          break;
+        }
+        free_slots.pop_back();
+        ++submitted;
+      }
+      auto const num_reaped = io.reap(completions);
+      for (size_t i = 0; i < num_reaped; ++i) {
+        free_slots.push_back(completions[i].user_data);
+      }
+      completed += num_reaped;
+    }
+    num_ops += completed;
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(num_ops));
+  state.SetBytesProcessed(static_cast<int64_t>(num_ops * kBlockSize));
+  state.counters["IOPS"] =
+      benchmark::Counter(static_cast<double>(num_ops),
+                         benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_AsyncObjectIO<objectstore::AsyncObjectIO::Backend::IoUring,
+                           objectstore::IoOperation::Read>)
+    ->RangeMultiplier(2)
+    ->Range(1, 128)
+    ->UseRealTime();
+BENCHMARK(BM_AsyncObjectIO<objectstore::AsyncObjectIO::Backend::ThreadPool,
+                           objectstore::IoOperation::Read>)
+    ->RangeMultiplier(2)
+    ->Range(1, 128)
+    ->UseRealTime();
+BENCHMARK(BM_AsyncObjectIO<objectstore::AsyncObjectIO::Backend::IoUring,
+                           objectstore::IoOperation::Write>)
+    ->RangeMultiplier(2)
+    ->Range(1, 128)
+    ->UseRealTime();
+BENCHMARK(BM_AsyncObjectIO<objectstore::AsyncObjectIO::Backend::ThreadPool,
+                           objectstore::IoOperation::Write>)
+    ->RangeMultiplier(2)
+    ->Range(1, 128)
+    ->UseRealTime();
+
+/**
+ * Adds num_objects objects of 1 KB, reads all of them back in random order
+ * and destroys them again, each phase reported as its own benchmark. The
+ * MemoryCollection keeps up to 64 MB in memory, so it spills a third of the
+ * objects at 100K and most of them at 1M.
+ */
+enum class SmallObjectPhase { Add, Get, Destroy };
+
+template <typename Collection, SmallObjectPhase kPhase>
+static void BM_SmallObjects(benchmark::State &state) {
+  constexpr size_t kObjectSize = 1 << 10;
+  auto const num_objects = static_cast<size_t>(state.range(0));
+  auto const payload = std::string(kObjectSize, 'x');
+  auto buffer = std::string(kObjectSize, '\0');
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto bench_collection =
+        std::optional<BenchCollection<Collection>>{kBenchFolder};
+    auto &collection = *bench_collection;
+    auto ids = std::vector<objectstore::StoredObjectCollection::object_id_t>{};
+    ids.reserve(num_objects);
+    auto add_all = [&] {
+      for (size_t i = 0; i < num_objects; ++i) {
+        auto id = collection->add();
+        collection->get(id)->write(payload.data(), payload.size());
+        collection->close(id);
+        ids.push_back(id);
+      }
+    };
+    if (kPhase == SmallObjectPhase::Add) {
+      state.ResumeTiming();
+      add_all();
+      state.PauseTiming();
+    } else {
+      add_all();
+      std::shuffle(ids.begin(), ids.end(), std::mt19937_64{42});
+      state.ResumeTiming();
+      for (auto id : ids) {
+        if (kPhase == SmallObjectPhase::Get) {
+          collection->get(id)->read(buffer.data(), buffer.size());
+          collection->close(id);
+        } else {
+          collection->destroy(id);
+        }
+      }
+      state.PauseTiming();
+    }
+    // tearing down the collection is not part of the measurement
+    bench_collection.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects));
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects * kObjectSize));
+}
+BENCHMARK(BM_SmallObjects<objectstore::StoredFolder, SmallObjectPhase::Add>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(BM_SmallObjects<objectstore::StoredSegments, SmallObjectPhase::Add>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(BM_SmallObjects<objectstore::StoredFolder, SmallObjectPhase::Get>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(BM_SmallObjects<objectstore::StoredSegments, SmallObjectPhase::Get>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(
+    BM_SmallObjects<objectstore::StoredFolder, SmallObjectPhase::Destroy>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(
+    BM_SmallObjects<objectstore::StoredSegments, SmallObjectPhase::Destroy>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(
+    BM_SmallObjects<objectstore::MemoryCollection, SmallObjectPhase::Add>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(
+    BM_SmallObjects<objectstore::MemoryCollection, SmallObjectPhase::Get>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(
+    BM_SmallObjects<objectstore::MemoryCollection, SmallObjectPhase::Destroy>)
+    ->RangeMultiplier(10)
+    ->Range(10'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
+/**
+ * Fills a fresh directory with the files of num_objects empty objects, much
+ * faster than going through a StoredFolder.
+ */
+void CreateEmptyObjects(std::filesystem::path const &root,
+                        size_t num_objects) {
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root);
+  for (size_t i = 0; i < num_objects; ++i) {
+    auto const file_path = root / std::to_string(i);
+    ::close(::open(file_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+  }
+}
+
+/**
+ * Opens a folder of num_objects empty objects, either by scanning the
+ * directory or from the manifest written by a checkpoint before.
+ */
+enum class StartupMode { Scan, Manifest };
+
+template <StartupMode kMode>
+static void BM_StoredFolderStartup(benchmark::State &state) {
+  auto const num_objects = static_cast<size_t>(state.range(0));
+  auto const root = std::filesystem::path{kBenchFolder};
+  CreateEmptyObjects(root, num_objects);
+  objectstore::StoredFolder{std::pmr::get_default_resource(), root}
+      .checkpoint();
+
+  for (auto _ : state) {
+    if (kMode == StartupMode::Scan) {
+      state.PauseTiming();
+      objectstore::RemoveManifest(root);
+      state.ResumeTiming();
+    }
+    auto folder = std::optional<objectstore::StoredFolder>{};
+    folder.emplace(std::pmr::get_default_resource(), root);
+    state.PauseTiming();
+    if (!folder->has(num_objects - 1)) {
+      state.SkipWithError("object missing");
+    }
+    // neither is closing the folder
+    folder.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects));
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(BM_StoredFolderStartup<StartupMode::Scan>)
+    ->RangeMultiplier(10)
+    ->Range(100'000, 10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK(BM_StoredFolderStartup<StartupMode::Manifest>)
+    ->RangeMultiplier(10)
+    ->Range(100'000, 10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+
+/**
+ * get() and close() of random objects out of num_objects, keeping at most
+ * max_open_files open (zero for no limit).
+ */
+static void BM_StoredFolderRandomGet(benchmark::State &state) {
+  auto const num_objects = static_cast<size_t>(state.range(0));
+  auto const root = std::filesystem::path{kBenchFolder};
+  // a fixed number of iterations, so that the objects are only created once
+  CreateEmptyObjects(root, num_objects);
+  auto options = objectstore::StoredFolderOptions{};
+  options.max_open_files = static_cast<size_t>(state.range(1));
+  auto folder = std::optional<objectstore::StoredFolder>{};
+  folder.emplace(std::pmr::get_default_resource(), root, options);
+
+  auto engine = std::mt19937_64{42};
+  auto distribution = std::uniform_int_distribution<size_t>(0, num_objects - 1);
+  for (auto _ : state) {
+    auto const id = distribution(engine);
+    benchmark::DoNotOptimize(folder->get(id)->peek());
+    folder->close(id);
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["open_files"] =
+      static_cast<double>(folder->num_open_files());
+  folder.reset();
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(BM_StoredFolderRandomGet)
+    ->Args({10'000, 0})
+    ->Args({10'000, 1'024})
+    ->Args({1'000'000, 1'024})
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(200'000);
+
+/**
+ * Adds num_objects empty objects to a folder with the given number of fan-out
+ * levels, opens random ones of them, or destroys all of them again, each phase
+ * reported as its own benchmark. Only a single file is kept open, so that
+ * every get() looks up the object in its directory.
+ */
+enum class LayoutPhase { Add, Lookup, Destroy };
+
+template <LayoutPhase kPhase>
+static void BM_FolderLayout(benchmark::State &state) {
+  auto const num_objects = static_cast<size_t>(state.range(0));
+  auto const root = std::filesystem::path{kBenchFolder};
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = static_cast<unsigned>(state.range(1));
+  options.max_open_files = 1;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::filesystem::remove_all(root);
+    auto folder = std::optional<objectstore::StoredFolder>{};
+    folder.emplace(std::pmr::get_default_resource(), root, options);
+    auto add_all = [&] {
+      for (size_t i = 0; i < num_objects; ++i) {
+        auto id = folder->add();
+        folder->get(id);
+        folder->close(id);
+      }
+    };
+    if (kPhase == LayoutPhase::Add) {
+      state.ResumeTiming();
+      add_all();
+      state.PauseTiming();
+    } else {
+      add_all();
+      auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+      ids.reserve(num_objects);
+      for (auto id : *folder) {
+        ids.push_back(id);
+      }
+      std::shuffle(ids.begin(), ids.end(), std::mt19937_64{42});
+      state.ResumeTiming();
+      for (auto id : ids) {
+        if (kPhase == LayoutPhase::Lookup) {
+          benchmark::DoNotOptimize(folder->get(id));
+          folder->close(id);
+        } else {
+          folder->destroy(id);
+        }
+      }
+      state.PauseTiming();
+    }
+    folder.reset();
+    std::filesystem::remove_all(root);
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects));
+}
+BENCHMARK(BM_FolderLayout<LayoutPhase::Add>)
+    ->ArgNames({"objects", "fanout_levels"})
+    ->ArgsProduct({{1'000'000, 10'000'000}, {0, 2}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(BM_FolderLayout<LayoutPhase::Lookup>)
+    ->ArgNames({"objects", "fanout_levels"})
+    ->ArgsProduct({{1'000'000, 10'000'000}, {0, 2}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK(BM_FolderLayout<LayoutPhase::Destroy>)
+    ->ArgNames({"objects", "fanout_levels"})
+    ->ArgsProduct({{1'000'000, 10'000'000}, {0, 2}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
+/**
+ * JSON records like the ones in exercises/generated.json, which compress
+ * about as well.
+ */
+std::string JsonRecords(size_t size) {
+  static constexpr char const *kNames[] = {"Stewart Mccormick", "Ida Lowe",
+                                           "Marsha Hyde", "Bird Travis"};
+  static constexpr char const *kColors[] = {"blue", "brown", "green"};
+  static constexpr char const *kWords[] = {
+      "nostrud", "tempor",   "excepteur", "anim",   "sit",  "commodo",
+      "in",      "eiusmod",  "ex",        "labore", "amet", "consequat",
+      "dolor",   "proident", "velit",     "irure",  "qui",  "officia"};
+  auto engine = std::mt19937_64{42};
+  auto hex = [&engine] {
+    constexpr char kDigits[] = "0123456789abcdef";
+    auto value = engine();
+    auto text = std::string(16, '0');
+    for (auto &c : text) {
+      c = kDigits[value & 0xf];
+      value >>= 4;
+    }
+    return text;
+  };
+  auto text = std::string{"[\n"};
+  for (size_t i = 0; text.size() < size; ++i) {
+    auto about = std::string{};
+    for (size_t word = 0, n = 8 + engine() % 16; word < n; ++word) {
+      about += kWords[engine() % std::size(kWords)];
+      about += word + 1 < n ? " " : ".";
+    }
+    text += "  {\n    \"index\": " + std::to_string(i) +
+            ",\n    \"guid\": \"" + hex() + hex() +
+            "\",\n    \"isActive\": " + (engine() % 2 ? "true" : "false") +
+            ",\n    \"balance\": \"$" + std::to_string(engine() % 4'000) +
+            "." + std::to_string(engine() % 100) + "\",\n    \"age\": " +
+            std::to_string(20 + engine() % 50) + ",\n    \"eyeColor\": \"" +
+            kColors[engine() % 3] + "\",\n    \"name\": \"" +
+            kNames[engine() % 4] + "\",\n    \"about\": \"" + about +
+            "\"\n  },\n";
+  }
+  text.resize(size);
+  return text;
+}
+
+/**
+ * Writes an object of JSON records in chunks of 64 KB, or reads it back
+ * either as a whole or in random 4 KB pieces, with and without compression.
+ * With cold set, the object is dropped from the page cache before every read,
+ * so that the disk has to deliver it.
+ */
+enum class CompressionOp { Write, Read, RandomRead };
+
+template <bool kCompressed, CompressionOp kOp>
+static void BM_Compression(benchmark::State &state) {
+  constexpr size_t kChunkSize = 64 << 10;
+  constexpr size_t kPieceSize = 4 << 10;
+  auto const size = static_cast<size_t>(state.range(0));
+  auto const cold = state.range(1) != 0;
+  auto const content = JsonRecords(size);
+  auto const codec = objectstore::LzCodec{};
+  auto options = objectstore::StoredFolderOptions{};
+  options.add_all_existing_files = false;
+  if (kCompressed) {
+    options.compression.codec = &codec;
+  }
+  auto folder =
+      BenchCollection<objectstore::StoredFolder>{kBenchFolder, options};
+
+  auto write = [&](objectstore::StoredFolder::object_id_t id) {
+    auto *stream = folder->get(id);
+    for (size_t written = 0; written < size; written += kChunkSize) {
+      stream->write(content.data() + written,
+                    static_cast<std::streamsize>(
+                        std::min(kChunkSize, size - written)));
+    }
+    folder->close(id);
+  };
+
+  auto id = folder->add();
+  write(id);
+  auto buffer = std::string(size, '\0');
+  auto engine = std::mt19937_64{42};
+  auto offsets = std::uniform_int_distribution<size_t>(0, size - kPieceSize);
+  size_t bytes_per_iteration = size;
+  for (auto _ : state) {
+    if (kOp == CompressionOp::Write) {
+      state.PauseTiming();
+      folder->destroy(id);
+      id = folder->add();
+      state.ResumeTiming();
+      write(id);
+      continue;
+    }
+    if (cold) {
+      state.PauseTiming();
+      // only a file that is not open is read from the disk again
+      folder->destroy(id);
+      id = folder->add();
+      write(id);
+      DropFromPageCache(folder->path(id));
+      state.ResumeTiming();
+    }
+    auto *stream = folder->get(id);
+    if (kOp == CompressionOp::Read) {
+      stream->read(buffer.data(), static_cast<std::streamsize>(size));
+    } else {
+      bytes_per_iteration = 64 * kPieceSize;
+      for (int i = 0; i < 64; ++i) {
+        stream->seekg(static_cast<std::streamoff>(offsets(engine)));
+        stream->read(buffer.data(), static_cast<std::streamsize>(kPieceSize));
+      }
+    }
+    benchmark::DoNotOptimize(buffer.data());
+    folder->close(id);
+  }
+
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * bytes_per_iteration));
+  state.counters["ratio"] =
+      static_cast<double>(size) /
+      static_cast<double>(std::filesystem::file_size(folder->path(id)));
+}
+BENCHMARK(BM_Compression<false, CompressionOp::Write>)
+    ->Args({16 << 20, 0})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Compression<true, CompressionOp::Write>)
+    ->Args({16 << 20, 0})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Compression<false, CompressionOp::Read>)
+    ->Args({16 << 20, 0})
+    ->Args({16 << 20, 1})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Compression<true, CompressionOp::Read>)
+    ->Args({16 << 20, 0})
+    ->Args({16 << 20, 1})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Compression<false, CompressionOp::RandomRead>)
+    ->Args({16 << 20, 0})
+    ->Args({16 << 20, 1})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Compression<true, CompressionOp::RandomRead>)
+    ->Args({16 << 20, 0})
+    ->Args({16 << 20, 1})
+    ->Unit(benchmark::kMillisecond);
+
+std::uintmax_t DiskUsage(std::filesystem::path const &root) {
+  std::uintmax_t size = 0;
+  for (auto const &entry :
+       std::filesystem::recursive_directory_iterator(root)) {
+    if (entry.is_regular_file()) {
+      size += entry.file_size();
+    }
+  }
+  return size;
+}
+
+/**
+ * Writes objects of JSON records of which every content occurs twice, i.e.
+ * half of the objects duplicate another one, and reports how much of the
+ * written data ends up on disk.
+ */
+template <typename Collection> static void BM_Dedup(benchmark::State &state) {
+  constexpr size_t kNumObjects = 256;
+  constexpr size_t kNumContents = kNumObjects / 2;
+  auto const size = static_cast<size_t>(state.range(0));
+  auto const records = JsonRecords(kNumContents * size);
+  auto folder = [] {
+    if constexpr (std::is_same_v<Collection, objectstore::StoredFolder>) {
+      return BenchCollection<Collection>{kBenchFolder, false};
+    } else {
+      return BenchCollection<Collection>{kBenchFolder};
+    }
+  }();
+
+  auto ids = std::vector<typename Collection::object_id_t>{};
+  std::uintmax_t stored = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < kNumObjects; ++i) {
+      auto id = folder->add();
+      folder->get(id)->write(records.data() + (i % kNumContents) * size,
+                             static_cast<std::streamsize>(size));
+      folder->close(id);
+      ids.push_back(id);
+    }
+
+    state.PauseTiming();
+    stored = DiskUsage(kBenchFolder);
+    for (auto id : ids) {
+      folder->destroy(id);
+    }
+    ids.clear();
+    state.ResumeTiming();
+  }
+
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * kNumObjects * size));
+  state.counters["saved"] =
+      1.0 - static_cast<double>(stored) /
+                static_cast<double>(kNumObjects * size);
+}
+BENCHMARK(BM_Dedup<objectstore::StoredFolder>)
+    ->Arg(4 << 10)
+    ->Arg(256 << 10)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Dedup<objectstore::DedupFolder>)
+    ->Arg(4 << 10)
+    ->Arg(256 << 10)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * A StoredFolder behind one big mutex, which is what sharing it between
+ * threads takes.
+ */
+class LockedFolder {
+public:
+  LockedFolder(std::pmr::memory_resource *resource, std::string const &name)
+      : m_folder{resource, name, false} {}
+
+  void add_write_destroy(std::string const &payload) {
+    auto lock = std::lock_guard{m_mutex};
+    auto id = m_folder.add();
+    m_folder.get(id)->write(payload.data(), payload.size());
+    m_folder.close(id);
+    benchmark::DoNotOptimize(m_folder.size(id));
+    m_folder.destroy(id);
+  }
+
+private:
+  std::mutex m_mutex;
+  objectstore::StoredFolder m_folder;
+};
+
+class ShardedFolder {
+public:
+  ShardedFolder(std::pmr::memory_resource *resource, std::string const &name)
+      : m_folder{resource, name, false} {}
+
+  void add_write_destroy(std::string const &payload) {
+    auto id = m_folder.add();
+    {
+      auto [access, ec] = m_folder.write(id);
+      access.stream().write(payload.data(), payload.size());
+    }
+    benchmark::DoNotOptimize(m_folder.size(id));
+    m_folder.destroy(id);
+  }
+
+private:
+  objectstore::ConcurrentStoredFolder m_folder;
+};
+
+/**
+ * Every thread adds a 1 KB object, writes it, asks for its size and destroys
+ * it again, all threads sharing one collection.
+ */
+template <typename Folder>
+static void BM_ConcurrentFolderScaling(benchmark::State &state) {
+  static std::optional<BenchCollection<Folder>> shared_folder;
+  if (state.thread_index() == 0) {
+    shared_folder.emplace(kBenchFolder);
+  }
+  auto const payload = std::string(1 << 10, 'x');
+
+  for (auto _ : state) {
+    (*shared_folder)->add_write_destroy(payload);
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  if (state.thread_index() == 0) {
+    shared_folder.reset();
+  }
+}
+BENCHMARK(BM_ConcurrentFolderScaling<LockedFolder>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_ConcurrentFolderScaling<ShardedFolder>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+/**
+ * Every thread reads random ranges of range_size bytes from one shared 1 GB
+ * object, either positionally with read_at() or through the object's stream,
+ * which has to be locked for every seek and read.
+ */
+enum class RangedReadMode { Positional, SharedStream };
+
+template <RangedReadMode kMode>
+static void BM_RangedRead(benchmark::State &state) {
+  constexpr size_t kObjectSize = size_t{1} << 30;
+  static std::optional<BenchFolder> shared_folder;
+  static objectstore::StoredFolder::object_id_t id;
+  static std::mutex mutex;
+  if (state.thread_index() == 0) {
+    shared_folder.emplace();
+    id = (*shared_folder)->add();
+    auto [writer, ec] = (*shared_folder)->writer(id);
+    auto chunk = std::vector<std::byte>(1 << 20);
+    std::iota(reinterpret_cast<unsigned char *>(chunk.data()),
+              reinterpret_cast<unsigned char *>(chunk.data() + chunk.size()),
+              0);
+    for (size_t written = 0; written < kObjectSize; written += chunk.size()) {
+      writer.write(chunk);
+    }
+  }
+  auto const range_size = static_cast<size_t>(state.range(0));
+  auto buffer = std::vector<std::byte>(range_size);
+  auto engine = std::mt19937_64{static_cast<uint64_t>(state.thread_index())};
+  auto offsets =
+      std::uniform_int_distribution<size_t>(0, kObjectSize - range_size);
+
+  for (auto _ : state) {
+    auto const offset = offsets(engine);
+    if constexpr (kMode == RangedReadMode::Positional) {
+      (*shared_folder)->read_at(id, offset, buffer);
+    } else {
+      auto lock = std::lock_guard{mutex};
+      auto *stream = (*shared_folder)->get(id);
+      stream->seekg(static_cast<std::streamoff>(offset));
+      stream->read(reinterpret_cast<char *>(buffer.data()),
+                   static_cast<std::streamsize>(range_size));
+    }
+    benchmark::DoNotOptimize(buffer.data());
+  }
+
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * range_size));
+  if (state.thread_index() == 0) {
+    shared_folder.reset();
+  }
+}
+BENCHMARK(BM_RangedRead<RangedReadMode::Positional>)
+    ->ArgName("range_size")
+    ->Arg(4 << 10)
+    ->Arg(1 << 20)
+    ->Threads(1)
+    ->Threads(16)
+    ->UseRealTime();
+BENCHMARK(BM_RangedRead<RangedReadMode::SharedStream>)
+    ->ArgName("range_size")
+    ->Arg(4 << 10)
+    ->Arg(1 << 20)
+    ->Threads(1)
+    ->Threads(16)
+    ->UseRealTime();
+
+/**
+ * Every thread adds a 1 KB object, writes and commits it, all threads
+ * sharing one StoredFolder behind a mutex, and waits outside of the mutex
+ * until the object is durable. latency_us is the time from commit() until
+ * then. With syncfs set, group commit syncs the file system once per batch,
+ * and it waits up to interval_us for a batch to fill.
+ */
+template <objectstore::Durability kDurability>
+static void BM_Durability(benchmark::State &state) {
+  static std::optional<BenchCollection<objectstore::StoredFolder>>
+      shared_folder;
+  static std::mutex mutex;
+  if (state.thread_index() == 0) {
+    auto options = objectstore::StoredFolderOptions{};
+    options.add_all_existing_files = false;
+    options.durability = kDurability;
+    options.group_commit.use_syncfs = state.range(0) != 0;
+    options.group_commit.interval = std::chrono::microseconds{state.range(1)};
+    shared_folder.emplace(kBenchFolder, options);
+  }
+  auto const payload = std::string(1 << 10, 'x');
+
+  auto latency = std::chrono::steady_clock::duration{};
+  for (auto _ : state) {
+    auto future = std::shared_future<std::error_code>{};
+    auto start = std::chrono::steady_clock::time_point{};
+    {
+      auto lock = std::lock_guard{mutex};
+      auto &folder = **shared_folder;
+      auto id = folder.add();
+      folder.get(id)->write(payload.data(),
+                            static_cast<std::streamsize>(payload.size()));
+      start = std::chrono::steady_clock::now();
+      future = folder.commit(id);
+    }
+    if (future.get()) {
+      state.SkipWithError("commit failed");
+      break;
+    }
+    latency += std::chrono::steady_clock::now() - start;
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["latency_us"] = benchmark::Counter(
+      std::chrono::duration<double, std::micro>(latency).count() /
+          static_cast<double>(std::max<benchmark::IterationCount>(
+              state.iterations(), 1)),
+      benchmark::Counter::kAvgThreads);
+  if (state.thread_index() == 0) {
+    shared_folder.reset();
+  }
+}
+BENCHMARK(BM_Durability<objectstore::Durability::None>)
+    ->ArgNames({"syncfs", "interval_us"})
+    ->Args({0, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Iterations(1000)
+    ->UseRealTime();
+BENCHMARK(BM_Durability<objectstore::Durability::Sync>)
+    ->ArgNames({"syncfs", "interval_us"})
+    ->Args({0, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Iterations(1000)
+    ->UseRealTime();
+BENCHMARK(BM_Durability<objectstore::Durability::GroupCommit>)
+    ->ArgNames({"syncfs", "interval_us"})
+    ->ArgsProduct({{0, 1}, {0, 1'000}})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Iterations(1000)
+    ->UseRealTime();
+
+/**
+ * Writes a 256 MB file sequentially in chunks of chunk_size and syncs it, or
+ * reads it back, through the std::fstream that StoredFile used before, or a
+ * FileStream with a 1 MB buffer, written with or without O_DIRECT. cached is
+ * the fraction of the file left in the page cache by a write. Reads start
+ * from a cold cache with cold set.
+ */
+enum class StreamKind { Fstream, Buffered, Direct };
+
+template <StreamKind kKind, bool kWrite>
+static void BM_SequentialStream(benchmark::State &state) {
+  constexpr size_t kFileSize = 256 << 20;
+  auto const chunk_size = static_cast<size_t>(state.range(0));
+  auto const cold = !kWrite && state.range(1) != 0;
+  auto const file_path = std::filesystem::path{kBenchFolder} / "sequential";
+  std::filesystem::remove_all(kBenchFolder);
+  std::filesystem::create_directories(kBenchFolder);
+  auto chunk = std::vector<char>(chunk_size);
+  std::iota(chunk.begin(), chunk.end(), 0);
+
+  auto open = [&]() -> std::unique_ptr<std::iostream> {
+    if (kKind == StreamKind::Fstream) {
+      {
+        std::ofstream{file_path, std::ios::app};
+      }
+      return std::make_unique<std::fstream>(file_path,
+                                            std::ios::in | std::ios::out);
+    }
+    auto options = objectstore::FileStreamOptions{};
+    options.buffer_size = 1 << 20;
+    options.direct_io = kKind == StreamKind::Direct;
+    return std::make_unique<objectstore::FileStream>(
+        std::pmr::get_default_resource(), file_path, options);
+  };
+  auto write_file = [&] {
+    auto stream = open();
+    for (size_t written = 0; written < kFileSize; written += chunk_size) {
+      stream->write(chunk.data(), static_cast<std::streamsize>(chunk_size));
+    }
+    stream->flush();
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    fdatasync(fd);
+    ::close(fd);
+  };
+
+  if (!kWrite) {
+    write_file();
+  }
+  for (auto _ : state) {
+    if (kWrite) {
+      state.PauseTiming();
+      std::filesystem::remove(file_path);
+      state.ResumeTiming();
+      write_file();
+      continue;
+    }
+    if (cold) {
+      state.PauseTiming();
+      DropFromPageCache(file_path);
+      state.ResumeTiming();
+    }
+    auto stream = open();
+    for (size_t read = 0; read < kFileSize; read += chunk_size) {
+      stream->read(chunk.data(), static_cast<std::streamsize>(chunk_size));
+    }
+    benchmark::DoNotOptimize(chunk.data());
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kFileSize));
+  if (kWrite) {
+    state.counters["cached"] = CachedFraction(file_path);
+  }
+  std::filesystem::remove_all(kBenchFolder);
+}
+BENCHMARK(BM_SequentialStream<StreamKind::Fstream, true>)
+    ->ArgName("chunk_size")
+    ->Arg(4 << 10)
+    ->Arg(1 << 20)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK(BM_SequentialStream<StreamKind::Buffered, true>)
+    ->ArgName("chunk_size")
+    ->Arg(4 << 10)
+    ->Arg(1 << 20)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK(BM_SequentialStream<StreamKind::Direct, true>)
+    ->ArgName("chunk_size")
+    ->Arg(4 << 10)
+    ->Arg(1 << 20)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK(BM_SequentialStream<StreamKind::Fstream, false>)
+    ->ArgNames({"chunk_size", "cold"})
+    ->ArgsProduct({{4 << 10, 1 << 20}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK(BM_SequentialStream<StreamKind::Buffered, false>)
+    ->ArgNames({"chunk_size", "cold"})
+    ->ArgsProduct({{4 << 10, 1 << 20}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+
+/**
+ * The baseline of StoredFolder that storage changes are judged against: each
+ * iteration runs one operation on every one of num_objects objects of
+ * object_size bytes, spread evenly over the threads, each of which works on a
+ * folder of its own. Rescan opens the folder without a manifest, so that the
+ * constructor has to scan the directory. With cold set, the objects are
+ * dropped from the caches before, see DropFromCaches(). syscalls_per_op is
+ * only reported where SyscallCounter is available. Populating the folders
+ * takes much longer than most operations, so each benchmark runs a single
+ * iteration; --benchmark_repetitions gives the spread.
+ */
+enum class FolderOp { Add, Write, Read, Size, Destroy, Clear, Rescan };
+
+template <FolderOp kOp> static void BM_FolderOps(benchmark::State &state) {
+  auto const object_size = static_cast<size_t>(state.range(0));
+  auto const num_objects = static_cast<size_t>(state.range(1)) /
+                           static_cast<size_t>(state.threads());
+  auto const cold = state.range(2) != 0;
+  auto const root = std::filesystem::path{
+      std::string{kBenchFolder} + "_" + std::to_string(state.thread_index())};
+  auto chunk = std::vector<char>(std::min<size_t>(object_size, 1 << 20));
+  std::iota(chunk.begin(), chunk.end(), 0);
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  ids.reserve(num_objects);
+  auto folder = std::optional<objectstore::StoredFolder>{};
+  auto syscalls = SyscallCounter{};
+
+  auto write = [&](objectstore::StoredFolder::object_id_t id) {
+    auto *stream = folder->get(id);
+    for (size_t written = 0; written < object_size; written += chunk.size()) {
+      stream->write(chunk.data(),
+                    static_cast<std::streamsize>(
+                        std::min(chunk.size(), object_size - written)));
+    }
+    folder->close(id);
+  };
+  auto read = [&](objectstore::StoredFolder::object_id_t id) {
+    auto *stream = folder->get(id);
+    for (size_t read = 0; read < object_size; read += chunk.size()) {
+      stream->read(chunk.data(),
+                   static_cast<std::streamsize>(
+                       std::min(chunk.size(), object_size - read)));
+    }
+    benchmark::DoNotOptimize(chunk.data());
+    folder->close(id);
+  };
+  // a single iteration, so that all threads start on populated folders
+  std::filesystem::remove_all(root);
+  folder.emplace(std::pmr::get_default_resource(), root);
+  for (size_t i = 0; kOp != FolderOp::Add && i < num_objects; ++i) {
+    ids.push_back(folder->add());
+    if (kOp != FolderOp::Write) {
+      write(ids.back());
+    }
+  }
+  if (kOp == FolderOp::Rescan) {
+    folder.reset();
+    objectstore::RemoveManifest(root);
+  }
+  if (cold) {
+    DropFromCaches(root);
+  }
+
+  for (auto _ : state) {
+    syscalls.start();
+    switch (kOp) {
+    case FolderOp::Add:
+      for (size_t i = 0; i < num_objects; ++i) {
+        ids.push_back(folder->add());
+      }
+      break;
+    case FolderOp::Write:
+      std::for_each(ids.begin(), ids.end(), write);
+      break;
+    case FolderOp::Read:
+      std::for_each(ids.begin(), ids.end(), read);
+      break;
+    case FolderOp::Size:
+      for (auto id : ids) {
+        benchmark::DoNotOptimize(folder->size(id));
+      }
+      break;
+    case FolderOp::Destroy:
+      for (auto id : ids) {
+        folder->destroy(id);
+      }
+      break;
+    case FolderOp::Clear:
+      folder->clear();
+      break;
+    case FolderOp::Rescan:
+      folder.emplace(std::pmr::get_default_resource(), root);
+      break;
+    }
+    syscalls.stop();
+  }
+  if (kOp == FolderOp::Rescan && num_objects > 0 &&
+      !folder->has(ids.back())) {
+    state.SkipWithError("object missing after rescan");
+  }
+  folder.reset();
+  std::filesystem::remove_all(root);
+
+  auto const num_operations = state.iterations() * num_objects;
+  state.SetItemsProcessed(static_cast<int64_t>(num_operations));
+  if (kOp == FolderOp::Write || kOp == FolderOp::Read) {
+    state.SetBytesProcessed(
+        static_cast<int64_t>(num_operations * object_size));
+  }
+  syscalls.report(state, num_operations);
+}
+
+/**
+ * 1K to 1M objects of 64 B, and for writes and reads 1 KB to 64 MB objects, as
+ * many as fit into 256 MB but no more than 1K. Operations that read run both
+ * cold and warm.
+ */
+template <FolderOp kOp>
+void SweepFolderOps(benchmark::internal::Benchmark *benchmark) {
+  constexpr int64_t kMaxBytes = 256 << 20;
+  auto const reads = kOp == FolderOp::Read || kOp == FolderOp::Size ||
+                     kOp == FolderOp::Rescan;
+  for (int64_t cold = 0; cold <= (reads ? 1 : 0); ++cold) {
+    for (int64_t count = 1'000; count <= 1'000'000; count *= 10) {
+      benchmark->Args({64, count, cold});
+    }
+    if (kOp == FolderOp::Write || kOp == FolderOp::Read) {
+      for (int64_t size = 1 << 10; size <= (64 << 20); size *= 16) {
+        benchmark->Args(
+            {size, std::min<int64_t>(1'000, kMaxBytes / size), cold});
+      }
+    }
+  }
+}
+BENCHMARK(BM_FolderOps<FolderOp::Add>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Add>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Add>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Write>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Write>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Write>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Read>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Read>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Read>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Size>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Size>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Size>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Destroy>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Destroy>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Destroy>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Clear>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Clear>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Clear>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Rescan>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Apply(SweepFolderOps<FolderOp::Rescan>)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderOps<FolderOp::Rescan>)
+    ->ArgNames({"object_size", "objects", "cold"})
+    ->Args({4 << 10, 10'000, 0})
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(16)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+
+/**
+ * How long clear() blocks on a folder of num_objects empty objects, deleting
+ * them right away or moving the folder into the trash for the reaper.
+ */
+template <bool kDeferred>
+static void BM_FolderClear(benchmark::State &state) {
+  auto const num_objects = static_cast<size_t>(state.range(0));
+  auto const root = std::filesystem::path{kBenchFolder};
+  CreateEmptyObjects(root, num_objects);
+  auto options = objectstore::StoredFolderOptions{};
+  options.deferred_deletion = kDeferred;
+  options.reaper.max_removals_per_second = 0;
+  auto folder = std::optional<objectstore::StoredFolder>{};
+  folder.emplace(std::pmr::get_default_resource(), root, options);
+
+  for (auto _ : state) {
+    folder->clear();
+  }
+
+  auto const start = std::chrono::steady_clock::now();
+  folder->wait_for_deletion();
+  state.counters["reap_ms"] =
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  folder.reset();
+  std::filesystem::remove_all(root);
+  std::filesystem::remove_all(objectstore::TrashPath(root));
+}
+BENCHMARK(BM_FolderClear<false>)
+    ->ArgNames({"objects"})
+    ->Arg(10'000)
+    ->Arg(100'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_FolderClear<true>)
+    ->ArgNames({"objects"})
+    ->Arg(10'000)
+    ->Arg(100'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+
+/**
+ * Latency of reading random 4 KB objects out of another folder while the
+ * reaper removes a cleared folder of 200K objects at the given rate (zero
+ * for no limit), or while nothing is reaped.
+ */
+static void BM_GetWhileReaping(benchmark::State &state) {
+  constexpr size_t kNumObjects = 10'000;
+  constexpr size_t kObjectSize = 4 << 10;
+  constexpr size_t kNumReaped = 200'000;
+  auto const reaping = state.range(0) != 0;
+  auto const foreground_root =
+      std::filesystem::path{std::string{kBenchFolder} + "_foreground"};
+  auto const reaped_root = std::filesystem::path{kBenchFolder};
+  std::filesystem::remove_all(foreground_root);
+  auto foreground = std::optional<objectstore::StoredFolder>{};
+  foreground.emplace(std::pmr::get_default_resource(), foreground_root);
+  auto const content = std::string(kObjectSize, 'x');
+  for (size_t i = 0; i < kNumObjects; ++i) {
+    auto const id = foreground->add();
+    foreground->get(id)->write(content.data(),
+                               static_cast<std::streamsize>(kObjectSize));
+    foreground->close(id);
+  }
+
+  auto reaped = std::optional<objectstore::StoredFolder>{};
+  if (reaping) {
+    CreateEmptyObjects(reaped_root, kNumReaped);
+    auto options = objectstore::StoredFolderOptions{};
+    options.deferred_deletion = true;
+    options.reaper.max_removals_per_second =
+        static_cast<size_t>(state.range(1));
+    reaped.emplace(std::pmr::get_default_resource(), reaped_root, options);
+    reaped->clear();
+  }
+
+  auto engine = std::mt19937_64{42};
+  auto distribution = std::uniform_int_distribution<size_t>(0, kNumObjects - 1);
+  auto buffer = std::string(kObjectSize, '\0');
+  auto latencies = common::Histogram{};
+  for (auto _ : state) {
+    auto const start = std::chrono::steady_clock::now();
+    auto const id = distribution(engine);
+    foreground->get(id)->read(buffer.data(),
+                              static_cast<std::streamsize>(kObjectSize));
+    foreground->close(id);
+    latencies.Record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count()));
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["p50_us"] =
+      static_cast<double>(latencies.ValueAtPercentile(50)) / 1e3;
+  state.counters["p99_us"] =
+      static_cast<double>(latencies.ValueAtPercentile(99)) / 1e3;
+  state.counters["p999_us"] =
+      static_cast<double>(latencies.ValueAtPercentile(99.9)) / 1e3;
+  if (reaping) {
+    // whether the reaper was busy for the whole measurement
+    state.counters["still_reaping"] = !std::filesystem::is_empty(
+        objectstore::TrashPath(reaped_root));
+  }
+  reaped.reset();
+  foreground.reset();
+  std::filesystem::remove_all(foreground_root);
+  std::filesystem::remove_all(reaped_root);
+  std::filesystem::remove_all(objectstore::TrashPath(reaped_root));
+}
+BENCHMARK(BM_GetWhileReaping)
+    ->ArgNames({"reaping", "rate"})
+    ->Args({0, 0})
+    ->Args({1, 0})
+    ->Args({1, 10'000})
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(200'000);
+
+/**
+ * Copies an object of the given size, either streamed through user space
+ * with get() or with clone(), which falls back to copy_file_range() on file
+ * systems without reflinks.
+ */
+enum class CopyMethod { Stream, Clone };
+
+template <CopyMethod kMethod>
+static void BM_CloneObject(benchmark::State &state) {
+  auto const object_size = static_cast<size_t>(state.range(0));
+  auto const root = std::filesystem::path{kBenchFolder};
+  std::filesystem::remove_all(root);
+  auto folder = std::optional<objectstore::StoredFolder>{};
+  folder.emplace(std::pmr::get_default_resource(), root);
+  auto buffer = std::string(1 << 20, 'x');
+  auto const id = folder->add();
+  auto *stream = folder->get(id);
+  for (size_t written = 0; written < object_size; written += buffer.size()) {
+    stream->write(buffer.data(), static_cast<std::streamsize>(std::min(
+                                     buffer.size(), object_size - written)));
+  }
+  folder->close(id);
+
+  for (auto _ : state) {
+    auto copy = objectstore::StoredFolder::object_id_t{};
+    if (kMethod == CopyMethod::Stream) {
+      copy = folder->add();
+      auto *in = folder->get(id);
+      auto *out = folder->get(copy);
+      in->seekg(0);
+      while (in->read(buffer.data(),
+                      static_cast<std::streamsize>(buffer.size())) ||
+             in->gcount() > 0) {
+        out->write(buffer.data(), in->gcount());
+      }
+      in->clear();
+      folder->close(copy);
+      folder->close(id);
+    } else {
+      auto [clone, ec] = folder->clone(id);
+      if (ec) {
+        state.SkipWithError(ec.message().c_str());
+        break;
+      }
+      copy = clone;
+    }
+    state.PauseTiming();
+    auto const copy_size = folder->size(copy).first;
+    folder->destroy(copy);
+    if (copy_size != object_size) {
+      state.SkipWithError("copy has the wrong size");
+      break;
+    }
+    state.ResumeTiming();
+  }
+
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * object_size));
+  folder.reset();
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(BM_CloneObject<CopyMethod::Stream>)
+    ->ArgNames({"object_size"})
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Arg(128 << 20)
+    ->Arg(1 << 30)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3)
+    ->UseRealTime();
+BENCHMARK(BM_CloneObject<CopyMethod::Clone>)
+    ->ArgNames({"object_size"})
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Arg(128 << 20)
+    ->Arg(1 << 30)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3)
+    ->UseRealTime();
+
+/**
+ * Reads every object of a folder, either with get() in the order of the
+ * folder's iterators, or with scan() in inode order and with the given number
+ * of objects read ahead.
+ */
+template <bool kScan> static void BM_ReadAllObjects(benchmark::State &state) {
+  auto const object_size = static_cast<size_t>(state.range(0));
+  auto const num_objects = static_cast<size_t>(state.range(1));
+  auto const cold = state.range(2) != 0;
+  auto const root = std::filesystem::path{kBenchFolder};
+  std::filesystem::remove_all(root);
+  auto folder = std::optional<objectstore::StoredFolder>{};
+  folder.emplace(std::pmr::get_default_resource(), root);
+  auto buffer = std::string(std::max<size_t>(object_size, 64 << 10), 'x');
+  for (size_t i = 0; i < num_objects; ++i) {
+    auto const id = folder->add();
+    folder->get(id)->write(buffer.data(),
+                           static_cast<std::streamsize>(object_size));
+    folder->close(id);
+  }
+  // the streams would serve the first reads from their buffers
+  folder.emplace(std::pmr::get_default_resource(), root);
+  auto scan_options = objectstore::ScanOptions{};
+  scan_options.prefetch = static_cast<size_t>(state.range(3));
+
+  uint64_t bytes = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    if (cold) {
+      DropFromCaches(root);
+    }
+    state.ResumeTiming();
+    if (kScan) {
+      auto [scanner, ec] = folder->scan(scan_options);
+      auto const chunk = std::as_writable_bytes(std::span{buffer});
+      while (scanner.next()) {
+        while (true) {
+          auto [data, read_ec] = scanner.read(chunk);
+          if (data.empty()) {
+            break;
+          }
+          bytes += data.size();
+        }
+      }
+    } else {
+      for (auto id : *folder) {
+        auto *stream = folder->get(id);
+        while (stream->read(buffer.data(),
+                            static_cast<std::streamsize>(buffer.size())) ||
+               stream->gcount() > 0) {
+          bytes += static_cast<uint64_t>(stream->gcount());
+        }
+        folder->close(id);
+      }
+    }
+  }
+
+  if (bytes != state.iterations() * num_objects * object_size) {
+    state.SkipWithError("objects were not read completely");
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects));
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  folder.reset();
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(BM_ReadAllObjects<false>)
+    ->ArgNames({"object_size", "objects", "cold", "prefetch"})
+    ->Args({4 << 10, 100'000, 0, 0})
+    ->Args({4 << 10, 100'000, 1, 0})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+BENCHMARK(BM_ReadAllObjects<true>)
+    ->ArgNames({"object_size", "objects", "cold", "prefetch"})
+    ->Args({4 << 10, 100'000, 0, 32})
+    ->Args({4 << 10, 100'000, 1, 0})
+    ->Args({4 << 10, 100'000, 1, 32})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+
+/**
+ * The cost of timing an operation and recording it, the overhead metrics add
+ * to every operation of a folder. Built with OBJECTSTORE_DISABLE_METRICS it
+ * measures an empty loop.
+ */
+static void BM_MetricsRecord(benchmark::State &state) {
+  // shared by the threads
+  static auto *metrics =
+      new objectstore::Metrics{std::pmr::get_default_resource()};
+  for (auto _ : state) {
+    auto timer = metrics->time(objectstore::MetricOperation::Get);
+    metrics->count(objectstore::MetricSyscall::Read);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_MetricsRecord)->Threads(1)->Threads(4);
+
+enum class IdIndex { Hash, Dense };
+enum class IdIndexOp { Has, Get, Iterate };
+
+/**
+ * Looking up objects by id in the index of a StoredFolder, the hash map it
+ * used to have against the DenseIdMap, with pointers as values like the
+ * folder. Has and Get look up random ids, a tenth of them destroyed, and Get
+ * also reads the value. Iterate visits all of them.
+ *
+ * Args: number of ids
+ */
+template <IdIndex kIndex, IdIndexOp kOp>
+static void BM_IdIndex(benchmark::State &state) {
+  auto const num_ids = static_cast<std::uint64_t>(state.range(0));
+  auto resource = std::pmr::get_default_resource();
+  using Value = common::UniquePtr<std::uint64_t>;
+  using Index =
+      std::conditional_t<kIndex == IdIndex::Hash,
+                         std::pmr::unordered_map<std::uint64_t, Value>,
+                         objectstore::DenseIdMap<Value>>;
+  auto index = Index{resource};
+  auto engine = std::mt19937_64{42};
+  for (std::uint64_t id = 0; id < num_ids; ++id) {
+    index.try_emplace(id, common::MakeUnique<std::uint64_t>(resource, id));
+  }
+  for (std::uint64_t i = 0; i < num_ids / 10; ++i) {
+    index.erase(engine() % num_ids);
+  }
+  auto ids = std::vector<std::uint64_t>(1 << 20);
+  for (auto &id : ids) {
+    id = engine() % num_ids;
+  }
+
+  std::size_t next = 0;
+  std::uint64_t sum = 0;
+  for (auto _ : state) {
+    if constexpr (kOp == IdIndexOp::Iterate) {
+      for (auto const &[id, value] : index) {
+        sum += *value;
+      }
+    } else {
+      auto const id = ids[next++ & (ids.size() - 1)];
+      if constexpr (kOp == IdIndexOp::Has) {
+        sum += index.contains(id);
+      } else if (auto it = index.find(id); it != index.end()) {
+        sum += *it->second;
+      }
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(static_cast<int64_t>(
+      state.iterations() *
+      (kOp == IdIndexOp::Iterate ? index.size() : std::size_t{1})));
+}
+BENCHMARK(BM_IdIndex<IdIndex::Hash, IdIndexOp::Has>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000);
+BENCHMARK(BM_IdIndex<IdIndex::Dense, IdIndexOp::Has>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000);
+BENCHMARK(BM_IdIndex<IdIndex::Hash, IdIndexOp::Get>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000);
+BENCHMARK(BM_IdIndex<IdIndex::Dense, IdIndexOp::Get>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000);
+BENCHMARK(BM_IdIndex<IdIndex::Hash, IdIndexOp::Iterate>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IdIndex<IdIndex::Dense, IdIndexOp::Iterate>)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * @return the resident set size of the process
+ */
+std::size_t ResidentBytes() {
+  std::size_t pages = 0;
+  std::size_t resident = 0;
+  std::ifstream{"/proc/self/statm"} >> pages >> resident;
+  return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * What a folder keeps in memory for objects that are not in use, as the
+ * growth of the resident set while num_objects objects are added. They are
+ * never written, so no file is created.
+ *
+ * Args: number of objects
+ */
+static void BM_FolderFootprint(benchmark::State &state) {
+  auto const num_objects = static_cast<std::size_t>(state.range(0));
+  for (auto _ : state) {
+    auto folder = BenchFolder{};
+    auto const before = ResidentBytes();
+    for (std::size_t i = 0; i < num_objects; ++i) {
+      folder->add();
+    }
+    auto const growth = static_cast<double>(ResidentBytes() - before);
+    state.counters["resident_MB"] = growth / (1 << 20);
+    state.counters["bytes_per_object"] =
+        growth / static_cast<double>(num_objects);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_objects));
+}
+BENCHMARK(BM_FolderFootprint)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+
+/**
+ * Threads writing objects of object_size bytes with Durability::Sync into a
+ * StripedFolder over num_roots directories, for the aggregate throughput.
+ * The directories should be on different drives, e.g. by pointing them to
+ * mount points with symbolic links.
+ *
+ * Args: number of roots, object size
+ */
+static void BM_StripedWrite(benchmark::State &state) {
+  static std::optional<objectstore::StripedFolder> folder;
+  auto const num_roots = static_cast<std::size_t>(state.range(0));
+  auto const object_size = static_cast<std::size_t>(state.range(1));
+  auto roots = std::vector<objectstore::StripeRoot>{};
+  for (std::size_t i = 0; i < num_roots; ++i) {
+    roots.push_back({std::string{kBenchFolder} + "_" + std::to_string(i)});
+  }
+  if (state.thread_index() == 0) {
+    for (auto const &root : roots) {
+      std::filesystem::remove_all(root.path);
+    }
+    auto options = objectstore::StripedFolderOptions{};
+    options.folder_options.add_all_existing_files = false;
+    // the streams are used by several threads
+    options.folder_options.max_open_files = 0;
+    options.folder_options.durability = objectstore::Durability::Sync;
+    folder.emplace(std::pmr::get_default_resource(), roots, options);
+  }
+  auto const data = std::vector<char>(object_size, 'x');
+
+  for (auto _ : state) {
+    auto const id = folder->add();
+    folder->get(id)->write(data.data(),
+                           static_cast<std::streamsize>(data.size()));
+    folder->close(id);
+  }
+
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * object_size));
+  if (state.thread_index() == 0) {
+    folder->clear();
+    folder.reset();
+    for (auto const &root : roots) {
+      std::filesystem::remove_all(root.path);
+    }
+  }
+}
+BENCHMARK(BM_StripedWrite)
+    ->ArgsProduct({{1, 2, 3, 4}, {64 << 10}})
+    ->Threads(4)
+    ->UseRealTime();
+
+/**
+ * Draws keys in [0, num_keys) with probability proportional to
+ * 1 / (rank + 1)^skew, key 0 being the most popular.
+ */
+class Zipfian {
+public:
+  Zipfian(std::size_t num_keys, double skew) : m_cdf(num_keys) {
+    auto sum = 0.0;
+    for (std::size_t i = 0; i < num_keys; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+      m_cdf[i] = sum;
+    }
+    for (auto &p : m_cdf) {
+      p /= sum;
+    }
+  }
+
+  template <typename Engine> std::size_t operator()(Engine &engine) {
+    auto const p = std::uniform_real_distribution<double>{}(engine);
+    auto it = std::lower_bound(m_cdf.begin(), m_cdf.end(), p);
+    return std::min(static_cast<std::size_t>(it - m_cdf.begin()),
+                    m_cdf.size() - 1);
+  }
+
+private:
+  std::vector<double> m_cdf;
+};
+
+/**
+ * A CacheFolder as a cache of remote blobs: keys are drawn from a Zipfian
+ * distribution, a cached blob is read with get(), and a missing one is
+ * "fetched" and written with add(). The blobs take data_percent of the disk
+ * budget in total, so that they fit at 80 and must be evicted at 120.
+ *
+ * Args: size of all blobs in percent of the budget
+ */
+static void BM_CacheFolderZipf(benchmark::State &state) {
+  constexpr std::size_t kNumKeys = 4096;
+  constexpr std::size_t kObjectSize = 16 << 10;
+  constexpr auto kNoObject = ~objectstore::CacheFolder::object_id_t{0};
+  auto options = objectstore::CacheFolderOptions{};
+  options.disk_budget = kNumKeys * kObjectSize * 100 /
+                        static_cast<std::uint64_t>(state.range(0));
+  options.folder_options.add_all_existing_files = false;
+  auto folder =
+      BenchCollection<objectstore::CacheFolder>{kBenchFolder, options};
+  auto objects = std::vector<objectstore::CacheFolder::object_id_t>(
+      kNumKeys, kNoObject);
+  auto buffer = std::string(kObjectSize, 'x');
+  auto engine = std::mt19937_64{42};
+  auto keys = Zipfian{kNumKeys, 0.99};
+  auto get_latencies = common::Histogram{};
+  auto add_latencies = common::Histogram{};
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+
+  auto const access = [&](bool record) {
+    auto &id = objects[keys(engine)];
+    auto const start = std::chrono::steady_clock::now();
+    auto const hit = id != kNoObject && folder->has(id);
+    if (hit) {
+      folder->get(id)->read(buffer.data(),
+                            static_cast<std::streamsize>(kObjectSize));
+      folder->close(id);
+    } else {
+      id = folder->add();
+      folder->get(id)->write(buffer.data(),
+                             static_cast<std::streamsize>(kObjectSize));
+      folder->close(id);
+    }
+    if (!record) {
+      return;
+    }
+    auto const latency = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    (hit ? get_latencies : add_latencies).Record(latency);
+    ++(hit ? hits : misses);
+  };
+  // fills the cache
+  for (std::size_t i = 0; i < 4 * kNumKeys; ++i) {
+    access(false);
+  }
+  folder->wait_for_eviction();
+
+  for (auto _ : state) {
+    access(true);
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["hit_ratio"] =
+      static_cast<double>(hits) / static_cast<double>(hits + misses);
+  state.counters["get_p50_us"] =
+      static_cast<double>(get_latencies.ValueAtPercentile(50)) / 1e3;
+  state.counters["get_p99_us"] =
+      static_cast<double>(get_latencies.ValueAtPercentile(99)) / 1e3;
+  state.counters["add_p50_us"] =
+      static_cast<double>(add_latencies.ValueAtPercentile(50)) / 1e3;
+  state.counters["add_p99_us"] =
+      static_cast<double>(add_latencies.ValueAtPercentile(99)) / 1e3;
+  state.counters["evicted"] = static_cast<double>(folder->num_evicted());
+}
+BENCHMARK(BM_CacheFolderZipf)
+    ->ArgName("data_percent")
+    ->Arg(80)
+    ->Arg(120)
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(100'000);
+
+std::string NameKey(std::size_t i) { return "blob/" + std::to_string(i); }
+
+/**
+ * Name indexes of num_keys keys, built once for all benchmarks that need
+ * them and removed at exit. A checkpointed one holds all keys in its
+ * checkpoint, the other one only in its log.
+ */
+std::filesystem::path NameIndexOf(std::size_t num_keys, bool checkpointed) {
+  struct Paths {
+    std::map<std::pair<std::size_t, bool>, std::filesystem::path> built;
+    ~Paths() {
+      for (auto const &[key, path] : built) {
+        std::filesystem::remove_all(path);
+      }
+    }
+  };
+  static Paths paths;
+  auto &path = paths.built[{num_keys, checkpointed}];
+  if (path.empty()) {
+    path = std::string{kBenchFolder} + "_names_" + std::to_string(num_keys) +
+           (checkpointed ? "_checkpoint" : "_log");
+    std::filesystem::remove_all(path);
+    auto options = objectstore::NameIndexOptions{};
+    options.checkpoint_on_close = checkpointed;
+    auto index = objectstore::NameIndex{std::pmr::get_default_resource(),
+                                        path, options};
+    for (std::size_t i = 0; i < num_keys; ++i) {
+      index.insert(NameKey(i), i);
+    }
+  }
+  return path;
+}
+
+/**
+ * Drops the files of the directory from the page cache, so that the next
+ * open reads them from disk.
+ */
+void EvictFromPageCache(std::filesystem::path const &path) {
+  for (auto const &entry : std::filesystem::directory_iterator{path}) {
+    int fd = ::open(entry.path().c_str(), O_RDONLY);
+    if (fd >= 0) {
+      ::fdatasync(fd);
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      ::close(fd);
+    }
+  }
+}
+
+/**
+ * Inserts num_keys keys into an empty name index that starts at the
+ * default capacity, for the latency of single inserts while the table grows
+ * many times.
+ *
+ * Args: number of keys
+ */
+static void BM_NameIndexInsert(benchmark::State &state) {
+  auto const num_keys = static_cast<std::size_t>(state.range(0));
+  auto const path = std::filesystem::path{kBenchFolder};
+  auto keys = std::vector<std::string>{};
+  keys.reserve(num_keys);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    keys.push_back(NameKey(i));
+  }
+  auto latencies = common::Histogram{};
+  for (auto _ : state) {
+    std::filesystem::remove_all(path);
+    auto options = objectstore::NameIndexOptions{};
+    options.checkpoint_on_close = false;
+    auto index = objectstore::NameIndex{std::pmr::get_default_resource(),
+                                        path, options};
+    for (std::size_t i = 0; i < num_keys; ++i) {
+      auto const start = std::chrono::steady_clock::now();
+      index.insert(keys[i], i);
+      latencies.Record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count()));
+    }
+  }
+  std::filesystem::remove_all(path);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_keys));
+  state.counters["p50_us"] =
+      static_cast<double>(latencies.ValueAtPercentile(50)) / 1e3;
+  state.counters["p99_us"] =
+      static_cast<double>(latencies.ValueAtPercentile(99)) / 1e3;
+  state.counters["max_us"] = static_cast<double>(latencies.Max()) / 1e3;
+}
+BENCHMARK(BM_NameIndexInsert)
+    ->Arg(1'000'000)
+    ->Arg(10'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1)
+    ->UseRealTime();
+
+/**
+ * Random lookups in a checkpointed name index of num_keys keys, of keys
+ * that are there, or not.
+ *
+ * Args: number of keys, whether the keys are there
+ */
+static void BM_NameIndexLookup(benchmark::State &state) {
+  auto const num_keys = static_cast<std::size_t>(state.range(0));
+  auto const hit = state.range(1) != 0;
+  auto const index = objectstore::NameIndex{
+      std::pmr::get_default_resource(), NameIndexOf(num_keys, true)};
+  auto engine = std::mt19937_64{42};
+  auto distribution = std::uniform_int_distribution<size_t>(0, num_keys - 1);
+  auto keys = std::vector<std::string>(1 << 20);
+  for (auto &key : keys) {
+    key = NameKey(distribution(engine) + (hit ? 0 : num_keys));
+  }
+  // maps the pages of the checkpoint in
+  for (std::size_t i = 0; i < num_keys; i += 64) {
+    benchmark::DoNotOptimize(index.find(NameKey(i)));
+  }
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.find(keys[i++ % keys.size()]));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_NameIndexLookup)
+    ->ArgNames({"keys", "hit"})
+    ->Args({10'000'000, 1})
+    ->Args({10'000'000, 0});
+
+/**
+ * Opens a name index of num_keys keys with the files not in the page cache,
+ * and looks up a key, either mapping the checkpoint or replaying the log.
+ *
+ * Args: number of keys, whether the keys are in a checkpoint
+ */
+static void BM_NameIndexOpen(benchmark::State &state) {
+  auto const num_keys = static_cast<std::size_t>(state.range(0));
+  auto const checkpointed = state.range(1) != 0;
+  auto const path = NameIndexOf(num_keys, checkpointed);
+  auto options = objectstore::NameIndexOptions{};
+  // leaves the log to replay for the next iteration
+  options.checkpoint_on_close = false;
+  for (auto _ : state) {
+    state.PauseTiming();
+    EvictFromPageCache(path);
+    state.ResumeTiming();
+    auto const index = objectstore::NameIndex{
+        std::pmr::get_default_resource(), path, options};
+    benchmark::DoNotOptimize(index.find(NameKey(num_keys / 2)));
+  }
+}
+BENCHMARK(BM_NameIndexOpen)
+    ->ArgNames({"keys", "checkpoint"})
+    ->Args({10'000'000, 1})
+    ->Args({10'000'000, 0})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -1,10 +1,33 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <unistd.h>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include <folder_manifest.hpp>
+#include <memory_collection.hpp>
 #include <objectstore.hpp>
 #include <scopeguard.hpp>
+#include <test_helpers.hpp>
 
 TEST(StoredFile, Basics) {
   auto resource = std::pmr::get_default_resource();
@@ -111,50 +134,910 @@ TEST(StoredFile, WriteRead) {
   }
 }
 
-TEST(StoredFolder, Basics) {
+TEST(StoredFile, Map) {
   auto resource = std::pmr::get_default_resource();
-  auto folder = objectstore::StoredFolder{resource, "objectstore_test_folder"};
+  auto file = objectstore::StoredFile{resource, "objectstore_test_map.dat"};
+  file.destroy();
+  auto _ = common::MakeScopeGuard([&file] {
+    file.destroy();
+    EXPECT_FALSE(file.exists());
+  });
+
+  {
+    auto [mapped, ec] = file.map();
+    EXPECT_TRUE(ec);
+    EXPECT_TRUE(mapped.empty());
+  }
+
+  file.open();
+  {
+    auto [mapped, ec] = file.map();
+    EXPECT_FALSE(ec);
+    EXPECT_TRUE(mapped.empty());
+  }
+
+  std::string const data = "Mapped data without copies";
+  {
+    auto stream = file.stream();
+    // not flushed on purpose, map() has to take care of it
+    stream->write(data.data(), data.size());
+  }
+
+  auto [mapped, ec] = file.map();
+  ASSERT_FALSE(ec);
+  ASSERT_EQ(mapped.size(), data.size());
+  EXPECT_EQ(std::string_view(reinterpret_cast<char const *>(
+                                 mapped.data().data()),
+                             mapped.size()),
+            data);
+  EXPECT_FALSE(mapped.advise(objectstore::AccessAdvice::Random));
+
+  auto moved = std::move(mapped);
+  EXPECT_TRUE(mapped.empty());
+  EXPECT_EQ(moved.size(), data.size());
+}
+
+TEST(StoredFolder, Map) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_folder_map"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_folder_map");
+  });
+
+  auto id = folder.add();
+  std::string const data = "Data for a mapped object";
+  {
+    auto stream = folder.get(id);
+    stream->write(data.data(), data.size());
+    stream->flush();
+  }
+
+  {
+    auto [mapped, ec] = folder.map(id);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(mapped.size(), data.size());
+    EXPECT_EQ(std::memcmp(mapped.data().data(), data.data(), data.size()), 0);
+  }
+
+  {
+    auto [mapped, ec] = folder.map(id + 1);
+    EXPECT_EQ(ec, std::errc::no_such_file_or_directory);
+    EXPECT_TRUE(mapped.empty());
+  }
+}
+
+TEST(StoredFolder, Reopen) {
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_reopen"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+
+  std::string const data = "Data that survives a restart";
+  objectstore::StoredFolder::object_id_t written_id{};
+  objectstore::StoredFolder::object_id_t destroyed_id{};
+  {
+    auto folder = objectstore::StoredFolder{resource, path};
+    written_id = folder.add();
+    destroyed_id = folder.add();
+    folder.get(written_id)->write(data.data(), data.size());
+    folder.close(written_id);
+    folder.get(destroyed_id);
+    folder.destroy(destroyed_id);
+    EXPECT_FALSE(folder.checkpoint());
+  }
+  auto has_valid_manifest = [&] {
+    return !objectstore::LoadManifest(resource, path, 0).second;
+  };
+  EXPECT_TRUE(has_valid_manifest());
+  // neither names an object
+  std::ofstream{path / "notes.txt"};
+  std::ofstream{path / "007"};
+
+  for (int round = 0; round < 2; ++round) {
+    // the first round scans the directory, the second uses the manifest
+    EXPECT_EQ(round == 1, has_valid_manifest());
+    auto folder = objectstore::StoredFolder{resource, path};
+    EXPECT_EQ(std::distance(folder.begin(), folder.end()), 1);
+    ASSERT_TRUE(folder.has(written_id));
+    EXPECT_FALSE(folder.has(destroyed_id));
+    EXPECT_EQ(folder.size(written_id).first, data.size());
+    folder.close(written_id);
+    EXPECT_FALSE(folder.checkpoint());
+  }
+
+  {
+    auto folder = objectstore::StoredFolder{resource, path};
+    auto id = folder.add();
+    EXPECT_GT(id, written_id);
+    // the manifest is invalid as soon as the content changes
+    EXPECT_FALSE(has_valid_manifest());
+    folder.get(id);
+    folder.close(id);
+  }
+
+  auto folder = objectstore::StoredFolder{resource, path};
+  EXPECT_EQ(std::distance(folder.begin(), folder.end()), 2);
+}
+
+TEST(StoredFolder, ManifestOnClose) {
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_on_close"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+  auto has_valid_manifest = [&] {
+    return !objectstore::LoadManifest(resource, path, 0).second;
+  };
+  auto add_object = [](objectstore::StoredFolder &&folder) {
+    auto id = folder.add();
+    *folder.get(id) << "object " << id;
+    folder.close(id);
+    // past the coarse clock tick of the change
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  };
+
+  add_object(objectstore::StoredFolder{resource, path});
+  EXPECT_FALSE(std::filesystem::exists(path / ".manifest"));
+
+  auto options = objectstore::StoredFolderOptions{};
+  options.manifest_on_close = true;
+  add_object(objectstore::StoredFolder{resource, path, options});
+  EXPECT_TRUE(has_valid_manifest());
+
+  // nothing changed, nothing to write
+  auto const written = std::filesystem::last_write_time(path / ".manifest");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  {
+    auto folder = objectstore::StoredFolder{resource, path, options};
+    EXPECT_EQ(std::distance(folder.begin(), folder.end()), 2);
+  }
+  EXPECT_EQ(std::filesystem::last_write_time(path / ".manifest"), written);
+
+  // the existing manifest is rewritten in place
+  add_object(objectstore::StoredFolder{resource, path, options});
+  EXPECT_TRUE(has_valid_manifest());
+  auto folder = objectstore::StoredFolder{resource, path};
+  EXPECT_EQ(std::distance(folder.begin(), folder.end()), 3);
+}
+
+TEST(StoredFolder, OpenFileLimit) {
+  constexpr size_t kMaxOpenFiles = 4;
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.max_open_files = kMaxOpenFiles;
+  auto folder = objectstore::StoredFolder{
+      resource, "objectstore_test_folder_open_files", options};
   auto _ = common::MakeScopeGuard([&folder] {
     folder.clear();
-    auto path = folder.path();
-    EXPECT_TRUE(std::filesystem::exists(path));
+    EXPECT_EQ(folder.num_open_files(), 0u);
+    std::filesystem::remove_all("objectstore_test_folder_open_files");
+  });
+
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (size_t i = 0; i < 3 * kMaxOpenFiles; ++i) {
+    auto id = folder.add();
+    auto const data = std::to_string(id);
+    folder.get(id)->write(data.data(), data.size());
+    folder.close(id);
+    ids.push_back(id);
+    EXPECT_LE(folder.num_open_files(), kMaxOpenFiles);
+  }
+
+  auto read_all = [&folder](objectstore::StoredFolder::object_id_t id) {
+    auto *stream = folder.get(id);
+    return std::string{std::istreambuf_iterator<char>{*stream}, {}};
+  };
+
+  // idle files are reused, and rewound even after reading up to the end
+  auto const last = ids.back();
+  EXPECT_EQ(read_all(last), std::to_string(last));
+  EXPECT_EQ(read_all(last), std::to_string(last));
+  folder.close(last);
+
+  // files in use are only closed once there are no idle ones left
+  auto *in_use = folder.get(ids[0]);
+  for (size_t i = 1; i < kMaxOpenFiles; ++i) {
+    folder.get(ids[i]);
+  }
+  EXPECT_EQ(folder.num_open_files(), kMaxOpenFiles);
+  EXPECT_TRUE(in_use->good());
+  folder.get(ids[kMaxOpenFiles]);
+  EXPECT_EQ(folder.num_open_files(), kMaxOpenFiles);
+  in_use->write("x", 1);
+  EXPECT_FALSE(in_use->good());
+
+  for (auto id : ids) {
+    EXPECT_EQ(read_all(id), std::to_string(id));
+    folder.close(id);
+  }
+}
+
+TEST(StoredFolder, FanoutMigration) {
+  constexpr size_t kNumObjects = 50;
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_fanout"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+
+  auto open_folder = [&](unsigned fanout_levels) {
+    auto options = objectstore::StoredFolderOptions{};
+    options.fanout_levels = fanout_levels;
+    return std::make_unique<objectstore::StoredFolder>(resource, path,
+                                                       options);
+  };
+  auto count_files_in_root = [&path] {
     size_t num_files = 0;
-    for (auto const &dir_iter : std::filesystem::directory_iterator(path)) {
-      ++num_files;
+    for (auto const &entry : std::filesystem::directory_iterator(path)) {
+      num_files += entry.is_regular_file() &&
+                   entry.path().filename().string()[0] != '.';
+    }
+    return num_files;
+  };
+  auto expect_all_objects = [&](objectstore::StoredFolder *folder) {
+    EXPECT_EQ(std::distance(folder->begin(), folder->end()), kNumObjects);
+    for (size_t id = 0; id < kNumObjects; ++id) {
+      ASSERT_TRUE(folder->has(id));
+      auto *stream = folder->get(id);
+      EXPECT_EQ(std::string(std::istreambuf_iterator<char>{*stream}, {}),
+                std::to_string(id));
+      folder->close(id);
+    }
+  };
+
+  {
+    auto folder = open_folder(0);
+    for (size_t i = 0; i < kNumObjects; ++i) {
+      auto id = folder->add();
+      *folder->get(id) << id;
+      folder->close(id);
     }
-    EXPECT_EQ(num_files, 0);
-    std::filesystem::remove_all("objectstore_test_folder");
+  }
+  EXPECT_EQ(count_files_in_root(), kNumObjects);
+
+  {
+    auto folder = open_folder(2);
+    EXPECT_EQ(count_files_in_root(), 0u);
+    expect_all_objects(folder.get());
+    auto id = folder->add();
+    EXPECT_EQ(folder->path(id).parent_path().parent_path().parent_path(),
+              path);
+    folder->destroy(id);
+    EXPECT_FALSE(folder->checkpoint());
+  }
+  // from the manifest
+  expect_all_objects(open_folder(2).get());
+
+  // and back to a flat folder
+  expect_all_objects(open_folder(0).get());
+  EXPECT_EQ(count_files_in_root(), kNumObjects);
+}
+
+TEST(StoredFolder, FanoutMigrationFailure) {
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_fanout"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+
+  auto options = objectstore::StoredFolderOptions{};
+  auto id = objectstore::StoredFolder::object_id_t{};
+  {
+    auto folder = objectstore::StoredFolder{resource, path, options};
+    id = folder.add();
+    *folder.get(id) << "moved";
+    folder.close(id);
+  }
+
+  // a directory where the object belongs, which rename() cannot replace
+  options.fanout_levels = 1;
+  auto const blocker = objectstore::ObjectPath(path, id, options.fanout_levels);
+  std::filesystem::create_directories(blocker / "taken");
+  EXPECT_THROW((objectstore::StoredFolder{resource, path, options}),
+               std::filesystem::filesystem_error);
+
+  std::filesystem::remove_all(blocker);
+  auto folder = objectstore::StoredFolder{resource, path, options};
+  ASSERT_TRUE(folder.has(id));
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>{*folder.get(id)}, {}),
+            "moved");
+}
+
+TEST(StoredFolder, FanoutDirectoryFailure) {
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_fanout"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = 1;
+  auto folder = objectstore::StoredFolder{resource, path, options};
+
+  // a file where the directory of the next object belongs
+  auto const blocker = objectstore::ObjectPath(path, 0, options.fanout_levels)
+                           .parent_path();
+  std::ofstream{blocker};
+  EXPECT_THROW(folder.add(), std::filesystem::filesystem_error);
+  EXPECT_FALSE(folder.has(0));
+
+  std::filesystem::remove(blocker);
+  auto id = folder.add();
+  EXPECT_TRUE(folder.get(id));
+  folder.close(id);
+}
+
+TEST(StoredFolder, PositionalIO) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_folder_positional"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_folder_positional");
+  });
+
+  auto id = folder.add();
+  auto const data = std::string{"0123456789"};
+  auto [written, ec] = folder.write_at(id, 0, std::as_bytes(std::span{data}));
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(written, data.size());
+  folder.write_at(id, 4, std::as_bytes(std::span{"ab", 2}));
+
+  // the stream of the object is left alone
+  auto *stream = folder.get(id);
+  stream->seekg(2);
+  auto buffer = std::string(4, '\0');
+  auto [read, read_ec] =
+      folder.read_at(id, 3, std::as_writable_bytes(std::span{buffer}));
+  EXPECT_FALSE(read_ec);
+  EXPECT_EQ(buffer.substr(0, read), "3ab6");
+  EXPECT_EQ(stream->tellg(), 2);
+  folder.close(id);
+
+  // short at the end of the object
+  EXPECT_EQ(
+      folder.read_at(id, 8, std::as_writable_bytes(std::span{buffer})).first,
+      2u);
+  EXPECT_EQ(
+      folder.read_at(id + 1, 0, std::as_writable_bytes(std::span{buffer}))
+          .second,
+      std::errc::no_such_file_or_directory);
+}
+
+TEST(StoredFolder, PositionalIOSharesOpenFileLimit) {
+  constexpr size_t kMaxOpenFiles = 4;
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.max_open_files = kMaxOpenFiles;
+  auto const path =
+      std::filesystem::path{"objectstore_test_folder_positional_limit"};
+  auto folder = objectstore::StoredFolder{resource, path, options};
+  auto _ = common::MakeScopeGuard([&folder, &path] {
+    folder.clear();
+    std::filesystem::remove_all(path);
   });
 
-  auto id1 = folder.add();
-  auto id2 = folder.add();
+  // reading an object that was never written does not create it
+  auto const unwritten = folder.add();
+  auto buffer = std::string(2, '\0');
+  EXPECT_EQ(
+      folder.read_at(unwritten, 0, std::as_writable_bytes(std::span{buffer})),
+      std::make_pair(size_t{0}, std::error_code{}));
+  EXPECT_FALSE(std::filesystem::exists(folder.path(unwritten)));
+  EXPECT_EQ(folder.num_open_files(), 0u);
+
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (size_t i = 0; i < 3 * kMaxOpenFiles; ++i) {
+    auto const id = folder.add();
+    auto const data = std::to_string(id % 10) + "x";
+    folder.write_at(id, 0, std::as_bytes(std::span{data}));
+    ids.push_back(id);
+    EXPECT_LE(folder.num_open_files(), kMaxOpenFiles);
+  }
+  for (auto id : ids) {
+    EXPECT_EQ(
+        folder.read_at(id, 0, std::as_writable_bytes(std::span{buffer}))
+            .first,
+        2u);
+    EXPECT_EQ(buffer, std::to_string(id % 10) + "x");
+    EXPECT_LE(folder.num_open_files(), kMaxOpenFiles);
+  }
+  EXPECT_EQ(folder.num_open_files(), kMaxOpenFiles);
+
+  // a stream in use is not taken for idle by reading positionally
+  auto *in_use = folder.get(ids[0]);
+  folder.read_at(ids[0], 0, std::as_writable_bytes(std::span{buffer}));
+  for (size_t i = 1; i < kMaxOpenFiles; ++i) {
+    folder.read_at(ids[i], 0, std::as_writable_bytes(std::span{buffer}));
+  }
+  EXPECT_TRUE(in_use->good());
+  folder.close(ids[0]);
+}
+
+TEST(StoredFolder, ChunkedReaderWriter) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_folder_chunked"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_folder_chunked");
+  });
+
+  auto content = std::string{};
+  for (int i = 0; i < 10'000; ++i) {
+    content += std::to_string(i);
+  }
+  auto id = folder.add();
+  {
+    auto [writer, ec] = folder.writer(id);
+    ASSERT_FALSE(ec);
+    auto bytes = std::as_bytes(std::span{content});
+    for (std::size_t i = 0; i < bytes.size(); i += 1000) {
+      EXPECT_FALSE(writer.write(
+          bytes.subspan(i, std::min<std::size_t>(1000, bytes.size() - i))));
+    }
+    EXPECT_FALSE(writer.sync());
+    EXPECT_EQ(writer.position(), content.size());
+  }
+  EXPECT_EQ(folder.size(id).first, content.size());
+
+  auto read_all = [&folder, id](std::uint64_t offset, std::uint64_t length) {
+    auto [reader, ec] = folder.reader(id, offset, length);
+    EXPECT_FALSE(ec);
+    auto result = std::string{};
+    auto buffer = std::vector<std::byte>(777);
+    while (true) {
+      auto [chunk, chunk_ec] = reader.next(buffer);
+      EXPECT_FALSE(chunk_ec);
+      if (chunk.empty()) {
+        return result;
+      }
+      result.append(reinterpret_cast<char const *>(chunk.data()),
+                    chunk.size());
+    }
+  };
+  EXPECT_EQ(read_all(0, UINT64_MAX), content);
+  EXPECT_EQ(read_all(1234, 5000), content.substr(1234, 5000));
+  EXPECT_EQ(read_all(content.size() - 10, 100),
+            content.substr(content.size() - 10));
+  EXPECT_EQ(read_all(content.size() + 10, 100), "");
+
+  // writing at an offset replaces the rest of the object
+  {
+    auto [writer, ec] = folder.writer(id, 10);
+    writer.write(std::as_bytes(std::span{"end", 3}));
+  }
+  EXPECT_EQ(read_all(0, UINT64_MAX), content.substr(0, 10) + "end");
+
+  // never written objects are empty
+  auto empty = folder.add();
+  auto [reader, ec] = folder.reader(empty);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(reader.remaining(), 0u);
+}
+
+TEST(StoredFolder, CloneAndExport) {
+  auto resource = std::pmr::get_default_resource();
+  auto folder =
+      objectstore::StoredFolder{resource, "objectstore_test_folder_clone"};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_folder_clone");
+    std::filesystem::remove("objectstore_test_folder_clone.out");
+  });
+
+  auto content = std::string{};
+  for (int i = 0; i < 100'000; ++i) {
+    content += std::to_string(i);
+  }
+  auto id = folder.add();
+  // still buffered in the stream
+  *folder.get(id) << content;
+  auto [copy, ec] = folder.clone(id);
+  ASSERT_FALSE(ec);
+  EXPECT_NE(copy, id);
+  folder.close(id);
+
+  // the copy is independent of the original
+  folder.write_at(copy, 0, std::as_bytes(std::span{"x", 1}));
+  auto buffer = std::string(content.size(), '\0');
+  EXPECT_EQ(
+      folder.read_at(id, 0, std::as_writable_bytes(std::span{buffer})).first,
+      content.size());
+  EXPECT_EQ(buffer, content);
+  folder.read_at(copy, 0, std::as_writable_bytes(std::span{buffer}));
+  EXPECT_EQ(buffer, "x" + content.substr(1));
+
+  auto [empty_copy, empty_ec] = folder.clone(folder.add());
+  EXPECT_FALSE(empty_ec);
+  EXPECT_TRUE(folder.has(empty_copy));
+  EXPECT_FALSE(std::filesystem::exists(folder.path(empty_copy)));
+  EXPECT_EQ(folder.clone(empty_copy + 1).second,
+            std::errc::no_such_file_or_directory);
+
+  // into a file, appended to what is there
+  std::ofstream{"objectstore_test_folder_clone.out"} << "head";
+  int fd = ::open("objectstore_test_folder_clone.out", O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  auto [sent, send_ec] = folder.export_to(id, fd, 10, 1000);
+  ::close(fd);
+  EXPECT_FALSE(send_ec);
+  EXPECT_EQ(sent, 1000u);
+  auto file = std::ifstream{"objectstore_test_folder_clone.out"};
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>{file}, {}),
+            "head" + content.substr(10, 1000));
+
+  // and into a pipe, up to the end of the object
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  std::tie(sent, send_ec) = folder.export_to(id, fds[1], content.size() - 100);
+  ::close(fds[1]);
+  EXPECT_FALSE(send_ec);
+  EXPECT_EQ(sent, 100u);
+  auto piped = std::string(200, '\0');
+  auto res = ::read(fds[0], piped.data(), piped.size());
+  ::close(fds[0]);
+  EXPECT_EQ(piped.substr(0, static_cast<std::size_t>(res)),
+            content.substr(content.size() - 100));
+}
+
+TEST(StoredFolder, ScanInInodeOrder) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = 1;
+  auto folder = objectstore::StoredFolder{
+      resource, "objectstore_test_folder_scan", options};
+  auto _ = common::MakeScopeGuard([&folder] {
+    folder.clear();
+    std::filesystem::remove_all("objectstore_test_folder_scan");
+  });
+
+  auto expected = std::map<objectstore::StoredFolder::object_id_t,
+                           std::string>{};
+  for (int i = 0; i < 100; ++i) {
+    auto id = folder.add();
+    expected[id] = "object " + std::to_string(id);
+    *folder.get(id) << expected[id];
+    folder.close(id);
+  }
+  expected[folder.add()] = "";
+
+  auto scan_options = objectstore::ScanOptions{};
+  scan_options.prefetch = 4;
+  auto [scanner, ec] = folder.scan(scan_options);
+  ASSERT_FALSE(ec);
+  EXPECT_EQ(scanner.size(), expected.size());
+  auto scanned = std::map<objectstore::StoredFolder::object_id_t,
+                          std::string>{};
+  auto inodes = std::vector<ino_t>{};
+  // smaller than the objects, so that they come in several chunks
+  auto buffer = std::vector<std::byte>(3);
+  while (scanner.next()) {
+    auto &content = scanned[scanner.id()];
+    while (true) {
+      auto [chunk, chunk_ec] = scanner.read(buffer);
+      EXPECT_FALSE(chunk_ec);
+      if (chunk.empty()) {
+        break;
+      }
+      content.append(reinterpret_cast<char const *>(chunk.data()),
+                     chunk.size());
+    }
+    struct stat st {};
+    if (::stat(folder.path(scanner.id()).c_str(), &st) == 0) {
+      inodes.push_back(st.st_ino);
+    }
+  }
+  EXPECT_FALSE(scanner.next());
+  EXPECT_EQ(scanned, expected);
+  EXPECT_EQ(inodes.size(), 100u);
+  EXPECT_TRUE(std::is_sorted(inodes.begin(), inodes.end()));
+}
+
+namespace {
+
+/**
+ * Counts the bytes currently allocated through it.
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t allocated() const { return m_allocated; }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    m_allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    m_allocated -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+
+  std::size_t m_allocated = 0;
+};
+
+} // namespace
+
+TEST(StoredFolder, UnusedObjectsAreCompact) {
+  constexpr std::size_t kNumObjects = 100'000;
+  auto resource = CountingResource{};
+  auto const path = std::filesystem::path{"objectstore_test_folder_compact"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+  auto folder = objectstore::StoredFolder{&resource, path, false};
+  auto const first = folder.add();
+  auto const before = resource.allocated();
+  for (std::size_t i = 1; i < kNumObjects; ++i) {
+    folder.add();
+  }
+  // neither a path nor a stream for objects that were never opened
+  EXPECT_LT((resource.allocated() - before) / kNumObjects, 24u);
+
+  *folder.get(first) << "in use";
+  folder.close(first);
+  EXPECT_EQ(folder.size(first).first, 6u);
+  EXPECT_EQ(folder.path(first), path / std::to_string(first));
+  auto buffer = std::string(3, '\0');
+  EXPECT_EQ(folder.read_at(first, 3, std::as_writable_bytes(
+                                         std::span{buffer.data(), 3}))
+                .first,
+            3u);
+  EXPECT_EQ(buffer, "use");
+  folder.destroy(first);
+  EXPECT_FALSE(std::filesystem::exists(path / std::to_string(first)));
+  folder.clear();
+}
+
+TEST(StoredFolder, AddWithId) {
+  auto resource = std::pmr::get_default_resource();
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = 2;
+  auto const path = std::filesystem::path{"objectstore_test_folder_add_id"};
+  auto folder = objectstore::StoredFolder{resource, path, options};
+  auto _ = common::MakeScopeGuard([&] {
+    folder.clear();
+    std::filesystem::remove_all(path);
+  });
+
+  EXPECT_TRUE(folder.add(41));
+  EXPECT_FALSE(folder.add(41));
+  *folder.get(41) << "placed";
+  folder.close(41);
+  EXPECT_EQ(folder.size(41).first, 6u);
+  EXPECT_TRUE(std::filesystem::exists(folder.path(41)));
+  EXPECT_EQ(folder.add(), 42u);
+}
+
+TEST(StoredFolder, RecycleIds) {
+  auto resource = std::pmr::get_default_resource();
+  auto const path = std::filesystem::path{"objectstore_test_folder_recycle"};
+  auto _ =
+      common::MakeScopeGuard([&path] { std::filesystem::remove_all(path); });
+  auto options = objectstore::StoredFolderOptions{};
+  options.recycle_ids = true;
+
+  {
+    auto folder = objectstore::StoredFolder{resource, path, options};
+    for (objectstore::StoredFolder::object_id_t id = 0; id < 6; ++id) {
+      EXPECT_EQ(folder.add(), id);
+      *folder.get(id) << "object " << id;
+      folder.close(id);
+    }
+    folder.destroy(4);
+    folder.destroy(1);
+    // the lowest first
+    EXPECT_EQ(folder.add(), 1u);
+    EXPECT_FALSE(folder.get(1)->fail());
+    EXPECT_EQ(folder.size(1).first, 0u);
+    folder.close(1);
+    folder.destroy(2);
+    EXPECT_FALSE(folder.checkpoint());
+  }
+
+  for (int round = 0; round < 2; ++round) {
+    // the free ids are the holes in the manifest, or in the directory
+    // without it
+    if (round == 1) {
+      std::filesystem::remove(path / ".manifest");
+    }
+    auto folder = objectstore::StoredFolder{resource, path, options};
+    EXPECT_EQ(folder.add(), 2u);
+    EXPECT_EQ(folder.add(), 4u);
+    EXPECT_EQ(folder.add(), 6u);
+    for (auto id : {2, 4, 6}) {
+      folder.get(id);
+      folder.close(id);
+      folder.destroy(id);
+    }
+  }
+
+  auto folder = objectstore::StoredFolder{resource, path, options};
+  auto ids = std::vector<objectstore::StoredFolder::object_id_t>{};
+  for (auto id : folder) {
+    ids.push_back(id);
+  }
+  EXPECT_EQ(ids, (std::vector<objectstore::StoredFolder::object_id_t>{
+                     0, 1, 3, 5}));
+  folder.clear();
+  EXPECT_EQ(folder.add(), 0u);
+}
+
+namespace {
+
+using objectstore::test::ReadAll;
+using objectstore::test::ReadAndClose;
+using objectstore::test::Write;
+
+/**
+ * A MemoryCollection that spills every object as soon as it is closed.
+ */
+class SpillingMemoryCollection : public objectstore::MemoryCollection {
+public:
+  SpillingMemoryCollection(std::pmr::memory_resource *resource,
+                           std::filesystem::path path)
+      : MemoryCollection{resource, std::move(path), SpillingOptions()} {}
+
+private:
+  static objectstore::MemoryCollectionOptions SpillingOptions() {
+    auto options = objectstore::MemoryCollectionOptions{};
+    options.memory_budget = 0;
+    return options;
+  }
+};
+
+template <typename Collection>
+class StoredObjectCollectionTest : public testing::Test {
+protected:
+  static constexpr auto kPath = "objectstore_test_collection";
+
+  StoredObjectCollectionTest() {
+    std::filesystem::remove_all(kPath);
+    m_collection.emplace(std::pmr::get_default_resource(), kPath);
+  }
+
+  ~StoredObjectCollectionTest() override {
+    m_collection.reset();
+    std::filesystem::remove_all(kPath);
+  }
+
+  Collection &collection() { return *m_collection; }
+
+  /// Destroys the collection and opens a new one on the same path.
+  void reopen() {
+    m_collection.reset();
+    m_collection.emplace(std::pmr::get_default_resource(), kPath);
+  }
+
+  /// Whether the objects survive a reopen().
+  static constexpr bool kPersistent =
+      std::is_same_v<Collection, objectstore::StoredFolder>;
+
+private:
+  std::optional<Collection> m_collection;
+};
+
+using CollectionTypes =
+    testing::Types<objectstore::StoredFolder, objectstore::MemoryCollection,
+                   SpillingMemoryCollection>;
+TYPED_TEST_SUITE(StoredObjectCollectionTest, CollectionTypes);
+
+} // namespace
+
+TYPED_TEST(StoredObjectCollectionTest, Basics) {
+  auto &collection = this->collection();
+  auto _ = common::MakeScopeGuard([&collection] {
+    collection.clear();
+    // no object is left on disk, if anything was spilled at all
+    auto path = collection.path();
+    if (!path.empty()) {
+      EXPECT_TRUE(std::filesystem::exists(path));
+      size_t num_files = 0;
+      for (auto const &entry :
+           std::filesystem::recursive_directory_iterator(path)) {
+        num_files += entry.is_regular_file();
+      }
+      EXPECT_EQ(num_files, 0u);
+    }
+  });
+
+  auto id1 = collection.add();
+  auto id2 = collection.add();
 
   std::string const data_file_1 = "Data for file 1";
   std::string const data_file_2 = "Data for file 2, which contains more words";
 
   {
-    auto stream1 = folder.get(id1);
+    auto stream1 = collection.get(id1);
     stream1->write(data_file_1.data(), data_file_1.size());
     stream1->flush();
+    collection.close(id1);
   }
 
   {
-    auto stream2 = folder.get(id2);
+    auto stream2 = collection.get(id2);
     stream2->write(data_file_2.data(), data_file_2.size());
     stream2->flush();
+    collection.close(id2);
   }
 
   {
-    auto stream1 = folder.get(id1);
-    std::string data1(folder.size(id1).first, '\0');
+    auto stream1 = collection.get(id1);
+    std::string data1(collection.size(id1).first, '\0');
     stream1->read(data1.data(), data1.size());
     EXPECT_EQ(data1, data_file_1);
+    collection.close(id1);
   }
 
   {
-    auto stream2 = folder.get(id2);
-    std::string data2(folder.size(id2).first, '\0');
+    auto stream2 = collection.get(id2);
+    std::string data2(collection.size(id2).first, '\0');
     stream2->read(data2.data(), data2.size());
     EXPECT_EQ(data2, data_file_2);
+    collection.close(id2);
+  }
+}
+
+TYPED_TEST(StoredObjectCollectionTest, WriteRead) {
+  auto id1 = this->collection().add();
+  auto id2 = this->collection().add();
+  EXPECT_NE(id1, id2);
+  EXPECT_TRUE(this->collection().has(id1));
+
+  std::string const data_file_1 = "Data for file 1";
+  std::string const data_file_2 = "Data for file 2, which contains more words";
+  Write(&this->collection(), id1, data_file_1);
+  Write(&this->collection(), id2, data_file_2);
+
+  EXPECT_EQ(ReadAll(&this->collection(), id1), data_file_1);
+  this->collection().close(id1);
+  EXPECT_EQ(ReadAll(&this->collection(), id2), data_file_2);
+  this->collection().close(id2);
+
+  // every get() starts at the beginning again
+  EXPECT_EQ(ReadAll(&this->collection(), id1), data_file_1);
+  EXPECT_EQ(ReadAll(&this->collection(), id1), data_file_1);
+  this->collection().close(id1);
+
+  auto const &constant = std::as_const(this->collection());
+  auto const &stream = constant.get(id2);
+  EXPECT_EQ(stream.rdbuf()->sgetc(), 'D');
+}
+
+TYPED_TEST(StoredObjectCollectionTest, DestroyAndClear) {
+  auto id1 = this->collection().add();
+  auto id2 = this->collection().add();
+  Write(&this->collection(), id1, "first");
+  Write(&this->collection(), id2, "second");
+
+  this->collection().destroy(id1);
+  EXPECT_FALSE(this->collection().has(id1));
+  EXPECT_EQ(this->collection().get(id1), nullptr);
+  EXPECT_EQ(this->collection().size(id1).second,
+            std::errc::no_such_file_or_directory);
+  EXPECT_EQ(ReadAll(&this->collection(), id2), "second");
+  this->collection().close(id2);
+
+  this->collection().clear();
+  EXPECT_FALSE(this->collection().has(id2));
+  EXPECT_GT(this->collection().add(), id2);
+}
+
+TYPED_TEST(StoredObjectCollectionTest, Reopen) {
+  std::string const data = "Data that survives a restart";
+  auto written_id = this->collection().add();
+  auto destroyed_id = this->collection().add();
+  Write(&this->collection(), written_id, data);
+  Write(&this->collection(), destroyed_id, "gone");
+  this->collection().destroy(destroyed_id);
+
+  this->reopen();
+  EXPECT_EQ(this->collection().has(written_id), TestFixture::kPersistent);
+  EXPECT_FALSE(this->collection().has(destroyed_id));
+  if (TestFixture::kPersistent) {
+    EXPECT_EQ(this->collection().size(written_id).first, data.size());
+    EXPECT_EQ(ReadAndClose(&this->collection(), written_id), data);
+    // an id handed out before is not handed out again
+    EXPECT_GT(this->collection().add(), written_id);
   }
 }
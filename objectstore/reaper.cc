@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <utility>
+
+#include "reaper.hpp"
+
+namespace objectstore {
+
+namespace {
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+/// How far the reaper may get ahead of its rate before it sleeps, so that it
+/// does not sleep for every single removal.
+constexpr auto kMaxAhead = std::chrono::milliseconds{1};
+/// Bounds of the delay before the reaper tries again what it failed to
+/// remove, doubling with each pass that leaves something behind.
+constexpr auto kMinRetryDelay = std::chrono::milliseconds{10};
+constexpr auto kMaxRetryDelay = std::chrono::seconds{10};
+
+/**
+ * @return true if the directory has no entries or does not exist (yet)
+ */
+bool IsEmptyDirectory(std::filesystem::path const &path) {
+  auto ec = std::error_code{};
+  auto const it = std::filesystem::directory_iterator{path, ec};
+  if (ec) {
+    return ec == std::errc::no_such_file_or_directory;
+  }
+  return it == std::filesystem::directory_iterator{};
+}
+
+} // namespace
+
+std::filesystem::path TrashPath(std::filesystem::path const &root_path) {
+  auto path = root_path.lexically_normal();
+  if (!path.has_filename()) {
+    // a trailing separator
+    path = path.parent_path();
+  }
+  path += ".trash";
+  return path;
+}
+
+Reaper::Reaper(std::pmr::memory_resource *resource,
+               std::filesystem::path trash_path, ReaperOptions options)
+    : m_trash_path{std::move(trash_path)}, m_options{options},
+      m_name_prefix{resource} {
+  auto const now = std::chrono::system_clock::now().time_since_epoch();
+  m_name_prefix = std::to_string(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+  m_name_prefix += '-';
+  m_thread = std::jthread{[this](std::stop_token token) { run(token); }};
+}
+
+Reaper::~Reaper() {
+  m_thread.request_stop();
+  m_thread.join();
+  // fails unless the trash is empty
+  ::rmdir(m_trash_path.c_str());
+}
+
+std::error_code Reaper::trash(std::filesystem::path const &path) {
+  auto lock = std::lock_guard{m_mutex};
+  if (!m_trash_created) {
+    auto ec = std::error_code{};
+    std::filesystem::create_directories(m_trash_path, ec);
+    if (ec) {
+      return ec;
+    }
+    m_trash_created = true;
+  }
+  auto name = m_name_prefix;
+  name += std::to_string(m_next_entry++);
+  auto const entry = m_trash_path / name;
+  if (::rename(path.c_str(), entry.c_str()) != 0) {
+    return LastError();
+  }
+  m_pending = true;
+  m_empty = false;
+  m_cv.notify_all();
+  return {};
+}
+
+void Reaper::wait_until_empty() {
+  auto lock = std::unique_lock{m_mutex};
+  m_cv.wait(lock, [this] { return m_empty && !m_pending; });
+}
+
+std::uint64_t Reaper::num_removed() const { return m_num_removed.load(); }
+
+void Reaper::run(std::stop_token token) {
+  auto retry_delay = std::chrono::milliseconds{kMinRetryDelay};
+  auto lock = std::unique_lock{m_mutex};
+  while (true) {
+    m_cv.wait(lock, token, [this] { return m_pending; });
+    if (token.stop_requested()) {
+      // what is left stays for the next reaper
+      return;
+    }
+    m_pending = false;
+    lock.unlock();
+    auto ec = std::error_code{};
+    for (auto it = std::filesystem::directory_iterator{m_trash_path, ec};
+         !ec && it != std::filesystem::directory_iterator{};
+         it.increment(ec)) {
+      remove(*it, token);
+    }
+    auto const empty = IsEmptyDirectory(m_trash_path);
+    lock.lock();
+    if (m_pending) {
+      // another pass anyway
+      continue;
+    }
+    if (empty) {
+      m_empty = true;
+      m_cv.notify_all();
+      retry_delay = kMinRetryDelay;
+      continue;
+    }
+    // what could not be removed, or was added to a trashed directory after
+    // it was read, is tried again
+    m_cv.wait_for(lock, token, retry_delay, [this] { return m_pending; });
+    retry_delay = std::min<std::chrono::milliseconds>(2 * retry_delay,
+                                                      kMaxRetryDelay);
+    m_pending = true;
+  }
+}
+
+void Reaper::remove(std::filesystem::directory_entry const &entry,
+                    std::stop_token const &token) {
+  if (token.stop_requested()) {
+    return;
+  }
+  auto ec = std::error_code{};
+  // never follows a symbolic link, the type comes with the directory entry
+  auto const is_directory = entry.symlink_status(ec).type() ==
+                            std::filesystem::file_type::directory;
+  if (is_directory) {
+    for (auto it = std::filesystem::directory_iterator{entry.path(), ec};
+         !ec && it != std::filesystem::directory_iterator{};
+         it.increment(ec)) {
+      remove(*it, token);
+    }
+  }
+  throttle(token);
+  if (token.stop_requested()) {
+    return;
+  }
+  auto const res = is_directory ? ::rmdir(entry.path().c_str())
+                                : ::unlink(entry.path().c_str());
+  if (res == 0) {
+    m_num_removed.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void Reaper::throttle(std::stop_token const &token) {
+  if (m_options.max_removals_per_second == 0) {
+    return;
+  }
+  auto const interval = std::chrono::nanoseconds{
+      1'000'000'000 / static_cast<std::int64_t>(std::min<std::size_t>(
+                          m_options.max_removals_per_second, 1'000'000'000))};
+  auto const now = std::chrono::steady_clock::now();
+  // falling behind the rate does not earn a burst later on
+  m_next_removal = std::max(m_next_removal, now);
+  if (m_next_removal - now > kMaxAhead) {
+    auto lock = std::unique_lock{m_mutex};
+    m_cv.wait_until(lock, token, m_next_removal, [] { return false; });
+  }
+  m_next_removal += interval;
+}
+
+} // namespace objectstore
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+
+namespace objectstore {
+
+struct ReaperOptions {
+  /// Files and directories the reaper removes per second at most, so that it
+  /// leaves the disk to the foreground. Zero for no limit.
+  std::size_t max_removals_per_second = 10'000;
+};
+
+/**
+ * @return the trash directory of the folder at root_path, next to it so that
+ * the whole folder can be moved into it, e.g. objects.trash for objects/
+ */
+std::filesystem::path TrashPath(std::filesystem::path const &root_path);
+
+/**
+ * @brief Deletes files and directories in the background.
+ *
+ * trash() moves them into the trash directory with a single rename(), no
+ * matter how many files a directory holds, and a thread removes whatever is
+ * in the trash at the configured rate. The thread stops with the reaper even
+ * if the trash is not empty yet, and the next reaper on the same trash
+ * directory takes over what is left, e.g. after a crash.
+ */
+class Reaper {
+public:
+  /**
+   * @param trash_path the trash directory, created with the first trash()
+   */
+  Reaper(std::pmr::memory_resource *resource, std::filesystem::path trash_path,
+         ReaperOptions options);
+
+  Reaper(const Reaper &) = delete;
+  Reaper &operator=(const Reaper &) = delete;
+
+  /**
+   * @brief Stops removing files, and removes the trash directory if it is
+   * empty.
+   */
+  ~Reaper();
+
+  /**
+   * @brief Moves the file or directory into the trash, which must be on the
+   * same file system.
+   *
+   * @return an error if it could not be moved, in which case it is left
+   * where it is
+   */
+  std::error_code trash(std::filesystem::path const &path);
+
+  /**
+   * @brief Blocks until everything trashed so far is removed, and the trash
+   * is empty. Whatever the thread fails to remove is tried again, with a
+   * growing delay, so this keeps waiting as long as that fails.
+   */
+  void wait_until_empty();
+
+  /**
+   * @return the number of files and directories removed so far
+   */
+  std::uint64_t num_removed() const;
+
+  std::filesystem::path const &path() const { return m_trash_path; }
+
+private:
+  void run(std::stop_token token);
+  void remove(std::filesystem::directory_entry const &entry,
+              std::stop_token const &token);
+  void throttle(std::stop_token const &token);
+
+  std::filesystem::path m_trash_path;
+  ReaperOptions m_options;
+  /// Makes the names of the entries in the trash unique across reapers.
+  std::pmr::string m_name_prefix;
+  std::uint64_t m_next_entry = 0;
+  bool m_trash_created = false;
+  std::atomic<std::uint64_t> m_num_removed{0};
+  /// Only used by the thread.
+  std::chrono::steady_clock::time_point m_next_removal;
+
+  std::mutex m_mutex;
+  /// Something was trashed since the thread last looked at the trash, or the
+  /// thread has not looked yet.
+  bool m_pending = true;
+  /// The last look at the trash found it empty.
+  bool m_empty = false;
+
+  std::condition_variable_any m_cv;
+  // declared last, so that it is stopped before any other member goes away
+  std::jthread m_thread;
+};
+
+} // namespace objectstore
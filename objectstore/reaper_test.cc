@@ -0,0 +1,191 @@
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <objectstore.hpp>
+#include <reaper.hpp>
+#include <scopeguard.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_reaper";
+
+/**
+ * Creates a directory with files in two levels, count of each.
+ */
+std::filesystem::path CreateTree(std::filesystem::path const &path,
+                                 std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    auto const dir = path / std::to_string(i);
+    std::filesystem::create_directories(dir);
+    for (std::size_t j = 0; j < count; ++j) {
+      std::ofstream{dir / std::to_string(j)} << j;
+    }
+  }
+  return path;
+}
+
+void RemoveAll() {
+  std::filesystem::remove_all(kTestPath);
+  std::filesystem::remove_all(objectstore::TrashPath(kTestPath));
+}
+
+} // namespace
+
+TEST(Reaper, TrashPathIsNextToRoot) {
+  EXPECT_EQ(objectstore::TrashPath("a/objects"), "a/objects.trash");
+  EXPECT_EQ(objectstore::TrashPath("a/objects/"), "a/objects.trash");
+}
+
+TEST(Reaper, RemovesTrashedFilesAndDirectories) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto const root = std::filesystem::path{kTestPath};
+  CreateTree(root / "tree", 10);
+  std::ofstream{root / "file"} << "content";
+  {
+    auto reaper = objectstore::Reaper{std::pmr::get_default_resource(),
+                                      objectstore::TrashPath(root), {}};
+    EXPECT_FALSE(reaper.trash(root / "tree"));
+    EXPECT_FALSE(reaper.trash(root / "file"));
+    EXPECT_FALSE(std::filesystem::exists(root / "tree"));
+    EXPECT_EQ(reaper.trash(root / "none"),
+              std::errc::no_such_file_or_directory);
+
+    reaper.wait_until_empty();
+    EXPECT_EQ(reaper.num_removed(), 10u * 10 + 10 + 1 + 1);
+    EXPECT_TRUE(std::filesystem::is_empty(reaper.path()));
+  }
+  EXPECT_FALSE(std::filesystem::exists(objectstore::TrashPath(root)));
+}
+
+TEST(Reaper, NextReaperRemovesLeftovers) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto const trash = objectstore::TrashPath(kTestPath);
+  // as if a reaper was interrupted
+  CreateTree(trash / "1-0", 5);
+
+  auto reaper =
+      objectstore::Reaper{std::pmr::get_default_resource(), trash, {}};
+  reaper.wait_until_empty();
+  EXPECT_EQ(reaper.num_removed(), 5u * 5 + 5 + 1);
+}
+
+TEST(Reaper, KeepsToRate) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto const root = std::filesystem::path{kTestPath};
+  CreateTree(root / "tree", 6);
+  auto options = objectstore::ReaperOptions{};
+  options.max_removals_per_second = 200;
+
+  auto reaper = objectstore::Reaper{std::pmr::get_default_resource(),
+                                    objectstore::TrashPath(root), options};
+  auto const start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(reaper.trash(root / "tree"));
+  reaper.wait_until_empty();
+  // 43 removals at 5 ms each
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds{200});
+  EXPECT_EQ(reaper.num_removed(), 6u * 6 + 6 + 1);
+}
+
+TEST(Reaper, RetriesWhatItFailedToRemove) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto const root = std::filesystem::path{kTestPath};
+  std::filesystem::create_directories(root / "dir");
+  std::ofstream{root / "dir" / "file"} << "content";
+  int dir_fd = ::open((root / "dir").c_str(), O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(dir_fd, 0);
+  auto close_dir = common::MakeScopeGuard([dir_fd] { ::close(dir_fd); });
+  auto options = objectstore::ReaperOptions{};
+  options.max_removals_per_second = 2;
+
+  auto reaper = objectstore::Reaper{std::pmr::get_default_resource(),
+                                    objectstore::TrashPath(root), options};
+  ASSERT_FALSE(reaper.trash(root / "dir"));
+  // while the reaper waits to remove the directory it has already emptied
+  std::this_thread::sleep_for(std::chrono::milliseconds{100});
+  int fd = ::openat(dir_fd, "late", O_WRONLY | O_CREAT, 0644);
+  ASSERT_GE(fd, 0);
+  ::close(fd);
+
+  reaper.wait_until_empty();
+  EXPECT_TRUE(std::filesystem::is_empty(reaper.path()));
+  EXPECT_EQ(reaper.num_removed(), 3u);
+}
+
+TEST(Reaper, StopsWithoutEmptyingTrash) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto const root = std::filesystem::path{kTestPath};
+  CreateTree(root / "tree", 10);
+  auto options = objectstore::ReaperOptions{};
+  options.max_removals_per_second = 10;
+  {
+    auto reaper = objectstore::Reaper{std::pmr::get_default_resource(),
+                                      objectstore::TrashPath(root), options};
+    ASSERT_FALSE(reaper.trash(root / "tree"));
+  }
+  EXPECT_FALSE(std::filesystem::is_empty(objectstore::TrashPath(root)));
+}
+
+TEST(StoredFolder, DeferredDeletion) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  auto options = objectstore::StoredFolderOptions{};
+  options.fanout_levels = 1;
+  options.deferred_deletion = true;
+  auto folder = objectstore::StoredFolder{std::pmr::get_default_resource(),
+                                          kTestPath, options};
+  auto const first = folder.add();
+  *folder.get(first) << "first";
+  folder.close(first);
+  auto const second = folder.add();
+  *folder.get(second) << "second";
+  folder.close(second);
+  auto const first_path = folder.path(first);
+
+  folder.destroy(first);
+  EXPECT_FALSE(folder.has(first));
+  EXPECT_FALSE(std::filesystem::exists(first_path));
+  // never written
+  folder.destroy(folder.add());
+
+  folder.clear();
+  EXPECT_FALSE(folder.has(second));
+  EXPECT_TRUE(std::filesystem::is_empty(kTestPath));
+  folder.wait_for_deletion();
+  EXPECT_TRUE(std::filesystem::is_empty(objectstore::TrashPath(kTestPath)));
+
+  // the folder goes on as before
+  auto const third = folder.add();
+  EXPECT_GT(third, second);
+  *folder.get(third) << "third";
+  folder.close(third);
+  std::string content;
+  *folder.get(third) >> content;
+  EXPECT_EQ(content, "third");
+  folder.close(third);
+}
+
+TEST(StoredFolder, EmptiesTrashOfEarlierFolder) {
+  RemoveAll();
+  auto _ = common::MakeScopeGuard(RemoveAll);
+  CreateTree(objectstore::TrashPath(kTestPath) / "1-0", 3);
+  {
+    auto folder = objectstore::StoredFolder{std::pmr::get_default_resource(),
+                                            kTestPath};
+    folder.wait_for_deletion();
+  }
+  EXPECT_FALSE(std::filesystem::exists(objectstore::TrashPath(kTestPath)));
+  EXPECT_TRUE(std::filesystem::exists(kTestPath));
+}
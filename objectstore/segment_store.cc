@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "segment_store.hpp"
+
+namespace objectstore {
+
+namespace {
+
+constexpr std::string_view kSegmentPrefix = "segment-";
+constexpr std::string_view kIndexFileName = "index";
+constexpr std::string_view kIndexCheckpointFileName = "index.tmp";
+
+constexpr std::uint32_t kNoSegment = ~std::uint32_t{0};
+
+/**
+ * Put and Tombstone record the location and the destruction of an object,
+ * NextId persists the id counter, so that ids are never handed out twice.
+ */
+enum class RecordKind : std::uint32_t { Put = 1, Tombstone = 2, NextId = 3 };
+
+/**
+ * @brief Fixed-size record of the persisted index log.
+ */
+struct IndexRecord {
+  std::uint64_t id;
+  std::uint32_t segment;
+  RecordKind kind;
+  std::uint64_t offset;
+  std::uint64_t length;
+};
+static_assert(sizeof(IndexRecord) == 32);
+
+std::system_error SystemError(char const *what) {
+  return std::system_error{errno, std::system_category(), what};
+}
+
+void WriteAll(int fd, void const *data, std::size_t size, off_t offset) {
+  auto const *bytes = static_cast<std::byte const *>(data);
+  while (size > 0) {
+    auto res = pwrite(fd, bytes, size, offset);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw SystemError("pwrite");
+    }
+    bytes += res;
+    size -= static_cast<std::size_t>(res);
+    offset += res;
+  }
+}
+
+void AppendAll(int fd, void const *data, std::size_t size) {
+  auto const *bytes = static_cast<std::byte const *>(data);
+  while (size > 0) {
+    auto res = write(fd, bytes, size);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw SystemError("write");
+    }
+    bytes += res;
+    size -= static_cast<std::size_t>(res);
+  }
+}
+
+void ReadAll(int fd, void *data, std::size_t size, off_t offset) {
+  auto *bytes = static_cast<std::byte *>(data);
+  while (size > 0) {
+    auto res = pread(fd, bytes, size, offset);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw SystemError("pread");
+    }
+    if (res == 0) {
+      throw std::runtime_error{"unexpected end of segment"};
+    }
+    bytes += res;
+    size -= static_cast<std::size_t>(res);
+    offset += res;
+  }
+}
+
+void SyncData(int fd, char const *what) {
+  if (fdatasync(fd) != 0) {
+    throw SystemError(what);
+  }
+}
+
+void SyncDirectory(std::filesystem::path const &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    throw SystemError("open directory");
+  }
+  if (fsync(fd) != 0) {
+    auto error = SystemError("fsync directory");
+    ::close(fd);
+    throw error;
+  }
+  ::close(fd);
+}
+
+bool ParseSegmentId(std::string_view filename, std::uint32_t *segment_id) {
+  if (!filename.starts_with(kSegmentPrefix)) {
+    return false;
+  }
+  filename.remove_prefix(kSegmentPrefix.size());
+  auto const *end = filename.data() + filename.size();
+  auto [ptr, ec] = std::from_chars(filename.data(), end, *segment_id);
+  return ec == std::errc{} && ptr == end;
+}
+
+} // namespace
+
+StoredSegments::StoredSegments(std::pmr::memory_resource *resource,
+                               std::filesystem::path root_path,
+                               StoredSegmentsOptions options)
+    : m_resource{resource}, m_root_path{std::move(root_path)},
+      m_options{options}, m_objects{resource}, m_open_objects{resource},
+      m_segments{resource} {
+  std::filesystem::create_directories(m_root_path);
+  recover();
+  if (m_options.compaction_interval.count() > 0) {
+    m_compaction_thread = std::jthread{
+        [this](std::stop_token token) { compaction_loop(token); }};
+  }
+}
+
+StoredSegments::~StoredSegments() {
+  if (m_compaction_thread.joinable()) {
+    m_compaction_thread.request_stop();
+    m_compaction_thread.join();
+  }
+  flush();
+  for (auto &[segment_id, segment] : m_segments) {
+    ::close(segment.fd);
+  }
+  if (m_index_fd >= 0) {
+    ::close(m_index_fd);
+  }
+}
+
+bool StoredSegments::has(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  return m_objects.contains(id);
+}
+
+StoredSegments::object_id_t StoredSegments::add() {
+  auto lock = std::lock_guard{m_mutex};
+  auto id = m_next_object_id++;
+  m_objects.try_emplace(id, Location{kNoSegment, 0, 0});
+  return id;
+}
+
+std::iostream *StoredSegments::get(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  if (!m_objects.contains(id)) {
+    return nullptr;
+  }
+  auto *stream = open_locked(id);
+  stream->rewind();
+  return stream;
+}
+
+std::iostream const &StoredSegments::get(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  if (!m_objects.contains(id)) {
+    throw std::out_of_range{"Object ID not found in StoredSegments"};
+  }
+  auto *stream = open_locked(id);
+  stream->rewind();
+  return *stream;
+}
+
+std::pair<std::uintmax_t, std::error_code>
+StoredSegments::size(object_id_t id) const {
+  auto lock = std::lock_guard{m_mutex};
+  if (auto it = m_open_objects.find(id); it != m_open_objects.end()) {
+    return std::make_pair(it->second->buffer().size(), std::error_code{});
+  }
+  auto it = m_objects.find(id);
+  if (it == m_objects.end()) {
+    return std::make_pair(
+        0, std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+  return std::make_pair(it->second.length, std::error_code{});
+}
+
+void StoredSegments::close(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  close_locked(id);
+}
+
+void StoredSegments::destroy(object_id_t id) {
+  auto lock = std::lock_guard{m_mutex};
+  m_open_objects.erase(id);
+  if (auto it = m_objects.find(id); it != m_objects.end()) {
+    if (it->second.segment != kNoSegment) {
+      release_locked(it->second);
+      log_tombstone_locked(id);
+    }
+    m_objects.erase(it);
+  }
+}
+
+void StoredSegments::clear() {
+  auto lock = std::lock_guard{m_mutex};
+  m_open_objects.clear();
+  m_objects.clear();
+  while (!m_segments.empty()) {
+    remove_segment_locked(m_segments.begin()->first);
+  }
+  m_active_segment = 0;
+  open_segment_locked(m_active_segment);
+  checkpoint_locked();
+}
+
+void StoredSegments::flush() {
+  auto lock = std::lock_guard{m_mutex};
+  while (!m_open_objects.empty()) {
+    close_locked(m_open_objects.begin()->first);
+  }
+}
+
+std::uintmax_t StoredSegments::compact() {
+  auto candidates = std::pmr::vector<std::uint32_t>{m_resource};
+  {
+    auto lock = std::lock_guard{m_mutex};
+    for (auto const &[segment_id, segment] : m_segments) {
+      if (segment_id == m_active_segment || segment.size == 0) {
+        continue;
+      }
+      auto const dead_bytes = segment.size - segment.live_bytes;
+      if (static_cast<double>(dead_bytes) >=
+          m_options.compaction_threshold * static_cast<double>(segment.size)) {
+        candidates.push_back(segment_id);
+      }
+    }
+  }
+
+  std::uintmax_t reclaimed = 0;
+  for (auto segment_id : candidates) {
+    // released in between, so that foreground operations only ever wait for
+    // the compaction of a single segment
+    auto lock = std::lock_guard{m_mutex};
+    reclaimed += compact_segment_locked(segment_id);
+  }
+  if (!candidates.empty()) {
+    auto lock = std::lock_guard{m_mutex};
+    checkpoint_locked();
+  }
+  return reclaimed;
+}
+
+StoredSegmentsStats StoredSegments::stats() const {
+  auto lock = std::lock_guard{m_mutex};
+  auto stats = StoredSegmentsStats{};
+  stats.num_segments = m_segments.size();
+  for (auto const &[segment_id, segment] : m_segments) {
+    stats.live_bytes += segment.live_bytes;
+    stats.dead_bytes += segment.size - segment.live_bytes;
+  }
+  return stats;
+}
+
+void StoredSegments::recover() {
+  auto max_segment_id = std::uint32_t{0};
+  for (auto const &entry : std::filesystem::directory_iterator(m_root_path)) {
+    auto segment_id = std::uint32_t{};
+    if (entry.is_regular_file() &&
+        ParseSegmentId(entry.path().filename().native(), &segment_id)) {
+      open_segment_locked(segment_id);
+      max_segment_id = std::max(max_segment_id, segment_id);
+    }
+  }
+
+  m_index_fd = ::open(index_path().c_str(),
+                      O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_index_fd < 0) {
+    throw SystemError("open index");
+  }
+
+  auto records = std::pmr::vector<IndexRecord>(4096, m_resource);
+  off_t offset = 0;
+  while (true) {
+    auto res = pread(m_index_fd, records.data(),
+                     records.size() * sizeof(IndexRecord), offset);
+    if (res < 0) {
+      throw SystemError("pread index");
+    }
+    auto const num_records =
+        static_cast<std::size_t>(res) / sizeof(IndexRecord);
+    for (std::size_t i = 0; i < num_records; ++i) {
+      auto const &record = records[i];
+      switch (record.kind) {
+      case RecordKind::Put:
+        m_objects.insert_or_assign(
+            record.id, Location{record.segment, record.offset, record.length});
+        m_next_object_id = std::max(m_next_object_id, record.id + 1);
+        break;
+      case RecordKind::Tombstone:
+        m_objects.erase(record.id);
+        m_next_object_id = std::max(m_next_object_id, record.id + 1);
+        break;
+      case RecordKind::NextId:
+        m_next_object_id = std::max(m_next_object_id, record.id);
+        break;
+      }
+    }
+    offset += static_cast<off_t>(num_records * sizeof(IndexRecord));
+    if (num_records < records.size()) {
+      break;
+    }
+  }
+  // cut off a record that was torn by a crash while it was appended
+  if (ftruncate(m_index_fd, offset) != 0) {
+    throw SystemError("ftruncate index");
+  }
+
+  for (auto it = m_objects.begin(); it != m_objects.end();) {
+    auto segment = m_segments.find(it->second.segment);
+    if (segment == m_segments.end() ||
+        it->second.offset + it->second.length > segment->second.size) {
+      // the index record made it to disk, but the data didn't
+      it = m_objects.erase(it);
+    } else {
+      segment->second.live_bytes += it->second.length;
+      ++it;
+    }
+  }
+
+  m_active_segment = max_segment_id;
+  open_segment_locked(m_active_segment);
+
+  // segments without live objects are left over from an interrupted compaction
+  for (auto it = m_segments.begin(); it != m_segments.end();) {
+    auto const segment_id = (it++)->first;
+    if (m_segments[segment_id].live_bytes == 0 &&
+        segment_id != m_active_segment) {
+      remove_segment_locked(segment_id);
+    }
+  }
+}
+
+MemoryStream *StoredSegments::open_locked(object_id_t id) const {
+  if (auto it = m_open_objects.find(id); it != m_open_objects.end()) {
+    return it->second.get();
+  }
+  auto stream = common::MakeUnique<MemoryStream>(m_resource, m_resource);
+  auto const &location = m_objects.at(id);
+  if (location.segment != kNoSegment && location.length > 0) {
+    auto data = stream->buffer().reset(location.length);
+    ReadAll(m_segments.at(location.segment).fd, data.data(), data.size(),
+            static_cast<off_t>(location.offset));
+  }
+  auto *result = stream.get();
+  m_open_objects.try_emplace(id, std::move(stream));
+  return result;
+}
+
+void StoredSegments::close_locked(object_id_t id) {
+  auto it = m_open_objects.find(id);
+  if (it == m_open_objects.end()) {
+    return;
+  }
+  auto &location = m_objects.at(id);
+  auto const &buffer = it->second->buffer();
+  if (buffer.dirty() || location.segment == kNoSegment) {
+    auto new_location = append_locked(buffer.data());
+    release_locked(location);
+    location = new_location;
+    log_put_locked(id, location);
+  }
+  m_open_objects.erase(it);
+}
+
+StoredSegments::Location
+StoredSegments::append_locked(std::span<const std::byte> data) {
+  auto *active = &m_segments.at(m_active_segment);
+  if (active->size > 0 && active->size + data.size() > m_options.segment_size) {
+    active = &open_segment_locked(++m_active_segment);
+  }
+  auto const location = Location{m_active_segment, active->size, data.size()};
+  WriteAll(active->fd, data.data(), data.size(),
+           static_cast<off_t>(active->size));
+  active->size += data.size();
+  active->live_bytes += data.size();
+  return location;
+}
+
+void StoredSegments::release_locked(Location const &location) {
+  if (location.segment == kNoSegment) {
+    return;
+  }
+  if (auto it = m_segments.find(location.segment); it != m_segments.end()) {
+    assert(it->second.live_bytes >= location.length);
+    it->second.live_bytes -= location.length;
+  }
+}
+
+void StoredSegments::log_put_locked(object_id_t id,
+                                    Location const &location) {
+  auto const record = IndexRecord{id, location.segment, RecordKind::Put,
+                                  location.offset, location.length};
+  AppendAll(m_index_fd, &record, sizeof(record));
+}
+
+void StoredSegments::log_tombstone_locked(object_id_t id) {
+  auto const record = IndexRecord{id, kNoSegment, RecordKind::Tombstone, 0, 0};
+  AppendAll(m_index_fd, &record, sizeof(record));
+}
+
+void StoredSegments::checkpoint_locked() {
+  auto const tmp_path = m_root_path / kIndexCheckpointFileName;
+  int fd = ::open(tmp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw SystemError("open index checkpoint");
+  }
+
+  auto records = std::pmr::vector<IndexRecord>{m_resource};
+  records.reserve(m_objects.size() + 1);
+  for (auto const &[id, location] : m_objects) {
+    if (location.segment != kNoSegment) {
+      records.push_back({id, location.segment, RecordKind::Put,
+                         location.offset, location.length});
+    }
+  }
+  records.push_back({m_next_object_id, kNoSegment, RecordKind::NextId, 0, 0});
+  AppendAll(fd, records.data(), records.size() * sizeof(IndexRecord));
+  if (fdatasync(fd) != 0) {
+    ::close(fd);
+    throw SystemError("fdatasync index checkpoint");
+  }
+
+  std::filesystem::rename(tmp_path, index_path());
+  ::close(m_index_fd);
+  m_index_fd = fd;
+  // the rename itself, or a crash brings the log it replaced back
+  SyncDirectory(m_root_path);
+}
+
+StoredSegments::Segment &
+StoredSegments::open_segment_locked(std::uint32_t segment_id) {
+  if (auto it = m_segments.find(segment_id); it != m_segments.end()) {
+    return it->second;
+  }
+  int fd = ::open(segment_path(segment_id).c_str(),
+                  O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw SystemError("open segment");
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw SystemError("fstat segment");
+  }
+  return m_segments
+      .try_emplace(segment_id,
+                   Segment{fd, static_cast<std::uint64_t>(st.st_size), 0})
+      .first->second;
+}
+
+void StoredSegments::remove_segment_locked(std::uint32_t segment_id) {
+  auto it = m_segments.find(segment_id);
+  if (it == m_segments.end()) {
+    return;
+  }
+  ::close(it->second.fd);
+  unlink(segment_path(segment_id).c_str());
+  m_segments.erase(it);
+}
+
+std::uintmax_t
+StoredSegments::compact_segment_locked(std::uint32_t segment_id) {
+  auto it = m_segments.find(segment_id);
+  if (it == m_segments.end() || segment_id == m_active_segment) {
+    return 0;
+  }
+  auto const old_size = it->second.size;
+  auto const old_fd = it->second.fd;
+  auto const first_written = m_active_segment;
+
+  auto buffer = std::pmr::vector<std::byte>{m_resource};
+  std::uintmax_t moved = 0;
+  for (auto &[id, location] : m_objects) {
+    if (location.segment != segment_id) {
+      continue;
+    }
+    buffer.resize(location.length);
+    ReadAll(old_fd, buffer.data(), buffer.size(),
+            static_cast<off_t>(location.offset));
+    auto new_location = append_locked(buffer);
+    release_locked(location);
+    location = new_location;
+    log_put_locked(id, location);
+    moved += location.length;
+  }
+
+  // the copies and the records naming them have to be on disk before the
+  // only other copy goes away, the copies and the entries of new segments
+  // first, so that no record ever names bytes that are not
+  for (auto written = first_written; written <= m_active_segment; ++written) {
+    SyncData(m_segments.at(written).fd, "fdatasync segment");
+  }
+  if (m_active_segment != first_written) {
+    SyncDirectory(m_root_path);
+  }
+  SyncData(m_index_fd, "fdatasync index");
+  remove_segment_locked(segment_id);
+  return old_size - moved;
+}
+
+void StoredSegments::compaction_loop(std::stop_token token) {
+  while (!token.stop_requested()) {
+    {
+      auto lock = std::unique_lock{m_mutex};
+      m_compaction_cv.wait_for(lock, token, m_options.compaction_interval,
+                               [] { return false; });
+    }
+    if (token.stop_requested()) {
+      return;
+    }
+    compact();
+  }
+}
+
+std::filesystem::path
+StoredSegments::segment_path(std::uint32_t segment_id) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%.*s%06u",
+                static_cast<int>(kSegmentPrefix.size()), kSegmentPrefix.data(),
+                segment_id);
+  return m_root_path / name;
+}
+
+std::filesystem::path StoredSegments::index_path() const {
+  return m_root_path / kIndexFileName;
+}
+
+} // namespace objectstore
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <memory.hpp>
+
+#include "memory_stream.hpp"
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+struct StoredSegmentsOptions {
+  /// A segment is sealed and a new one started once it exceeds this size.
+  std::size_t segment_size = 64 << 20;
+  /// Sealed segments with at least this fraction of dead bytes are compacted.
+  double compaction_threshold = 0.5;
+  /// Interval of the background compaction, zero disables it.
+  std::chrono::milliseconds compaction_interval{1'000};
+};
+
+struct StoredSegmentsStats {
+  std::size_t num_segments = 0;
+  std::uintmax_t live_bytes = 0;
+  std::uintmax_t dead_bytes = 0;
+};
+
+/**
+ * @brief Stores many small objects by appending them to a few large segment
+ * files instead of creating one file per object.
+ *
+ * An index of object id -> (segment, offset, length) is kept in memory and
+ * persisted as an append-only log, which is replayed on construction and
+ * rewritten as a checkpoint after compaction. get() hands out an in-memory
+ * copy of the object, which is appended to the active segment on close() if
+ * it was modified. destroy() only records a tombstone; the dead space is
+ * reclaimed by compaction, which copies the live objects of mostly-dead
+ * sealed segments to the active segment and deletes the old files.
+ *
+ * All operations are serialized by a single mutex, which the background
+ * compaction takes per segment. An object only survives a restart once it has
+ * been closed.
+ */
+class StoredSegments : public StoredObjectCollection {
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  StoredSegments(std::pmr::memory_resource *resource,
+                 std::filesystem::path root_path,
+                 StoredSegmentsOptions options = {});
+
+  StoredSegments(const StoredSegments &) = delete;
+  StoredSegments(StoredSegments &&) = delete;
+  StoredSegments &operator=(const StoredSegments &) = delete;
+  StoredSegments &operator=(StoredSegments &&) = delete;
+
+  ~StoredSegments() override;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @brief Closes all objects that are still open.
+   */
+  void flush();
+
+  /**
+   * @brief Compacts all sealed segments above the compaction threshold.
+   *
+   * @return the number of bytes reclaimed
+   */
+  std::uintmax_t compact();
+
+  StoredSegmentsStats stats() const;
+
+  std::filesystem::path const &path() const { return m_root_path; }
+
+private:
+  struct Location {
+    std::uint32_t segment;
+    std::uint64_t offset;
+    std::uint64_t length;
+  };
+
+  struct Segment {
+    int fd = -1;
+    std::uint64_t size = 0;
+    std::uint64_t live_bytes = 0;
+  };
+
+  using ObjectMap = std::pmr::unordered_map<object_id_t, Location>;
+  using OpenObjectMap =
+      std::pmr::unordered_map<object_id_t, common::UniquePtr<MemoryStream>>;
+
+  void recover();
+  MemoryStream *open_locked(object_id_t id) const;
+  void close_locked(object_id_t id);
+  Location append_locked(std::span<const std::byte> data);
+  void release_locked(Location const &location);
+  void log_put_locked(object_id_t id, Location const &location);
+  void log_tombstone_locked(object_id_t id);
+  void checkpoint_locked();
+  Segment &open_segment_locked(std::uint32_t segment_id);
+  void remove_segment_locked(std::uint32_t segment_id);
+  std::uintmax_t compact_segment_locked(std::uint32_t segment_id);
+  void compaction_loop(std::stop_token token);
+
+  std::filesystem::path segment_path(std::uint32_t segment_id) const;
+  std::filesystem::path index_path() const;
+
+  std::pmr::memory_resource *m_resource;
+  std::filesystem::path m_root_path;
+  StoredSegmentsOptions m_options;
+
+  mutable std::mutex m_mutex;
+  ObjectMap m_objects;
+  mutable OpenObjectMap m_open_objects;
+  std::pmr::map<std::uint32_t, Segment> m_segments;
+  std::uint32_t m_active_segment = 0;
+  int m_index_fd = -1;
+  object_id_t m_next_object_id{};
+
+  std::condition_variable_any m_compaction_cv;
+  // declared last, so that it is stopped before any other member goes away
+  std::jthread m_compaction_thread;
+};
+
+} // namespace objectstore
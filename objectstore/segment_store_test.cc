@@ -0,0 +1,191 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <memory_stream.hpp>
+#include <scopeguard.hpp>
+#include <segment_store.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_segments";
+
+using objectstore::test::ReadAll;
+using objectstore::test::Write;
+
+objectstore::StoredSegmentsOptions NoBackgroundCompaction() {
+  auto options = objectstore::StoredSegmentsOptions{};
+  options.segment_size = 1024;
+  options.compaction_interval = std::chrono::milliseconds{0};
+  return options;
+}
+
+} // namespace
+
+TEST(MemoryStream, WriteSeekRead) {
+  auto stream = objectstore::MemoryStream{std::pmr::get_default_resource()};
+  EXPECT_FALSE(stream.buffer().dirty());
+
+  stream << "Hello";
+  stream.write(", World", 7);
+  EXPECT_TRUE(stream.buffer().dirty());
+  EXPECT_EQ(stream.buffer().size(), 12u);
+
+  std::string read(12, '\0');
+  stream.read(read.data(), 12);
+  EXPECT_EQ(read, "Hello, World");
+
+  stream.seekp(7);
+  stream << "There";
+  stream.seekg(0);
+  std::string word;
+  stream >> word;
+  EXPECT_EQ(word, "Hello,");
+
+  stream.rewind();
+  stream.buffer().mark_clean();
+  read.assign(12, '\0');
+  stream.read(read.data(), 12);
+  EXPECT_EQ(read, "Hello, There");
+  EXPECT_FALSE(stream.buffer().dirty());
+
+  EXPECT_EQ(stream.get(), std::char_traits<char>::eof());
+  EXPECT_TRUE(stream.eof());
+}
+
+TEST(StoredSegments, Basics) {
+  std::filesystem::remove_all(kTestPath);
+  auto _ =
+      common::MakeScopeGuard([] { std::filesystem::remove_all(kTestPath); });
+  auto segments = objectstore::StoredSegments{
+      std::pmr::get_default_resource(), kTestPath, NoBackgroundCompaction()};
+
+  auto id1 = segments.add();
+  auto id2 = segments.add();
+  EXPECT_TRUE(segments.has(id1));
+  EXPECT_TRUE(segments.has(id2));
+  EXPECT_FALSE(segments.has(id2 + 1));
+  EXPECT_EQ(segments.get(id2 + 1), nullptr);
+
+  Write(&segments, id1, "Data for object 1");
+  Write(&segments, id2, "Data for object 2, which contains more words");
+
+  EXPECT_EQ(segments.size(id1).first, 17u);
+  EXPECT_EQ(ReadAll(&segments, id1), "Data for object 1");
+  EXPECT_EQ(ReadAll(&segments, id2),
+            "Data for object 2, which contains more words");
+
+  segments.destroy(id1);
+  EXPECT_FALSE(segments.has(id1));
+  EXPECT_EQ(segments.size(id1).second,
+            std::errc::no_such_file_or_directory);
+
+  segments.clear();
+  EXPECT_FALSE(segments.has(id2));
+  EXPECT_EQ(segments.stats().live_bytes, 0u);
+}
+
+TEST(StoredSegments, Recovery) {
+  std::filesystem::remove_all(kTestPath);
+  auto _ =
+      common::MakeScopeGuard([] { std::filesystem::remove_all(kTestPath); });
+  auto resource = std::pmr::get_default_resource();
+
+  auto ids = std::vector<objectstore::StoredSegments::object_id_t>{};
+  {
+    auto segments = objectstore::StoredSegments{resource, kTestPath,
+                                                NoBackgroundCompaction()};
+    for (int i = 0; i < 100; ++i) {
+      ids.push_back(segments.add());
+      Write(&segments, ids.back(), "object " + std::to_string(i));
+    }
+    // overwritten and destroyed objects must come back in their final state
+    Write(&segments, ids[0], "overwritten");
+    segments.destroy(ids[1]);
+    // left open, so it is persisted on destruction
+    segments.get(ids[2])->write("open", 4);
+  }
+
+  auto segments = objectstore::StoredSegments{resource, kTestPath,
+                                              NoBackgroundCompaction()};
+  EXPECT_EQ(ReadAll(&segments, ids[0]), "overwritten");
+  EXPECT_FALSE(segments.has(ids[1]));
+  EXPECT_EQ(ReadAll(&segments, ids[2]), "openct 2");
+  for (int i = 3; i < 100; ++i) {
+    EXPECT_EQ(ReadAll(&segments, ids[i]), "object " + std::to_string(i));
+  }
+  EXPECT_GT(segments.add(), ids.back());
+}
+
+TEST(StoredSegments, Compaction) {
+  std::filesystem::remove_all(kTestPath);
+  auto _ =
+      common::MakeScopeGuard([] { std::filesystem::remove_all(kTestPath); });
+  auto resource = std::pmr::get_default_resource();
+  auto const payload = std::string(100, 'x');
+
+  auto ids = std::vector<objectstore::StoredSegments::object_id_t>{};
+  {
+    auto segments = objectstore::StoredSegments{resource, kTestPath,
+                                                NoBackgroundCompaction()};
+    for (int i = 0; i < 100; ++i) {
+      ids.push_back(segments.add());
+      Write(&segments, ids.back(), payload + std::to_string(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+      if (i % 4 != 0) {
+        segments.destroy(ids[i]);
+      }
+    }
+
+    auto const before = segments.stats();
+    EXPECT_GT(before.dead_bytes, before.live_bytes);
+    auto const reclaimed = segments.compact();
+    auto const after = segments.stats();
+    EXPECT_GT(reclaimed, 0u);
+    EXPECT_EQ(after.live_bytes, before.live_bytes);
+    EXPECT_LT(after.dead_bytes, before.dead_bytes);
+    EXPECT_LT(after.num_segments, before.num_segments);
+  }
+
+  // the checkpointed index has to point to the moved objects
+  auto segments = objectstore::StoredSegments{resource, kTestPath,
+                                              NoBackgroundCompaction()};
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(segments.has(ids[i]), i % 4 == 0);
+    if (i % 4 == 0) {
+      EXPECT_EQ(ReadAll(&segments, ids[i]), payload + std::to_string(i));
+    }
+  }
+}
+
+TEST(StoredSegments, BackgroundCompaction) {
+  std::filesystem::remove_all(kTestPath);
+  auto _ =
+      common::MakeScopeGuard([] { std::filesystem::remove_all(kTestPath); });
+  auto options = objectstore::StoredSegmentsOptions{};
+  options.segment_size = 1024;
+  options.compaction_interval = std::chrono::milliseconds{1};
+  auto segments = objectstore::StoredSegments{std::pmr::get_default_resource(),
+                                              kTestPath, options};
+
+  auto ids = std::vector<objectstore::StoredSegments::object_id_t>{};
+  for (int i = 0; i < 100; ++i) {
+    ids.push_back(segments.add());
+    Write(&segments, ids.back(), std::string(100, 'y'));
+  }
+  for (int i = 0; i < 90; ++i) {
+    segments.destroy(ids[i]);
+  }
+
+  for (int i = 0; i < 1'000 && segments.stats().dead_bytes > 1024; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+  EXPECT_LE(segments.stats().dead_bytes, 1024u);
+  for (int i = 90; i < 100; ++i) {
+    EXPECT_EQ(ReadAll(&segments, ids[i]), std::string(100, 'y'));
+  }
+}
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+
+#include "striped_folder.hpp"
+
+namespace objectstore {
+
+namespace {
+
+std::error_code LastError() {
+  return std::error_code{errno, std::system_category()};
+}
+
+std::error_code NotFound() {
+  return std::make_error_code(std::errc::no_such_file_or_directory);
+}
+
+bool SameVersion(struct stat const &a, struct stat const &b) {
+  return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+         a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+std::uint64_t Mix(std::uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+/**
+ * FNV-1a, which unlike std::hash is the same in every build, so that the
+ * roots keep their places on the ring.
+ */
+std::uint64_t HashPath(std::filesystem::path const &path) {
+  auto const normal = path.lexically_normal();
+  auto hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : std::string_view{normal.native()}) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+} // namespace
+
+StripedFolder::StripedFolder(std::pmr::memory_resource *resource,
+                             std::span<const StripeRoot> roots,
+                             StripedFolderOptions options)
+    : m_resource{resource}, m_options{std::move(options)}, m_roots{resource},
+      m_ring{resource}, m_moving{resource} {
+  if (roots.empty()) {
+    throw std::invalid_argument{"StripedFolder needs at least one root"};
+  }
+  // finding the existing objects is what takes long, on each drive
+  auto folders =
+      std::vector<std::future<common::UniquePtr<StoredFolder>>>{};
+  folders.reserve(roots.size());
+  for (auto const &root : roots) {
+    folders.push_back(std::async(std::launch::async, [this, &root] {
+      return common::MakeUnique<StoredFolder>(m_resource, m_resource,
+                                              root.path,
+                                              m_options.folder_options);
+    }));
+  }
+  for (std::size_t index = 0; index < roots.size(); ++index) {
+    auto root = common::MakeUnique<Root>(m_resource);
+    root->root = roots[index];
+    root->folder = folders[index].get();
+    attach(std::move(root));
+  }
+  // errors leave objects where they are, where they are still found
+  move_misplaced();
+}
+
+bool StripedFolder::has(object_id_t id) const {
+  auto lock = std::shared_lock{m_roots_mutex};
+  return locate(id).has_value();
+}
+
+StripedFolder::object_id_t StripedFolder::add() {
+  auto lock = std::shared_lock{m_roots_mutex};
+  auto const id = m_next_object_id++;
+  auto &root = *m_roots[place(id)];
+  auto root_lock = std::lock_guard{root.mutex};
+  root.folder->add(id);
+  return id;
+}
+
+std::iostream *StripedFolder::get(object_id_t id) {
+  auto lock = std::shared_lock{m_roots_mutex};
+  wait_until_moved(id);
+  auto index = locate(id);
+  if (!index) {
+    return nullptr;
+  }
+  auto &root = *m_roots[*index];
+  auto root_lock = std::lock_guard{root.mutex};
+  return root.folder->get(id);
+}
+
+std::iostream const &StripedFolder::get(object_id_t id) const {
+  auto lock = std::shared_lock{m_roots_mutex};
+  wait_until_moved(id);
+  auto index = locate(id);
+  if (!index) {
+    throw std::out_of_range{"Object ID not found in StripedFolder"};
+  }
+  auto const &root = *m_roots[*index];
+  auto root_lock = std::lock_guard{root.mutex};
+  return std::as_const(*root.folder).get(id);
+}
+
+std::pair<std::uintmax_t, std::error_code>
+StripedFolder::size(object_id_t id) const {
+  auto lock = std::shared_lock{m_roots_mutex};
+  auto index = locate(id);
+  if (!index) {
+    return std::make_pair(0, NotFound());
+  }
+  auto const &root = *m_roots[*index];
+  auto root_lock = std::lock_guard{root.mutex};
+  return root.folder->size(id);
+}
+
+void StripedFolder::close(object_id_t id) {
+  auto lock = std::shared_lock{m_roots_mutex};
+  wait_until_moved(id);
+  if (auto index = locate(id)) {
+    auto &root = *m_roots[*index];
+    auto root_lock = std::lock_guard{root.mutex};
+    root.folder->close(id);
+  }
+}
+
+void StripedFolder::destroy(object_id_t id) {
+  auto lock = std::shared_lock{m_roots_mutex};
+  wait_until_moved(id);
+  if (auto index = locate(id)) {
+    auto &root = *m_roots[*index];
+    auto root_lock = std::lock_guard{root.mutex};
+    root.folder->destroy(id);
+  }
+}
+
+void StripedFolder::clear() {
+  auto lock = std::unique_lock{m_roots_mutex};
+  for (auto &root : m_roots) {
+    root->folder->clear();
+  }
+}
+
+std::pair<std::size_t, std::error_code>
+StripedFolder::add_root(StripeRoot root) {
+  auto entry = common::MakeUnique<Root>(m_resource);
+  entry->root = std::move(root);
+  entry->folder = common::MakeUnique<StoredFolder>(
+      m_resource, m_resource, entry->root.path, m_options.folder_options);
+  auto rebalance_lock = std::lock_guard{m_rebalance_mutex};
+  {
+    auto lock = std::unique_lock{m_roots_mutex};
+    attach(std::move(entry));
+  }
+  return move_misplaced();
+}
+
+std::pair<std::size_t, std::error_code> StripedFolder::rebalance() {
+  auto rebalance_lock = std::lock_guard{m_rebalance_mutex};
+  return move_misplaced();
+}
+
+std::size_t StripedFolder::num_roots() const {
+  auto lock = std::shared_lock{m_roots_mutex};
+  return m_roots.size();
+}
+
+std::size_t StripedFolder::root_of(object_id_t id) const {
+  auto lock = std::shared_lock{m_roots_mutex};
+  return place(id);
+}
+
+StoredFolder &StripedFolder::folder(std::size_t root) {
+  return *m_roots.at(root)->folder;
+}
+
+StoredFolder const &StripedFolder::folder(std::size_t root) const {
+  return *m_roots.at(root)->folder;
+}
+
+void StripedFolder::attach(common::UniquePtr<Root> root_ptr) {
+  auto &root = *m_roots.emplace_back(std::move(root_ptr));
+  if (m_options.weight_by_capacity) {
+    auto ec = std::error_code{};
+    auto const space = std::filesystem::space(root.root.path, ec);
+    root.capacity = ec ? 0 : space.capacity;
+  }
+  build_ring();
+
+  // the root may hold objects already
+  for (auto id : *root.folder) {
+    if (id >= m_next_object_id) {
+      m_next_object_id = id + 1;
+    }
+  }
+}
+
+void StripedFolder::build_ring() {
+  auto largest = std::uintmax_t{0};
+  for (auto const &root : m_roots) {
+    largest = std::max(largest, root->capacity);
+  }
+  m_ring.clear();
+  for (std::size_t index = 0; index < m_roots.size(); ++index) {
+    auto const &root = *m_roots[index];
+    auto weight = root.root.weight;
+    if (root.capacity != 0) {
+      weight *= static_cast<double>(root.capacity) /
+                static_cast<double>(largest);
+    }
+    // every root keeps a point, however light it is
+    auto const num_points = std::max<std::size_t>(
+        1, static_cast<std::size_t>(std::llround(
+               weight * static_cast<double>(m_options.points_per_weight))));
+    // the same points with every rebuild, so that only shares move
+    auto const key = HashPath(root.root.path);
+    for (std::size_t i = 0; i < num_points; ++i) {
+      m_ring.push_back({Mix(key + i * 0x9e3779b97f4a7c15ull),
+                        static_cast<std::uint32_t>(index)});
+    }
+  }
+  std::sort(m_ring.begin(), m_ring.end());
+}
+
+std::size_t StripedFolder::place(object_id_t id) const {
+  auto it = std::upper_bound(m_ring.begin(), m_ring.end(),
+                             RingPoint{Mix(id), 0});
+  return (it == m_ring.end() ? m_ring.front() : *it).root;
+}
+
+std::optional<std::size_t> StripedFolder::locate(object_id_t id) const {
+  {
+    // already at home, but not complete yet
+    auto moving_lock = std::lock_guard{m_moving_mutex};
+    if (auto it = m_moving.find(id); it != m_moving.end()) {
+      return it->second;
+    }
+  }
+  auto const home = place(id);
+  for (std::size_t i = 0; i < m_roots.size(); ++i) {
+    // where the object belongs first, the others only if a move failed
+    auto const index = (home + i) % m_roots.size();
+    auto const &root = *m_roots[index];
+    auto root_lock = std::lock_guard{root.mutex};
+    if (root.folder->has(id)) {
+      return index;
+    }
+  }
+  return std::nullopt;
+}
+
+void StripedFolder::wait_until_moved(object_id_t id) const {
+  auto moving_lock = std::unique_lock{m_moving_mutex};
+  m_moved.wait(moving_lock, [this, id] { return !m_moving.contains(id); });
+}
+
+std::pair<std::size_t, std::error_code> StripedFolder::move_misplaced() {
+  // held throughout, so that the moves go on while an exclusive lock waits
+  // for operations waiting for them
+  auto lock = std::shared_lock{m_roots_mutex};
+  std::size_t num_moved = 0;
+  auto first_error = std::error_code{};
+  auto misplaced = std::pmr::vector<object_id_t>{m_resource};
+  for (std::size_t index = 0; index < m_roots.size(); ++index) {
+    auto &from = *m_roots[index];
+    misplaced.clear();
+    {
+      auto root_lock = std::lock_guard{from.mutex};
+      for (auto id : *from.folder) {
+        if (place(id) != index) {
+          misplaced.push_back(id);
+        }
+      }
+    }
+    for (auto id : misplaced) {
+      {
+        auto moving_lock = std::lock_guard{m_moving_mutex};
+        m_moving.emplace(id, index);
+      }
+      auto ec = move(id, from, *m_roots[place(id)]);
+      {
+        auto moving_lock = std::lock_guard{m_moving_mutex};
+        m_moving.erase(id);
+      }
+      m_moved.notify_all();
+      if (ec) {
+        if (!first_error) {
+          first_error = ec;
+        }
+      } else {
+        ++num_moved;
+      }
+    }
+  }
+  return std::make_pair(num_moved, first_error);
+}
+
+std::error_code StripedFolder::move(object_id_t id, Root &from, Root &to) {
+  auto source = std::filesystem::path{};
+  auto target = std::filesystem::path{};
+  struct stat before {};
+  {
+    auto root_locks = std::scoped_lock{from.mutex, to.mutex};
+    if (!from.folder->has(id)) {
+      // destroyed since the misplaced objects were listed
+      return {};
+    }
+    // writes what the stream still buffers
+    from.folder->close(id);
+    if (!to.folder->add(id)) {
+      // left behind by a move that was interrupted, the source is complete
+      to.folder->destroy(id);
+      to.folder->add(id);
+    }
+    source = from.folder->path(id);
+    target = to.folder->path(id);
+    // without a source, the object was never written
+    if (std::rename(source.c_str(), target.c_str()) == 0 || errno == ENOENT) {
+      // syncs the new place, as far as the folder is durable
+      to.folder->close(id);
+      from.folder->destroy(id);
+      return {};
+    }
+    auto ec = errno == EXDEV ? std::error_code{} : LastError();
+    if (!ec && ::stat(source.c_str(), &before) != 0) {
+      ec = LastError();
+    }
+    if (ec) {
+      to.folder->destroy(id);
+      return ec;
+    }
+  }
+
+  // another drive, copied without the locks
+  auto ec = std::error_code{};
+  std::filesystem::copy_file(
+      source, target, std::filesystem::copy_options::overwrite_existing, ec);
+  if (!ec) {
+    // the source goes away right after
+    ec = SyncFile(target, true);
+  }
+  auto root_locks = std::scoped_lock{from.mutex, to.mutex};
+  if (!from.folder->has(id)) {
+    // destroyed meanwhile
+    to.folder->destroy(id);
+    return {};
+  }
+  struct stat after {};
+  if (!ec && ::stat(source.c_str(), &after) != 0) {
+    ec = LastError();
+  }
+  if (!ec && !SameVersion(before, after)) {
+    // written meanwhile, the copy is outdated
+    ec = std::make_error_code(std::errc::device_or_resource_busy);
+  }
+  if (ec) {
+    to.folder->destroy(id);
+    return ec;
+  }
+  to.folder->close(id);
+  from.folder->destroy(id);
+  return {};
+}
+
+} // namespace objectstore
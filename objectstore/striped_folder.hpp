@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <memory.hpp>
+
+#include "objectstore.hpp"
+
+namespace objectstore {
+
+/**
+ * @brief A directory of a StripedFolder, usually on a drive of its own.
+ */
+struct StripeRoot {
+  std::filesystem::path path;
+  /// The share of the objects the root gets, relative to the other roots.
+  double weight = 1;
+};
+
+struct StripedFolderOptions {
+  /// Points each root gets on the hash ring per unit of weight. More points
+  /// spread the objects more evenly, at the cost of a larger ring.
+  std::size_t points_per_weight = 128;
+  /// Multiplies the weight of every root by the capacity of its file system,
+  /// relative to the largest one, so that larger drives get more objects. A
+  /// root whose capacity is unknown keeps its weight. A root larger than all
+  /// others takes points from them, so adding it moves objects among them.
+  bool weight_by_capacity = false;
+  /// Options of the StoredFolder of every root.
+  StoredFolderOptions folder_options;
+};
+
+/**
+ * @brief Spreads objects over several StoredFolders, one per root, so that
+ * all drives of a machine serve them.
+ *
+ * The ids are handed out by the striped folder and placed by consistent
+ * hashing: every root has points on a hash ring, by its path and weight, and
+ * an object belongs to the root of the first point after the hash of its id.
+ * Adding a root only moves the objects that now belong to it, about its
+ * share of them, see add_root().
+ *
+ * The folders of the roots are opened in parallel, and objects found under
+ * another root than the one they belong to, e.g. after the roots changed,
+ * are moved there. An object that could not be moved is still found, at the
+ * cost of looking in every root.
+ *
+ * Operations on objects of different roots may run in parallel, each root
+ * has a lock of its own. The streams returned by get() follow the contract
+ * of StoredObjectCollection, and are used without the lock: with several
+ * threads, the folders must not have an open-file limit, or a thread may
+ * close the file of another one.
+ */
+class StripedFolder : public StoredObjectCollection {
+public:
+  using object_id_t = StoredObjectCollection::object_id_t;
+
+  /**
+   * @brief Opens the roots, creating them if necessary, and moves misplaced
+   * objects to where they belong. The memory resource is used from several
+   * threads while the roots are opened.
+   *
+   * @throw std::invalid_argument without any root
+   */
+  StripedFolder(std::pmr::memory_resource *resource,
+                std::span<const StripeRoot> roots,
+                StripedFolderOptions options = {});
+
+  StripedFolder(const StripedFolder &) = delete;
+  StripedFolder(StripedFolder &&) = delete;
+  StripedFolder &operator=(const StripedFolder &) = delete;
+  StripedFolder &operator=(StripedFolder &&) = delete;
+
+  ~StripedFolder() override = default;
+
+  bool has(object_id_t id) const override;
+  object_id_t add() override;
+  std::iostream *get(object_id_t id) override;
+  std::iostream const &get(object_id_t id) const override;
+  std::pair<std::uintmax_t, std::error_code>
+  size(object_id_t id) const override;
+  void close(object_id_t id) override;
+  void destroy(object_id_t id) override;
+  void clear() override;
+
+  /**
+   * @brief Adds a root and moves the objects that belong to it now from the
+   * other roots.
+   *
+   * Other operations go on while objects are copied between drives. An
+   * object being moved is found where it was until its copy is synced, and
+   * get(), close() and destroy() of it wait for the move. No object may be in
+   * use when the move starts, and one that is written before it completes
+   * stays where it was.
+   *
+   * @return the number of objects moved, and the first error. Objects that
+   * could not be moved stay where they are until the next rebalance.
+   */
+  std::pair<std::size_t, std::error_code> add_root(StripeRoot root);
+
+  /**
+   * @brief Moves the objects that are not under the root they belong to,
+   * see add_root().
+   */
+  std::pair<std::size_t, std::error_code> rebalance();
+
+  std::size_t num_roots() const;
+
+  /**
+   * @return the index of the root the object belongs to, whether it exists
+   * or not
+   */
+  std::size_t root_of(object_id_t id) const;
+
+  StoredFolder &folder(std::size_t root);
+  StoredFolder const &folder(std::size_t root) const;
+
+private:
+  struct Root {
+    StripeRoot root;
+    /// Serializes the operations on the folder.
+    mutable std::mutex mutex;
+    common::UniquePtr<StoredFolder> folder;
+    /// Of its file system, if weight_by_capacity, 0 if unknown.
+    std::uintmax_t capacity = 0;
+  };
+
+  struct RingPoint {
+    std::uint64_t hash;
+    std::uint32_t root;
+
+    friend bool operator<(RingPoint const &a, RingPoint const &b) {
+      return a.hash < b.hash;
+    }
+  };
+
+  /**
+   * @brief Adds the root to the ring, and makes sure add() skips the ids of
+   * its objects.
+   */
+  void attach(common::UniquePtr<Root> root);
+  void build_ring();
+  std::size_t place(object_id_t id) const;
+  /**
+   * @return the root that holds the object, or none, which is the one it is
+   * moved from while it is moved
+   */
+  std::optional<std::size_t> locate(object_id_t id) const;
+  void wait_until_moved(object_id_t id) const;
+  /**
+   * @brief Moves the misplaced objects one by one, without blocking the
+   * operations on others. Called without m_roots_mutex.
+   */
+  std::pair<std::size_t, std::error_code> move_misplaced();
+  std::error_code move(object_id_t id, Root &from, Root &to);
+
+  std::pmr::memory_resource *m_resource;
+  StripedFolderOptions m_options;
+  /// Shared by all operations, exclusive while the roots change.
+  mutable std::shared_mutex m_roots_mutex;
+  std::pmr::vector<common::UniquePtr<Root>> m_roots;
+  /// Sorted by hash.
+  std::pmr::vector<RingPoint> m_ring;
+  std::atomic<object_id_t> m_next_object_id{};
+
+  /// Serializes add_root() and rebalance().
+  std::mutex m_rebalance_mutex;
+  mutable std::mutex m_moving_mutex;
+  mutable std::condition_variable m_moved;
+  /// The objects being moved, by the index of the root they are moved from.
+  std::pmr::unordered_map<object_id_t, std::size_t> m_moving;
+};
+
+} // namespace objectstore
@@ -0,0 +1,227 @@
+#include <cstddef>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <scopeguard.hpp>
+#include <striped_folder.hpp>
+#include <test_helpers.hpp>
+
+namespace {
+
+constexpr auto kTestPath = "objectstore_test_striped";
+
+std::vector<objectstore::StripeRoot> Roots(std::size_t count) {
+  auto roots = std::vector<objectstore::StripeRoot>{};
+  for (std::size_t i = 0; i < count; ++i) {
+    roots.push_back({std::filesystem::path{kTestPath} / std::to_string(i)});
+  }
+  return roots;
+}
+
+std::size_t NumObjects(objectstore::StoredFolder const &folder) {
+  return static_cast<std::size_t>(std::distance(folder.begin(), folder.end()));
+}
+
+using objectstore::test::ReadAndClose;
+
+class StripedFolderTest : public objectstore::test::DirectoryTest {
+protected:
+  StripedFolderTest() : DirectoryTest{kTestPath} {}
+};
+
+} // namespace
+
+TEST_F(StripedFolderTest, SpreadsObjectsOverRoots) {
+  auto const roots = Roots(3);
+  auto expected =
+      std::map<objectstore::StripedFolder::object_id_t, std::string>{};
+  {
+    auto folder = objectstore::StripedFolder{resource, roots};
+    EXPECT_EQ(folder.num_roots(), 3u);
+    for (int i = 0; i < 300; ++i) {
+      auto id = folder.add();
+      expected[id] = "object " + std::to_string(id);
+      *folder.get(id) << expected[id];
+      folder.close(id);
+      EXPECT_TRUE(folder.folder(folder.root_of(id)).has(id));
+    }
+    for (std::size_t root = 0; root < 3; ++root) {
+      EXPECT_GT(NumObjects(folder.folder(root)), 50u);
+    }
+    auto const destroyed = expected.begin()->first;
+    folder.destroy(destroyed);
+    expected.erase(destroyed);
+    EXPECT_FALSE(folder.has(destroyed));
+    EXPECT_EQ(folder.get(destroyed), nullptr);
+    EXPECT_TRUE(folder.size(destroyed).second);
+  }
+
+  // found again, and new ids do not collide with them
+  auto folder = objectstore::StripedFolder{resource, roots};
+  for (auto const &[id, content] : expected) {
+    EXPECT_EQ(ReadAndClose(&folder, id), content);
+    EXPECT_EQ(folder.size(id).first, content.size());
+  }
+  EXPECT_GT(folder.add(), expected.rbegin()->first);
+
+  folder.clear();
+  for (std::size_t root = 0; root < 3; ++root) {
+    EXPECT_EQ(NumObjects(folder.folder(root)), 0u);
+  }
+}
+
+TEST_F(StripedFolderTest, WeightsSetTheShares) {
+  auto roots = Roots(2);
+  roots[1].weight = 3;
+  auto folder = objectstore::StripedFolder{resource, roots};
+  constexpr std::size_t kNumObjects = 4000;
+  for (std::size_t i = 0; i < kNumObjects; ++i) {
+    folder.add();
+  }
+  auto const share = static_cast<double>(NumObjects(folder.folder(1))) /
+                     static_cast<double>(kNumObjects);
+  EXPECT_NEAR(share, 0.75, 0.1);
+}
+
+TEST_F(StripedFolderTest, WeightsByCapacityRelativeToLargest) {
+  auto roots = Roots(2);
+  roots[1].weight = 3;
+  auto options = objectstore::StripedFolderOptions{};
+  options.weight_by_capacity = true;
+  auto weighted = std::vector<std::size_t>{};
+  {
+    // one file system, so capacity does not change the weights
+    auto folder = objectstore::StripedFolder{resource, roots, options};
+    for (objectstore::StripedFolder::object_id_t id = 0; id < 1000; ++id) {
+      weighted.push_back(folder.root_of(id));
+    }
+  }
+  auto folder = objectstore::StripedFolder{resource, roots};
+  for (objectstore::StripedFolder::object_id_t id = 0; id < 1000; ++id) {
+    EXPECT_EQ(folder.root_of(id), weighted[id]) << id;
+  }
+}
+
+TEST_F(StripedFolderTest, AddRootMovesOnlyItsShare) {
+  auto const roots = Roots(3);
+  auto folder = objectstore::StripedFolder{
+      resource, std::span{roots.data(), 2}};
+  auto placement =
+      std::map<objectstore::StripedFolder::object_id_t, std::size_t>{};
+  for (int i = 0; i < 600; ++i) {
+    auto id = folder.add();
+    *folder.get(id) << id;
+    folder.close(id);
+    placement[id] = folder.root_of(id);
+  }
+  // never written, so there is no file to move
+  auto const empty = folder.add();
+  placement[empty] = folder.root_of(empty);
+
+  auto [moved, ec] = folder.add_root(roots[2]);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(folder.num_roots(), 3u);
+  std::size_t expected_moves = 0;
+  for (auto const &[id, root] : placement) {
+    auto const new_root = folder.root_of(id);
+    // an object either stays or goes to the new root
+    if (new_root != root) {
+      EXPECT_EQ(new_root, 2u);
+      ++expected_moves;
+    }
+    EXPECT_TRUE(folder.folder(new_root).has(id));
+    if (id != empty) {
+      EXPECT_EQ(ReadAndClose(&folder, id), std::to_string(id));
+    }
+  }
+  EXPECT_EQ(moved, expected_moves);
+  EXPECT_GT(moved, 100u);
+  EXPECT_LT(moved, 300u);
+  EXPECT_EQ(folder.rebalance().first, 0u);
+}
+
+TEST_F(StripedFolderTest, AddRootCopiesFromAnotherDrive) {
+  // a root on another file system, so that the objects are copied
+  auto const other_drive = std::filesystem::path{"/dev/shm"} /
+                           (kTestPath + std::to_string(::getpid()));
+  auto ec = std::error_code{};
+  std::filesystem::create_directories(other_drive, ec);
+  if (ec) {
+    GTEST_SKIP() << "no /dev/shm";
+  }
+  auto _ = common::MakeScopeGuard(
+      [&other_drive] { std::filesystem::remove_all(other_drive); });
+  struct stat here {}, there {};
+  if (::stat(".", &here) != 0 || ::stat(other_drive.c_str(), &there) != 0 ||
+      here.st_dev == there.st_dev) {
+    GTEST_SKIP() << "/dev/shm is on the same file system";
+  }
+
+  auto const roots = Roots(1);
+  auto folder = objectstore::StripedFolder{resource, roots};
+  for (int i = 0; i < 300; ++i) {
+    auto id = folder.add();
+    *folder.get(id) << id;
+    folder.close(id);
+  }
+  // objects are found where they were while they are copied
+  auto mover = std::thread{[&folder, &other_drive] {
+    auto [moved, ec] = folder.add_root({other_drive / "root"});
+    EXPECT_FALSE(ec);
+    EXPECT_GT(moved, 50u);
+  }};
+  for (objectstore::StripedFolder::object_id_t id = 0; id < 300; ++id) {
+    EXPECT_TRUE(folder.has(id));
+    EXPECT_EQ(folder.size(id).first, std::to_string(id).size());
+  }
+  mover.join();
+
+  EXPECT_GT(NumObjects(folder.folder(1)), 50u);
+  EXPECT_EQ(NumObjects(folder.folder(0)) + NumObjects(folder.folder(1)),
+            300u);
+  for (objectstore::StripedFolder::object_id_t id = 0; id < 300; ++id) {
+    EXPECT_TRUE(folder.folder(folder.root_of(id)).has(id));
+    EXPECT_EQ(ReadAndClose(&folder, id), std::to_string(id));
+  }
+}
+
+TEST_F(StripedFolderTest, OpeningWithAnotherRootRebalances) {
+  auto const roots = Roots(3);
+  {
+    auto folder = objectstore::StripedFolder{
+        resource, std::span{roots.data(), 2}};
+    for (int i = 0; i < 200; ++i) {
+      auto id = folder.add();
+      *folder.get(id) << id;
+      folder.close(id);
+    }
+  }
+  auto folder = objectstore::StripedFolder{resource, roots};
+  EXPECT_GT(NumObjects(folder.folder(2)), 0u);
+  std::size_t num_objects = 0;
+  for (std::size_t root = 0; root < 3; ++root) {
+    for (auto id : folder.folder(root)) {
+      EXPECT_EQ(folder.root_of(id), root);
+      ++num_objects;
+    }
+  }
+  EXPECT_EQ(num_objects, 200u);
+  for (objectstore::StripedFolder::object_id_t id = 0; id < 200; ++id) {
+    EXPECT_EQ(ReadAndClose(&folder, id), std::to_string(id));
+  }
+}
+
+TEST_F(StripedFolderTest, NeedsARoot) {
+  EXPECT_THROW((objectstore::StripedFolder{resource, {}}),
+               std::invalid_argument);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace objectstore::test {
+
+/**
+ * @return the whole content of the object, which is left open
+ */
+template <typename Collection>
+std::string ReadAll(Collection *collection,
+                    typename Collection::object_id_t id) {
+  return std::string{std::istreambuf_iterator<char>{*collection->get(id)},
+                     {}};
+}
+
+/**
+ * @return the whole content of the object, which is closed afterwards
+ */
+template <typename Collection>
+std::string ReadAndClose(Collection *collection,
+                         typename Collection::object_id_t id) {
+  auto content = ReadAll(collection, id);
+  collection->close(id);
+  return content;
+}
+
+/**
+ * @brief Writes @p data to the object and closes it.
+ */
+template <typename Collection>
+void Write(Collection *collection, typename Collection::object_id_t id,
+           std::string const &data) {
+  collection->get(id)->write(data.data(),
+                             static_cast<std::streamsize>(data.size()));
+  collection->close(id);
+}
+
+/**
+ * A fixture that removes its directory before and after each test.
+ */
+class DirectoryTest : public ::testing::Test {
+protected:
+  explicit DirectoryTest(std::filesystem::path path)
+      : m_path{std::move(path)} {}
+
+  void SetUp() override { std::filesystem::remove_all(m_path); }
+  void TearDown() override { std::filesystem::remove_all(m_path); }
+
+  std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+
+private:
+  std::filesystem::path m_path;
+};
+
+} // namespace objectstore::test